@@ -0,0 +1,1160 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#include "ahocorasick.h"
+#include "deriv.h"
+#include "dfa.h"
+#include "lexer.h"
+#include "packedpair.h"
+#include "pikevm.h"
+#include "posnfa.h"
+#include "prefilter.h"
+#include "regex.h"
+#include "shiftand.h"
+#include "teddy.h"
+#include "utf8valid.h"
+
+#define HAYSTACK_LEN (1 << 20)
+#define MIN_SECONDS 0.2
+#define ALLOC_RUNS 100
+
+typedef bool (*SearchFn)(const void *ctx, const Input *input);
+
+typedef struct {
+    const Regex *re;
+    RegexCache *cache;
+} Searcher;
+
+typedef struct {
+    const Prog *prog;
+    PikeCache cache;
+} PikeSearcher;
+
+typedef struct {
+    const Regex *re;
+    RegexCache *cache;
+    size_t nslots;
+    size_t matches;
+} LineFilter;
+
+typedef struct {
+    const PosNfa *nfa;
+    PosNfaCache cache;
+} PosNfaSearcher;
+
+typedef struct {
+    Deriv *d;
+    uint32_t term;
+} DerivSearcher;
+
+typedef struct {
+    Dfa *dfa;
+    DfaCache cache;
+} DfaSearcher;
+
+// The bench is linked with --wrap for the allocation functions (see
+// CMakeLists.txt), which routes every call through these counters.
+#ifdef BENCH_COUNT_ALLOCS
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+static size_t allocations;
+
+void *__wrap_malloc(const size_t size) {
+    allocations++;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(const size_t n, const size_t size) {
+    allocations++;
+    return __real_calloc(n, size);
+}
+
+void *__wrap_realloc(void *ptr, const size_t size) {
+    allocations++;
+    return __real_realloc(ptr, size);
+}
+#endif
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec * 1e-9;
+}
+
+// Time stamp counter ticks where the CPU has one, nanoseconds elsewhere.
+static uint64_t ticks(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000U + (uint64_t) ts.tv_nsec;
+#endif
+}
+
+// Lowercase words separated by spaces: typical text without digits or
+// punctuation, so the benchmark patterns below scan the whole haystack.
+static char *make_haystack(const size_t length) {
+    char *hay = malloc(length + 1);
+    unsigned state = 12345;
+    for (size_t i = 0; i < length; i++) {
+        state = state * 1103515245U + 12345U;
+        const unsigned r = (state >> 16) % 32;
+        hay[i] = r < 26 ? (char) ('a' + r) : ' ';
+    }
+    hay[length] = '\0';
+    return hay;
+}
+
+// Log lines: mostly INFO requests, a few warnings and errors, and every
+// request's duration, the kind of text a line filter goes through.
+static char *make_log(const size_t length) {
+    static const char *levels[] = {"INFO", "INFO", "INFO", "INFO", "INFO", "INFO", "WARN", "ERROR"};
+    static const char *paths[] = {"users", "orders", "items", "search", "login"};
+    char *log = malloc(length + 1);
+    unsigned state = 54321;
+    size_t n = 0;
+    for (unsigned i = 0; n < length; i++) {
+        state = state * 1103515245U + 12345U;
+        const unsigned r = state >> 8;
+        char line[160];
+        const int len = snprintf(line, sizeof(line),
+                                 "2024-05-%02u 12:%02u:%02u %-5s worker-%u request /api/%s/%u user=u%u took %ums%s\n",
+                                 1 + i % 28, r % 60, (r >> 6) % 60, levels[r % 8], (r >> 3) % 16, paths[(r >> 7) % 5],
+                                 r % 10000, (r >> 11) % 500, (r >> 4) % 2000, r % 97 == 0 ? " timeout" : "");
+        const size_t take = n + (size_t) len > length ? length - n : (size_t) len;
+        memcpy(log + n, line, take);
+        n += take;
+    }
+    log[length] = '\0';
+    return log;
+}
+
+// Short key=value records, so that a literal made of the key and its
+// separator turns up every few bytes.
+static char *make_records(const size_t length) {
+    char *records = malloc(length + 1);
+    unsigned state = 54321;
+    size_t n = 0;
+    while (n < length) {
+        state = state * 1103515245U + 12345U;
+        char record[16];
+        const int len = snprintf(record, sizeof(record), "id=%u;", (state >> 8) % 100000);
+        const size_t take = n + (size_t) len > length ? length - n : (size_t) len;
+        memcpy(records + n, record, take);
+        n += take;
+    }
+    records[length] = '\0';
+    return records;
+}
+
+// Words in Latin, Greek, Cyrillic and CJK scripts, with the odd emoji:
+// every sequence length, and few blocks of pure ASCII.
+static char *make_utf8(const size_t length) {
+    static const char *words[] = {"naïve", "café", "λόγος", "слово", "文字", "Straße", "😀", "word", "ἀρχή", "日本語"};
+    char *text = malloc(length + 1);
+    unsigned state = 24680;
+    size_t n = 0;
+    while (n < length) {
+        state = state * 1103515245U + 12345U;
+        const char *word = words[(state >> 8) % 10];
+        const size_t len = strlen(word);
+        if (n + len + 1 > length) {
+            memset(text + n, ' ', length - n);
+            break;
+        }
+        memcpy(text + n, word, len);
+        text[n + len] = ' ';
+        n += len + 1;
+    }
+    text[length] = '\0';
+    return text;
+}
+
+static Hir *parse(const char *pattern) {
+    Node *ast = build_syntax_tree(pattern);
+    size_t capture_count;
+    Hir *hir = hir_from_ast(ast, &capture_count);
+    free_node(ast);
+    return hir;
+}
+
+// Returns throughput in MB/s, repeating the search for at least MIN_SECONDS.
+static double measure(const SearchFn fn, const void *ctx, const Input *input) {
+    size_t runs = 0;
+    const double start = now();
+    double elapsed;
+    do {
+        fn(ctx, input);
+        runs++;
+        elapsed = now() - start;
+    } while (elapsed < MIN_SECONDS);
+    return (double) (input->end - input->start) * (double) runs / elapsed / 1e6;
+}
+
+static bool run_shiftand(const void *ctx, const Input *input) {
+    size_t end;
+    return shiftand_search(ctx, input, &end);
+}
+
+static bool run_pikevm(const void *ctx, const Input *input) {
+    PikeSearcher *ps = (PikeSearcher *) ctx;
+    size_t slots[2];
+    return pikevm_search(ps->prog, &ps->cache, input, slots, 2);
+}
+
+// Yes/no with the Pike VM: no slots, stopping at the first match end.
+static bool run_pikevm_earliest(const void *ctx, const Input *input) {
+    PikeSearcher *ps = (PikeSearcher *) ctx;
+    Input earliest = *input;
+    earliest.earliest = true;
+    return pikevm_search(ps->prog, &ps->cache, &earliest, NULL, 0);
+}
+
+static bool run_posnfa(const void *ctx, const Input *input) {
+    PosNfaSearcher *ns = (PosNfaSearcher *) ctx;
+    size_t end;
+    return posnfa_search(ns->nfa, &ns->cache, input, &end);
+}
+
+static bool run_deriv(const void *ctx, const Input *input) {
+    const DerivSearcher *ds = ctx;
+    size_t end;
+    return deriv_search(ds->d, ds->term, input, &end) == DERIV_MATCH;
+}
+
+static bool run_dfa_earliest(const void *ctx, const Input *input) {
+    DfaSearcher *ds = (DfaSearcher *) ctx;
+    Input earliest = *input;
+    earliest.earliest = true;
+    size_t end;
+    return dfa_search_fwd(ds->dfa, &ds->cache, &earliest, &end) == DFA_MATCH;
+}
+
+static bool run_dfa(const void *ctx, const Input *input) {
+    DfaSearcher *ds = (DfaSearcher *) ctx;
+    size_t end;
+    return dfa_search_fwd(ds->dfa, &ds->cache, input, &end) == DFA_MATCH;
+}
+
+static bool run_packed_pair(const void *ctx, const Input *input) {
+    return packed_pair_find(ctx, (const uint8_t *) input->haystack, input->start, input->end) != NO_POS;
+}
+
+// memmem is declared pure, so without a use of its result the call
+// would be optimised away.
+static const void *volatile memmem_result;
+
+static bool run_memmem(const void *ctx, const Input *input) {
+    const PackedPair *pp = ctx;
+    memmem_result = memmem(input->haystack + input->start, input->end - input->start, pp->needle, pp->len);
+    return memmem_result != NULL;
+}
+
+static bool run_utf8_validate(const void *ctx, const Input *input) {
+    const CpuLevel *level = ctx;
+    const uint8_t *s = (const uint8_t *) input->haystack + input->start;
+    return utf8_validate_level(s, input->end - input->start, *level) == NO_POS;
+}
+
+// Inlined from the header, utf8nvalid would be dropped with its result unused.
+static const void *volatile utf8nvalid_result;
+
+static bool run_utf8nvalid(const void *ctx, const Input *input) {
+    (void) ctx;
+    utf8nvalid_result = utf8nvalid((const utf8_int8_t *) input->haystack + input->start, input->end - input->start);
+    return utf8nvalid_result == NULL;
+}
+
+static bool run_teddy(const void *ctx, const Input *input) {
+    return teddy_find(ctx, (const uint8_t *) input->haystack, input->start, input->end) != NO_POS;
+}
+
+// Three bytes absent from the log lines, so the scan reads all of them.
+static bool run_needles(const void *ctx, const Input *input) {
+    return needles_find(ctx, (const uint8_t *) "#~|", 3, false, (const uint8_t *) input->haystack, input->start,
+                        input->end) != input->end;
+}
+
+static bool run_ahocorasick(const void *ctx, const Input *input) {
+    size_t start, end;
+    return ahocorasick_find(ctx, input, &start, &end);
+}
+
+static bool run_is_match(const void *ctx, const Input *input) {
+    const Searcher *s = ctx;
+    return regex_search(s->re, s->cache, input, NULL, 0);
+}
+
+static bool run_find(const void *ctx, const Input *input) {
+    const Searcher *s = ctx;
+    size_t slots[2];
+    return regex_search(s->re, s->cache, input, slots, 2);
+}
+
+static bool run_captures(const void *ctx, const Input *input) {
+    const Searcher *s = ctx;
+    size_t slots[16];
+    return regex_search(s->re, s->cache, input, slots, 16);
+}
+
+// Runs the search on every line, as grep does.
+static bool run_lines(const void *ctx, const Input *input) {
+    LineFilter *f = (LineFilter *) ctx;
+    const char *p = input->haystack + input->start;
+    const char *end = input->haystack + input->end;
+    size_t slots[16];
+
+    f->matches = 0;
+    while (p < end) {
+        const char *nl = memchr(p, '\n', (size_t) (end - p));
+        if (!nl) {
+            nl = end;
+        }
+        Input line;
+        input_init(&line, p, (size_t) (nl - p));
+        if (regex_search(f->re, f->cache, &line, slots, f->nslots)) {
+            f->matches++;
+        }
+        p = nl + 1;
+    }
+    return f->matches > 0;
+}
+
+static void bench_shiftand(const char *hay) {
+    const char *patterns[] = {
+            "[0-9]{3}-[0-9]{4}",
+            "[A-Z][a-z]+ing",
+            "(foo|bar|baz)[0-9]+",
+            "[a-z]+@[a-z]+\\x{2E}com",
+            "(alpha|beta|gamma|delta)[0-9]{40,60}z",
+            "[a-z]{3,8}[0-9]{30,90}",
+    };
+    Input input;
+    input_init(&input, hay, HAYSTACK_LEN);
+    input.earliest = true;
+
+    printf("%-40s %5s %12s %12s %12s\n", "pattern", "pos", "shiftand", "scalar", "pikevm");
+    for (size_t i = 0; i < sizeof(patterns) / sizeof(patterns[0]); i++) {
+        Hir *hir = parse(patterns[i]);
+        ShiftAnd *sa = shiftand_build(hir);
+        PikeSearcher ps = {.prog = prog_compile(hir, 0, false)};
+        if (!sa || !ps.prog || !pikevm_cache_init(&ps.cache, ps.prog)) {
+            printf("%-40s skipped\n", patterns[i]);
+        } else {
+            const double fast = measure(run_shiftand, sa, &input);
+            const CpuLevel level = sa->level;
+            shiftand_select(sa, CPU_SCALAR);
+            const double scalar = measure(run_shiftand, sa, &input);
+            shiftand_select(sa, level);
+            const double pike = measure(run_pikevm, &ps, &input);
+            printf("%-40s %5zu %9.1f MB/s %7.1f MB/s %7.1f MB/s (%s)\n", patterns[i], sa->npos, fast, scalar, pike,
+                   cpu_level_name(level));
+        }
+        shiftand_free(sa);
+        pikevm_cache_free(&ps.cache);
+        prog_free((Prog *) ps.prog);
+        hir_free(hir);
+    }
+}
+
+// Searches through the meta layer at two haystack lengths, then prints
+// what it analysed and which engines it picked.
+static void bench_meta(const char *hay) {
+    const char *patterns[] = {
+            "[0-9]{3}-[0-9]{4}",
+            "(foo|bar|baz)[0-9]+",
+            "([a-z]+)@([a-z]+)",
+            "(alpha|beta|gamma|delta)[0-9]{40,60}z",
+            "\\w+[0-9]",
+    };
+    const size_t lengths[] = {64, HAYSTACK_LEN};
+
+    for (size_t i = 0; i < sizeof(patterns) / sizeof(patterns[0]); i++) {
+        Regex *re = regex_compile(patterns[i], NULL);
+        RegexCache *cache = re ? regex_cache_new(re) : NULL;
+        if (!cache) {
+            printf("%s skipped\n", patterns[i]);
+            regex_free(re);
+            continue;
+        }
+        const Searcher s = {re, cache};
+        printf("%s\n", patterns[i]);
+        for (size_t l = 0; l < sizeof(lengths) / sizeof(lengths[0]); l++) {
+            Input input;
+            input_init(&input, hay, lengths[l]);
+            printf("  %7zu bytes: is_match %7.1f MB/s  find %7.1f MB/s  captures %7.1f MB/s\n", lengths[l],
+                   measure(run_is_match, &s, &input), measure(run_find, &s, &input),
+                   measure(run_captures, &s, &input));
+        }
+        regex_print_strategy(re, cache);
+        regex_cache_free(cache);
+        regex_free(re);
+    }
+}
+
+// Counted repetitions: with counters the program size and the per-byte
+// cost stay flat as the bound grows.
+static void bench_counters(const char *hay) {
+    const char *bodies[] = {"[a-z ]", "[^,]"};
+    const int bounds[] = {100, 1000, 10000, 100000};
+    // The trailing comma never occurs in the text, so every search of it
+    // fails after scanning it all. The copy has one comma near its end.
+    char *matching = malloc(HAYSTACK_LEN + 1);
+    memcpy(matching, hay, HAYSTACK_LEN + 1);
+    matching[HAYSTACK_LEN - 1000] = ',';
+    const char *haystacks[] = {hay, matching};
+    const char *names[] = {"none", "match"};
+
+    printf("%-24s %8s %8s %8s %14s %14s %14s\n", "pattern", "insts", "counters", "haystack", "is_match", "find",
+           "captures");
+    for (size_t i = 0; i < sizeof(bodies) / sizeof(bodies[0]); i++) {
+        for (size_t j = 0; j < sizeof(bounds) / sizeof(bounds[0]); j++) {
+            char pattern[64];
+            snprintf(pattern, sizeof(pattern), "%s{%d,%d},", bodies[i], bounds[j] / 2, bounds[j]);
+            Hir *hir = parse(pattern);
+            Prog *prog = hir ? prog_compile(hir, 0, false) : NULL;
+            Regex *re = regex_compile(pattern, NULL);
+            RegexCache *cache = re ? regex_cache_new(re) : NULL;
+            for (size_t h = 0; h < 2; h++) {
+                if (!prog || !cache) {
+                    printf("%-24s skipped\n", pattern);
+                    break;
+                }
+                Input input;
+                input_init(&input, haystacks[h], HAYSTACK_LEN);
+                const Searcher s = {re, cache};
+                printf("%-24s %8zu %8zu %8s %9.1f MB/s %9.1f MB/s %9.1f MB/s\n", pattern, prog->length,
+                       prog->ncounters, names[h], measure(run_is_match, &s, &input), measure(run_find, &s, &input),
+                       measure(run_captures, &s, &input));
+            }
+            regex_cache_free(cache);
+            regex_free(re);
+            prog_free(prog);
+            hir_free(hir);
+        }
+    }
+    free(matching);
+}
+
+// The forward DFA with and without acceleration. The text has no digits,
+// dots or capitals, so states waiting for one skip far ahead.
+static void bench_accel(const char *hay) {
+    const char *patterns[] = {
+            ".*abc",
+            ".*[0-9]",
+            "\\x{2E}com",
+            "(Foo|Bar)[a-z]+",
+            "[0-9]{3}-[0-9]{4}",
+    };
+    Input input;
+    input_init(&input, hay, HAYSTACK_LEN);
+
+    printf("%-24s %8s %14s %14s\n", "pattern", "states", "accelerated", "stepping");
+    for (size_t i = 0; i < sizeof(patterns) / sizeof(patterns[0]); i++) {
+        Hir *hir = parse(patterns[i]);
+        Prog *prog = hir ? prog_compile(hir, 0, false) : NULL;
+        DfaSearcher ds = {.dfa = prog ? dfa_build(prog, false) : NULL};
+        if (!ds.dfa || !dfa_cache_init(&ds.cache, ds.dfa, DFA_DEFAULT_CACHE_SIZE)) {
+            printf("%-24s skipped\n", patterns[i]);
+        } else {
+            const double fast = measure(run_dfa, &ds, &input);
+            size_t accelerated = 0;
+            for (size_t id = 0; id < ds.cache.nstates; id++) {
+                const uint8_t accel = ds.cache.states[id].accel;
+                accelerated += accel != DFA_ACCEL_UNKNOWN && accel != DFA_ACCEL_NONE;
+            }
+            ds.dfa->accelerate = false;
+            dfa_cache_free(&ds.cache);
+            dfa_cache_init(&ds.cache, ds.dfa, DFA_DEFAULT_CACHE_SIZE);
+            const double slow = measure(run_dfa, &ds, &input);
+            printf("%-24s %8zu %9.1f MB/s %9.1f MB/s\n", patterns[i], accelerated, fast, slow);
+        }
+        dfa_cache_free(&ds.cache);
+        dfa_free(ds.dfa);
+        prog_free(prog);
+        hir_free(hir);
+    }
+}
+
+// The Glushkov position NFA against the Thompson program, both simulated
+// for a yes/no answer. Thompson's count includes the splits and saves a
+// Pike VM step chases; the position NFA has only positions and edges.
+static void bench_glushkov(const char *hay) {
+    const char *patterns[] = {
+            "[a-z]+ing [0-9]",
+            "(foo|bar|baz|qux)+[0-9]",
+            "\\w+@\\w+\\.com",
+            "([a-z]+ ){3}[0-9]",
+            "[a-z]{3,}(xx|yy)[0-9]",
+            "(a|b|c|d|e)*[0-9]{300}",
+            "([a-z]{2,20} ){10}[0-9]",
+    };
+    Input input;
+    input_init(&input, hay, HAYSTACK_LEN / 16);
+
+    printf("%-28s %8s %8s %8s %8s %14s %14s\n", "pattern", "insts", "epsilon", "posns", "edges", "pikevm",
+           "glushkov");
+    for (size_t i = 0; i < sizeof(patterns) / sizeof(patterns[0]); i++) {
+        Hir *hir = parse(patterns[i]);
+        Prog *prog = hir ? prog_compile(hir, 0, false) : NULL;
+        PosNfaSearcher ns = {.nfa = hir ? posnfa_build(hir) : NULL};
+        PikeSearcher ps = {.prog = prog};
+        if (!prog || !ns.nfa || !pikevm_cache_init(&ps.cache, prog) || !posnfa_cache_init(&ns.cache, ns.nfa)) {
+            printf("%-28s skipped\n", patterns[i]);
+        } else {
+            size_t epsilon = 0;
+            for (size_t pc = 0; pc < prog->length; pc++) {
+                epsilon += prog->insts[pc].op != OP_BYTE && prog->insts[pc].op != OP_MATCH;
+            }
+            printf("%-28s %8zu %8zu %8zu %8zu", patterns[i], prog->length, epsilon, ns.nfa->npos, ns.nfa->nedges);
+            printf(" %9.1f MB/s", measure(run_pikevm_earliest, &ps, &input));
+            printf(" %9.1f MB/s\n", measure(run_posnfa, &ns, &input));
+        }
+        posnfa_cache_free(&ns.cache);
+        posnfa_free((PosNfa *) ns.nfa);
+        pikevm_cache_free(&ps.cache);
+        prog_free(prog);
+        hir_free(hir);
+    }
+}
+
+// The derivative matcher against the lazy DFA, both answering yes/no.
+// Once warm, both are a table lookup per byte. The last two rows remove
+// words containing "th" with an intersection and a complement, which
+// only the derivatives can express.
+static void bench_deriv(const char *hay) {
+    const struct {
+        const char *pattern;
+        const char *without;
+    } cases[] = {
+            {"[a-z]+ing [0-9]", NULL},
+            {"(foo|bar|baz)[a-z]*!", NULL},
+            {"[a-z]{3,}(xx|yy)[0-9]", NULL},
+            {"([a-z]+ ){3}[0-9]", NULL},
+            {" [a-z]{5,} [0-9]", ".*th.*"},
+            {" [a-z]+ [a-z]+ [0-9]", ".*(th|qu).*"},
+    };
+    Input input;
+    input_init(&input, hay, HAYSTACK_LEN);
+
+    printf("%-40s %8s %8s %14s %14s\n", "pattern", "terms", "states", "derivatives", "dfa");
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        DerivSearcher ds = {.d = deriv_new()};
+        ds.term = deriv_parse(ds.d, cases[i].pattern);
+        const uint32_t without = cases[i].without ? deriv_parse(ds.d, cases[i].without) : DERIV_NONE;
+        if (without != DERIV_NONE) {
+            ds.term = deriv_and(ds.d, ds.term, deriv_not(ds.d, without));
+        }
+        char label[64];
+        snprintf(label, sizeof(label), "%s%s%s", cases[i].pattern, cases[i].without ? " & ~" : "",
+                 cases[i].without ? cases[i].without : "");
+        if (ds.term == DERIV_NONE) {
+            printf("%-40s skipped\n", label);
+            deriv_free(ds.d);
+            continue;
+        }
+        const double speed = measure(run_deriv, &ds, &input);
+        printf("%-40s %8zu %8zu %9.1f MB/s", label, ds.d->nterms, ds.d->nrows, speed);
+
+        Hir *hir = cases[i].without ? NULL : parse(cases[i].pattern);
+        Prog *prog = hir ? prog_compile(hir, 0, false) : NULL;
+        DfaSearcher fs = {.dfa = prog ? dfa_build(prog, false) : NULL};
+        if (fs.dfa && dfa_cache_init(&fs.cache, fs.dfa, DFA_DEFAULT_CACHE_SIZE)) {
+            printf(" %9.1f MB/s\n", measure(run_dfa_earliest, &fs, &input));
+        } else {
+            printf(" %14s\n", "n/a");
+        }
+        dfa_cache_free(&fs.cache);
+        dfa_free(fs.dfa);
+        prog_free(prog);
+        hir_free(hir);
+        deriv_free(ds.d);
+    }
+}
+
+// Cycles per byte of the DFA's stepping loop, acceleration off, on the
+// fixed text and log corpora. None of the patterns match, so every search
+// scans the whole haystack; the best of several runs is reported.
+static void bench_cycles(const char *hay) {
+    const char *patterns[] = {
+            "[a-z]+ing [0-9]",
+            "(foo|bar|baz)[a-z]*!",
+            "\\w+@\\w+",
+            "user=u[0-9]+ took [0-9]+ms!",
+            "(INFO|WARN) worker-[0-9]+ request /api/[a-z]+/[0-9]+ user=u0",
+    };
+    char *log = make_log(HAYSTACK_LEN);
+    const char *corpora[] = {hay, log};
+
+    printf("%-60s %12s %12s\n", "pattern", "text", "log");
+    for (size_t i = 0; i < sizeof(patterns) / sizeof(patterns[0]); i++) {
+        Hir *hir = parse(patterns[i]);
+        Prog *prog = hir ? prog_compile(hir, 0, false) : NULL;
+        DfaSearcher ds = {.dfa = prog ? dfa_build(prog, false) : NULL};
+        if (!ds.dfa || !dfa_cache_init(&ds.cache, ds.dfa, DFA_DEFAULT_CACHE_SIZE)) {
+            printf("%-60s skipped\n", patterns[i]);
+        } else {
+            ds.dfa->accelerate = false;
+            printf("%-60s", patterns[i]);
+            for (size_t c = 0; c < 2; c++) {
+                Input input;
+                input_init(&input, corpora[c], HAYSTACK_LEN);
+                uint64_t best = UINT64_MAX;
+                for (int run = 0; run < 10; run++) {
+                    const uint64_t start = ticks();
+                    run_dfa(&ds, &input);
+                    const uint64_t elapsed = ticks() - start;
+                    best = elapsed < best ? elapsed : best;
+                }
+                printf(" %12.3f", (double) best / HAYSTACK_LEN);
+            }
+            printf("\n");
+        }
+        dfa_cache_free(&ds.cache);
+        dfa_free(ds.dfa);
+        prog_free(prog);
+        hir_free(hir);
+    }
+    free(log);
+}
+
+// An alternation of n made-up words with common prefixes and suffixes,
+// the shape of a keyword list. The words must be followed by a '!', which
+// the haystack lacks, so searches scan all of it.
+static char *make_words(const size_t n) {
+    static const char *prefixes[] = {"", "", "un", "re", "pre", "over", "dis", "in"};
+    static const char *suffixes[] = {"", "s", "ed", "ing", "er", "tion", "ness", "able"};
+    char *pattern = malloc(n * 24 + 3);
+    unsigned state = 777;
+    size_t len = 1;
+    pattern[0] = '(';
+    for (size_t i = 0; i < n; i++) {
+        state = state * 1103515245U + 12345U;
+        const unsigned r = state >> 8;
+        if (i > 0) {
+            pattern[len++] = '|';
+        }
+        len += (size_t) sprintf(pattern + len, "%s", prefixes[r % 8]);
+        for (unsigned k = 0; k < 3 + (r >> 3) % 4; k++) {
+            pattern[len++] = (char) ('a' + (r >> (5 + 4 * k)) % 26);
+        }
+        len += (size_t) sprintf(pattern + len, "%s", suffixes[(r >> 21) % 8]);
+    }
+    strcpy(pattern + len, ")!");
+    return pattern;
+}
+
+// Word lists: instructions and search speed as the alternation grows.
+static void bench_words(const char *hay) {
+    const size_t counts[] = {10, 100, 1000, 10000};
+    Input small;
+    input_init(&small, hay, HAYSTACK_LEN / 64);
+    Input input;
+    input_init(&input, hay, HAYSTACK_LEN);
+
+    printf("%8s %10s %8s %14s %14s\n", "words", "compile", "insts", "pikevm", "dfa");
+    for (size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+        char *pattern = make_words(counts[i]);
+        const double start = now();
+        Hir *hir = parse(pattern);
+        Prog *prog = hir ? prog_compile(hir, 0, false) : NULL;
+        const double elapsed = now() - start;
+        PikeSearcher ps = {.prog = prog};
+        DfaSearcher ds = {.dfa = prog ? dfa_build(prog, false) : NULL};
+        if (!ds.dfa || !pikevm_cache_init(&ps.cache, prog) ||
+            !dfa_cache_init(&ds.cache, ds.dfa, DFA_DEFAULT_CACHE_SIZE)) {
+            printf("%8zu skipped\n", counts[i]);
+        } else {
+            printf("%8zu %8.1fms %8zu", counts[i], elapsed * 1e3, prog->length);
+            printf(" %9.1f MB/s", measure(run_pikevm_earliest, &ps, &small));
+            printf(" %9.1f MB/s\n", measure(run_dfa_earliest, &ds, &input));
+        }
+        dfa_cache_free(&ds.cache);
+        dfa_free(ds.dfa);
+        pikevm_cache_free(&ps.cache);
+        prog_free(prog);
+        hir_free(hir);
+        free(pattern);
+    }
+}
+
+// Filtering log lines: is_match stops at the first match end and records
+// nothing, find has to settle where the leftmost-first match ends.
+static void bench_filter(const char *hay) {
+    (void) hay;
+    const char *patterns[] = {
+            "ERROR",
+            "(WARN|ERROR) .*timeout",
+            "took [0-9]{4}ms",
+            "user=u[0-9]+ took [0-9]+ms",
+            "[a-z]+/[0-9]+",
+            "[0-9]+",
+    };
+    char *log = make_log(HAYSTACK_LEN);
+    Input input;
+    input_init(&input, log, HAYSTACK_LEN);
+
+    printf("%-32s %8s %14s %14s %8s\n", "pattern", "lines", "is_match", "find", "speedup");
+    for (size_t i = 0; i < sizeof(patterns) / sizeof(patterns[0]); i++) {
+        Regex *re = regex_compile(patterns[i], NULL);
+        RegexCache *cache = re ? regex_cache_new(re) : NULL;
+        if (!cache) {
+            printf("%-32s skipped\n", patterns[i]);
+            regex_free(re);
+            continue;
+        }
+        LineFilter is_match = {re, cache, 0, 0};
+        LineFilter find = {re, cache, 2, 0};
+        const double fast = measure(run_lines, &is_match, &input);
+        const double slow = measure(run_lines, &find, &input);
+        printf("%-32s %8zu %9.1f MB/s %9.1f MB/s %7.2fx\n", patterns[i], is_match.matches, fast, slow, fast / slow);
+        regex_cache_free(cache);
+        regex_free(re);
+    }
+    free(log);
+}
+
+// The forward DFA over log lines with and without the rare-byte
+// prefilter. None of the patterns match, so both scan the whole log.
+// Each literal starts with bytes the log is full of; the prefilter
+// scans for a rarer one and the DFA only runs from there. The last ones
+// run over records whose key is a candidate every few bytes, where the
+// prefilter pauses itself; it is also timed never pausing.
+static void bench_prefilter(const char *hay) {
+    (void) hay;
+    const char *patterns[] = {
+            "timeout!",
+            "took 2999ms",
+            "user=u999 ",
+            "request /api/(items|users)/99999",
+            "(WARN|ERROR) +worker-16",
+            "(users|orders|login)/99999",
+            "worker-[0-9]+ requests",
+            "id=[0-9]+x",
+    };
+    const size_t first_record = 7;
+    char *log = make_log(HAYSTACK_LEN);
+    char *records = make_records(HAYSTACK_LEN);
+
+    printf("%-32s %-22s %14s %14s %14s\n", "pattern", "needles", "prefilter", "never paused", "dfa only");
+    for (size_t i = 0; i < sizeof(patterns) / sizeof(patterns[0]); i++) {
+        Input input;
+        input_init(&input, i < first_record ? log : records, HAYSTACK_LEN);
+        Hir *hir = parse(patterns[i]);
+        Prog *prog = hir ? prog_compile(hir, 0, false) : NULL;
+        Literals *literals = hir ? literals_extract(hir) : NULL;
+        Prefilter *pre = literals ? prefilter_build(&literals->prefixes) : NULL;
+        DfaSearcher ds = {.dfa = prog ? dfa_build(prog, false) : NULL};
+        if (!pre || !ds.dfa || !dfa_cache_init(&ds.cache, ds.dfa, DFA_DEFAULT_CACHE_SIZE)) {
+            printf("%-32s skipped\n", patterns[i]);
+        } else {
+            char needles[32] = "";
+            if (pre->pair) {
+                snprintf(needles, sizeof(needles), "pair '%c' '%c'", pre->pair->byte1, pre->pair->byte2);
+            } else if (pre->teddy) {
+                snprintf(needles, sizeof(needles), "teddy");
+            }
+            for (size_t j = 0; j < pre->nneedles; j++) {
+                snprintf(needles + strlen(needles), sizeof(needles) - strlen(needles), "'%c' ", pre->needles[j]);
+            }
+            ds.dfa->prefilter = pre;
+            const double fast = measure(run_dfa, &ds, &input);
+            ds.dfa->adapt_prefilter = false;
+            const double always = measure(run_dfa, &ds, &input);
+            ds.dfa->prefilter = NULL;
+            dfa_cache_free(&ds.cache);
+            dfa_cache_init(&ds.cache, ds.dfa, DFA_DEFAULT_CACHE_SIZE);
+            const double slow = measure(run_dfa, &ds, &input);
+            printf("%-32s %-22s %9.1f MB/s %9.1f MB/s %9.1f MB/s\n", patterns[i], needles, fast, always, slow);
+        }
+        dfa_cache_free(&ds.cache);
+        dfa_free(ds.dfa);
+        prefilter_free(pre);
+        literals_free(literals);
+        prog_free(prog);
+        hir_free(hir);
+    }
+    free(records);
+    free(log);
+}
+
+// Packed-pair search for single literals against the C library's memmem,
+// over log lines none of them occur in. The needles start with bytes the
+// log is full of, and some have only common bytes.
+static void bench_pair(const char *hay) {
+    (void) hay;
+    const char *needles[] = {
+            "timeout!",
+            "took 2999ms",
+            "request /api/items/99999",
+            "INFO  worker-16",
+            "2024-05-29",
+    };
+    char *log = make_log(HAYSTACK_LEN);
+    Input input;
+    input_init(&input, log, HAYSTACK_LEN);
+
+    printf("%-26s %-12s %14s %14s\n", "needle", "pair", "packed pair", "memmem");
+    for (size_t i = 0; i < sizeof(needles) / sizeof(needles[0]); i++) {
+        PackedPair *pp = packed_pair_build((const uint8_t *) needles[i], strlen(needles[i]));
+        char pair[16];
+        snprintf(pair, sizeof(pair), "'%c' '%c'", pp->byte1, pp->byte2);
+        const double fast = measure(run_packed_pair, pp, &input);
+        const double slow = measure(run_memmem, pp, &input);
+        printf("%-26s %-12s %9.2f GB/s %9.2f GB/s\n", needles[i], pair, fast / 1e3, slow / 1e3);
+        packed_pair_free(pp);
+    }
+    free(log);
+}
+
+// Patterns that are one string go to the substring searcher without any
+// automaton being built. Wrapping one in a group gives it a capture slot,
+// which sends it down the usual path, for comparison.
+static void bench_substr(const char *hay) {
+    (void) hay;
+    const char *patterns[] = {
+            "timeout!",
+            "[Tt][Ii][Mm][Ee][Oo][Uu][Tt]!",
+            "took 2999ms",
+            "request /api/items/99999",
+    };
+    char *log = make_log(HAYSTACK_LEN);
+    Input input;
+    input_init(&input, log, HAYSTACK_LEN);
+
+    printf("%-30s %10s %10s %14s %14s\n", "pattern", "compile", "grouped", "substr", "grouped");
+    for (size_t i = 0; i < sizeof(patterns) / sizeof(patterns[0]); i++) {
+        char grouped[64];
+        snprintf(grouped, sizeof(grouped), "(%s)", patterns[i]);
+        double start = now();
+        Regex *re = regex_compile(patterns[i], NULL);
+        const double compile = now() - start;
+        start = now();
+        Regex *group_re = regex_compile(grouped, NULL);
+        const double group_compile = now() - start;
+        Searcher fast = {re, regex_cache_new(re)};
+        Searcher slow = {group_re, regex_cache_new(group_re)};
+        printf("%-30s %8.1fus %8.1fus", patterns[i], compile * 1e6, group_compile * 1e6);
+        printf(" %9.2f GB/s", measure(run_find, &fast, &input) / 1e3);
+        printf(" %9.2f GB/s\n", measure(run_find, &slow, &input) / 1e3);
+        regex_cache_free(fast.cache);
+        regex_cache_free(slow.cache);
+        regex_free(re);
+        regex_free(group_re);
+    }
+    free(log);
+}
+
+// Patterns whose literal comes after a class they are found by through the
+// literal, with the reverse DFA running back from it. Wrapping one in a
+// group leaves no top-level concatenation, so it takes the plain DFA.
+static void bench_inner(const char *hay) {
+    (void) hay;
+    const char *patterns[] = {
+            "\\w+@example\\.com",
+            "[0-9]+ms timeouts",
+            "[a-z]+/99999/",
+    };
+    char *log = make_log(HAYSTACK_LEN);
+    Input input;
+    input_init(&input, log, HAYSTACK_LEN);
+
+    printf("%-30s %14s %14s\n", "pattern", "reverse inner", "dfa only");
+    for (size_t i = 0; i < sizeof(patterns) / sizeof(patterns[0]); i++) {
+        char grouped[64];
+        snprintf(grouped, sizeof(grouped), "(%s)", patterns[i]);
+        Regex *re = regex_compile(patterns[i], NULL);
+        Regex *group_re = regex_compile(grouped, NULL);
+        Searcher fast = {re, regex_cache_new(re)};
+        Searcher slow = {group_re, regex_cache_new(group_re)};
+        printf("%-30s %9.2f GB/s", patterns[i], measure(run_find, &fast, &input) / 1e3);
+        printf(" %9.2f GB/s\n", measure(run_find, &slow, &input) / 1e3);
+        regex_cache_free(fast.cache);
+        regex_cache_free(slow.cache);
+        regex_free(re);
+        regex_free(group_re);
+    }
+    free(log);
+}
+
+// Each vectorized kernel at every level up to the CPU's, over log lines
+// with no match: packed pair, Teddy with 16 words, the scan for three
+// needle bytes, and the four-word shift-and, whose ragged repetition
+// keeps it from matching early.
+static void bench_dispatch(const char *hay) {
+    (void) hay;
+    const char *needle = "request /api/items/99999";
+    char *log = make_log(HAYSTACK_LEN);
+    Input input;
+    input_init(&input, log, HAYSTACK_LEN);
+    PackedPair *pp = packed_pair_build((const uint8_t *) needle, strlen(needle));
+    char *words = make_words(16);
+    Hir *word_hir = parse(words);
+    Literals *literals = word_hir ? literals_extract(word_hir) : NULL;
+    Teddy *t = literals ? teddy_build(&literals->prefixes) : NULL;
+    Hir *sa_hir = parse("[a-z]{3,8}[0-9]{30,90}");
+    ShiftAnd *sa = sa_hir ? shiftand_build(sa_hir) : NULL;
+
+    printf("cpu: %s\n", cpu_level_name(cpu_level()));
+    NeedleScan scan;
+
+    printf("%-8s %14s %14s %14s %14s\n", "level", "packed pair", "teddy", "needles", "shiftand");
+    for (CpuLevel level = CPU_SCALAR; level <= cpu_level(); level++) {
+        printf("%-8s", cpu_level_name(level));
+        if (pp) {
+            packed_pair_select(pp, level);
+            printf(" %9.2f GB/s", measure(run_packed_pair, pp, &input) / 1e3);
+        }
+        if (t) {
+            teddy_select(t, level);
+            printf(" %9.2f GB/s", measure(run_teddy, t, &input) / 1e3);
+        }
+        needles_select(&scan, level);
+        printf(" %9.2f GB/s", measure(run_needles, &scan, &input) / 1e3);
+        if (sa) {
+            shiftand_select(sa, level);
+            printf(" %9.1f MB/s", measure(run_shiftand, sa, &input));
+        }
+        printf("\n");
+    }
+    shiftand_free(sa);
+    hir_free(sa_hir);
+    teddy_free(t);
+    literals_free(literals);
+    hir_free(word_hir);
+    free(words);
+    packed_pair_free(pp);
+    free(log);
+}
+
+// UTF-8 validation at every level up to the CPU's against utf8.h's
+// utf8nvalid(), over ASCII log lines and over text in several scripts.
+static void bench_utf8(const char *hay) {
+    (void) hay;
+    char *corpora[] = {make_log(HAYSTACK_LEN), make_utf8(HAYSTACK_LEN)};
+
+    printf("%-10s %14s %14s\n", "level", "ascii log", "mixed text");
+    for (CpuLevel level = CPU_SCALAR; level <= cpu_level(); level++) {
+        printf("%-10s", cpu_level_name(level));
+        for (size_t c = 0; c < 2; c++) {
+            Input input;
+            input_init(&input, corpora[c], HAYSTACK_LEN);
+            printf(" %9.2f GB/s", measure(run_utf8_validate, &level, &input) / 1e3);
+        }
+        printf("\n");
+    }
+    printf("%-10s", "utf8.h");
+    for (size_t c = 0; c < 2; c++) {
+        Input input;
+        input_init(&input, corpora[c], HAYSTACK_LEN);
+        printf(" %9.2f GB/s", measure(run_utf8nvalid, NULL, &input) / 1e3);
+    }
+    printf("\n");
+    free(corpora[0]);
+    free(corpora[1]);
+}
+
+// Teddy on its own against the forward DFA, both looking for alternations
+// of made-up words over log lines that hold none of them.
+static void bench_teddy(const char *hay) {
+    (void) hay;
+    const size_t counts[] = {2, 8, 16, 32, 64};
+    char *log = make_log(HAYSTACK_LEN);
+    Input input;
+    input_init(&input, log, HAYSTACK_LEN);
+
+    printf("%-8s %-8s %14s %14s\n", "words", "masks", "teddy", "dfa only");
+    for (size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+        char *pattern = make_words(counts[i]);
+        Hir *hir = parse(pattern);
+        Prog *prog = hir ? prog_compile(hir, 0, false) : NULL;
+        Literals *literals = hir ? literals_extract(hir) : NULL;
+        Teddy *t = literals ? teddy_build(&literals->prefixes) : NULL;
+        DfaSearcher ds = {.dfa = prog ? dfa_build(prog, false) : NULL};
+        if (!t || !ds.dfa || !dfa_cache_init(&ds.cache, ds.dfa, DFA_DEFAULT_CACHE_SIZE)) {
+            printf("%-8zu skipped\n", counts[i]);
+        } else {
+            const double fast = measure(run_teddy, t, &input);
+            const double slow = measure(run_dfa, &ds, &input);
+            printf("%-8zu %-8zu %9.2f GB/s %9.2f GB/s\n", counts[i], t->nmasks, fast / 1e3, slow / 1e3);
+        }
+        dfa_cache_free(&ds.cache);
+        dfa_free(ds.dfa);
+        teddy_free(t);
+        literals_free(literals);
+        prog_free(prog);
+        hir_free(hir);
+        free(pattern);
+    }
+    free(log);
+}
+
+// Both Aho-Corasick variants against the forward DFA on word lists too
+// long for Teddy. The random letters keep every variant busy in the trie.
+static void bench_ahocorasick(const char *hay) {
+    const size_t counts[] = {100, 1000, 10000};
+    Input input;
+    input_init(&input, hay, HAYSTACK_LEN);
+
+    printf("%-8s %-8s %14s %14s %14s\n", "words", "states", "nfa", "dfa", "dfa only");
+    for (size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+        char *pattern = make_words(counts[i]);
+        Hir *hir = parse(pattern);
+        Prog *prog = hir ? prog_compile(hir, 0, false) : NULL;
+        LiteralSet set = {0};
+        const bool spelled = hir && literal_set_build(hir, SIZE_MAX, &set);
+        AhoCorasick *nfa = spelled ? ahocorasick_build(&set, AHOCORASICK_LEFTMOST_FIRST, AHOCORASICK_NFA) : NULL;
+        AhoCorasick *dfa = spelled ? ahocorasick_build(&set, AHOCORASICK_LEFTMOST_FIRST, AHOCORASICK_DFA) : NULL;
+        DfaSearcher ds = {.dfa = prog ? dfa_build(prog, false) : NULL};
+        if (!nfa || !dfa || !ds.dfa || !dfa_cache_init(&ds.cache, ds.dfa, DFA_DEFAULT_CACHE_SIZE)) {
+            printf("%-8zu skipped\n", counts[i]);
+        } else {
+            printf("%-8zu %-8zu", counts[i], dfa->nstates);
+            printf(" %9.2f GB/s", measure(run_ahocorasick, nfa, &input) / 1e3);
+            printf(" %9.2f GB/s", measure(run_ahocorasick, dfa, &input) / 1e3);
+            printf(" %9.2f GB/s\n", measure(run_dfa, &ds, &input) / 1e3);
+        }
+        dfa_cache_free(&ds.cache);
+        dfa_free(ds.dfa);
+        ahocorasick_free(nfa);
+        ahocorasick_free(dfa);
+        literal_set_free(&set);
+        prog_free(prog);
+        hir_free(hir);
+        free(pattern);
+    }
+}
+
+// Leftmost-longest against leftmost-first on the same log lines. The
+// longest DFA pass and the NFAs running on past the first match cost
+// little next to the scan itself.
+static void bench_longest(const char *hay) {
+    (void) hay;
+    const char *patterns[] = {
+            "ERROR|ERROR worker-[0-9]+",
+            "[0-9]+|[0-9]+ms",
+            "(user=u[0-9]+)( took [0-9]+ms)?",
+            "/api/(users|orders|items)(/[0-9]+)?",
+    };
+    char *log = make_log(HAYSTACK_LEN);
+    Input input;
+    input_init(&input, log, HAYSTACK_LEN);
+
+    printf("%-40s %14s %14s %14s %14s\n", "pattern", "first find", "first groups", "longest find",
+           "longest groups");
+    for (size_t i = 0; i < sizeof(patterns) / sizeof(patterns[0]); i++) {
+        printf("%-40s", patterns[i]);
+        for (int longest = 0; longest < 2; longest++) {
+            RegexConfig config;
+            regex_config_init(&config);
+            config.longest = longest;
+            Regex *re = regex_compile(patterns[i], &config);
+            RegexCache *cache = re ? regex_cache_new(re) : NULL;
+            if (!cache) {
+                printf(" %14s %14s", "skipped", "skipped");
+                regex_free(re);
+                continue;
+            }
+            LineFilter find = {re, cache, 2, 0};
+            LineFilter groups = {re, cache, 16, 0};
+            printf(" %9.1f MB/s", measure(run_lines, &find, &input));
+            printf(" %9.1f MB/s", measure(run_lines, &groups, &input));
+            regex_cache_free(cache);
+            regex_free(re);
+        }
+        printf("\n");
+    }
+    free(log);
+}
+
+// Allocations per search once the cache has warmed up, which should be
+// none. Between them the patterns reach every engine the meta layer picks.
+static void bench_allocs(const char *hay) {
+#ifdef BENCH_COUNT_ALLOCS
+    const char *patterns[] = {
+            "[0-9]{3}-[0-9]{4}",
+            "([a-z]+) ([a-z]+)",
+            "([a-z]*)([a-z]*) ",
+            "(\\w+)\\s+(\\w+)\\s+(\\w+)\\s+[0-9]",
+            "([a-z]{2,200}) ([a-z ]{150,200})x",
+    };
+    const size_t lengths[] = {64, HAYSTACK_LEN / 16};
+    const SearchFn fns[] = {run_is_match, run_find, run_captures};
+
+    printf("%-36s %9s %9s %9s %9s\n", "pattern", "bytes", "is_match", "find", "captures");
+    for (size_t i = 0; i < sizeof(patterns) / sizeof(patterns[0]); i++) {
+        Regex *re = regex_compile(patterns[i], NULL);
+        RegexCache *cache = re ? regex_cache_new(re) : NULL;
+        if (!cache) {
+            printf("%-36s skipped\n", patterns[i]);
+            regex_free(re);
+            continue;
+        }
+        const Searcher s = {re, cache};
+        for (size_t l = 0; l < sizeof(lengths) / sizeof(lengths[0]); l++) {
+            Input input;
+            input_init(&input, hay, lengths[l]);
+            printf("%-36s %9zu", patterns[i], lengths[l]);
+            for (size_t f = 0; f < sizeof(fns) / sizeof(fns[0]); f++) {
+                fns[f](&s, &input);
+                const size_t before = allocations;
+                for (size_t r = 0; r < ALLOC_RUNS; r++) {
+                    fns[f](&s, &input);
+                }
+                printf(" %9.2f", (double) (allocations - before) / ALLOC_RUNS);
+            }
+            printf("\n");
+        }
+        regex_print_strategy(re, cache);
+        regex_cache_free(cache);
+        regex_free(re);
+    }
+#else
+    (void) hay;
+    printf("allocation counting needs the linker's --wrap option\n");
+#endif
+}
+
+int main(const int argc, const char **argv) {
+    const struct {
+        const char *name;
+        void (*run)(const char *hay);
+    } benches[] = {
+            {"shiftand", bench_shiftand},
+            {"meta", bench_meta},
+            {"counters", bench_counters},
+            {"glushkov", bench_glushkov},
+            {"deriv", bench_deriv},
+            {"words", bench_words},
+            {"filter", bench_filter},
+            {"prefilter", bench_prefilter},
+            {"pair", bench_pair},
+            {"substr", bench_substr},
+            {"inner", bench_inner},
+            {"teddy", bench_teddy},
+            {"dispatch", bench_dispatch},
+            {"utf8", bench_utf8},
+            {"ahocorasick", bench_ahocorasick},
+            {"longest", bench_longest},
+            {"accel", bench_accel},
+            {"cycles", bench_cycles},
+            {"allocs", bench_allocs},
+    };
+
+    char *hay = make_haystack(HAYSTACK_LEN);
+    for (size_t i = 0; i < sizeof(benches) / sizeof(benches[0]); i++) {
+        if (argc > 1 && strcmp(argv[1], benches[i].name) != 0) {
+            continue;
+        }
+        printf("== %s ==\n", benches[i].name);
+        benches[i].run(hay);
+    }
+    free(hay);
+    return 0;
+}
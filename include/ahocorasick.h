@@ -0,0 +1,67 @@
+#pragma once
+
+#include "input.h"
+#include "literal.h"
+
+/*
+ * Aho-Corasick search for large sets of literals. The literals form a
+ * trie, and every state gets a failure link to the state for the longest
+ * proper suffix of its string that is also in the trie, so a single pass
+ * over the haystack finds every literal that occurs. Matches come out
+ * leftmost-first, the first literal of the set that occurs at the
+ * leftmost position, or leftmost-longest, the longest one there.
+ *
+ * Two representations are built from the trie. The contiguous NFA keeps
+ * each state's transitions as a packed list in one array and follows
+ * failure links at search time; it stays small for any number of
+ * literals. The DFA resolves the failure links at build time into a full
+ * transition table over byte classes, so every byte costs one lookup, and
+ * is used when that table fits AHOCORASICK_MAX_DFA_BYTES.
+ */
+
+#define AHOCORASICK_MAX_DFA_BYTES (16 * 1024 * 1024)
+// Tags DFA transitions into states where a literal ends.
+#define AHOCORASICK_MATCH (1U << 31)
+
+typedef enum {
+    AHOCORASICK_LEFTMOST_FIRST,
+    AHOCORASICK_LEFTMOST_LONGEST,
+} AhoCorasickKind;
+
+typedef enum {
+    // The DFA when it fits, otherwise the NFA.
+    AHOCORASICK_AUTO,
+    AHOCORASICK_NFA,
+    AHOCORASICK_DFA,
+} AhoCorasickImpl;
+
+typedef struct {
+    AhoCorasickKind kind;
+    size_t npatterns;
+    size_t nstates;
+    // Contiguous NFA: state s is nfa[s] onwards, laid out as its failure
+    // link, depth, pattern, output link and transition count, then its
+    // transition bytes packed four to a word, then their targets. The
+    // root is state 0 and moves through root[] instead.
+    uint32_t *nfa;
+    size_t nfa_length;
+    uint32_t root[256];
+    // DFA: state s moves on byte b to trans[s + classes[b]], with
+    // AHOCORASICK_MATCH set on states where a literal ends. Its depth,
+    // pattern and output link are info[3 * (s >> stride_shift)] onwards.
+    uint32_t *trans;
+    uint32_t *info;
+    uint8_t classes[256];
+    size_t stride_shift;
+    bool dfa;
+} AhoCorasick;
+
+// Returns NULL when the set is empty, or when a DFA was asked for and
+// would not fit.
+AhoCorasick *ahocorasick_build(const LiteralSet *set, AhoCorasickKind kind, AhoCorasickImpl impl);
+void ahocorasick_free(AhoCorasick *ac);
+
+// Finds the match in haystack[start, end), honouring anchored and
+// earliest: an earliest search returns the first match to end.
+bool ahocorasick_find(const AhoCorasick *ac, const Input *input, size_t *start, size_t *end);
+void ahocorasick_print(const AhoCorasick *ac);
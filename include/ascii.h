@@ -0,0 +1,17 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * ASCII letter tests for the caseless literal searchers, whatever the
+ * locale. Only ASCII letters fold; every other byte is its own case.
+ */
+
+static inline bool ascii_is_letter(const uint8_t b) {
+    return (uint8_t) ((b | 0x20) - 'a') < 26;
+}
+
+static inline uint8_t ascii_to_lower(const uint8_t b) {
+    return ascii_is_letter(b) ? (uint8_t) (b | 0x20) : b;
+}
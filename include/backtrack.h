@@ -0,0 +1,36 @@
+#pragma once
+
+#include "input.h"
+#include "prog.h"
+
+/*
+ * Bounded backtracker. A (pc, position) visited bitset guarantees every
+ * pair is explored at most once, so the search stays linear in
+ * pattern size times haystack length, and only runs when that product
+ * fits the configured memory budget.
+ */
+
+typedef struct {
+    uint32_t pc;
+    uint32_t slot;
+    size_t at;
+} BacktrackFrame;
+
+typedef struct {
+    uint64_t *visited;
+    size_t visited_capacity;
+    BacktrackFrame *stack;
+    size_t stack_capacity;
+    size_t *slots;
+    // The slots of the longest match so far, for leftmost-longest programs.
+    size_t *best;
+    size_t nslots;
+} BacktrackCache;
+
+bool backtrack_cache_init(BacktrackCache *cache, const Prog *prog);
+void backtrack_cache_free(BacktrackCache *cache);
+
+size_t backtrack_max_haystack(const Prog *prog, size_t budget);
+
+// Also returns false, having reported it, when memory runs out.
+bool backtrack_search(const Prog *prog, BacktrackCache *cache, const Input *input, size_t *slots, size_t nslots);
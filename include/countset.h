@@ -0,0 +1,83 @@
+#pragma once
+
+#include "input.h"
+#include "prog.h"
+
+/*
+ * Counting-set simulation of programs with counters. Rather than one
+ * thread per (pc, count), each pc inside a counter loop holds the set of
+ * counts reaching it. All counts in a set advance together, so a set is a
+ * sorted run of stamps plus one shared offset: incrementing every member
+ * is a single add, and the largest count, the only one that can leave the
+ * loop first or run past max, sits at the head. Work per byte is therefore
+ * independent of the repetition bounds.
+ *
+ * The simulation tracks neither priorities nor capture positions, so it
+ * answers whether and where the earliest match ends. Run on a reversed
+ * program it reads the span backwards, and the last match it meets is
+ * where the leftmost match starts.
+ */
+
+typedef enum {
+    COUNTSET_NO_MATCH,
+    COUNTSET_MATCH,
+    // Memory ran out; another engine has to answer.
+    COUNTSET_GAVE_UP,
+} CountSetResult;
+
+typedef struct {
+    uint32_t *stamps;
+    size_t head;
+    size_t tail;
+    size_t capacity;
+    uint32_t offset;
+    uint32_t refs;
+} CountSet;
+
+typedef struct {
+    uint32_t pc;
+    uint32_t set;
+} CountFrame;
+
+typedef struct {
+    uint32_t *dense;
+    uint32_t *sparse;
+    size_t size;
+    // Set held by each pc in the list, or NO_COUNTER outside counters.
+    uint32_t *set_of;
+    // Identifies the step this list is being built for.
+    size_t stamp;
+} CountList;
+
+typedef struct {
+    CountList lists[2];
+    CountSet *sets;
+    size_t nsets;
+    size_t sets_capacity;
+    uint32_t *free_sets;
+    size_t nfree;
+    CountFrame *stack;
+    size_t stack_capacity;
+    // Buffer a merge is built in before it is swapped with the target's.
+    uint32_t *merged;
+    size_t merged_capacity;
+    // Per counter: the set entering its body during the current step, and
+    // the counters whose body has yet to be expanded.
+    uint32_t *body;
+    uint32_t *pending;
+    size_t npending;
+    // Per pc: the last set a region split was expanded with, and when.
+    uint32_t *seen_set;
+    size_t *seen_step;
+    size_t step;
+    size_t ninsts;
+    // Set when an allocation fails during a search.
+    bool failed;
+} CountCache;
+
+bool countset_cache_init(CountCache *cache, const Prog *prog);
+void countset_cache_free(CountCache *cache);
+
+// Where the first match the scan meets ends with input->earliest, and
+// otherwise the last one.
+CountSetResult countset_search(const Prog *prog, CountCache *cache, const Input *input, size_t *pos);
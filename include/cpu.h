@@ -0,0 +1,24 @@
+#pragma once
+
+/*
+ * CPU feature dispatch. Each vectorized kernel is compiled for several
+ * instruction sets through target attributes, and the objects that run
+ * one store the variant for the current level in a function pointer when
+ * they are built, so a search never tests features. The level comes from
+ * cpuid, checked once at startup. Setting C_REX_CPU to scalar, sse2,
+ * ssse3, avx2 or avx512 lowers it, to compare the variants on one
+ * machine; a level the CPU lacks is never used.
+ */
+
+typedef enum {
+    CPU_SCALAR,
+    CPU_SSE2,
+    CPU_SSSE3,
+    CPU_AVX2,
+    // AVX-512 with byte and word instructions.
+    CPU_AVX512,
+    CPU_LEVEL_COUNT,
+} CpuLevel;
+
+CpuLevel cpu_level(void);
+const char *cpu_level_name(CpuLevel level);
@@ -0,0 +1,105 @@
+#pragma once
+
+#include "hir.h"
+#include "input.h"
+
+/*
+ * Brzozowski derivatives. A regex is a term, and the derivative of a term
+ * with respect to a byte is the term matching the rest of every match
+ * that starts with that byte; a term matches the empty string when it is
+ * nullable. Scanning a haystack is repeated differentiation, so the terms
+ * themselves are the states of a DFA built as the scan goes.
+ *
+ * Terms are hash-consed: every term is built once by the smart
+ * constructors and named by its id, so equal terms are one comparison
+ * apart. The constructors also normalise: alternations and intersections
+ * are flattened, sorted and deduplicated, their classes merged, and the
+ * identities of the empty language, the empty string and the universal
+ * language applied. That keeps the set of derivatives of any term finite.
+ * Each term's derivatives are memoised in a 256-entry row, so a state the
+ * scan has seen before costs one lookup per byte.
+ *
+ * Intersection and complement come for free, since the derivative of an
+ * intersection (complement) is the intersection (complement) of the
+ * derivatives. They work on bytes: the complement of a pattern also
+ * matches byte strings that are not UTF-8. Assertions are not supported.
+ */
+
+#define DERIV_NONE UINT32_MAX
+#define DERIV_DEFAULT_MAX_TERMS (1U << 16)
+
+typedef enum {
+    DERIV_NOTHING,
+    DERIV_EPSILON,
+    DERIV_CLASS,
+    DERIV_CONCAT,
+    DERIV_STAR,
+    DERIV_REPEAT,
+    DERIV_ALT,
+    DERIV_AND,
+    DERIV_NOT,
+} DerivKind;
+
+typedef struct {
+    DerivKind kind;
+    bool nullable;
+    // Operands, in canonical order for ALT and AND.
+    uint32_t a;
+    uint32_t b;
+    // REPEAT bounds; max is -1 when unbounded.
+    int min;
+    int max;
+    ByteSet set;
+    // Row of memoised derivatives, or DERIV_NONE until the first step.
+    uint32_t row;
+} DerivTerm;
+
+typedef struct {
+    DerivTerm *terms;
+    size_t nterms;
+    size_t capacity;
+    uint32_t *table;
+    size_t table_size;
+    uint32_t *rows;
+    size_t nrows;
+    size_t rows_capacity;
+    // Differentiation gives up once this many terms exist.
+    size_t max_terms;
+    uint32_t nothing;
+    uint32_t epsilon;
+    uint32_t any;
+    uint32_t universe;
+} Deriv;
+
+typedef enum {
+    DERIV_NO_MATCH,
+    DERIV_MATCH,
+    DERIV_GAVE_UP,
+} DerivResult;
+
+Deriv *deriv_new(void);
+void deriv_free(Deriv *d);
+
+// DERIV_NONE when the pattern does not parse or uses assertions. The
+// constructors return DERIV_NONE when memory runs out, and pass it on
+// when given it.
+uint32_t deriv_parse(Deriv *d, const char *pattern);
+uint32_t deriv_from_hir(Deriv *d, const Hir *hir);
+
+uint32_t deriv_class(Deriv *d, const ByteSet *set);
+uint32_t deriv_concat(Deriv *d, uint32_t a, uint32_t b);
+uint32_t deriv_alt(Deriv *d, uint32_t a, uint32_t b);
+uint32_t deriv_and(Deriv *d, uint32_t a, uint32_t b);
+uint32_t deriv_not(Deriv *d, uint32_t a);
+uint32_t deriv_star(Deriv *d, uint32_t a);
+uint32_t deriv_repeat(Deriv *d, uint32_t a, int min, int max);
+
+// The derivative of t with respect to byte b, or DERIV_NONE once
+// max_terms is reached or memory runs out.
+uint32_t deriv_step(Deriv *d, uint32_t t, uint8_t b);
+
+// Where a match of t ends: the first end with input->earliest, otherwise
+// the last one in the span. Anchored, that is the longest match from the
+// start, so a whole-span match ends at input->end. DERIV_GAVE_UP when a
+// step fails.
+DerivResult deriv_search(Deriv *d, uint32_t t, const Input *input, size_t *end);
@@ -0,0 +1,158 @@
+#pragma once
+
+#include "input.h"
+#include "prefilter.h"
+#include "prog.h"
+
+/*
+ * Lazy DFA. States are determinized on demand from the program and kept
+ * in a bounded cache; a state is the ordered list of byte and match
+ * instructions its threads sit on. Matches are delayed by one byte: the
+ * transition out of a state that contains a match is flagged, and the
+ * extra end-of-input column reports matches at the end of the haystack.
+ *
+ * In leftmost-first mode the thread list is cut after the first match,
+ * which drops threads that could only produce lower-priority matches.
+ * In longest mode nothing is cut and states are sorted sets, which is
+ * what the reverse scan that locates match starts needs.
+ *
+ * Assertions are part of the states. A state records its look-behind
+ * context: whether the scan is at the start of the haystack and whether
+ * the byte just consumed was a word character. Assertions that also need
+ * the next byte ($, \b, \B) stay in the thread list and are decided when
+ * the transition on that byte is computed. The scan direction is all that
+ * matters, so the reverse DFA runs the same way on a reversed program.
+ * Only ASCII bytes have a word-ness of their own; with word boundaries,
+ * the DFA gives up on any other byte and leaves the search to an NFA.
+ *
+ * A state that loops on all but a few bytes is accelerated: the first
+ * time the scan takes its self-loop, the whole row is computed, and if
+ * at most three ASCII bytes (and possibly every byte from 0x80 up) leave
+ * the state, the scan jumps to the next such byte instead of stepping.
+ * Stopping at a byte that turns out to stay in the state is harmless.
+ *
+ * With a prefilter, an unanchored scan that falls back into its start
+ * state has no match under way, so it jumps straight to the prefilter's
+ * next candidate. Only programs without assertions get one: a jump would
+ * skip the look-behind context the start state depends on. A candidate
+ * counts as confirmed when a match follows before the scan falls back; a
+ * prefilter the search finds not paying is paused (see prefilter.h), and
+ * the scan meanwhile steps through the start state like any other.
+ *
+ * A transition holds its target's id premultiplied by the stride, so a
+ * step is a single load, and the top bits tag the targets the scan must
+ * stop at: match states, the dead state, the self-loops of (possibly)
+ * accelerated states, the start state a prefilter skips from, and bytes
+ * the DFA gives up on. Unknown transitions
+ * have every bit set. Every special transition is then at least
+ * DFA_SPECIAL, and the scan's hot loop tests for all of them with one
+ * comparison per byte.
+ */
+
+#define DFA_UNKNOWN UINT32_MAX
+#define DFA_DEAD 0
+#define DFA_MATCH_TAG (1U << 31)
+#define DFA_ACCEL_TAG (1U << 30)
+#define DFA_DEAD_TAG (1U << 29)
+#define DFA_QUIT_TAG (1U << 28)
+#define DFA_START_TAG (1U << 27)
+#define DFA_SPECIAL DFA_START_TAG
+#define DFA_OFFSET_MASK (DFA_SPECIAL - 1)
+#define DFA_DEFAULT_CACHE_SIZE (2 * 1024 * 1024)
+
+// Look-behind context of a state.
+#define DFA_AT_START 1
+#define DFA_AFTER_WORD 2
+#define DFA_LOOK_CONTEXTS 4
+// Set when the thread list holds undecided assertions.
+#define DFA_HAS_LOOKS 4
+
+// DfaState.accel: not examined yet, not accelerated, or DFA_ACCEL_ON
+// with the number of needles and whether bytes from 0x80 up leave too.
+#define DFA_ACCEL_UNKNOWN 0xFF
+#define DFA_ACCEL_NONE 0
+#define DFA_ACCEL_ON 8
+#define DFA_ACCEL_HIGH 4
+#define DFA_ACCEL_NEEDLES 3
+
+typedef enum {
+    DFA_NO_MATCH,
+    DFA_MATCH,
+    DFA_GAVE_UP,
+} DfaResult;
+
+typedef struct {
+    uint32_t offset;
+    uint32_t ninsts;
+    bool is_match;
+    uint8_t look;
+    // The unanchored start state the prefilter skips from.
+    bool is_start;
+    uint8_t accel;
+    uint8_t needles[NEEDLES_MAX];
+    // Jumps taken from this state and the bytes they skipped.
+    uint32_t jumps;
+    size_t skipped;
+} DfaState;
+
+typedef struct {
+    const Prog *prog;
+    bool longest;
+    // Jump over the self-loops of accelerated states; on by default.
+    bool accelerate;
+    // Pause a prefilter that stops paying; on by default.
+    bool adapt_prefilter;
+    // Give up on non-ASCII bytes, whose word-ness needs the whole rune.
+    bool word_quit;
+    // Owned by the caller; NULL for none.
+    const Prefilter *prefilter;
+    // Finds the bytes that leave an accelerated state.
+    NeedleScan scan;
+    size_t stride;
+    uint8_t class_rep[256];
+} Dfa;
+
+typedef struct {
+    // Row of state id at id * stride; see the tags above.
+    uint32_t *trans;
+    DfaState *states;
+    size_t nstates;
+    size_t state_capacity;
+    uint32_t *pool;
+    size_t pool_length;
+    size_t pool_capacity;
+    uint32_t *table;
+    size_t table_size;
+    uint32_t *dense;
+    uint32_t *sparse;
+    size_t set_size;
+    uint32_t *stack;
+    uint32_t *list;
+    uint32_t *resolved;
+    uint32_t start[2][DFA_LOOK_CONTEXTS];
+    size_t memory_limit;
+    size_t clears;
+    size_t scanned;
+    // Where the last forward search stopped reading.
+    size_t stop;
+    // Totals over every search, kept across cache clears.
+    size_t accel_jumps;
+    size_t accel_skipped;
+    size_t prefilter_jumps;
+    size_t prefilter_skipped;
+    size_t prefilter_confirmed;
+    size_t prefilter_pauses;
+} DfaCache;
+
+Dfa *dfa_build(const Prog *prog, bool longest);
+void dfa_free(Dfa *dfa);
+
+bool dfa_cache_init(DfaCache *cache, const Dfa *dfa, size_t memory_limit);
+void dfa_cache_free(DfaCache *cache);
+
+DfaResult dfa_search_fwd(const Dfa *dfa, DfaCache *cache, const Input *input, size_t *end);
+DfaResult dfa_search_rev(const Dfa *dfa, DfaCache *cache, const Input *input, size_t *start);
+
+// Prints the accelerated states currently in the cache, the totals and
+// what the prefilter skipped.
+void dfa_print_accel(const DfaCache *cache);
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "hir.h"
+
+/*
+ * Glushkov position automaton. Every HIR_CLASS occurrence (after counted
+ * repetitions are expanded) is a position; the automaton has no epsilon
+ * transitions and every edge into a position is labelled by that
+ * position's class. Positions are numbered left to right, so most edges
+ * go from p to p + 1.
+ */
+
+typedef struct {
+    size_t npos;
+    size_t nwords;
+    bool nullable;
+    ByteSet *classes;
+    uint64_t *first;
+    uint64_t *last;
+    uint64_t *follow;
+    // Set while building once an allocation has failed.
+    bool failed;
+} Glushkov;
+
+size_t glushkov_count_positions(const Hir *hir, size_t limit);
+
+// Returns NULL for patterns with assertions or over max_positions, and
+// when memory runs out.
+Glushkov *glushkov_build(const Hir *hir, size_t max_positions);
+void glushkov_free(Glushkov *g);
+
+bool glushkov_bit(const uint64_t *set, size_t p);
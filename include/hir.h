@@ -0,0 +1,84 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "ast.h"
+#include "input.h"
+#include "rrange.h"
+
+/*
+ * High-level intermediate representation of a pattern.
+ *
+ * The syntax tree produced by build_syntax_tree() is keyed by string labels,
+ * which is convenient for printing but awkward to analyze. The HIR is the
+ * typed form every compiler and analysis works from. It is byte oriented:
+ * rune classes are lowered to alternations of UTF-8 byte sequences, so a
+ * HIR_CLASS always matches exactly one byte. A HIR_LOOK matches no bytes
+ * at all; it only succeeds where its assertion holds.
+ */
+
+typedef enum {
+    HIR_EMPTY,
+    HIR_CLASS,
+    HIR_CONCAT,
+    HIR_ALT,
+    HIR_REPEAT,
+    HIR_CAPTURE,
+    HIR_LOOK,
+} HirKind;
+
+// Zero-width assertions. They see the whole haystack, not just the span
+// being searched. Word boundaries are Unicode-aware: a word character is
+// any rune in \w, and \B never holds between the bytes of a character.
+typedef enum {
+    LOOK_START,
+    LOOK_END,
+    LOOK_WORD,
+    LOOK_NOT_WORD,
+    LOOK_COUNT,
+} Look;
+
+#define LOOK_BIT(look) (1U << (look))
+#define LOOK_WORD_BITS (LOOK_BIT(LOOK_WORD) | LOOK_BIT(LOOK_NOT_WORD))
+
+typedef struct {
+    uint64_t bits[4];
+} ByteSet;
+
+typedef struct Hir {
+    HirKind kind;
+    ByteSet set;
+    int min;
+    int max;
+    size_t index;
+    Look look;
+    struct Hir **sub;
+    size_t sub_count;
+} Hir;
+
+void byteset_clear(ByteSet *set);
+void byteset_add(ByteSet *set, uint8_t b);
+void byteset_add_range(ByteSet *set, uint8_t lo, uint8_t hi);
+void byteset_union(ByteSet *set, const ByteSet *other);
+bool byteset_contains(const ByteSet *set, uint8_t b);
+size_t byteset_count(const ByteSet *set);
+bool byteset_equal(const ByteSet *a, const ByteSet *b);
+
+Hir *hir_new(HirKind kind);
+Hir *hir_class(const ByteSet *set);
+Hir *hir_byte(uint8_t b);
+Hir *hir_look(Look look);
+Hir *hir_clone(const Hir *hir);
+void hir_free(Hir *hir);
+void hir_add(Hir *parent, Hir *child);
+
+Hir *hir_from_runes(const RuneRange *rr);
+Hir *hir_from_ast(const Node *root, size_t *capture_count);
+Hir *hir_reverse(const Hir *hir);
+bool hir_nullable(const Hir *hir);
+bool hir_has_look(const Hir *hir);
+
+bool is_word_rune(rune r);
+bool look_matches(Look look, const Input *input, size_t at);
+
+void hir_print(const Hir *hir, int depth);
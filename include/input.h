@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#define NO_POS SIZE_MAX
+
+/*
+ * A single search request. Engines only look at haystack[start, end);
+ * anchored pins the match start to `start`, earliest lets an engine stop
+ * at the first match end it sees instead of extending it.
+ */
+typedef struct {
+    const char *haystack;
+    size_t length;
+    size_t start;
+    size_t end;
+    bool anchored;
+    bool earliest;
+} Input;
+
+void input_init(Input *input, const char *haystack, size_t length);
@@ -0,0 +1,91 @@
+#pragma once
+
+#include "hir.h"
+
+/*
+ * Literal extraction. Every match of a pattern starts with one of its
+ * prefix literals, ends with one of its suffix literals and contains one
+ * of its inner literals, so a search can look for those first and leave
+ * the regex engines to verify the few places they occur.
+ *
+ * A literal is exact when it is a whole match of the subexpression it was
+ * taken from, and inexact when the match may run on past it; only exact
+ * literals are extended by what follows. Small classes expand into one
+ * literal per byte ([ab]c gives ac and bc), larger ones end the literals
+ * there. Assertions match no bytes and count as empty, so an exact
+ * literal says nothing about them. Sets that would grow past the limits
+ * are cut short: literals are shortened until the set fits, or the set
+ * is given up on.
+ *
+ * A set's score estimates how well it would serve as a prefilter. Sets
+ * scoring zero, such as those holding the empty literal, are dropped.
+ *
+ * Separately, a pattern without assertions that matches finitely many
+ * strings can be spelled out whole, in the order leftmost-first prefers
+ * them: the first string in that order that occurs at a position is the
+ * match there. No cuts apply, only limits on the set's size.
+ */
+
+#define LITERAL_MAX_LEN 32
+#define LITERAL_MAX_COUNT 64
+// Largest class expanded into one literal per byte.
+#define LITERAL_MAX_CLASS 8
+// Copies of a repeated subexpression spelled out before giving up.
+#define LITERAL_MAX_REPEAT 8
+
+typedef struct {
+    uint8_t bytes[LITERAL_MAX_LEN];
+    size_t len;
+    bool exact;
+} Literal;
+
+typedef struct {
+    Literal *lits;
+    size_t count;
+    size_t capacity;
+    // No finite set covers the matches; count is then 0.
+    bool infinite;
+} LiteralSeq;
+
+// String i is bytes[starts[i]] up to bytes[starts[i + 1]].
+typedef struct {
+    uint8_t *bytes;
+    size_t *starts;
+    size_t count;
+    size_t capacity;
+    size_t length;
+    size_t bytes_capacity;
+} LiteralSet;
+
+// Largest total length of a spelled-out set.
+#define LITERAL_SET_MAX_BYTES (1 << 22)
+
+typedef struct {
+    LiteralSeq prefixes;
+    LiteralSeq suffixes;
+    LiteralSeq inner;
+} Literals;
+
+Literals *literals_extract(const Hir *hir);
+void literals_free(Literals *literals);
+
+LiteralSeq literal_prefixes(const Hir *hir);
+LiteralSeq literal_suffixes(const Hir *hir);
+LiteralSeq literal_inner(const Hir *hir);
+void literal_seq_free(LiteralSeq *seq);
+
+// Returns false when the pattern has assertions, matches infinitely many
+// strings or more than max_count of them.
+bool literal_set_build(const Hir *hir, size_t max_count, LiteralSet *set);
+// Returns whether the pattern matches exactly one string, putting it in
+// set. Classes of the two cases of an ASCII letter are also accepted when
+// every letter of the string is one, the letters then stored in lower case
+// and caseless set.
+bool literal_single(const Hir *hir, LiteralSet *set, bool *caseless);
+// Appends a string; returns false once the set would pass its byte limit.
+bool literal_set_add(LiteralSet *set, const uint8_t *bytes, size_t len);
+void literal_set_free(LiteralSet *set);
+
+size_t literal_seq_score(const LiteralSeq *seq);
+void literal_seq_print(const LiteralSeq *seq);
+void literals_print(const Literals *literals);
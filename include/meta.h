@@ -0,0 +1,93 @@
+#pragma once
+
+#include "ahocorasick.h"
+#include "hir.h"
+#include "input.h"
+#include "literal.h"
+#include "prefilter.h"
+#include "prog.h"
+
+/*
+ * Engine selection. A pattern is analysed once when it is compiled; every
+ * search then goes to the cheapest engine that can answer it, given how
+ * many slots the caller wants, whether the search is anchored and how long
+ * the haystack is. The analysis never changes after compilation; what the
+ * searches actually did is counted separately in StrategyStats, which
+ * lives with the caller's scratch, so strategy_print() can show both.
+ *
+ * A pattern whose prefix literals make no prefilter may still hold a good
+ * literal further in, as in \w+@example\.com. If it is a concatenation
+ * with such a literal at the start of a tail, and nothing before the tail
+ * can match the literals' first bytes, a search can look for the literal
+ * and run a reverse DFA of what precedes it back from there: that finds
+ * the leftmost start, since a match starting earlier would have to step
+ * over the literal. The forward DFA, anchored at the start, then finds the
+ * end. The same condition keeps each reverse scan from reading back past
+ * the previous candidate; a forward scan that fails after reading past
+ * the next one gives up instead, to a plain DFA search.
+ */
+
+// After this many give-ups the lazy DFA is considered to thrash on this
+// pattern and is no longer tried.
+#define META_MAX_DFA_GIVE_UPS 4
+// Patterns spelling out more literals than the prefix sets hold are
+// matched whole by Aho-Corasick, up to this many.
+#define META_MAX_AHOCORASICK_LITERALS 100000
+
+typedef enum {
+    ENGINE_SHIFTAND,
+    ENGINE_POSNFA,
+    ENGINE_ONEPASS,
+    ENGINE_DFA,
+    ENGINE_BACKTRACK,
+    ENGINE_PIKEVM,
+    ENGINE_COUNTSET,
+    ENGINE_AHOCORASICK,
+    ENGINE_SUBSTR,
+    ENGINE_REVERSE_INNER,
+    ENGINE_COUNT,
+} Engine;
+
+typedef struct {
+    // Pattern analysis, fixed after compilation.
+    size_t capture_count;
+    // NULL if extraction failed.
+    Literals *literals;
+    // Built from the prefix literals; NULL if they make a poor one.
+    Prefilter *prefilter;
+    // Matches the whole pattern when it is a large set of literals.
+    AhoCorasick *ahocorasick;
+    // Reverse inner: a prefilter for the literals starting the tail of the
+    // top-level concatenation from item inner_split on, and the reversed
+    // program of the items before it. NULL when there is no such tail.
+    Prefilter *inner_prefilter;
+    Prog *inner_rprog;
+    size_t inner_split;
+    bool reverse_inner;
+    size_t positions;
+    size_t byte_insts;
+    size_t dfa_estimate;
+    bool counters;
+    // The counting sets read backwards for a yes/no answer too, since the
+    // pattern's suffix literals are rarer than its prefix literals.
+    bool counters_reverse;
+    bool onepass;
+    bool shiftand;
+    bool posnfa;
+    bool dfa;
+} Strategy;
+
+typedef struct {
+    size_t searches[ENGINE_COUNT];
+    size_t dfa_give_ups;
+    size_t reverse_inner_give_ups;
+} StrategyStats;
+
+const char *engine_name(Engine engine);
+
+void strategy_analyze(Strategy *s, const Hir *hir, const Prog *prog, size_t capture_count, size_t dfa_cache_size);
+void strategy_free(Strategy *s);
+Engine strategy_select(const Strategy *s, const StrategyStats *stats, const Input *input, size_t nslots,
+                       size_t backtrack_max);
+Engine strategy_select_captures(const Strategy *s, const Input *input, size_t backtrack_max);
+void strategy_print(const Strategy *s, const StrategyStats *stats);
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "cpu.h"
+
+/*
+ * Scans for the first, or last, of up to three needle bytes, and with
+ * high set for any byte from 0x80 up as well. The prefilter looks for its
+ * rare bytes this way, and the DFA for the bytes that leave an
+ * accelerated state.
+ *
+ * The vector variants compare 16, 32 or 64 bytes at a time with SSE2,
+ * AVX2 or AVX-512 against each needle, and take the top bits of the
+ * loaded bytes for high. The scalar variant leaves a lone needle to
+ * memchr and otherwise tests eight bytes at a time: a needle shows up as
+ * a zero byte of the word XORed with it, found with the subtract-and-mask
+ * trick.
+ */
+
+#define NEEDLES_MAX 3
+
+typedef struct {
+    // Returns the first position in [at, end) holding a needle, or end.
+    size_t (*find)(const uint8_t *needles, size_t n, bool high, const uint8_t *hay, size_t at, size_t end);
+    // Returns the position just past the last needle in [start, at), or
+    // start.
+    size_t (*rfind)(const uint8_t *needles, size_t n, bool high, const uint8_t *hay, size_t start, size_t at);
+    CpuLevel level;
+} NeedleScan;
+
+// Picks the scan variants for level, or for the CPU's if that is lower.
+void needles_select(NeedleScan *scan, CpuLevel level);
+
+size_t needles_find(const NeedleScan *scan, const uint8_t *needles, size_t n, bool high, const uint8_t *hay, size_t at,
+                    size_t end);
+size_t needles_rfind(const NeedleScan *scan, const uint8_t *needles, size_t n, bool high, const uint8_t *hay,
+                     size_t start, size_t at);
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "input.h"
+#include "prog.h"
+
+/*
+ * One-pass DFA. A program is one-pass when, from every state, the next
+ * input byte selects at most one way forward. The DFA then fills capture
+ * slots directly during a single forward scan of an anchored search,
+ * without thread lists or backtracking. Assertions crossed on the way to a
+ * byte or to the match are recorded with it and checked at search time.
+ */
+
+#define ONEPASS_DEAD UINT32_MAX
+#define ONEPASS_MAX_SLOTS 64
+#define ONEPASS_MAX_BYTES (2 * 1024 * 1024)
+
+typedef struct {
+    uint32_t next;
+    // LOOK_BITs that must hold at the current position.
+    uint32_t looks;
+    // Slots to set to the current position before the byte is consumed.
+    uint64_t slots;
+} OnePassTrans;
+
+typedef struct {
+    OnePassTrans *table;
+    uint64_t *match_slots;
+    uint32_t *match_looks;
+    bool *is_match;
+    size_t nstates;
+    size_t stride;
+    size_t nslots;
+    uint8_t byte_class[256];
+} OnePass;
+
+OnePass *onepass_build(const Prog *prog);
+void onepass_free(OnePass *op);
+
+bool onepass_search(const OnePass *op, const Input *input, size_t *slots, size_t nslots);
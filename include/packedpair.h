@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "cpu.h"
+
+/*
+ * Packed-pair substring search. Two bytes of the needle, the rarest two
+ * by the prefilter's ranking, are compared across 16 haystack positions
+ * at once with SSE2, 32 with AVX2 or 64 with AVX-512: one load lines
+ * up the first byte of each window, a second load the other, and only
+ * positions where both agree are compared in full. A pair of rare bytes
+ * at their fixed distance rules out far more positions than the first
+ * byte alone, which is all memchr-then-compare looks at.
+ *
+ * Other targets fall back to memchr on the rarer byte.
+ *
+ * A caseless needle is kept in lower case, and haystack bytes compared
+ * with a letter of the pair are ORed with 0x20 first, which folds exactly
+ * the two cases of that letter onto it.
+ */
+
+typedef struct PackedPair {
+    uint8_t *needle;
+    size_t len;
+    // The pair: needle[index1] == byte1 and needle[index2] == byte2.
+    size_t index1;
+    size_t index2;
+    uint8_t byte1;
+    uint8_t byte2;
+    // 0x20 where the pair byte is a letter of a caseless needle, else 0.
+    uint8_t fold1;
+    uint8_t fold2;
+    bool caseless;
+    // The search variant and the level it was picked for.
+    size_t (*find)(const struct PackedPair *pp, const uint8_t *hay, size_t at, size_t end);
+    CpuLevel level;
+} PackedPair;
+
+// Returns NULL for needles shorter than two bytes, which memchr serves.
+PackedPair *packed_pair_build(const uint8_t *needle, size_t len);
+// The same, matching ASCII letters in either case.
+PackedPair *packed_pair_build_caseless(const uint8_t *needle, size_t len);
+void packed_pair_free(PackedPair *pp);
+// Picks the search variant for level, or for the CPU's if that is lower.
+// Building picks the CPU's.
+void packed_pair_select(PackedPair *pp, CpuLevel level);
+
+// Returns the first position in [at, end) where the needle starts and
+// fits before end, or NO_POS.
+size_t packed_pair_find(const PackedPair *pp, const uint8_t *hay, size_t at, size_t end);
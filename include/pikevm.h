@@ -0,0 +1,48 @@
+#pragma once
+
+#include "input.h"
+#include "prog.h"
+
+/*
+ * Threads are kept in priority order. Outside counter loops a thread is
+ * identified by its pc alone; inside one, threads with different counts
+ * behave differently and are keyed by (pc, count) in a hash table whose
+ * entries are invalidated by bumping the list's generation.
+ */
+typedef struct {
+    uint32_t *pcs;
+    uint32_t *counts;
+    size_t *slots;
+    size_t size;
+    size_t capacity;
+    uint32_t *sparse;
+    uint64_t *keys;
+    uint32_t *gens;
+    size_t table_size;
+    size_t table_used;
+    uint32_t gen;
+} ThreadList;
+
+typedef struct {
+    uint32_t pc;
+    uint32_t slot;
+    uint32_t count;
+    size_t value;
+} PikeFrame;
+
+typedef struct {
+    ThreadList lists[2];
+    PikeFrame *stack;
+    size_t stack_capacity;
+    size_t *scratch;
+    size_t ninsts;
+    size_t nslots;
+    // Slots the current search records; the rest are never written.
+    size_t tracked;
+} PikeCache;
+
+bool pikevm_cache_init(PikeCache *cache, const Prog *prog);
+void pikevm_cache_free(PikeCache *cache);
+
+// Also returns false, having reported it, when memory runs out.
+bool pikevm_search(const Prog *prog, PikeCache *cache, const Input *input, size_t *slots, size_t nslots);
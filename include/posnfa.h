@@ -0,0 +1,51 @@
+#pragma once
+
+#include "glushkov.h"
+#include "input.h"
+
+/*
+ * Sparse simulation of the Glushkov automaton, for patterns with too many
+ * positions for shift-and. The automaton has no epsilon transitions, so a
+ * byte step visits each active position's successors once and keeps those
+ * whose class holds the byte; there are no split chains to chase as in the
+ * Pike VM. Successors are stored as one array indexed by position, and the
+ * first positions are listed per byte class, so the unanchored restart
+ * only adds positions that can take the byte.
+ *
+ * Like shift-and, the simulation tracks no priorities and answers whether
+ * and where the earliest match ends.
+ */
+
+#define POSNFA_MAX_POSITIONS 4096
+
+typedef struct {
+    size_t npos;
+    bool nullable;
+    ByteSet *classes;
+    uint8_t *is_last;
+    // Successors of position p: succ[succ_start[p]] to succ[succ_start[p + 1]].
+    uint32_t *succ_start;
+    uint32_t *succ;
+    size_t nedges;
+    uint8_t byte_class[256];
+    size_t nclasses;
+    // First positions taking a byte of class c, laid out like succ.
+    uint32_t *first_start;
+    uint32_t *first;
+} PosNfa;
+
+typedef struct {
+    uint32_t *lists[2];
+    // Step at which each position last joined the list being built.
+    uint32_t *marks;
+    uint32_t step;
+    size_t npos;
+} PosNfaCache;
+
+PosNfa *posnfa_build(const Hir *hir);
+void posnfa_free(PosNfa *nfa);
+
+bool posnfa_cache_init(PosNfaCache *cache, const PosNfa *nfa);
+void posnfa_cache_free(PosNfaCache *cache);
+
+bool posnfa_search(const PosNfa *nfa, PosNfaCache *cache, const Input *input, size_t *end);
@@ -0,0 +1,88 @@
+#pragma once
+
+#include "ahocorasick.h"
+#include "literal.h"
+#include "needles.h"
+#include "packedpair.h"
+#include "teddy.h"
+
+/*
+ * Prefilters. A prefilter finds the next position where a match may
+ * start, so a search can skip the bytes in between. It is built from the
+ * prefix literals and looks for them by their rarest bytes rather than
+ * their first: a table ranks every byte by how often it occurs in typical
+ * text and binaries, and each literal is keyed on its lowest ranked byte.
+ * At most three distinct needles are scanned for, with memchr, memchr2 or
+ * memchr3, and a hit only becomes a candidate once the literals keyed on
+ * that needle are compared in full around it. Unless a single rare byte
+ * will do, literals of two bytes or more are looked for many positions
+ * at a time instead: a single literal by a pair of its bytes, several by
+ * Teddy on their leading bytes, or by Aho-Corasick where the CPU lacks
+ * the shuffles Teddy needs.
+ *
+ * Patterns left with single-byte literals that need more needles, or
+ * only common ones, get no prefilter: a scan stopping every few bytes is
+ * slower than none.
+ *
+ * Literals common in the haystack at hand stop a scan just as often, so a
+ * search keeps a PrefilterState: the candidates found, the ones that led
+ * to a match, and the bytes skipped. Once there are enough candidates to
+ * judge, a prefilter skipping too few bytes for each candidate that came
+ * to nothing is paused for a stretch of the haystack, then tried again
+ * with a fresh count.
+ */
+
+#define PREFILTER_MAX_NEEDLES 3
+// Needles ranked this common or more stop a scan too often to pay off.
+#define PREFILTER_MAX_RANK 240
+// A prefilter is judged after this many candidates, and paused when it
+// skipped fewer bytes than this for each false one.
+#define PREFILTER_MIN_CANDIDATES 32
+#define PREFILTER_MIN_SKIP 16
+// How far a paused prefilter stays off.
+#define PREFILTER_PAUSE (64 * 1024)
+
+typedef struct {
+    // Literals grouped by needle: those keyed on needles[i] are lits[first[i]]
+    // up to lits[first[i + 1]], and offsets[j] is where lits[j] holds it.
+    Literal *lits;
+    size_t *offsets;
+    size_t first[PREFILTER_MAX_NEEDLES + 1];
+    uint8_t needles[PREFILTER_MAX_NEEDLES];
+    size_t nneedles;
+    NeedleScan scan;
+    size_t max_offset;
+    // Set for a single literal, or for several with no rare byte between
+    // them, which then need none of the above.
+    PackedPair *pair;
+    Teddy *teddy;
+    AhoCorasick *ahocorasick;
+} Prefilter;
+
+typedef struct {
+    size_t candidates;
+    size_t confirmed;
+    size_t skipped;
+    // Off before this position; 0 while on.
+    size_t paused_until;
+} PrefilterState;
+
+// Returns NULL when the literals make no good prefilter.
+Prefilter *prefilter_build(const LiteralSeq *prefixes);
+void prefilter_free(Prefilter *pre);
+
+// Returns the first position in [at, end) where one of the literals starts
+// and fits before end, or NO_POS.
+size_t prefilter_find(const Prefilter *pre, const uint8_t *hay, size_t at, size_t end);
+
+void prefilter_state_init(PrefilterState *st);
+// Whether the prefilter is on at position at. It comes back on with a
+// fresh count once a pause is over.
+bool prefilter_active(PrefilterState *st, size_t at);
+// Counts a candidate at `to` found by a scan from `from`, and pauses the
+// prefilter from `to` on if it is not paying.
+void prefilter_record(PrefilterState *st, size_t from, size_t to);
+
+// How common a byte is, from 0 for the rarest to 255 for the most common.
+uint8_t prefilter_rank(uint8_t byte);
+void prefilter_print(const Prefilter *pre);
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "hir.h"
+
+/*
+ * Thompson NFA program. Instructions consume at most one byte, so every
+ * engine (backtracker, Pike VM, DFA) walks the same representation.
+ *
+ * Counted repetitions whose unrolled form would be large compile to a
+ * counter loop instead: CINIT zeroes counter `arg`, CLOOP continues into
+ * the body (out) while the count is below max and leaves (out1) once it
+ * has reached min, and CINC at the end of the body bumps the count. The
+ * body's instructions occupy one contiguous pc range, so a thread's count
+ * only matters while its pc lies in that range. Only the Pike VM and the
+ * counting-set matcher run programs with counters.
+ *
+ * LOOK consumes nothing and continues to out only where assertion `arg`
+ * holds.
+ *
+ * A program marked longest asks for POSIX leftmost-longest matches: of
+ * the matches that start leftmost, the one that ends last. Groups are
+ * those of the highest-priority path to that match.
+ */
+
+#define PROG_MAX_INSTS (1U << 20)
+// Repetitions with a larger bound, or whose unrolled form would exceed
+// PROG_MAX_UNROLL instructions, are compiled to counters. Below the bound
+// the DFA is usually faster on the unrolled form.
+#define PROG_MAX_REPEAT 100
+#define PROG_MAX_UNROLL (1 << 16)
+#define NO_COUNTER UINT32_MAX
+
+typedef enum {
+    OP_MATCH,
+    OP_BYTE,
+    OP_SPLIT,
+    OP_SAVE,
+    OP_FAIL,
+    OP_CINIT,
+    OP_CLOOP,
+    OP_CINC,
+    OP_LOOK,
+} Opcode;
+
+typedef struct {
+    Opcode op;
+    uint8_t lo;
+    uint8_t hi;
+    uint32_t out;
+    uint32_t out1;
+    uint32_t arg;
+} Inst;
+
+typedef struct {
+    uint32_t min;
+    // UINT32_MAX for an unbounded repetition, whose count saturates at min.
+    uint32_t max;
+    // The counter's pc range [first, last), from its CLOOP through the body.
+    uint32_t first;
+    uint32_t last;
+} Counter;
+
+typedef struct {
+    Inst *insts;
+    size_t length;
+    size_t capacity;
+    uint32_t start;
+    uint32_t start_unanchored;
+    size_t nslots;
+    uint8_t byte_class[256];
+    size_t nclasses;
+    bool reverse;
+    bool longest;
+    Counter *counters;
+    size_t ncounters;
+    // Counter owning each pc, or NO_COUNTER; NULL without counters.
+    uint32_t *counter_of;
+    // LOOK_BIT of every assertion the program uses.
+    uint32_t looks;
+} Prog;
+
+Prog *prog_compile(const Hir *hir, size_t capture_count, bool reverse);
+void prog_free(Prog *prog);
+void prog_print(const Prog *prog);
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "input.h"
+
+#define REGEX_DEFAULT_BACKTRACK_BUDGET (256 * 1024)
+
+/*
+ * A compiled Regex is immutable once regex_compile() returns and may be
+ * shared between threads. Everything a search writes to lives in a
+ * RegexCache the caller owns: thread lists, capture slots, the lazy DFA
+ * states and the search counters. A cache belongs to one regex and is used
+ * by one thread at a time; reused across searches it stops allocating once
+ * its buffers have grown to fit the pattern and the haystacks.
+ */
+
+typedef struct Regex Regex;
+typedef struct RegexCache RegexCache;
+
+typedef struct {
+    // Bytes the backtracker's visited bitset may use. Searches whose
+    // instruction count times haystack length exceeds it use the Pike VM.
+    size_t backtrack_budget;
+    // Bytes each lazy DFA cache may grow to before it is cleared.
+    size_t dfa_cache_size;
+    // POSIX leftmost-longest matches, as regexec() reports them, instead
+    // of leftmost-first.
+    bool longest;
+    // Check that the span of every search, [start, end), is valid UTF-8
+    // first, and fail the search where it is not. Each search checks its
+    // whole span, so a caller stepping through one haystack does better
+    // to check it once with utf8_validate() and leave this off.
+    bool utf8;
+} RegexConfig;
+
+typedef struct {
+    size_t start;
+    size_t end;
+} Match;
+
+void regex_config_init(RegexConfig *config);
+
+Regex *regex_compile(const char *pattern, const RegexConfig *config);
+void regex_free(Regex *re);
+size_t regex_capture_count(const Regex *re);
+
+RegexCache *regex_cache_new(const Regex *re);
+void regex_cache_free(RegexCache *cache);
+
+// With nslots == 0 the search only answers whether there is a match:
+// every engine stops at the first match end and records no positions.
+bool regex_search(const Regex *re, RegexCache *cache, const Input *input, size_t *slots, size_t nslots);
+bool regex_is_match(const Regex *re, RegexCache *cache, const char *haystack, size_t length);
+bool regex_find(const Regex *re, RegexCache *cache, const char *haystack, size_t length, Match *match);
+bool regex_captures(const Regex *re, RegexCache *cache, const char *haystack, size_t length, Match *groups,
+                    size_t ngroups);
+// Where the span of the last search stopped being valid UTF-8, in UTF-8
+// mode, or NO_POS.
+size_t regex_invalid_utf8(const RegexCache *cache);
+
+// Prints the analysis and, given a cache, which engines its searches used.
+void regex_print_strategy(const Regex *re, const RegexCache *cache);
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "cpu.h"
+#include "glushkov.h"
+#include "input.h"
+
+/*
+ * Bit-parallel simulation of the Glushkov automaton. The set of active
+ * positions is one bit vector; a byte step is D' = follow(D) & B[class].
+ *
+ * Up to 64 positions, follow(D) is the union of eight lookup tables
+ * indexed by the bytes of D. Up to 256 positions, it is a shift for the
+ * p -> p + 1 edges plus a per-position table for the remaining edges,
+ * evaluated four words at a time (with AVX2 when the CPU has it).
+ */
+
+#define SHIFTAND_WORD_POSITIONS 64
+#define SHIFTAND_MAX_POSITIONS 256
+
+typedef struct ShiftAnd {
+    size_t npos;
+    size_t nwords;
+    bool nullable;
+    // The search variant and the level it was picked for.
+    bool (*search)(const struct ShiftAnd *sa, const Input *input, size_t *end);
+    CpuLevel level;
+    uint8_t byte_class[256];
+    size_t nclasses;
+    uint64_t (*masks)[4];
+    uint64_t first[4];
+    uint64_t last[4];
+    uint64_t consec[4];
+    uint64_t exc_src[4];
+    uint64_t (*exc_follow)[4];
+    uint64_t (*tables)[256];
+} ShiftAnd;
+
+ShiftAnd *shiftand_build(const Hir *hir);
+void shiftand_free(ShiftAnd *sa);
+// Picks the search variant for level, or for the CPU's if that is lower.
+// Building picks the CPU's; only the four-word search has a vector one.
+void shiftand_select(ShiftAnd *sa, CpuLevel level);
+
+bool shiftand_search(const ShiftAnd *sa, const Input *input, size_t *end);
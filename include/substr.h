@@ -0,0 +1,27 @@
+#pragma once
+
+#include "input.h"
+#include "packedpair.h"
+
+/*
+ * Substring search for patterns that are one string, optionally matched
+ * without regard to ASCII case. Such patterns need no automaton: needles
+ * of two bytes or more go to the packed-pair searcher, a single byte to
+ * memchr, and the empty string matches wherever a search starts.
+ */
+
+typedef struct {
+    // Lower-cased when caseless.
+    uint8_t *needle;
+    size_t len;
+    bool caseless;
+    PackedPair *pair;
+} Substr;
+
+Substr *substr_build(const uint8_t *needle, size_t len, bool caseless);
+void substr_free(Substr *s);
+
+// Finds the first occurrence in haystack[start, end), or with anchored
+// only one at start. Every occurrence is as long as the needle, so
+// earliest changes nothing.
+bool substr_search(const Substr *s, const Input *input, size_t *start);
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "cpu.h"
+#include "literal.h"
+
+/*
+ * Teddy multi-literal search. Every literal is put in one of eight
+ * buckets, and each of the literals' first one to three bytes gets a pair
+ * of 16-entry tables, indexed by the low and the high nibble of a byte,
+ * whose entries hold the buckets with a literal that has such a nibble
+ * there. A pshufb per table looks up 16 haystack bytes at once (32 with
+ * AVX2, 64 with AVX-512), and ANDing the lookups for every nibble of
+ * every leading byte leaves, per position, the buckets whose literals may
+ * start there. Only those literals are then compared in full.
+ *
+ * Only the shuffles make the tables pay, so on a CPU without SSSE3 no
+ * Teddy is built. A scalar variant doing the lookups one position at a
+ * time remains, for the tail of a haystack and for a Teddy selected below
+ * SSSE3 on purpose, as when comparing levels.
+ */
+
+#define TEDDY_BUCKETS 8
+#define TEDDY_MAX_MASKS 3
+
+typedef struct Teddy {
+    // Literals grouped by bucket: bucket b holds lits[first[b]] up to
+    // lits[first[b + 1]].
+    Literal *lits;
+    size_t first[TEDDY_BUCKETS + 1];
+    // Leading bytes looked up, the shortest literal's length at most.
+    size_t nmasks;
+    uint8_t lo[TEDDY_MAX_MASKS][16];
+    uint8_t hi[TEDDY_MAX_MASKS][16];
+    // The search variant and the level it was picked for.
+    size_t (*find)(const struct Teddy *t, const uint8_t *hay, size_t at, size_t end);
+    CpuLevel level;
+} Teddy;
+
+// Returns NULL when the CPU lacks SSSE3 or a literal is empty.
+Teddy *teddy_build(const LiteralSeq *seq);
+void teddy_free(Teddy *t);
+// Picks the search variant for level, or for the CPU's if that is lower.
+// Building picks the CPU's; a level below SSSE3 picks the scalar variant.
+void teddy_select(Teddy *t, CpuLevel level);
+
+// Returns the first position in [at, end) where one of the literals starts
+// and fits before end, or NO_POS.
+size_t teddy_find(const Teddy *t, const uint8_t *hay, size_t at, size_t end);
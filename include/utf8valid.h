@@ -0,0 +1,30 @@
+#pragma once
+
+#include "cpu.h"
+#include "input.h"
+
+/*
+ * UTF-8 validation, many bytes at a time. Most errors show in a pair of
+ * adjacent bytes, and three 16-entry tables, indexed by the high and low
+ * nibble of the first byte and the high nibble of the second, each map to
+ * the set of errors that nibble allows; a pshufb per table looks them up
+ * for 16 pairs at once (32 with AVX2), and an error is any bit left in
+ * all three. The one rule the tables cannot see, that the second and
+ * third byte after a three- or four-byte lead are continuations too,
+ * comes from comparing the bytes two and three back. Blocks of ASCII
+ * skip all of it. This is the lookup scheme of Keiser and Lemire.
+ *
+ * A block with an error only says that there is one, so the search for
+ * its offset goes on a byte at a time from the last sequence boundary
+ * before the block. Without SSSE3 the whole check goes that way, eight
+ * ASCII bytes at a time.
+ *
+ * Valid means well-formed as the standard has it: no overlong forms, no
+ * surrogates and nothing past U+10FFFF.
+ */
+
+// Returns the offset of the first sequence in s[0, len) that is not valid
+// UTF-8, cut short included, or NO_POS when there is none.
+size_t utf8_validate(const uint8_t *s, size_t len);
+// The same with the kernel for level, or for the CPU's if that is lower.
+size_t utf8_validate_level(const uint8_t *s, size_t len, CpuLevel level);
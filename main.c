@@ -1,6 +1,13 @@
 #include <stdio.h>
 #include <assert.h>
+#include "deriv.h"
+#include "dfa.h"
 #include "lexer.h"
+#include "literal.h"
+#include "pikevm.h"
+#include "posnfa.h"
+#include "regex.h"
+#include "shiftand.h"
 
 int is_valid_regex(const char *pattern) {
     Node *result = build_syntax_tree(pattern);
@@ -13,6 +20,385 @@ int is_valid_regex(const char *pattern) {
     return 1;
 }
 
+int finds_match(const char *pattern, const char *haystack, const size_t start, const size_t end) {
+    Regex *re = regex_compile(pattern, NULL);
+    if (!re) {
+        return 0;
+    }
+    RegexCache *cache = regex_cache_new(re);
+
+    Match m;
+    const bool found = regex_find(re, cache, haystack, strlen(haystack), &m);
+    const bool any = regex_is_match(re, cache, haystack, strlen(haystack));
+    regex_cache_free(cache);
+    regex_free(re);
+    return found && any && m.start == start && m.end == end;
+}
+
+// In UTF-8 mode, where the haystack is invalid, or NO_POS when the pattern
+// matches it.
+int checks_utf8(const char *pattern, const char *haystack, const size_t invalid) {
+    RegexConfig config;
+    regex_config_init(&config);
+    config.utf8 = true;
+    Regex *re = regex_compile(pattern, &config);
+    if (!re) {
+        return 0;
+    }
+    RegexCache *cache = regex_cache_new(re);
+
+    Match m;
+    const bool found = regex_find(re, cache, haystack, strlen(haystack), &m);
+    const size_t at = regex_invalid_utf8(cache);
+    regex_cache_free(cache);
+    regex_free(re);
+    return found == (invalid == NO_POS) && at == invalid;
+}
+
+int finds_longest(const char *pattern, const char *haystack, const size_t start, const size_t end) {
+    RegexConfig config;
+    regex_config_init(&config);
+    config.longest = true;
+    Regex *re = regex_compile(pattern, &config);
+    if (!re) {
+        return 0;
+    }
+    RegexCache *cache = regex_cache_new(re);
+
+    Match m;
+    const bool found = regex_find(re, cache, haystack, strlen(haystack), &m);
+    regex_cache_free(cache);
+    regex_free(re);
+    return found && m.start == start && m.end == end;
+}
+
+int extracts_anchored(const char *pattern, const char *haystack, const size_t *expected, const size_t nslots) {
+    Regex *re = regex_compile(pattern, NULL);
+    if (!re) {
+        return 0;
+    }
+    RegexCache *cache = regex_cache_new(re);
+
+    Input input;
+    size_t slots[16];
+    input_init(&input, haystack, strlen(haystack));
+    input.anchored = true;
+    const bool found = regex_search(re, cache, &input, slots, nslots);
+    regex_cache_free(cache);
+    regex_free(re);
+    return found && memcmp(slots, expected, nslots * sizeof(size_t)) == 0;
+}
+
+int matches_without(const char *pattern, const char *without, const char *haystack) {
+    Deriv *d = deriv_new();
+    const uint32_t t = deriv_and(d, deriv_parse(d, pattern), deriv_not(d, deriv_parse(d, without)));
+
+    Input input;
+    size_t end;
+    input_init(&input, haystack, strlen(haystack));
+    input.anchored = true;
+    const bool found = deriv_search(d, t, &input, &end) == DERIV_MATCH && end == input.end;
+    deriv_free(d);
+    return found;
+}
+
+// Compares a literal set with its literals joined by '|', "" meaning none.
+int literals_are(const LiteralSeq *seq, const char *expected) {
+    char joined[256] = "";
+    size_t n = 0;
+    for (size_t i = 0; i < seq->count && n + seq->lits[i].len + 1 < sizeof(joined); i++) {
+        if (i > 0) {
+            joined[n++] = '|';
+        }
+        memcpy(joined + n, seq->lits[i].bytes, seq->lits[i].len);
+        n += seq->lits[i].len;
+    }
+    joined[n] = '\0';
+    return strcmp(joined, expected) == 0;
+}
+
+Hir *parse_hir(const char *pattern, size_t *capture_count) {
+    Node *ast = build_syntax_tree(pattern);
+    Hir *hir = ast ? hir_from_ast(ast, capture_count) : NULL;
+    free_node(ast);
+    return hir;
+}
+
+int extracts_literals(const char *pattern, const char *prefixes, const char *suffixes, const char *inner) {
+    size_t capture_count;
+    Hir *hir = parse_hir(pattern, &capture_count);
+    Literals *literals = hir ? literals_extract(hir) : NULL;
+    hir_free(hir);
+    if (!literals) {
+        return 0;
+    }
+
+    const int found = literals_are(&literals->prefixes, prefixes) && literals_are(&literals->suffixes, suffixes) &&
+                      literals_are(&literals->inner, inner);
+    literals_free(literals);
+    return found;
+}
+
+// Where the Pike VM's earliest match ends, or NO_POS.
+size_t pikevm_earliest(const Prog *prog, const char *haystack) {
+    PikeCache cache;
+    if (!pikevm_cache_init(&cache, prog)) {
+        return NO_POS;
+    }
+    Input input;
+    size_t slots[2];
+    input_init(&input, haystack, strlen(haystack));
+    input.earliest = true;
+    const bool found = pikevm_search(prog, &cache, &input, slots, 2);
+    pikevm_cache_free(&cache);
+    return found ? slots[1] : NO_POS;
+}
+
+// Shift-and, where the pattern fits it, and the Glushkov simulation must
+// both agree with the Pike VM on where the earliest match ends.
+int glushkov_agrees(const char *pattern, const char *haystack, const bool fits_shiftand) {
+    size_t capture_count;
+    Hir *hir = parse_hir(pattern, &capture_count);
+    if (!hir) {
+        return 0;
+    }
+    Prog *prog = prog_compile(hir, capture_count, false);
+    ShiftAnd *sa = shiftand_build(hir);
+    PosNfa *nfa = posnfa_build(hir);
+    hir_free(hir);
+    PosNfaCache cache;
+    if (!prog || !nfa || (sa != NULL) != fits_shiftand || !posnfa_cache_init(&cache, nfa)) {
+        prog_free(prog);
+        shiftand_free(sa);
+        posnfa_free(nfa);
+        return 0;
+    }
+
+    const size_t expected = pikevm_earliest(prog, haystack);
+    Input input;
+    size_t end = NO_POS;
+    input_init(&input, haystack, strlen(haystack));
+    int agrees = posnfa_search(nfa, &cache, &input, &end) == (expected != NO_POS) &&
+                 (expected == NO_POS || end == expected);
+    if (sa) {
+        end = NO_POS;
+        agrees &= shiftand_search(sa, &input, &end) == (expected != NO_POS) && (expected == NO_POS || end == expected);
+    }
+    posnfa_cache_free(&cache);
+    posnfa_free(nfa);
+    shiftand_free(sa);
+    prog_free(prog);
+    return agrees;
+}
+
+// A pattern compiled to counter loops must match like the Pike VM, run
+// over the whole haystack, in regex_is_match, regex_find and
+// regex_captures alike.
+int counters_agree(const char *pattern, const char *haystack) {
+    size_t capture_count;
+    Hir *hir = parse_hir(pattern, &capture_count);
+    Prog *prog = hir ? prog_compile(hir, capture_count, false) : NULL;
+    hir_free(hir);
+    Regex *re = regex_compile(pattern, NULL);
+    RegexCache *cache = re ? regex_cache_new(re) : NULL;
+    PikeCache pike;
+    if (!prog || prog->ncounters == 0 || capture_count >= 8 || !cache || !pikevm_cache_init(&pike, prog)) {
+        prog_free(prog);
+        regex_cache_free(cache);
+        regex_free(re);
+        return 0;
+    }
+
+    const size_t length = strlen(haystack);
+    Input input;
+    size_t expected[16];
+    input_init(&input, haystack, length);
+    const bool found = pikevm_search(prog, &pike, &input, expected, 2 * (capture_count + 1));
+    Match m, groups[8];
+    int agrees = regex_is_match(re, cache, haystack, length) == found &&
+                 regex_find(re, cache, haystack, length, &m) == found &&
+                 regex_captures(re, cache, haystack, length, groups, capture_count + 1) == found;
+    agrees &= !found || (m.start == expected[0] && m.end == expected[1]);
+    for (size_t i = 0; agrees && found && i <= capture_count; i++) {
+        agrees = groups[i].start == expected[2 * i] && groups[i].end == expected[2 * i + 1];
+    }
+    pikevm_cache_free(&pike);
+    prog_free(prog);
+    regex_cache_free(cache);
+    regex_free(re);
+    return agrees;
+}
+
+// The forward DFA must find where the match ends and the reverse DFA,
+// run back from there, where it starts, both jumping over at least one
+// run of an accelerated state.
+int accelerates(const char *pattern, const char *haystack, const size_t start, const size_t end) {
+    size_t capture_count;
+    Hir *hir = parse_hir(pattern, &capture_count);
+    Hir *reversed = hir ? hir_reverse(hir) : NULL;
+    Prog *prog = hir ? prog_compile(hir, capture_count, false) : NULL;
+    Prog *rprog = reversed ? prog_compile(reversed, 0, true) : NULL;
+    hir_free(hir);
+    hir_free(reversed);
+    Dfa *dfa = prog ? dfa_build(prog, false) : NULL;
+    Dfa *rdfa = rprog ? dfa_build(rprog, true) : NULL;
+    DfaCache cache, rcache;
+    if (!dfa || !rdfa || !dfa_cache_init(&cache, dfa, DFA_DEFAULT_CACHE_SIZE)) {
+        dfa_free(dfa);
+        dfa_free(rdfa);
+        prog_free(prog);
+        prog_free(rprog);
+        return 0;
+    }
+    if (!dfa_cache_init(&rcache, rdfa, DFA_DEFAULT_CACHE_SIZE)) {
+        dfa_cache_free(&cache);
+        dfa_free(dfa);
+        dfa_free(rdfa);
+        prog_free(prog);
+        prog_free(rprog);
+        return 0;
+    }
+
+    Input input;
+    size_t found_end = NO_POS, found_start = NO_POS;
+    input_init(&input, haystack, strlen(haystack));
+    int agrees = dfa_search_fwd(dfa, &cache, &input, &found_end) == DFA_MATCH && found_end == end;
+    input.end = end;
+    input.anchored = true;
+    agrees &= dfa_search_rev(rdfa, &rcache, &input, &found_start) == DFA_MATCH && found_start == start;
+    agrees &= cache.accel_jumps > 0 && rcache.accel_jumps > 0;
+    dfa_cache_free(&cache);
+    dfa_cache_free(&rcache);
+    dfa_free(dfa);
+    dfa_free(rdfa);
+    prog_free(prog);
+    prog_free(rprog);
+    return agrees;
+}
+
+// Every level up to the CPU's must find what the scalar variant finds,
+// from every start: the needle scans both ways, packed pair, Teddy and
+// shift-and.
+int variants_agree(void) {
+    uint8_t hay[512];
+    uint32_t seed = 1;
+    for (size_t i = 0; i < sizeof(hay); i++) {
+        seed = seed * 1103515245 + 12345;
+        hay[i] = (uint8_t) "abcdefgh;\xc3\xa9 "[(seed >> 16) % 12];
+    }
+    memcpy(hay + 100, "abc12345678901234567890123456789012", 35);
+    memcpy(hay + 300, "NeedLe", 6);
+    memcpy(hay + 450, "quux", 4);
+    memcpy(hay + 505, "needle", 6);
+    const size_t n = sizeof(hay);
+    Input input;
+    input_init(&input, (const char *) hay, n);
+
+    const struct {
+        const char *needles;
+        bool high;
+    } scans[] = {
+            {"", true}, {";", false}, {";", true}, {"e;", false}, {"hq ", true}, {"xyz", false}, {"", false},
+    };
+    PackedPair *pair = packed_pair_build((const uint8_t *) "needle", 6);
+    PackedPair *caseless = packed_pair_build_caseless((const uint8_t *) "needle", 6);
+    size_t capture_count;
+    Hir *words = parse_hir("needle|quux|zzyzx", &capture_count);
+    Literals *literals = words ? literals_extract(words) : NULL;
+    Teddy *teddy = literals ? teddy_build(&literals->prefixes) : NULL;
+    Hir *digits = parse_hir("[a-h]{3,8}[0-9]{30,90}", &capture_count);
+    ShiftAnd *sa = digits ? shiftand_build(digits) : NULL;
+    int agrees = pair && caseless && literals && sa;
+
+    for (CpuLevel level = CPU_SSE2; agrees && level <= cpu_level(); level++) {
+        for (size_t c = 0; c < sizeof(scans) / sizeof(scans[0]); c++) {
+            const uint8_t *needles = (const uint8_t *) scans[c].needles;
+            const size_t count = strlen(scans[c].needles);
+            NeedleScan scalar, vector;
+            needles_select(&scalar, CPU_SCALAR);
+            needles_select(&vector, level);
+            for (size_t at = 0; at <= n; at++) {
+                agrees &= needles_find(&vector, needles, count, scans[c].high, hay, at, n) ==
+                          needles_find(&scalar, needles, count, scans[c].high, hay, at, n);
+                agrees &= needles_rfind(&vector, needles, count, scans[c].high, hay, at / 3, at) ==
+                          needles_rfind(&scalar, needles, count, scans[c].high, hay, at / 3, at);
+            }
+        }
+        for (size_t at = 0; at <= n; at++) {
+            packed_pair_select(pair, CPU_SCALAR);
+            packed_pair_select(caseless, CPU_SCALAR);
+            const size_t pair_found = packed_pair_find(pair, hay, at, n);
+            const size_t caseless_found = packed_pair_find(caseless, hay, at, n);
+            packed_pair_select(pair, level);
+            packed_pair_select(caseless, level);
+            agrees &= packed_pair_find(pair, hay, at, n) == pair_found &&
+                      packed_pair_find(caseless, hay, at, n) == caseless_found;
+            if (teddy) {
+                teddy_select(teddy, CPU_SCALAR);
+                const size_t found = teddy_find(teddy, hay, at, n);
+                teddy_select(teddy, level);
+                agrees &= teddy_find(teddy, hay, at, n) == found;
+            }
+            size_t end = NO_POS, vector_end = NO_POS;
+            input.start = at;
+            shiftand_select(sa, CPU_SCALAR);
+            const bool found = shiftand_search(sa, &input, &end);
+            shiftand_select(sa, level);
+            agrees &= shiftand_search(sa, &input, &vector_end) == found && vector_end == end;
+        }
+    }
+    shiftand_free(sa);
+    hir_free(digits);
+    teddy_free(teddy);
+    literals_free(literals);
+    hir_free(words);
+    packed_pair_free(caseless);
+    packed_pair_free(pair);
+    return agrees;
+}
+
+// On a haystack of unit repeated count times, dense with candidates that
+// come to nothing, the DFA must pause its prefilter and still find the
+// match written at `at`, wherever that falls from the pause on.
+int pauses_prefilter(const char *pattern, const char *unit, const size_t count, const size_t at, const char *match) {
+    const size_t length = strlen(unit) * count;
+    char *haystack = malloc(length + 1);
+    size_t capture_count;
+    Hir *hir = parse_hir(pattern, &capture_count);
+    Literals *literals = hir ? literals_extract(hir) : NULL;
+    Prefilter *pre = literals ? prefilter_build(&literals->prefixes) : NULL;
+    Prog *prog = hir ? prog_compile(hir, capture_count, false) : NULL;
+    hir_free(hir);
+    literals_free(literals);
+    Dfa *dfa = prog ? dfa_build(prog, false) : NULL;
+    DfaCache cache;
+    if (!haystack || !pre || !dfa || !dfa_cache_init(&cache, dfa, DFA_DEFAULT_CACHE_SIZE)) {
+        free(haystack);
+        prefilter_free(pre);
+        dfa_free(dfa);
+        prog_free(prog);
+        return 0;
+    }
+    for (size_t i = 0; i < count; i++) {
+        memcpy(haystack + i * strlen(unit), unit, strlen(unit));
+    }
+    memcpy(haystack + at, match, strlen(match));
+    haystack[length] = '\0';
+
+    Input input;
+    size_t end = NO_POS;
+    input_init(&input, haystack, length);
+    dfa->prefilter = pre;
+    const bool found = dfa_search_fwd(dfa, &cache, &input, &end) == DFA_MATCH;
+    const int agrees = found && end == at + strlen(match) && cache.prefilter_pauses > 0 && cache.prefilter_jumps > 0;
+    dfa_cache_free(&cache);
+    dfa_free(dfa);
+    prog_free(prog);
+    prefilter_free(pre);
+    free(haystack);
+    return agrees;
+}
+
 int main() {
     const char *valid_patterns[] = {
             "a*|b+|c?",
@@ -27,6 +413,8 @@ int main() {
             "\\w+\\S",
             "\\x{0041}",
             "[a-z]{,5}",
+            "^a|b$",
+            "\\bword\\B",
     };
 
     const char *invalid_patterns[] = {
@@ -42,6 +430,242 @@ int main() {
         printf("Pattern '%s' is valid.\n", pattern);
     }
 
+    const struct {
+        const char *pattern;
+        const char *haystack;
+        size_t start;
+        size_t end;
+    } match_cases[] = {
+            {"(ab|cd)*", "cdabx", 0, 4},
+            {"a{2,4}", "caaaaa", 1, 5},
+            {"\\d{3}-\\d+", "tel 123-4567", 4, 12},
+            {"[a-z]{3,}", "AB abcd", 3, 7},
+            {".*abc", "xxabcabc", 0, 8},
+            {"\\x{0041}", "xA", 1, 2},
+            {"((a))b", "aab", 1, 3},
+            {"^ab|b", "xab", 2, 3},
+            {"a+$", "aabaa", 3, 5},
+            {"\\bcat\\b", "concat cat", 7, 10},
+            {"\\Bcat", "cat concat", 7, 10},
+            {"\\b\\w+\\b", "..été..", 2, 7},
+            {"\\bx", "éx x", 4, 5},
+            {"\\B", "éé", 2, 2},
+            {"foo|foobar|fox", "a foobar", 2, 5},
+            {"fox|foobar|foo", "a foobar", 2, 8},
+            {"(cat|car|cart)s", "carts", 0, 5},
+            {"took [0-9]+ms", "it took 15ms", 3, 12},
+            {"(alpha|bravo|charlie) team", "bravo alpha team", 6, 16},
+            {"[a-d][e-h][0-7]z|bg", "xx bg5z", 3, 7},
+            {"a\\.b", "axb a.b", 4, 7},
+            {"[Hh][Ee][Ll][Ll][Oo]", "say HeLLo", 4, 9},
+            {"[Hh]ello", "HELLO Hello", 6, 11},
+            {"[Hh][Ee]llo", "say HELLO hello", 10, 15},
+            {"a[Xx]", "AX aX", 3, 5},
+            {"\\w+@example\\.com", "mail bob@example.org, bob@example.com", 22, 37},
+    };
+
+    for (size_t i = 0; i < sizeof(match_cases) / sizeof(match_cases[0]); i++) {
+        const char *pattern = match_cases[i].pattern;
+        assert(finds_match(pattern, match_cases[i].haystack, match_cases[i].start, match_cases[i].end) == 1);
+        printf("Pattern '%s' matches '%s'.\n", pattern, match_cases[i].haystack);
+    }
+
+    const struct {
+        const char *pattern;
+        const char *haystack;
+        size_t start;
+        size_t end;
+    } longest_cases[] = {
+            {"a|ab", "xabc", 1, 3},
+            {"(a|ab)(c|bcd)", "abcd", 0, 4},
+            {"[0-9]+|[0-9]+-[0-9]+", "tel 555-1234", 4, 12},
+            {"bg|[a-d][e-h][0-7]z", "xx bg5z", 3, 7},
+    };
+
+    for (size_t i = 0; i < sizeof(longest_cases) / sizeof(longest_cases[0]); i++) {
+        const char *pattern = longest_cases[i].pattern;
+        assert(finds_longest(pattern, longest_cases[i].haystack, longest_cases[i].start, longest_cases[i].end) == 1);
+        printf("Pattern '%s' matches '%s' leftmost-longest.\n", pattern, longest_cases[i].haystack);
+    }
+
+    const struct {
+        const char *pattern;
+        const char *haystack;
+        size_t invalid;
+    } utf8_cases[] = {
+            {"\\w+é", "un café", NO_POS},
+            {"x", "\xC3" "x", 0},
+            {"b", "ab\xED\xA0\x80" "b", 2},
+            {"é", "0123456789abcdefghijklmnopqrstuvwxyzé\xE2\x82", 38},
+    };
+
+    for (size_t i = 0; i < sizeof(utf8_cases) / sizeof(utf8_cases[0]); i++) {
+        assert(checks_utf8(utf8_cases[i].pattern, utf8_cases[i].haystack, utf8_cases[i].invalid) == 1);
+        printf("Pattern '%s' %s in UTF-8 mode.\n", utf8_cases[i].pattern,
+               utf8_cases[i].invalid == NO_POS ? "matches valid text" : "rejects invalid text");
+    }
+
+    const struct {
+        const char *pattern;
+        const char *without;
+        const char *haystack;
+        int expected;
+    } without_cases[] = {
+            {"[a-z]+", ".*ab.*", "xba", 1},
+            {"[a-z]+", ".*ab.*", "xaby", 0},
+            {"\\d{3}-\\d{4}", "555-.*", "556-1234", 1},
+            {"\\d{3}-\\d{4}", "555-.*", "555-1234", 0},
+    };
+
+    for (size_t i = 0; i < sizeof(without_cases) / sizeof(without_cases[0]); i++) {
+        assert(matches_without(without_cases[i].pattern, without_cases[i].without, without_cases[i].haystack) ==
+               without_cases[i].expected);
+        printf("Pattern '%s' without '%s' %s '%s'.\n", without_cases[i].pattern, without_cases[i].without,
+               without_cases[i].expected ? "matches" : "rejects", without_cases[i].haystack);
+    }
+
+    const struct {
+        const char *pattern;
+        const char *prefixes;
+        const char *suffixes;
+        const char *inner;
+    } literal_cases[] = {
+            {"[ab]c", "ac|bc", "ac|bc", "ac|bc"},
+            {"ab?c", "abc|ac", "abc|ac", "abc|ac"},
+            {"(foo|bar)\\d+baz", "bar|foo", "baz", "baz"},
+            {"[a-z]+(foo|bar)[0-9]", "", "", "bar|foo"},
+            {"a|b|c|d", "", "", ""},
+    };
+
+    for (size_t i = 0; i < sizeof(literal_cases) / sizeof(literal_cases[0]); i++) {
+        assert(extracts_literals(literal_cases[i].pattern, literal_cases[i].prefixes, literal_cases[i].suffixes,
+                                 literal_cases[i].inner) == 1);
+        printf("Pattern '%s' has literals '%s', '%s', '%s'.\n", literal_cases[i].pattern, literal_cases[i].prefixes,
+               literal_cases[i].suffixes, literal_cases[i].inner);
+    }
+
+    const struct {
+        const char *pattern;
+        const char *haystack;
+        bool fits_shiftand;
+    } glushkov_cases[] = {
+            {"abc", "xxabcx", true},
+            {"a(b|c)*d", "xabcbcbd", true},
+            {"[a-c]+x|yz", "ccyaz yz", true},
+            {"a?b?", "", true},
+            {"(ab|cd){3}e", "abcdabcdcde", true},
+            {"(ab|ba){40}x", "abab", true},
+            {"(a|ab)(c|bcd){30}", "xabbcdbcdbcdcccccccccccccccccccccccccccbcd", true},
+            {"(ab|ba){40}x", "baabababababababababababababababababababababababababababababababababababababababx", true},
+            {"([a-f][0-9]){150}|b+c", "a1b2c3 abbc", false},
+            {"[a-z]{300}!|(wo|r)+d!", "a word!", false},
+    };
+
+    for (size_t i = 0; i < sizeof(glushkov_cases) / sizeof(glushkov_cases[0]); i++) {
+        assert(glushkov_agrees(glushkov_cases[i].pattern, glushkov_cases[i].haystack,
+                               glushkov_cases[i].fits_shiftand) == 1);
+        printf("Pattern '%s' matches '%s' like the Pike VM without epsilon moves.\n", glushkov_cases[i].pattern,
+               glushkov_cases[i].haystack);
+    }
+
+    // Haystacks are prefix, then unit repeated count times, then suffix.
+    const struct {
+        const char *pattern;
+        const char *prefix;
+        const char *unit;
+        size_t count;
+        const char *suffix;
+    } counter_cases[] = {
+            {"x[ab]{0,150}y", "zx", "", 0, "y"},
+            {"x[ab]{0,150}y", "x", "ab", 75, "y"},
+            {"x[ab]{0,150}y", "x", "a", 151, "y"},
+            {"a{105,110}", "b", "a", 120, ""},
+            {"a{105,110}", "", "a", 104, "b"},
+            {"^a{150}$", "", "a", 150, ""},
+            {"^a{150}$", "", "a", 151, ""},
+            {"[ab]{120,200}c", "cc", "ab", 80, "c"},
+            {"[ab]{101,150}b", "", "ab", 110, "b"},
+            {"a[bc]{0,150}d|c", "x", "abc", 1, "d"},
+            {"([a-z]{101,300}) (\\d+)", "1 ", "qz", 60, " 42!"},
+            {"[^,]{1,5000},", "", "hello ", 40, ","},
+            {"\\b\\w{101,}\\b", "a-", "w", 130, " end"},
+    };
+
+    for (size_t i = 0; i < sizeof(counter_cases) / sizeof(counter_cases[0]); i++) {
+        char haystack[4096];
+        size_t n = strlen(counter_cases[i].prefix);
+        memcpy(haystack, counter_cases[i].prefix, n);
+        for (size_t k = 0; k < counter_cases[i].count; k++) {
+            memcpy(haystack + n, counter_cases[i].unit, strlen(counter_cases[i].unit));
+            n += strlen(counter_cases[i].unit);
+        }
+        strcpy(haystack + n, counter_cases[i].suffix);
+        assert(counters_agree(counter_cases[i].pattern, haystack) == 1);
+        printf("Pattern '%s' matches '%s' + %zu x '%s' + '%s' like the Pike VM.\n", counter_cases[i].pattern,
+               counter_cases[i].prefix, counter_cases[i].count, counter_cases[i].unit, counter_cases[i].suffix);
+    }
+
+    // Haystacks are prefix, then unit repeated count times, then suffix.
+    const struct {
+        const char *pattern;
+        const char *prefix;
+        const char *unit;
+        size_t count;
+        const char *suffix;
+        size_t start;
+        size_t end;
+    } accel_cases[] = {
+            {"a[^xy]*x", "--a", "b", 61, "x--", 2, 65},
+            {"a[^xy]*x", "--a", "b", 61, "x", 2, 65},
+            {"a[^xy]*[xy]", "a", "bc", 40, "y", 0, 82},
+            {"q[^;]*;", "q", "abcdefghij\xc3\xa9", 12, ";", 0, 146},
+            {"a[^b]*", "-a", "c", 70, "", 1, 72},
+    };
+
+    for (size_t i = 0; i < sizeof(accel_cases) / sizeof(accel_cases[0]); i++) {
+        char haystack[4096];
+        size_t n = strlen(accel_cases[i].prefix);
+        memcpy(haystack, accel_cases[i].prefix, n);
+        for (size_t k = 0; k < accel_cases[i].count; k++) {
+            memcpy(haystack + n, accel_cases[i].unit, strlen(accel_cases[i].unit));
+            n += strlen(accel_cases[i].unit);
+        }
+        strcpy(haystack + n, accel_cases[i].suffix);
+        assert(accelerates(accel_cases[i].pattern, haystack, accel_cases[i].start, accel_cases[i].end) == 1);
+        printf("Pattern '%s' matches '%s' + %zu x '%s' + '%s' over accelerated states.\n", accel_cases[i].pattern,
+               accel_cases[i].prefix, accel_cases[i].count, accel_cases[i].unit, accel_cases[i].suffix);
+    }
+
+    // The pause starts after PREFILTER_MIN_CANDIDATES candidates and lasts
+    // PREFILTER_PAUSE bytes; the match is written inside it, right at its
+    // end and after the prefilter has come back on.
+    const struct {
+        const char *pattern;
+        const char *unit;
+        size_t count;
+        size_t at;
+        const char *match;
+    } pause_cases[] = {
+            {"zq[0-9]+!", "zqx ", 20000, 1000, "zq12!"},
+            {"zq[0-9]+!", "zqx ", 20000, 66000, "zq12!"},
+            {"zq[0-9]+!", "zqx ", 40000, 150000, "zq12!"},
+            {"(zq|jx|vk)[0-9]+!", "vk- jx- ", 20000, 120001, "jx9!"},
+    };
+
+    for (size_t i = 0; i < sizeof(pause_cases) / sizeof(pause_cases[0]); i++) {
+        assert(pauses_prefilter(pause_cases[i].pattern, pause_cases[i].unit, pause_cases[i].count, pause_cases[i].at,
+                                pause_cases[i].match) == 1);
+        printf("Pattern '%s' matches '%s' at %zu in %zu x '%s' past a paused prefilter.\n", pause_cases[i].pattern,
+               pause_cases[i].match, pause_cases[i].at, pause_cases[i].count, pause_cases[i].unit);
+    }
+
+    assert(variants_agree() == 1);
+    printf("Every vector level up to %s matches the scalar variants.\n", cpu_level_name(cpu_level()));
+
+    const size_t field_slots[] = {0, 8, 0, 3, 4, 8};
+    assert(extracts_anchored("(\\d{3})-(\\d+)", "555-1234 rest", field_slots, 6) == 1);
+    printf("Pattern '(\\d{3})-(\\d+)' extracts fields.\n");
+
     for (size_t i = 0; i < sizeof(invalid_patterns) / sizeof(invalid_patterns[0]); i++) {
         const char *pattern = invalid_patterns[i];
         assert(is_valid_regex(pattern) == 0);
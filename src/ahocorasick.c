@@ -0,0 +1,489 @@
+#include <stdio.h>
+#include "ahocorasick.h"
+
+#define NONE UINT32_MAX
+
+// Fields of a contiguous NFA state, and of a DFA state's info.
+#define NFA_FAIL 0
+#define NFA_DEPTH 1
+#define NFA_PATTERN 2
+#define NFA_OUT 3
+#define NFA_NTRANS 4
+#define NFA_HEADER 5
+#define INFO_DEPTH 0
+#define INFO_PATTERN 1
+#define INFO_OUT 2
+
+// The trie both representations are built from. Each node's children
+// are a linked list of edges.
+typedef struct {
+    uint32_t *depth;
+    uint32_t *pattern;
+    uint32_t *fail;
+    uint32_t *out;
+    uint32_t *edges;
+    size_t count;
+    size_t capacity;
+    uint8_t *edge_byte;
+    uint32_t *edge_next;
+    uint32_t *edge_sibling;
+    size_t nedges;
+    size_t edges_capacity;
+    // Nodes in breadth-first order, parents before children and every
+    // node after the target of its failure link.
+    uint32_t *order;
+    uint32_t root[256];
+} Trie;
+
+static void trie_free(Trie *t) {
+    free(t->depth);
+    free(t->pattern);
+    free(t->fail);
+    free(t->out);
+    free(t->edges);
+    free(t->edge_byte);
+    free(t->edge_next);
+    free(t->edge_sibling);
+    free(t->order);
+}
+
+static uint32_t trie_child(const Trie *t, const uint32_t node, const uint8_t b) {
+    if (node == 0) {
+        return t->root[b];
+    }
+    for (uint32_t e = t->edges[node]; e != NONE; e = t->edge_sibling[e]) {
+        if (t->edge_byte[e] == b) {
+            return t->edge_next[e];
+        }
+    }
+    return NONE;
+}
+
+static bool grow(uint32_t **array, const size_t capacity) {
+    uint32_t *grown = realloc(*array, capacity * sizeof(uint32_t));
+    if (!grown) {
+        return false;
+    }
+    *array = grown;
+    return true;
+}
+
+static uint32_t trie_add_node(Trie *t, const uint32_t depth) {
+    if (t->count == t->capacity) {
+        const size_t capacity = t->capacity ? t->capacity * 2 : 64;
+        if (!grow(&t->depth, capacity) || !grow(&t->pattern, capacity) || !grow(&t->fail, capacity) ||
+            !grow(&t->out, capacity) || !grow(&t->edges, capacity)) {
+            return NONE;
+        }
+        t->capacity = capacity;
+    }
+    t->depth[t->count] = depth;
+    t->pattern[t->count] = NONE;
+    t->fail[t->count] = 0;
+    t->out[t->count] = NONE;
+    t->edges[t->count] = NONE;
+    return (uint32_t) t->count++;
+}
+
+static uint32_t trie_add_child(Trie *t, const uint32_t node, const uint8_t b) {
+    if (t->nedges == t->edges_capacity) {
+        const size_t capacity = t->edges_capacity ? t->edges_capacity * 2 : 64;
+        uint8_t *edge_byte = realloc(t->edge_byte, capacity);
+        if (!edge_byte) {
+            return NONE;
+        }
+        t->edge_byte = edge_byte;
+        if (!grow(&t->edge_next, capacity) || !grow(&t->edge_sibling, capacity)) {
+            return NONE;
+        }
+        t->edges_capacity = capacity;
+    }
+    const uint32_t child = trie_add_node(t, t->depth[node] + 1);
+    if (child == NONE) {
+        return NONE;
+    }
+    if (node == 0) {
+        t->root[b] = child;
+    }
+    t->edge_byte[t->nedges] = b;
+    t->edge_next[t->nedges] = child;
+    t->edge_sibling[t->nedges] = t->edges[node];
+    t->edges[node] = (uint32_t) t->nedges++;
+    return child;
+}
+
+static bool trie_build(Trie *t, const LiteralSet *set, const AhoCorasickKind kind) {
+    memset(t->root, 0xFF, sizeof(t->root));
+    if (trie_add_node(t, 0) == NONE) {
+        return false;
+    }
+    for (size_t i = 0; i < set->count; i++) {
+        const uint8_t *bytes = set->bytes + set->starts[i];
+        const size_t len = set->starts[i + 1] - set->starts[i];
+        uint32_t node = 0;
+        bool dominated = false;
+        for (size_t j = 0; j < len; j++) {
+            // Leftmost-first never reports a literal that runs on past an
+            // earlier one: wherever it occurs, so does the earlier one.
+            if (kind == AHOCORASICK_LEFTMOST_FIRST && t->pattern[node] != NONE) {
+                dominated = true;
+                break;
+            }
+            const uint32_t child = trie_child(t, node, bytes[j]);
+            node = child != NONE ? child : trie_add_child(t, node, bytes[j]);
+            if (node == NONE) {
+                return false;
+            }
+        }
+        // Of equal literals only the first counts.
+        if (!dominated && t->pattern[node] == NONE) {
+            t->pattern[node] = (uint32_t) i;
+        }
+    }
+
+    t->order = malloc(t->count * sizeof(uint32_t));
+    if (!t->order) {
+        return false;
+    }
+    size_t head = 0, tail = 0;
+    t->order[tail++] = 0;
+    while (head < tail) {
+        const uint32_t node = t->order[head++];
+        for (uint32_t e = t->edges[node]; e != NONE; e = t->edge_sibling[e]) {
+            const uint32_t child = t->edge_next[e];
+            const uint8_t b = t->edge_byte[e];
+            uint32_t f = t->fail[node];
+            while (f != 0 && trie_child(t, f, b) == NONE) {
+                f = t->fail[f];
+            }
+            const uint32_t target = node == 0 ? NONE : trie_child(t, f, b);
+            t->fail[child] = target != NONE ? target : 0;
+            t->out[child] = t->pattern[t->fail[child]] != NONE ? t->fail[child] : t->out[t->fail[child]];
+            t->order[tail++] = child;
+        }
+    }
+    return true;
+}
+
+static bool build_nfa(AhoCorasick *ac, const Trie *t) {
+    uint32_t *offset = malloc(t->count * sizeof(uint32_t));
+    if (!offset) {
+        fprintf(stderr, "Memory allocation failed\n");
+        return false;
+    }
+    size_t length = 0;
+    for (size_t i = 0; i < t->count; i++) {
+        const uint32_t node = t->order[i];
+        size_t ntrans = 0;
+        for (uint32_t e = t->edges[node]; node != 0 && e != NONE; e = t->edge_sibling[e]) {
+            ntrans++;
+        }
+        offset[node] = (uint32_t) length;
+        length += NFA_HEADER + (ntrans + 3) / 4 + ntrans;
+    }
+    ac->nfa = calloc(length, sizeof(uint32_t));
+    if (!ac->nfa) {
+        fprintf(stderr, "Memory allocation failed\n");
+        free(offset);
+        return false;
+    }
+    ac->nfa_length = length;
+
+    for (size_t i = 0; i < t->count; i++) {
+        const uint32_t node = t->order[i];
+        uint32_t *state = ac->nfa + offset[node];
+        state[NFA_FAIL] = offset[t->fail[node]];
+        state[NFA_DEPTH] = t->depth[node];
+        state[NFA_PATTERN] = t->pattern[node];
+        state[NFA_OUT] = t->out[node] == NONE ? NONE : offset[t->out[node]];
+        if (node == 0) {
+            continue;
+        }
+        for (uint32_t e = t->edges[node]; e != NONE; e = t->edge_sibling[e]) {
+            state[NFA_NTRANS]++;
+        }
+        uint8_t *bytes = (uint8_t *) (state + NFA_HEADER);
+        uint32_t *next = state + NFA_HEADER + (state[NFA_NTRANS] + 3) / 4;
+        size_t k = 0;
+        for (uint32_t e = t->edges[node]; e != NONE; e = t->edge_sibling[e], k++) {
+            bytes[k] = t->edge_byte[e];
+            next[k] = offset[t->edge_next[e]];
+        }
+    }
+    for (unsigned b = 0; b < 256; b++) {
+        ac->root[b] = t->root[b] == NONE ? 0 : offset[t->root[b]];
+    }
+    free(offset);
+    return true;
+}
+
+// Bytes that occur in no literal act alike and share class 0; every other
+// byte gets a class of its own.
+static size_t build_classes(AhoCorasick *ac, const Trie *t) {
+    bool used[256] = {false};
+    size_t nused = 0;
+    for (size_t e = 0; e < t->nedges; e++) {
+        nused += !used[t->edge_byte[e]];
+        used[t->edge_byte[e]] = true;
+    }
+    size_t nclasses = nused == 256 ? 0 : 1;
+    for (unsigned b = 0; b < 256; b++) {
+        ac->classes[b] = used[b] ? (uint8_t) nclasses++ : 0;
+    }
+    return nclasses;
+}
+
+static bool build_dfa(AhoCorasick *ac, const Trie *t) {
+    const size_t nclasses = build_classes(ac, t);
+    ac->stride_shift = 0;
+    while (((size_t) 1 << ac->stride_shift) < nclasses) {
+        ac->stride_shift++;
+    }
+    const size_t stride = (size_t) 1 << ac->stride_shift;
+    if (t->count * stride * sizeof(uint32_t) > AHOCORASICK_MAX_DFA_BYTES) {
+        return false;
+    }
+    uint32_t *index = malloc(t->count * sizeof(uint32_t));
+    ac->trans = calloc(t->count * stride, sizeof(uint32_t));
+    ac->info = malloc(3 * t->count * sizeof(uint32_t));
+    if (!index || !ac->trans || !ac->info) {
+        fprintf(stderr, "Memory allocation failed\n");
+        free(index);
+        return false;
+    }
+    for (size_t i = 0; i < t->count; i++) {
+        index[t->order[i]] = (uint32_t) (i << ac->stride_shift);
+    }
+
+    // In breadth-first order a state's failure target already has its
+    // row, and the state moves like it except on its own children.
+    for (size_t i = 0; i < t->count; i++) {
+        const uint32_t node = t->order[i];
+        uint32_t *row = ac->trans + (i << ac->stride_shift);
+        if (node != 0) {
+            memcpy(row, ac->trans + index[t->fail[node]], stride * sizeof(uint32_t));
+        }
+        for (uint32_t e = t->edges[node]; e != NONE; e = t->edge_sibling[e]) {
+            row[ac->classes[t->edge_byte[e]]] = index[t->edge_next[e]];
+        }
+        uint32_t *info = ac->info + 3 * i;
+        info[INFO_DEPTH] = t->depth[node];
+        info[INFO_PATTERN] = t->pattern[node];
+        info[INFO_OUT] = t->out[node] == NONE ? NONE : index[t->out[node]];
+    }
+    for (size_t i = 0; i < t->count * stride; i++) {
+        const uint32_t *info = ac->info + 3 * (ac->trans[i] >> ac->stride_shift);
+        if (info[INFO_PATTERN] != NONE || info[INFO_OUT] != NONE) {
+            ac->trans[i] |= AHOCORASICK_MATCH;
+        }
+    }
+    free(index);
+    return true;
+}
+
+AhoCorasick *ahocorasick_build(const LiteralSet *set, const AhoCorasickKind kind, const AhoCorasickImpl impl) {
+    if (set->count == 0) {
+        return NULL;
+    }
+    AhoCorasick *ac = calloc(1, sizeof(AhoCorasick));
+    if (!ac) {
+        fprintf(stderr, "Memory allocation failed\n");
+        return NULL;
+    }
+    ac->kind = kind;
+    ac->npatterns = set->count;
+
+    Trie t = {0};
+    if (!trie_build(&t, set, kind)) {
+        fprintf(stderr, "Memory allocation failed\n");
+        trie_free(&t);
+        ahocorasick_free(ac);
+        return NULL;
+    }
+    ac->nstates = t.count;
+    bool ok;
+    if (impl == AHOCORASICK_NFA) {
+        ok = build_nfa(ac, &t);
+    } else {
+        ok = build_dfa(ac, &t);
+        ac->dfa = ok;
+        if (!ok && impl == AHOCORASICK_AUTO) {
+            free(ac->trans);
+            free(ac->info);
+            ac->trans = NULL;
+            ac->info = NULL;
+            ok = build_nfa(ac, &t);
+        }
+    }
+    trie_free(&t);
+    if (!ok) {
+        ahocorasick_free(ac);
+        return NULL;
+    }
+    return ac;
+}
+
+void ahocorasick_free(AhoCorasick *ac) {
+    if (!ac) {
+        return;
+    }
+    free(ac->nfa);
+    free(ac->trans);
+    free(ac->info);
+    free(ac);
+}
+
+typedef struct {
+    size_t start;
+    size_t end;
+    uint32_t pattern;
+    bool found;
+} Best;
+
+// Keeps the leftmost match, and of those starting together the first
+// literal or the longest.
+static void consider(const AhoCorasick *ac, Best *best, const size_t start, const size_t end, const uint32_t pattern,
+                     const size_t limit) {
+    if (start > limit) {
+        return;
+    }
+    if (!best->found || start < best->start ||
+        (start == best->start &&
+         (ac->kind == AHOCORASICK_LEFTMOST_FIRST ? pattern < best->pattern : end > best->end))) {
+        best->start = start;
+        best->end = end;
+        best->pattern = pattern;
+        best->found = true;
+    }
+}
+
+static uint32_t nfa_next(const AhoCorasick *ac, uint32_t s, const uint8_t b) {
+    while (s != 0) {
+        const uint32_t *state = ac->nfa + s;
+        const uint32_t ntrans = state[NFA_NTRANS];
+        const uint8_t *bytes = (const uint8_t *) (state + NFA_HEADER);
+        for (uint32_t k = 0; k < ntrans; k++) {
+            if (bytes[k] == b) {
+                return state[NFA_HEADER + (ntrans + 3) / 4 + k];
+            }
+        }
+        s = state[NFA_FAIL];
+    }
+    return ac->root[b];
+}
+
+static bool nfa_is_match(const AhoCorasick *ac, const uint32_t s) {
+    return ac->nfa[s + NFA_PATTERN] != NONE || ac->nfa[s + NFA_OUT] != NONE;
+}
+
+// Every literal ending at i, from state s and its output links.
+static void nfa_collect(const AhoCorasick *ac, Best *best, const size_t i, uint32_t s, const size_t limit) {
+    if (ac->nfa[s + NFA_PATTERN] == NONE) {
+        s = ac->nfa[s + NFA_OUT];
+    }
+    for (; s != NONE; s = ac->nfa[s + NFA_OUT]) {
+        consider(ac, best, i - ac->nfa[s + NFA_DEPTH], i, ac->nfa[s + NFA_PATTERN], limit);
+    }
+}
+
+// A match may still start anywhere from i minus the current depth on,
+// so the search ends once that is past the best match's start, or past
+// the input's start when anchored.
+static bool find_nfa(const AhoCorasick *ac, const Input *input, Best *best) {
+    const uint8_t *hay = (const uint8_t *) input->haystack;
+    size_t limit = input->anchored ? input->start : NO_POS;
+    size_t i = input->start;
+    uint32_t s = 0;
+    for (;;) {
+        if (!input->anchored && !best->found) {
+            while (i < input->end && !nfa_is_match(ac, s)) {
+                s = nfa_next(ac, s, hay[i++]);
+            }
+        }
+        if (limit != NO_POS && i - ac->nfa[s + NFA_DEPTH] > limit) {
+            break;
+        }
+        if (nfa_is_match(ac, s)) {
+            nfa_collect(ac, best, i, s, limit);
+            if (best->found) {
+                if (input->earliest) {
+                    break;
+                }
+                limit = best->start;
+            }
+        }
+        if (i == input->end) {
+            break;
+        }
+        s = nfa_next(ac, s, hay[i++]);
+    }
+    return best->found;
+}
+
+static void dfa_collect(const AhoCorasick *ac, Best *best, const size_t i, const uint32_t s, const size_t limit) {
+    const uint32_t *info = ac->info + 3 * (s >> ac->stride_shift);
+    if (info[INFO_PATTERN] == NONE) {
+        info = info[INFO_OUT] == NONE ? NULL : ac->info + 3 * (info[INFO_OUT] >> ac->stride_shift);
+    }
+    while (info) {
+        consider(ac, best, i - info[INFO_DEPTH], i, info[INFO_PATTERN], limit);
+        info = info[INFO_OUT] == NONE ? NULL : ac->info + 3 * (info[INFO_OUT] >> ac->stride_shift);
+    }
+}
+
+static bool find_dfa(const AhoCorasick *ac, const Input *input, Best *best) {
+    const uint8_t *hay = (const uint8_t *) input->haystack;
+    const uint32_t *trans = ac->trans;
+    const uint8_t *classes = ac->classes;
+    size_t limit = input->anchored ? input->start : NO_POS;
+    size_t i = input->start;
+    // The start state is the only one entered without a transition, so
+    // it carries its own tag.
+    uint32_t s = ac->info[INFO_PATTERN] != NONE ? AHOCORASICK_MATCH : 0;
+    for (;;) {
+        if (!input->anchored && !best->found) {
+            while (i < input->end && !(s & AHOCORASICK_MATCH)) {
+                s = trans[s + classes[hay[i++]]];
+            }
+        }
+        const uint32_t state = s & ~AHOCORASICK_MATCH;
+        if (limit != NO_POS && i - ac->info[3 * (state >> ac->stride_shift) + INFO_DEPTH] > limit) {
+            break;
+        }
+        if (s & AHOCORASICK_MATCH) {
+            dfa_collect(ac, best, i, state, limit);
+            if (best->found) {
+                if (input->earliest) {
+                    break;
+                }
+                limit = best->start;
+            }
+        }
+        if (i == input->end) {
+            break;
+        }
+        s = trans[state + classes[hay[i++]]];
+    }
+    return best->found;
+}
+
+bool ahocorasick_find(const AhoCorasick *ac, const Input *input, size_t *start, size_t *end) {
+    Best best = {0};
+    if (!(ac->dfa ? find_dfa(ac, input, &best) : find_nfa(ac, input, &best))) {
+        return false;
+    }
+    *start = best.start;
+    *end = best.end;
+    return true;
+}
+
+void ahocorasick_print(const AhoCorasick *ac) {
+    printf("ahocorasick:   %s, %s, %zu literals, %zu states, ",
+           ac->kind == AHOCORASICK_LEFTMOST_FIRST ? "leftmost-first" : "leftmost-longest", ac->dfa ? "dfa" : "nfa",
+           ac->npatterns, ac->nstates);
+    if (ac->dfa) {
+        printf("%zu bytes\n", (ac->nstates << ac->stride_shift) * sizeof(uint32_t));
+    } else {
+        printf("%zu bytes\n", ac->nfa_length * sizeof(uint32_t));
+    }
+}
@@ -0,0 +1,182 @@
+#include "backtrack.h"
+
+#define RESTORE UINT32_MAX
+
+bool backtrack_cache_init(BacktrackCache *cache, const Prog *prog) {
+    cache->visited = NULL;
+    cache->visited_capacity = 0;
+    cache->stack_capacity = 64;
+    cache->stack = malloc(cache->stack_capacity * sizeof(BacktrackFrame));
+    cache->nslots = prog->nslots;
+    cache->slots = malloc((prog->nslots + 1) * sizeof(size_t));
+    cache->best = malloc((prog->nslots + 1) * sizeof(size_t));
+    if (!cache->stack || !cache->slots || !cache->best) {
+        fprintf(stderr, "Memory allocation failed\n");
+        backtrack_cache_free(cache);
+        return false;
+    }
+    return true;
+}
+
+void backtrack_cache_free(BacktrackCache *cache) {
+    free(cache->visited);
+    free(cache->stack);
+    free(cache->slots);
+    free(cache->best);
+    cache->visited = NULL;
+    cache->stack = NULL;
+    cache->slots = NULL;
+    cache->best = NULL;
+    cache->visited_capacity = 0;
+    cache->stack_capacity = 0;
+}
+
+size_t backtrack_max_haystack(const Prog *prog, const size_t budget) {
+    const size_t bits = budget * 8;
+    if (bits / prog->length == 0) {
+        return 0;
+    }
+    // One bit per instruction per position, and there are length + 1 positions.
+    return bits / prog->length - 1;
+}
+
+static bool push(BacktrackCache *cache, size_t *top, const BacktrackFrame frame) {
+    if (*top == cache->stack_capacity) {
+        const size_t new_cap = cache->stack_capacity * 2;
+        BacktrackFrame *new_stack = realloc(cache->stack, new_cap * sizeof(BacktrackFrame));
+        if (!new_stack) {
+            fprintf(stderr, "Memory allocation failed\n");
+            return false;
+        }
+        cache->stack = new_stack;
+        cache->stack_capacity = new_cap;
+    }
+    cache->stack[(*top)++] = frame;
+    return true;
+}
+
+typedef enum {
+    STEP_NO_MATCH,
+    STEP_MATCH,
+    // The stack could not grow, so later starts must not be tried either.
+    STEP_FAILED,
+} StepResult;
+
+// Explores from (prog->start, start) depth first in priority order. The
+// first match reached is the leftmost-first match for this start position.
+// For a leftmost-longest program the search goes on, and the first match
+// reached at the furthest end is copied to cache->best.
+static StepResult step(const Prog *prog, BacktrackCache *cache, const Input *input, const size_t start,
+                 const size_t tracked) {
+    const uint8_t *hay = (const uint8_t *) input->haystack;
+    const size_t width = input->end - input->start + 1;
+    const bool longest = prog->longest && tracked > 0 && !input->earliest;
+    size_t best = NO_POS;
+    size_t top = 0;
+
+    if (!push(cache, &top, (BacktrackFrame) {.pc = prog->start, .at = start})) {
+        return STEP_FAILED;
+    }
+    while (top > 0) {
+        const BacktrackFrame frame = cache->stack[--top];
+        if (frame.pc == RESTORE) {
+            cache->slots[frame.slot] = frame.at;
+            continue;
+        }
+
+        uint32_t pc = frame.pc;
+        size_t at = frame.at;
+        for (;;) {
+            const size_t key = pc * width + (at - input->start);
+            const uint64_t bit = 1ULL << (key & 63);
+            if (cache->visited[key >> 6] & bit) {
+                break;
+            }
+            cache->visited[key >> 6] |= bit;
+
+            const Inst *inst = &prog->insts[pc];
+            if (inst->op == OP_MATCH && longest) {
+                if (best == NO_POS || at > best) {
+                    memcpy(cache->best, cache->slots, tracked * sizeof(size_t));
+                    best = at;
+                }
+                break;
+            }
+            if (inst->op == OP_MATCH) {
+                return STEP_MATCH;
+            }
+            if (inst->op == OP_BYTE) {
+                if (at >= input->end || hay[at] < inst->lo || hay[at] > inst->hi) {
+                    break;
+                }
+                pc = inst->out;
+                at++;
+            } else if (inst->op == OP_SPLIT) {
+                if (!push(cache, &top, (BacktrackFrame) {.pc = inst->out1, .at = at})) {
+                    return STEP_FAILED;
+                }
+                pc = inst->out;
+            } else if (inst->op == OP_SAVE) {
+                if (inst->arg < tracked) {
+                    const BacktrackFrame restore = {.pc = RESTORE, .slot = inst->arg, .at = cache->slots[inst->arg]};
+                    if (!push(cache, &top, restore)) {
+                        return STEP_FAILED;
+                    }
+                    cache->slots[inst->arg] = at;
+                }
+                pc = inst->out;
+            } else if (inst->op == OP_LOOK) {
+                if (!look_matches((Look) inst->arg, input, at)) {
+                    break;
+                }
+                pc = inst->out;
+            } else {
+                break;
+            }
+        }
+    }
+
+    if (best != NO_POS) {
+        memcpy(cache->slots, cache->best, tracked * sizeof(size_t));
+        return STEP_MATCH;
+    }
+    return STEP_NO_MATCH;
+}
+
+bool backtrack_search(const Prog *prog, BacktrackCache *cache, const Input *input, size_t *slots, const size_t nslots) {
+    const size_t width = input->end - input->start + 1;
+    const size_t words = (prog->length * width + 63) / 64;
+    const size_t tracked = nslots < cache->nslots ? nslots : cache->nslots;
+
+    if (words > cache->visited_capacity) {
+        uint64_t *visited = realloc(cache->visited, words * sizeof(uint64_t));
+        if (!visited) {
+            fprintf(stderr, "Memory allocation failed\n");
+            return false;
+        }
+        cache->visited = visited;
+        cache->visited_capacity = words;
+    }
+    memset(cache->visited, 0, words * sizeof(uint64_t));
+
+    for (size_t start = input->start; start <= input->end; start++) {
+        for (size_t i = 0; i < tracked; i++) {
+            cache->slots[i] = NO_POS;
+        }
+        const StepResult found = step(prog, cache, input, start, tracked);
+        if (found == STEP_FAILED) {
+            return false;
+        }
+        if (found == STEP_MATCH) {
+            if (tracked > 0) {
+                memcpy(slots, cache->slots, tracked * sizeof(size_t));
+            }
+            return true;
+        }
+        if (input->anchored) {
+            break;
+        }
+    }
+
+    return false;
+}
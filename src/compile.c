@@ -0,0 +1,437 @@
+#include "prog.h"
+
+// An instruction that may be shared, chained to the one entered before
+// it in the same bucket.
+typedef struct {
+    uint32_t pc;
+    uint32_t next;
+} Shared;
+
+typedef struct {
+    Prog *prog;
+    bool failed;
+    // Set while compiling a counter's body; counters do not nest.
+    bool counting;
+    // Bytes and splits whose targets are known when they are emitted are
+    // entered here, so equal instructions with equal targets are emitted
+    // once. Alternation branches ending in the same suffix, as the words
+    // of a keyword list do, then share its instructions.
+    uint32_t *buckets;
+    size_t nbuckets;
+    Shared *shared;
+    size_t nshared;
+    size_t shared_capacity;
+} Compiler;
+
+// Reports the first failure only; later calls just return 0.
+static uint32_t emit(Compiler *c, const Opcode op, const uint32_t out, const uint32_t out1, const uint32_t arg) {
+    Prog *prog = c->prog;
+    if (c->failed) {
+        return 0;
+    }
+    if (prog->length >= PROG_MAX_INSTS) {
+        fprintf(stderr, "Pattern too large: more than %u instructions\n", PROG_MAX_INSTS);
+        c->failed = true;
+        return 0;
+    }
+    if (prog->length == prog->capacity) {
+        const size_t capacity = prog->capacity ? prog->capacity * 2 : 64;
+        Inst *insts = realloc(prog->insts, capacity * sizeof(Inst));
+        if (!insts) {
+            fprintf(stderr, "Memory allocation failed\n");
+            c->failed = true;
+            return 0;
+        }
+        prog->insts = insts;
+        prog->capacity = capacity;
+    }
+
+    Inst *inst = &prog->insts[prog->length];
+    inst->op = op;
+    inst->lo = 0;
+    inst->hi = 0;
+    inst->out = out;
+    inst->out1 = out1;
+    inst->arg = arg;
+    return (uint32_t) prog->length++;
+}
+
+static size_t share_hash(const Compiler *c, const Opcode op, const uint8_t lo, const uint8_t hi,
+                         const uint32_t out, const uint32_t out1) {
+    uint64_t h = (uint64_t) op * 0x9E3779B97F4A7C15ULL;
+    h = (h ^ ((uint64_t) lo << 8 | hi)) * 0x9E3779B97F4A7C15ULL;
+    h = (h ^ out) * 0x9E3779B97F4A7C15ULL;
+    h = (h ^ out1) * 0x9E3779B97F4A7C15ULL;
+    return (size_t) (h >> 32) & (c->nbuckets - 1);
+}
+
+static void share_insert(Compiler *c, const uint32_t pc) {
+    if (c->nshared == c->shared_capacity) {
+        c->shared_capacity = c->shared_capacity ? c->shared_capacity * 2 : 64;
+        c->shared = realloc(c->shared, c->shared_capacity * sizeof(Shared));
+    }
+    if (c->nshared >= c->nbuckets) {
+        // Rehash in the order of entry, which keeps the newest entry at
+        // the head of its chain.
+        c->nbuckets = c->nbuckets ? c->nbuckets * 2 : 64;
+        c->buckets = realloc(c->buckets, c->nbuckets * sizeof(uint32_t));
+        memset(c->buckets, 0xFF, c->nbuckets * sizeof(uint32_t));
+        for (size_t i = 0; i < c->nshared; i++) {
+            const Inst *inst = &c->prog->insts[c->shared[i].pc];
+            const size_t h = share_hash(c, inst->op, inst->lo, inst->hi, inst->out, inst->out1);
+            c->shared[i].next = c->buckets[h];
+            c->buckets[h] = (uint32_t) i;
+        }
+    }
+    const Inst *inst = &c->prog->insts[pc];
+    const size_t h = share_hash(c, inst->op, inst->lo, inst->hi, inst->out, inst->out1);
+    c->shared[c->nshared] = (Shared) {.pc = pc, .next = c->buckets[h]};
+    c->buckets[h] = (uint32_t) c->nshared++;
+}
+
+// Forgets the instructions from pc `mark` on, which are being dropped.
+// They were entered last, so each is at the head of its chain.
+static void share_truncate(Compiler *c, const size_t mark) {
+    while (c->nshared > 0 && c->shared[c->nshared - 1].pc >= mark) {
+        const Inst *inst = &c->prog->insts[c->shared[c->nshared - 1].pc];
+        const size_t h = share_hash(c, inst->op, inst->lo, inst->hi, inst->out, inst->out1);
+        c->buckets[h] = c->shared[--c->nshared].next;
+    }
+}
+
+// Emits a byte or split, or returns an equal one emitted before. Counter
+// bodies must occupy their own pc range, so nothing is shared in them.
+static uint32_t emit_shared(Compiler *c, const Opcode op, const uint8_t lo, const uint8_t hi, const uint32_t out,
+                            const uint32_t out1) {
+    if (!c->counting && c->nbuckets > 0) {
+        const size_t h = share_hash(c, op, lo, hi, out, out1);
+        for (uint32_t i = c->buckets[h]; i != UINT32_MAX; i = c->shared[i].next) {
+            const Inst *inst = &c->prog->insts[c->shared[i].pc];
+            if (inst->op == op && inst->lo == lo && inst->hi == hi && inst->out == out && inst->out1 == out1) {
+                return c->shared[i].pc;
+            }
+        }
+    }
+    const uint32_t pc = emit(c, op, out, out1, 0);
+    if (c->failed) {
+        return pc;
+    }
+    c->prog->insts[pc].lo = lo;
+    c->prog->insts[pc].hi = hi;
+    if (!c->counting) {
+        share_insert(c, pc);
+    }
+    return pc;
+}
+
+static uint32_t emit_byte(Compiler *c, const uint8_t lo, const uint8_t hi, const uint32_t next) {
+    return emit_shared(c, OP_BYTE, lo, hi, next, 0);
+}
+
+static uint32_t emit_split(Compiler *c, const uint32_t out, const uint32_t out1) {
+    return emit_shared(c, OP_SPLIT, 0, 0, out, out1);
+}
+
+static uint32_t compile_class(Compiler *c, const ByteSet *set, const uint32_t next) {
+    uint8_t los[128], his[128];
+    size_t n = 0;
+
+    for (unsigned b = 0; b < 256; b++) {
+        if (!byteset_contains(set, (uint8_t) b)) {
+            continue;
+        }
+        unsigned hi = b;
+        while (hi < 255 && byteset_contains(set, (uint8_t) (hi + 1))) {
+            hi++;
+        }
+        los[n] = (uint8_t) b;
+        his[n] = (uint8_t) hi;
+        n++;
+        b = hi;
+    }
+
+    if (n == 0) {
+        return emit(c, OP_FAIL, 0, 0, 0);
+    }
+
+    uint32_t pc = emit_byte(c, los[n - 1], his[n - 1], next);
+    for (size_t i = n - 1; i-- > 0;) {
+        pc = emit_split(c, emit_byte(c, los[i], his[i], next), pc);
+    }
+    return pc;
+}
+
+static uint32_t compile(Compiler *c, const Hir *hir, uint32_t next);
+
+// Compiles a counter loop for hir, whose body is known to be non-nullable
+// and free of captures. The CLOOP and CINC are emitted before the body so
+// that the counter's pcs form one range.
+static uint32_t compile_counter(Compiler *c, const Hir *hir, const uint32_t next) {
+    Prog *prog = c->prog;
+    const uint32_t loop = emit(c, OP_CLOOP, 0, next, (uint32_t) prog->ncounters);
+    const uint32_t inc = emit(c, OP_CINC, loop, 0, (uint32_t) prog->ncounters);
+    c->counting = true;
+    const uint32_t body = compile(c, hir->sub[0], inc);
+    c->counting = false;
+    if (c->failed) {
+        return 0;
+    }
+    prog->insts[loop].out = body;
+
+    Counter *counters = realloc(prog->counters, (prog->ncounters + 1) * sizeof(Counter));
+    if (!counters) {
+        fprintf(stderr, "Memory allocation failed\n");
+        c->failed = true;
+        return 0;
+    }
+    prog->counters = counters;
+    prog->counters[prog->ncounters] = (Counter) {
+        .min = (uint32_t) hir->min,
+        .max = hir->max == -1 ? UINT32_MAX : (uint32_t) hir->max,
+        .first = loop,
+        .last = (uint32_t) prog->length,
+    };
+    return emit(c, OP_CINIT, loop, 0, (uint32_t) prog->ncounters++);
+}
+
+static bool has_capture(const Hir *hir) {
+    if (hir->kind == HIR_CAPTURE) {
+        return true;
+    }
+    for (size_t i = 0; i < hir->sub_count; i++) {
+        if (has_capture(hir->sub[i])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static uint32_t compile_repeat(Compiler *c, const Hir *hir, const uint32_t next) {
+    const Hir *sub = hir->sub[0];
+    int copies = hir->min;
+    uint32_t pc = next;
+
+    const int bound = hir->max == -1 ? hir->min : hir->max;
+    if (!c->counting && bound > 1 && !hir_nullable(sub) && !has_capture(sub)) {
+        // Compile one copy to learn the body's size, then drop it again:
+        // nothing references instructions emitted after `mark`. A body that
+        // already needed counters of its own is unrolled instead.
+        const size_t mark = c->prog->length;
+        const size_t ncounters = c->prog->ncounters;
+        compile(c, sub, next);
+        const size_t size = c->prog->length - mark;
+        const bool nested = c->prog->ncounters != ncounters;
+        share_truncate(c, mark);
+        c->prog->length = mark;
+        c->prog->ncounters = ncounters;
+        if (!c->failed && !nested && (bound > PROG_MAX_REPEAT || size * (size_t) bound > PROG_MAX_UNROLL)) {
+            return compile_counter(c, hir, next);
+        }
+    }
+
+    if (hir->max == -1) {
+        const uint32_t loop = emit(c, OP_SPLIT, 0, next, 0);
+        const uint32_t body = compile(c, sub, loop);
+        if (c->failed) {
+            return 0;
+        }
+        c->prog->insts[loop].out = body;
+        if (copies == 0) {
+            return loop;
+        }
+        pc = body;
+        copies--;
+    } else {
+        for (int i = hir->min; i < hir->max && !c->failed; i++) {
+            pc = emit_split(c, compile(c, sub, pc), next);
+        }
+    }
+
+    for (int i = 0; i < copies && !c->failed; i++) {
+        pc = compile(c, sub, pc);
+    }
+    return pc;
+}
+
+// Compiles hir so that it continues at next, returning its entry point.
+// Instructions are emitted back to front, which avoids patch lists.
+static uint32_t compile(Compiler *c, const Hir *hir, uint32_t next) {
+    if (c->failed) {
+        return 0;
+    }
+
+    switch (hir->kind) {
+        case HIR_EMPTY:
+            return next;
+        case HIR_CLASS:
+            return compile_class(c, &hir->set, next);
+        case HIR_CONCAT: {
+            for (size_t i = hir->sub_count; i-- > 0;) {
+                next = compile(c, hir->sub[i], next);
+            }
+            return next;
+        }
+        case HIR_ALT: {
+            uint32_t pc = compile(c, hir->sub[hir->sub_count - 1], next);
+            for (size_t i = hir->sub_count - 1; i-- > 0;) {
+                pc = emit_split(c, compile(c, hir->sub[i], next), pc);
+            }
+            return pc;
+        }
+        case HIR_CAPTURE: {
+            const uint32_t close = emit(c, OP_SAVE, next, 0, (uint32_t) (2 * hir->index + 1));
+            const uint32_t body = compile(c, hir->sub[0], close);
+            return emit(c, OP_SAVE, body, 0, (uint32_t) (2 * hir->index));
+        }
+        case HIR_REPEAT:
+            return compile_repeat(c, hir, next);
+        case HIR_LOOK:
+            c->prog->looks |= LOOK_BIT(hir->look);
+            return emit(c, OP_LOOK, next, 0, hir->look);
+    }
+
+    return next;
+}
+
+static void compute_byte_classes(Prog *prog) {
+    bool boundary[256] = {false};
+
+    for (size_t i = 0; i < prog->length; i++) {
+        const Inst *inst = &prog->insts[i];
+        if (inst->op != OP_BYTE) {
+            continue;
+        }
+        if (inst->lo > 0) {
+            boundary[inst->lo - 1] = true;
+        }
+        boundary[inst->hi] = true;
+    }
+    if (prog->looks & LOOK_WORD_BITS) {
+        // A word boundary depends on whether the next byte is a word
+        // character, so no class may mix word and non-word bytes. Bytes
+        // from 0x80 up only start or continue multibyte runes.
+        for (size_t b = 0; b < 0x7F; b++) {
+            if (is_word_rune((rune) b) != is_word_rune((rune) (b + 1))) {
+                boundary[b] = true;
+            }
+        }
+        boundary[0x7F] = true;
+    }
+
+    size_t cls = 0;
+    for (size_t b = 0; b < 256; b++) {
+        prog->byte_class[b] = (uint8_t) cls;
+        if (boundary[b] && b < 255) {
+            cls++;
+        }
+    }
+    prog->nclasses = cls + 1;
+}
+
+Prog *prog_compile(const Hir *hir, const size_t capture_count, const bool reverse) {
+    Prog *prog = calloc(1, sizeof(Prog));
+    if (!prog) {
+        fprintf(stderr, "Memory allocation failed\n");
+        return NULL;
+    }
+    Compiler c = {.prog = prog, .failed = false};
+
+    prog->reverse = reverse;
+    prog->nslots = reverse ? 0 : 2 * (capture_count + 1);
+
+    uint32_t pc = emit(&c, OP_MATCH, 0, 0, 0);
+    if (!reverse) {
+        pc = emit(&c, OP_SAVE, pc, 0, 1);
+    }
+    pc = compile(&c, hir, pc);
+    if (!reverse) {
+        pc = emit(&c, OP_SAVE, pc, 0, 0);
+    }
+    prog->start = pc;
+
+    // Unanchored searches start with a lazy any-byte loop, i.e. (?s:.)*?
+    const uint32_t loop = emit(&c, OP_SPLIT, pc, 0, 0);
+    const uint32_t any = emit_byte(&c, 0x00, 0xFF, loop);
+    free(c.buckets);
+    free(c.shared);
+    if (c.failed) {
+        prog_free(prog);
+        return NULL;
+    }
+    prog->insts[loop].out1 = any;
+    prog->start_unanchored = loop;
+
+    if (prog->ncounters > 0) {
+        prog->counter_of = malloc(prog->length * sizeof(uint32_t));
+        if (!prog->counter_of) {
+            fprintf(stderr, "Memory allocation failed\n");
+            prog_free(prog);
+            return NULL;
+        }
+        for (size_t i = 0; i < prog->length; i++) {
+            prog->counter_of[i] = NO_COUNTER;
+        }
+        for (size_t k = 0; k < prog->ncounters; k++) {
+            for (uint32_t i = prog->counters[k].first; i < prog->counters[k].last; i++) {
+                prog->counter_of[i] = (uint32_t) k;
+            }
+        }
+    }
+
+    compute_byte_classes(prog);
+    return prog;
+}
+
+void prog_free(Prog *prog) {
+    if (!prog) {
+        return;
+    }
+    free(prog->insts);
+    free(prog->counters);
+    free(prog->counter_of);
+    free(prog);
+}
+
+void prog_print(const Prog *prog) {
+    for (size_t i = 0; i < prog->length; i++) {
+        const Inst *inst = &prog->insts[i];
+        printf("%4zu%s ", i, i == prog->start ? "*" : " ");
+        switch (inst->op) {
+            case OP_MATCH:
+                printf("match\n");
+                break;
+            case OP_BYTE:
+                printf("byte [%02x-%02x] -> %u\n", inst->lo, inst->hi, inst->out);
+                break;
+            case OP_SPLIT:
+                printf("split -> %u, %u\n", inst->out, inst->out1);
+                break;
+            case OP_SAVE:
+                printf("save %u -> %u\n", inst->arg, inst->out);
+                break;
+            case OP_FAIL:
+                printf("fail\n");
+                break;
+            case OP_CINIT:
+                printf("cinit c%u -> %u\n", inst->arg, inst->out);
+                break;
+            case OP_CLOOP: {
+                const Counter *k = &prog->counters[inst->arg];
+                if (k->max == UINT32_MAX) {
+                    printf("cloop c%u {%u,} -> %u, %u\n", inst->arg, k->min, inst->out, inst->out1);
+                } else {
+                    printf("cloop c%u {%u,%u} -> %u, %u\n", inst->arg, k->min, k->max, inst->out, inst->out1);
+                }
+                break;
+            }
+            case OP_CINC:
+                printf("cinc c%u -> %u\n", inst->arg, inst->out);
+                break;
+            case OP_LOOK: {
+                static const char *looks[] = {"^", "$", "\\b", "\\B"};
+                printf("look %s -> %u\n", looks[inst->arg], inst->out);
+                break;
+            }
+        }
+    }
+}
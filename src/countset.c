@@ -0,0 +1,484 @@
+#include "countset.h"
+
+#define NO_SET UINT32_MAX
+
+static bool list_init(CountList *list, const size_t ninsts) {
+    list->dense = malloc(ninsts * sizeof(uint32_t));
+    list->sparse = malloc(ninsts * sizeof(uint32_t));
+    list->set_of = malloc(ninsts * sizeof(uint32_t));
+    list->size = 0;
+    list->stamp = 0;
+    return list->dense && list->sparse && list->set_of;
+}
+
+static void list_free(CountList *list) {
+    free(list->dense);
+    free(list->sparse);
+    free(list->set_of);
+    list->dense = NULL;
+    list->sparse = NULL;
+    list->set_of = NULL;
+}
+
+static bool list_insert(CountList *list, const uint32_t pc) {
+    const uint32_t i = list->sparse[pc];
+    if (i < list->size && list->dense[i] == pc) {
+        return false;
+    }
+    list->sparse[pc] = (uint32_t) list->size;
+    list->dense[list->size++] = pc;
+    list->set_of[pc] = NO_SET;
+    return true;
+}
+
+bool countset_cache_init(CountCache *cache, const Prog *prog) {
+    memset(cache, 0, sizeof(CountCache));
+    cache->ninsts = prog->length;
+    cache->stack_capacity = 2 * (prog->length + 1);
+    cache->stack = malloc(cache->stack_capacity * sizeof(CountFrame));
+    cache->body = malloc((prog->ncounters + 1) * sizeof(uint32_t));
+    cache->pending = malloc((prog->ncounters + 1) * sizeof(uint32_t));
+    cache->seen_set = malloc(prog->length * sizeof(uint32_t));
+    cache->seen_step = calloc(prog->length, sizeof(size_t));
+    const bool ok = list_init(&cache->lists[0], prog->length) && list_init(&cache->lists[1], prog->length);
+    if (!ok || !cache->stack || !cache->body || !cache->pending || !cache->seen_set || !cache->seen_step) {
+        fprintf(stderr, "Memory allocation failed\n");
+        countset_cache_free(cache);
+        return false;
+    }
+    for (size_t k = 0; k < prog->ncounters; k++) {
+        cache->body[k] = NO_SET;
+    }
+    return true;
+}
+
+void countset_cache_free(CountCache *cache) {
+    list_free(&cache->lists[0]);
+    list_free(&cache->lists[1]);
+    for (size_t i = 0; i < cache->sets_capacity; i++) {
+        free(cache->sets[i].stamps);
+    }
+    free(cache->sets);
+    free(cache->free_sets);
+    free(cache->stack);
+    free(cache->merged);
+    free(cache->body);
+    free(cache->pending);
+    free(cache->seen_set);
+    free(cache->seen_step);
+    memset(cache, 0, sizeof(CountCache));
+}
+
+static uint32_t value(const CountSet *s, const size_t i) {
+    return s->offset - s->stamps[i];
+}
+
+// Marks the search as given up; it unwinds without touching the sets again.
+static void fail(CountCache *cache) {
+    fprintf(stderr, "Memory allocation failed\n");
+    cache->failed = true;
+}
+
+// NO_SET when memory runs out.
+static uint32_t set_new(CountCache *cache) {
+    uint32_t id;
+    if (cache->nfree > 0) {
+        id = cache->free_sets[--cache->nfree];
+    } else {
+        if (cache->nsets == cache->sets_capacity) {
+            const size_t capacity = cache->sets_capacity ? cache->sets_capacity * 2 : 16;
+            CountSet *sets = realloc(cache->sets, capacity * sizeof(CountSet));
+            if (!sets) {
+                fail(cache);
+                return NO_SET;
+            }
+            cache->sets = sets;
+            uint32_t *free_sets = realloc(cache->free_sets, capacity * sizeof(uint32_t));
+            if (!free_sets) {
+                fail(cache);
+                return NO_SET;
+            }
+            cache->free_sets = free_sets;
+            memset(cache->sets + cache->sets_capacity, 0, (capacity - cache->sets_capacity) * sizeof(CountSet));
+            cache->sets_capacity = capacity;
+        }
+        id = (uint32_t) cache->nsets++;
+    }
+    CountSet *s = &cache->sets[id];
+    s->head = 0;
+    s->tail = 0;
+    s->offset = 0;
+    s->refs = 1;
+    return id;
+}
+
+static void set_release(CountCache *cache, const uint32_t id) {
+    if (id != NO_SET && --cache->sets[id].refs == 0) {
+        cache->free_sets[cache->nfree++] = id;
+    }
+}
+
+// Makes room for one more stamp at the tail.
+static bool set_reserve(CountCache *cache, CountSet *s) {
+    if (s->tail < s->capacity) {
+        return true;
+    }
+    if (s->head > 0) {
+        memmove(s->stamps, s->stamps + s->head, (s->tail - s->head) * sizeof(uint32_t));
+        s->tail -= s->head;
+        s->head = 0;
+        return true;
+    }
+    const size_t capacity = s->capacity ? s->capacity * 2 : 8;
+    uint32_t *stamps = realloc(s->stamps, capacity * sizeof(uint32_t));
+    if (!stamps) {
+        fail(cache);
+        return false;
+    }
+    s->stamps = stamps;
+    s->capacity = capacity;
+    return true;
+}
+
+static bool is_zero(const CountSet *s) {
+    return s->tail - s->head == 1 && value(s, s->head) == 0;
+}
+
+static void set_push_zero(CountCache *cache, CountSet *s) {
+    if (s->tail > s->head && value(s, s->tail - 1) == 0) {
+        return;
+    }
+    if (set_reserve(cache, s)) {
+        s->stamps[s->tail++] = s->offset;
+    }
+}
+
+// NO_SET when memory runs out.
+static uint32_t set_clone(CountCache *cache, const uint32_t id) {
+    const uint32_t copy = set_new(cache);
+    if (copy == NO_SET) {
+        return NO_SET;
+    }
+    CountSet *dst = &cache->sets[copy];
+    const CountSet *src = &cache->sets[id];
+    for (size_t i = src->head; i < src->tail; i++) {
+        if (!set_reserve(cache, dst)) {
+            return NO_SET;
+        }
+        dst->stamps[dst->tail++] = src->stamps[i];
+    }
+    dst->offset = src->offset;
+    return copy;
+}
+
+// Adds every count of src to dst. Both runs are sorted by decreasing
+// count, and so is the result.
+static void set_merge(CountCache *cache, const uint32_t dst_id, const uint32_t src_id) {
+    const CountSet *src = &cache->sets[src_id];
+    CountSet *dst = &cache->sets[dst_id];
+    if (is_zero(src)) {
+        set_push_zero(cache, dst);
+        return;
+    }
+
+    const size_t n = (dst->tail - dst->head) + (src->tail - src->head);
+    if (n > cache->merged_capacity) {
+        uint32_t *buffer = malloc(n * 2 * sizeof(uint32_t));
+        if (!buffer) {
+            fail(cache);
+            return;
+        }
+        free(cache->merged);
+        cache->merged = buffer;
+        cache->merged_capacity = n * 2;
+    }
+    uint32_t *merged = cache->merged;
+    size_t i = dst->head, j = src->head, m = 0;
+    while (i < dst->tail || j < src->tail) {
+        uint32_t v;
+        if (j == src->tail || (i < dst->tail && value(dst, i) >= value(src, j))) {
+            v = value(dst, i++);
+        } else {
+            v = value(src, j++);
+        }
+        if (m == 0 || 0 - merged[m - 1] != v) {
+            merged[m++] = 0 - v;
+        }
+    }
+    const size_t capacity = cache->merged_capacity;
+    cache->merged = dst->stamps;
+    cache->merged_capacity = dst->capacity;
+    dst->stamps = merged;
+    dst->capacity = capacity;
+    dst->head = 0;
+    dst->tail = m;
+    dst->offset = 0;
+}
+
+static void push(CountCache *cache, size_t *top, const uint32_t pc, const uint32_t set) {
+    if (*top == cache->stack_capacity) {
+        CountFrame *stack = realloc(cache->stack, 2 * cache->stack_capacity * sizeof(CountFrame));
+        if (!stack) {
+            fail(cache);
+            return;
+        }
+        cache->stack = stack;
+        cache->stack_capacity *= 2;
+    }
+    cache->stack[(*top)++] = (CountFrame) {.pc = pc, .set = set};
+}
+
+// A set of counts reaches counter k's loop. If any count may leave, the
+// exit is followed at once; the counts that may iterate again are pooled
+// into the body set, which is only expanded once the step has gathered
+// every arrival.
+static void arrive(const Prog *prog, CountCache *cache, const uint32_t k, const uint32_t id, size_t *top) {
+    const Counter *counter = &prog->counters[k];
+    CountSet *s = &cache->sets[id];
+    if (s->head == s->tail) {
+        set_release(cache, id);
+        return;
+    }
+
+    const uint32_t most = value(s, s->head);
+    if (most >= counter->min) {
+        push(cache, top, prog->insts[counter->first].out1, NO_SET);
+    }
+    if (counter->max != UINT32_MAX && most >= counter->max) {
+        s->head++;
+    }
+    if (s->head == s->tail) {
+        set_release(cache, id);
+    } else if (cache->body[k] == NO_SET) {
+        cache->body[k] = id;
+        cache->pending[cache->npending++] = k;
+    } else if (is_zero(&cache->sets[cache->body[k]])) {
+        // The common step: a fresh entry joins the counts carried over.
+        set_push_zero(cache, &cache->sets[id]);
+        set_release(cache, cache->body[k]);
+        cache->body[k] = id;
+    } else {
+        set_merge(cache, cache->body[k], id);
+        set_release(cache, id);
+    }
+}
+
+// A reversed program has the haystack's start and end swapped.
+static bool look_at(const Prog *prog, Look look, const Input *input, const size_t at) {
+    if (prog->reverse && (look == LOOK_START || look == LOOK_END)) {
+        look = look == LOOK_START ? LOOK_END : LOOK_START;
+    }
+    return look_matches(look, input, at);
+}
+
+static void follow(const Prog *prog, CountCache *cache, CountList *list, const Input *input, const size_t at,
+                   size_t top) {
+    while (top > 0 && !cache->failed) {
+        const CountFrame frame = cache->stack[--top];
+        uint32_t cur = frame.pc;
+        uint32_t id = frame.set;
+
+        for (;;) {
+            const Inst *inst = &prog->insts[cur];
+            if (inst->op == OP_CINIT) {
+                if (list_insert(list, cur)) {
+                    const uint32_t zero = set_new(cache);
+                    if (zero == NO_SET) {
+                        break;
+                    }
+                    set_push_zero(cache, &cache->sets[zero]);
+                    arrive(prog, cache, inst->arg, zero, &top);
+                }
+                break;
+            }
+            if (inst->op == OP_CINC) {
+                if (cache->sets[id].refs > 1) {
+                    const uint32_t copy = set_clone(cache, id);
+                    if (copy == NO_SET) {
+                        break;
+                    }
+                    set_release(cache, id);
+                    id = copy;
+                }
+                CountSet *s = &cache->sets[id];
+                const Counter *counter = &prog->counters[inst->arg];
+                s->offset++;
+                if (counter->max == UINT32_MAX && value(s, s->head) > counter->min) {
+                    // Unbounded: counts past min are all alike.
+                    s->stamps[s->head] = s->offset - counter->min;
+                    if (s->head + 1 < s->tail && value(s, s->head + 1) == counter->min) {
+                        s->head++;
+                    }
+                }
+                arrive(prog, cache, inst->arg, id, &top);
+                break;
+            }
+
+            if (id == NO_SET) {
+                if (!list_insert(list, cur)) {
+                    break;
+                }
+                if (inst->op == OP_SPLIT) {
+                    push(cache, &top, inst->out1, NO_SET);
+                    cur = inst->out;
+                    continue;
+                }
+                if (inst->op == OP_SAVE) {
+                    cur = inst->out;
+                    continue;
+                }
+                if (inst->op == OP_LOOK && look_at(prog, (Look) inst->arg, input, at)) {
+                    cur = inst->out;
+                    continue;
+                }
+                break;
+            }
+
+            // Inside a counter body, carrying a set of counts.
+            if (inst->op == OP_SPLIT) {
+                if (cache->seen_step[cur] == list->stamp && cache->seen_set[cur] == id) {
+                    set_release(cache, id);
+                    break;
+                }
+                cache->seen_step[cur] = list->stamp;
+                cache->seen_set[cur] = id;
+                cache->sets[id].refs++;
+                push(cache, &top, inst->out1, id);
+                cur = inst->out;
+                continue;
+            }
+            if (inst->op == OP_LOOK && look_at(prog, (Look) inst->arg, input, at)) {
+                cur = inst->out;
+                continue;
+            }
+            if (inst->op == OP_BYTE) {
+                if (list_insert(list, cur)) {
+                    list->set_of[cur] = id;
+                } else if (list->set_of[cur] == id) {
+                    set_release(cache, id);
+                } else {
+                    const uint32_t merged = set_clone(cache, list->set_of[cur]);
+                    if (merged == NO_SET) {
+                        break;
+                    }
+                    set_merge(cache, merged, id);
+                    set_release(cache, list->set_of[cur]);
+                    set_release(cache, id);
+                    list->set_of[cur] = merged;
+                }
+                break;
+            }
+            set_release(cache, id);
+            break;
+        }
+    }
+}
+
+static void add(const Prog *prog, CountCache *cache, CountList *list, const Input *input, const size_t at,
+                const uint32_t pc, const uint32_t set) {
+    size_t top = 0;
+    push(cache, &top, pc, set);
+    follow(prog, cache, list, input, at, top);
+}
+
+// Expands the bodies of the counters reached during this step. A body is
+// not nullable, so this cannot reach another loop or leave the counter.
+static void flush(const Prog *prog, CountCache *cache, CountList *list, const Input *input, const size_t at) {
+    for (size_t i = 0; i < cache->npending; i++) {
+        const uint32_t k = cache->pending[i];
+        add(prog, cache, list, input, at, prog->insts[prog->counters[k].first].out, cache->body[k]);
+        cache->body[k] = NO_SET;
+    }
+    cache->npending = 0;
+}
+
+static void list_clear(CountCache *cache, CountList *list) {
+    for (size_t i = 0; i < list->size; i++) {
+        set_release(cache, list->set_of[list->dense[i]]);
+    }
+    list->size = 0;
+    list->stamp = ++cache->step;
+}
+
+CountSetResult countset_search(const Prog *prog, CountCache *cache, const Input *input, size_t *pos) {
+    const uint8_t *hay = (const uint8_t *) input->haystack;
+    CountList *clist = &cache->lists[0];
+    CountList *nlist = &cache->lists[1];
+    // A reversed program reads the span backwards, from its end.
+    const bool reverse = prog->reverse;
+    const size_t first = reverse ? input->end : input->start;
+    const size_t last = reverse ? input->start : input->end;
+    size_t found = NO_POS;
+
+    // Every set from an earlier search is free again.
+    cache->nsets = 0;
+    cache->nfree = 0;
+    for (size_t i = 0; i < cache->npending; i++) {
+        cache->body[cache->pending[i]] = NO_SET;
+    }
+    cache->npending = 0;
+    cache->failed = false;
+    clist->size = 0;
+    nlist->size = 0;
+    clist->stamp = ++cache->step;
+    nlist->stamp = ++cache->step;
+
+    for (size_t at = first;; at = reverse ? at - 1 : at + 1) {
+        if (!input->anchored || at == first) {
+            add(prog, cache, clist, input, at, prog->start, NO_SET);
+        }
+        flush(prog, cache, clist, input, at);
+        if (cache->failed) {
+            return COUNTSET_GAVE_UP;
+        }
+        if (clist->size == 0) {
+            break;
+        }
+
+        // The byte read on from here, or -1 at the far end of the span.
+        const int byte = at == last ? -1 : hay[reverse ? at - 1 : at];
+        // Threads that die on this byte drop their sets first, so that a
+        // set surviving along a single path is no longer shared and can be
+        // incremented in place.
+        for (size_t i = 0; i < clist->size; i++) {
+            const uint32_t pc = clist->dense[i];
+            const Inst *inst = &prog->insts[pc];
+            if (inst->op == OP_MATCH) {
+                found = at;
+                if (input->earliest) {
+                    *pos = at;
+                    return COUNTSET_MATCH;
+                }
+            }
+            if (inst->op != OP_BYTE || byte < inst->lo || byte > inst->hi) {
+                set_release(cache, clist->set_of[pc]);
+                clist->set_of[pc] = NO_SET;
+            }
+        }
+        for (size_t i = 0; i < clist->size; i++) {
+            const uint32_t pc = clist->dense[i];
+            const Inst *inst = &prog->insts[pc];
+            if (inst->op == OP_BYTE && inst->lo <= byte && byte <= inst->hi) {
+                const uint32_t id = clist->set_of[pc];
+                clist->set_of[pc] = NO_SET;
+                add(prog, cache, nlist, input, reverse ? at - 1 : at + 1, inst->out, id);
+            }
+        }
+        if (cache->failed) {
+            return COUNTSET_GAVE_UP;
+        }
+        if (at == last) {
+            break;
+        }
+
+        list_clear(cache, clist);
+        CountList *tmp = clist;
+        clist = nlist;
+        nlist = tmp;
+    }
+    if (found == NO_POS) {
+        return COUNTSET_NO_MATCH;
+    }
+    *pos = found;
+    return COUNTSET_MATCH;
+}
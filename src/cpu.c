@@ -0,0 +1,54 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cpu.h"
+
+static const char *names[] = {"scalar", "sse2", "ssse3", "avx2", "avx512"};
+
+static CpuLevel detected = CPU_LEVEL_COUNT;
+
+static CpuLevel detect(void) {
+    CpuLevel level = CPU_SCALAR;
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2")) {
+        level = CPU_SSE2;
+    }
+    if (level == CPU_SSE2 && __builtin_cpu_supports("ssse3")) {
+        level = CPU_SSSE3;
+    }
+    if (level == CPU_SSSE3 && __builtin_cpu_supports("avx2")) {
+        level = CPU_AVX2;
+    }
+    if (level == CPU_AVX2 && __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")) {
+        level = CPU_AVX512;
+    }
+#endif
+    const char *forced = getenv("C_REX_CPU");
+    if (!forced || !*forced) {
+        return level;
+    }
+    for (CpuLevel l = CPU_SCALAR; l < CPU_LEVEL_COUNT; l++) {
+        if (strcmp(forced, names[l]) == 0) {
+            return l < level ? l : level;
+        }
+    }
+    fprintf(stderr, "Unknown C_REX_CPU level '%s'\n", forced);
+    return level;
+}
+
+// Runs before main, so threads only ever read the level.
+__attribute__((constructor)) static void cpu_init(void) {
+    detected = detect();
+}
+
+CpuLevel cpu_level(void) {
+    if (detected == CPU_LEVEL_COUNT) {
+        detected = detect();
+    }
+    return detected;
+}
+
+const char *cpu_level_name(const CpuLevel level) {
+    return level < CPU_LEVEL_COUNT ? names[level] : "?";
+}
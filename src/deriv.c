@@ -0,0 +1,473 @@
+#include "deriv.h"
+#include "lexer.h"
+
+#define ROW_SIZE 256
+
+static uint32_t hash_term(const DerivTerm *t) {
+    uint32_t h = 2166136261U ^ (uint32_t) t->kind;
+    const uint32_t words[4] = {t->a, t->b, (uint32_t) t->min, (uint32_t) t->max};
+    for (size_t i = 0; i < 4; i++) {
+        h = (h ^ words[i]) * 16777619U;
+    }
+    if (t->kind == DERIV_CLASS) {
+        for (size_t i = 0; i < 4; i++) {
+            h = (h ^ (uint32_t) t->set.bits[i] ^ (uint32_t) (t->set.bits[i] >> 32)) * 16777619U;
+        }
+    }
+    return h;
+}
+
+static bool same_term(const DerivTerm *x, const DerivTerm *y) {
+    return x->kind == y->kind && x->a == y->a && x->b == y->b && x->min == y->min && x->max == y->max &&
+           (x->kind != DERIV_CLASS || byteset_equal(&x->set, &y->set));
+}
+
+static bool rehash(Deriv *d) {
+    const size_t size = d->table_size ? d->table_size * 2 : 64;
+    uint32_t *table = malloc(size * sizeof(uint32_t));
+    if (!table) {
+        return false;
+    }
+    free(d->table);
+    d->table = table;
+    d->table_size = size;
+    for (size_t i = 0; i < size; i++) {
+        d->table[i] = DERIV_NONE;
+    }
+
+    for (uint32_t id = 0; id < d->nterms; id++) {
+        size_t h = hash_term(&d->terms[id]) & (size - 1);
+        while (d->table[h] != DERIV_NONE) {
+            h = (h + 1) & (size - 1);
+        }
+        d->table[h] = id;
+    }
+    return true;
+}
+
+static bool nullable(const Deriv *d, const uint32_t t) {
+    return d->terms[t].nullable;
+}
+
+// Returns the id of the term equal to key, adding it if needed, or
+// DERIV_NONE when memory runs out.
+static uint32_t intern(Deriv *d, DerivTerm key) {
+    if ((d->nterms + 1) * 2 > d->table_size && !rehash(d)) {
+        fprintf(stderr, "Memory allocation failed\n");
+        return DERIV_NONE;
+    }
+
+    const size_t mask = d->table_size - 1;
+    size_t h = hash_term(&key) & mask;
+    while (d->table[h] != DERIV_NONE) {
+        if (same_term(&d->terms[d->table[h]], &key)) {
+            return d->table[h];
+        }
+        h = (h + 1) & mask;
+    }
+
+    switch (key.kind) {
+        case DERIV_EPSILON:
+        case DERIV_STAR:
+            key.nullable = true;
+            break;
+        case DERIV_CONCAT:
+        case DERIV_AND:
+            key.nullable = nullable(d, key.a) && nullable(d, key.b);
+            break;
+        case DERIV_ALT:
+            key.nullable = nullable(d, key.a) || nullable(d, key.b);
+            break;
+        case DERIV_REPEAT:
+            key.nullable = key.min == 0 || nullable(d, key.a);
+            break;
+        case DERIV_NOT:
+            key.nullable = !nullable(d, key.a);
+            break;
+        default:
+            key.nullable = false;
+            break;
+    }
+    key.row = DERIV_NONE;
+
+    if (d->nterms == d->capacity) {
+        const size_t capacity = d->capacity ? d->capacity * 2 : 64;
+        DerivTerm *terms = realloc(d->terms, capacity * sizeof(DerivTerm));
+        if (!terms) {
+            fprintf(stderr, "Memory allocation failed\n");
+            return DERIV_NONE;
+        }
+        d->terms = terms;
+        d->capacity = capacity;
+    }
+    const uint32_t id = (uint32_t) d->nterms++;
+    d->terms[id] = key;
+    d->table[h] = id;
+    return id;
+}
+
+static DerivTerm term_key(const DerivKind kind, const uint32_t a, const uint32_t b) {
+    DerivTerm key;
+    memset(&key, 0, sizeof(key));
+    key.kind = kind;
+    key.a = a;
+    key.b = b;
+    return key;
+}
+
+Deriv *deriv_new(void) {
+    Deriv *d = calloc(1, sizeof(Deriv));
+    if (!d) {
+        fprintf(stderr, "Memory allocation failed\n");
+        return NULL;
+    }
+    d->max_terms = DERIV_DEFAULT_MAX_TERMS;
+    d->nothing = intern(d, term_key(DERIV_NOTHING, 0, 0));
+    d->epsilon = intern(d, term_key(DERIV_EPSILON, 0, 0));
+    ByteSet all;
+    byteset_clear(&all);
+    byteset_add_range(&all, 0, 255);
+    d->any = deriv_class(d, &all);
+    d->universe = deriv_not(d, d->nothing);
+    if (d->nothing == DERIV_NONE || d->epsilon == DERIV_NONE || d->any == DERIV_NONE || d->universe == DERIV_NONE) {
+        deriv_free(d);
+        return NULL;
+    }
+    return d;
+}
+
+void deriv_free(Deriv *d) {
+    if (!d) {
+        return;
+    }
+    free(d->terms);
+    free(d->table);
+    free(d->rows);
+    free(d);
+}
+
+uint32_t deriv_class(Deriv *d, const ByteSet *set) {
+    if (byteset_count(set) == 0) {
+        return d->nothing;
+    }
+    DerivTerm key = term_key(DERIV_CLASS, 0, 0);
+    key.set = *set;
+    return intern(d, key);
+}
+
+uint32_t deriv_concat(Deriv *d, const uint32_t a, const uint32_t b) {
+    if (a == DERIV_NONE || b == DERIV_NONE) {
+        return DERIV_NONE;
+    }
+    if (a == d->nothing || b == d->nothing) {
+        return d->nothing;
+    }
+    if (a == d->epsilon) {
+        return b;
+    }
+    if (b == d->epsilon) {
+        return a;
+    }
+    if (d->terms[a].kind == DERIV_CONCAT) {
+        // Concatenations nest to the right.
+        const uint32_t head = d->terms[a].a;
+        return deriv_concat(d, head, deriv_concat(d, d->terms[a].b, b));
+    }
+    return intern(d, term_key(DERIV_CONCAT, a, b));
+}
+
+uint32_t deriv_star(Deriv *d, const uint32_t a) {
+    if (a == DERIV_NONE) {
+        return DERIV_NONE;
+    }
+    if (a == d->nothing || a == d->epsilon) {
+        return d->epsilon;
+    }
+    if (d->terms[a].kind == DERIV_STAR) {
+        return a;
+    }
+    return intern(d, term_key(DERIV_STAR, a, 0));
+}
+
+uint32_t deriv_repeat(Deriv *d, const uint32_t a, const int min, const int max) {
+    if (a == DERIV_NONE) {
+        return DERIV_NONE;
+    }
+    if (max == 0 || a == d->epsilon) {
+        return d->epsilon;
+    }
+    if (a == d->nothing) {
+        return min == 0 ? d->epsilon : d->nothing;
+    }
+    if (min == 0 && max == -1) {
+        return deriv_star(d, a);
+    }
+    if (min == 1 && max == 1) {
+        return a;
+    }
+    DerivTerm key = term_key(DERIV_REPEAT, a, 0);
+    key.min = min;
+    key.max = max;
+    return intern(d, key);
+}
+
+uint32_t deriv_not(Deriv *d, const uint32_t a) {
+    if (a == DERIV_NONE) {
+        return DERIV_NONE;
+    }
+    if (d->terms[a].kind == DERIV_NOT) {
+        return d->terms[a].a;
+    }
+    return intern(d, term_key(DERIV_NOT, a, 0));
+}
+
+static int compare_id(const void *x, const void *y) {
+    const uint32_t a = *(const uint32_t *) x;
+    const uint32_t b = *(const uint32_t *) y;
+    return (a > b) - (a < b);
+}
+
+// Appends the operands of an alternation or intersection; canonical ones
+// nest to the right with no operand of their own kind on the left.
+static size_t operands(const Deriv *d, uint32_t t, const DerivKind kind, uint32_t *out, size_t n) {
+    while (d->terms[t].kind == kind) {
+        out[n++] = d->terms[t].a;
+        t = d->terms[t].b;
+    }
+    out[n++] = t;
+    return n;
+}
+
+static size_t count_operands(const Deriv *d, uint32_t t, const DerivKind kind) {
+    size_t n = 1;
+    while (d->terms[t].kind == kind) {
+        n++;
+        t = d->terms[t].b;
+    }
+    return n;
+}
+
+// The canonical alternation (ALT) or intersection (AND) of a and b:
+// operands flattened, classes combined into one, sorted and deduplicated.
+static uint32_t combine(Deriv *d, const DerivKind kind, const uint32_t a, const uint32_t b) {
+    const bool alt = kind == DERIV_ALT;
+    const uint32_t absorbing = alt ? d->universe : d->nothing;
+    const uint32_t identity = alt ? d->nothing : d->universe;
+    if (a == DERIV_NONE || b == DERIV_NONE) {
+        return DERIV_NONE;
+    }
+    if (a == absorbing || b == absorbing) {
+        return absorbing;
+    }
+    if (a == identity || a == b) {
+        return b;
+    }
+    if (b == identity) {
+        return a;
+    }
+
+    uint32_t *ops = malloc((count_operands(d, a, kind) + count_operands(d, b, kind) + 1) * sizeof(uint32_t));
+    if (!ops) {
+        fprintf(stderr, "Memory allocation failed\n");
+        return DERIV_NONE;
+    }
+    size_t n = operands(d, b, kind, ops, operands(d, a, kind, ops, 0));
+
+    ByteSet set;
+    bool classes = false;
+    size_t kept = 0;
+    for (size_t i = 0; i < n; i++) {
+        const DerivTerm *t = &d->terms[ops[i]];
+        if (t->kind != DERIV_CLASS) {
+            ops[kept++] = ops[i];
+        } else if (!classes) {
+            set = t->set;
+            classes = true;
+        } else {
+            for (size_t w = 0; w < 4; w++) {
+                set.bits[w] = alt ? set.bits[w] | t->set.bits[w] : set.bits[w] & t->set.bits[w];
+            }
+        }
+    }
+    if (classes && (ops[kept++] = deriv_class(d, &set)) == DERIV_NONE) {
+        free(ops);
+        return DERIV_NONE;
+    }
+    n = kept;
+
+    qsort(ops, n, sizeof(uint32_t), compare_id);
+    kept = 0;
+    uint32_t result = identity;
+    for (size_t i = 0; i < n; i++) {
+        if (ops[i] == absorbing) {
+            free(ops);
+            return absorbing;
+        }
+        if (ops[i] != identity && (kept == 0 || ops[kept - 1] != ops[i])) {
+            ops[kept++] = ops[i];
+        }
+    }
+    if (kept > 0) {
+        result = ops[kept - 1];
+        for (size_t i = kept - 1; result != DERIV_NONE && i-- > 0;) {
+            result = intern(d, term_key(kind, ops[i], result));
+        }
+    }
+    free(ops);
+    return result;
+}
+
+uint32_t deriv_alt(Deriv *d, const uint32_t a, const uint32_t b) {
+    return combine(d, DERIV_ALT, a, b);
+}
+
+uint32_t deriv_and(Deriv *d, const uint32_t a, const uint32_t b) {
+    return combine(d, DERIV_AND, a, b);
+}
+
+uint32_t deriv_from_hir(Deriv *d, const Hir *hir) {
+    uint32_t result, sub;
+
+    switch (hir->kind) {
+        case HIR_EMPTY:
+            return d->epsilon;
+        case HIR_CLASS:
+            return deriv_class(d, &hir->set);
+        case HIR_CAPTURE:
+            return deriv_from_hir(d, hir->sub[0]);
+        case HIR_CONCAT:
+            result = d->epsilon;
+            for (size_t i = hir->sub_count; i-- > 0;) {
+                if ((sub = deriv_from_hir(d, hir->sub[i])) == DERIV_NONE) {
+                    return DERIV_NONE;
+                }
+                result = deriv_concat(d, sub, result);
+            }
+            return result;
+        case HIR_ALT:
+            result = d->nothing;
+            for (size_t i = 0; i < hir->sub_count; i++) {
+                if ((sub = deriv_from_hir(d, hir->sub[i])) == DERIV_NONE) {
+                    return DERIV_NONE;
+                }
+                result = deriv_alt(d, result, sub);
+            }
+            return result;
+        case HIR_REPEAT:
+            if ((sub = deriv_from_hir(d, hir->sub[0])) == DERIV_NONE) {
+                return DERIV_NONE;
+            }
+            return deriv_repeat(d, sub, hir->min, hir->max);
+        default:
+            return DERIV_NONE;
+    }
+}
+
+uint32_t deriv_parse(Deriv *d, const char *pattern) {
+    Node *ast = build_syntax_tree(pattern);
+    size_t capture_count;
+    Hir *hir = hir_from_ast(ast, &capture_count);
+    free_node(ast);
+    if (!hir) {
+        return DERIV_NONE;
+    }
+    const uint32_t t = deriv_from_hir(d, hir);
+    hir_free(hir);
+    return t;
+}
+
+static uint32_t derive(Deriv *d, const uint32_t t, const uint8_t b) {
+    // A copy, since building terms may move the array.
+    const DerivTerm term = d->terms[t];
+    uint32_t r;
+
+    switch (term.kind) {
+        case DERIV_CLASS:
+            return byteset_contains(&term.set, b) ? d->epsilon : d->nothing;
+        case DERIV_CONCAT:
+            r = deriv_concat(d, derive(d, term.a, b), term.b);
+            return nullable(d, term.a) ? deriv_alt(d, r, derive(d, term.b, b)) : r;
+        case DERIV_STAR:
+            return deriv_concat(d, derive(d, term.a, b), t);
+        case DERIV_REPEAT:
+            // With a nullable body the derivative of the rest adds nothing.
+            r = deriv_repeat(d, term.a, term.min > 0 ? term.min - 1 : 0, term.max < 0 ? -1 : term.max - 1);
+            return deriv_concat(d, derive(d, term.a, b), r);
+        case DERIV_ALT:
+            r = derive(d, term.a, b);
+            return deriv_alt(d, r, derive(d, term.b, b));
+        case DERIV_AND:
+            r = derive(d, term.a, b);
+            return deriv_and(d, r, derive(d, term.b, b));
+        case DERIV_NOT:
+            return deriv_not(d, derive(d, term.a, b));
+        default:
+            return d->nothing;
+    }
+}
+
+uint32_t deriv_step(Deriv *d, const uint32_t t, const uint8_t b) {
+    uint32_t row = d->terms[t].row;
+    if (row != DERIV_NONE && d->rows[row * ROW_SIZE + b] != DERIV_NONE) {
+        return d->rows[row * ROW_SIZE + b];
+    }
+    if (d->nterms >= d->max_terms) {
+        return DERIV_NONE;
+    }
+
+    const uint32_t next = derive(d, t, b);
+    if (next == DERIV_NONE) {
+        return DERIV_NONE;
+    }
+    if (row == DERIV_NONE) {
+        if (d->nrows == d->rows_capacity) {
+            const size_t capacity = d->rows_capacity ? d->rows_capacity * 2 : 16;
+            uint32_t *rows = realloc(d->rows, capacity * ROW_SIZE * sizeof(uint32_t));
+            if (!rows) {
+                fprintf(stderr, "Memory allocation failed\n");
+                return DERIV_NONE;
+            }
+            d->rows = rows;
+            d->rows_capacity = capacity;
+        }
+        row = (uint32_t) d->nrows++;
+        memset(d->rows + row * ROW_SIZE, 0xFF, ROW_SIZE * sizeof(uint32_t));
+        d->terms[t].row = row;
+    }
+    d->rows[row * ROW_SIZE + b] = next;
+    return next;
+}
+
+DerivResult deriv_search(Deriv *d, const uint32_t t, const Input *input, size_t *end) {
+    const uint8_t *hay = (const uint8_t *) input->haystack;
+    // Unanchored, any prefix may come first.
+    uint32_t s = input->anchored ? t : deriv_concat(d, deriv_star(d, d->any), t);
+    size_t last = NO_POS;
+    if (s == DERIV_NONE) {
+        return DERIV_GAVE_UP;
+    }
+
+    for (size_t at = input->start;; at++) {
+        if (d->terms[s].nullable) {
+            last = at;
+            if (input->earliest) {
+                break;
+            }
+        }
+        if (at == input->end || s == d->nothing) {
+            break;
+        }
+        const uint32_t row = d->terms[s].row;
+        const uint32_t next = row != DERIV_NONE ? d->rows[row * ROW_SIZE + hay[at]] : DERIV_NONE;
+        s = next != DERIV_NONE ? next : deriv_step(d, s, hay[at]);
+        if (s == DERIV_NONE) {
+            return DERIV_GAVE_UP;
+        }
+    }
+
+    if (last == NO_POS) {
+        return DERIV_NO_MATCH;
+    }
+    *end = last;
+    return DERIV_MATCH;
+}
@@ -0,0 +1,766 @@
+#include "dfa.h"
+
+#define END_OF_INPUT(dfa) ((dfa)->stride - 1)
+
+static int compare_pc(const void *a, const void *b) {
+    const uint32_t x = *(const uint32_t *) a;
+    const uint32_t y = *(const uint32_t *) b;
+    return (x > y) - (x < y);
+}
+
+Dfa *dfa_build(const Prog *prog, const bool longest) {
+    if (prog->ncounters > 0) {
+        // A state would have to carry every live count.
+        return NULL;
+    }
+    Dfa *dfa = calloc(1, sizeof(Dfa));
+    if (!dfa) {
+        fprintf(stderr, "Memory allocation failed\n");
+        return NULL;
+    }
+    dfa->prog = prog;
+    dfa->longest = longest;
+    dfa->accelerate = true;
+    dfa->adapt_prefilter = true;
+    dfa->word_quit = (prog->looks & LOOK_WORD_BITS) != 0;
+    needles_select(&dfa->scan, cpu_level());
+    dfa->stride = prog->nclasses + 1;
+    for (int b = 255; b >= 0; b--) {
+        dfa->class_rep[prog->byte_class[b]] = (uint8_t) b;
+    }
+    return dfa;
+}
+
+void dfa_free(Dfa *dfa) {
+    free(dfa);
+}
+
+bool dfa_cache_init(DfaCache *cache, const Dfa *dfa, const size_t memory_limit) {
+    const size_t n = dfa->prog->length;
+    memset(cache, 0, sizeof(DfaCache));
+    cache->memory_limit = memory_limit;
+    cache->dense = malloc(n * sizeof(uint32_t));
+    cache->sparse = malloc(n * sizeof(uint32_t));
+    cache->stack = malloc((n + 1) * sizeof(uint32_t));
+    cache->list = malloc(n * sizeof(uint32_t));
+    cache->resolved = malloc(n * sizeof(uint32_t));
+    memset(cache->start, 0xFF, sizeof(cache->start));
+    if (!cache->dense || !cache->sparse || !cache->stack || !cache->list || !cache->resolved) {
+        fprintf(stderr, "Memory allocation failed\n");
+        dfa_cache_free(cache);
+        return false;
+    }
+    return true;
+}
+
+void dfa_cache_free(DfaCache *cache) {
+    free(cache->trans);
+    free(cache->states);
+    free(cache->pool);
+    free(cache->table);
+    free(cache->dense);
+    free(cache->sparse);
+    free(cache->stack);
+    free(cache->list);
+    free(cache->resolved);
+    memset(cache, 0, sizeof(DfaCache));
+}
+
+static size_t memory_usage(const Dfa *dfa, const DfaCache *cache) {
+    return cache->nstates * (dfa->stride * sizeof(uint32_t) + sizeof(DfaState)) +
+           cache->pool_length * sizeof(uint32_t) + cache->table_size * sizeof(uint32_t);
+}
+
+// Whether the cache must be cleared before it takes another state: it is
+// over its memory limit, or premultiplied ids would run into the tags.
+static bool cache_full(const Dfa *dfa, const DfaCache *cache) {
+    return memory_usage(dfa, cache) > cache->memory_limit || (cache->nstates + 1) * dfa->stride > DFA_OFFSET_MASK;
+}
+
+static uint32_t hash_list(const uint32_t *list, const size_t n, const bool is_match, const uint8_t look) {
+    uint32_t h = 2166136261U ^ (uint32_t) is_match ^ ((uint32_t) look << 1);
+    for (size_t i = 0; i < n; i++) {
+        h = (h ^ list[i]) * 16777619U;
+    }
+    return h;
+}
+
+static bool rehash(DfaCache *cache) {
+    const size_t size = cache->table_size ? cache->table_size * 2 : 64;
+    uint32_t *table = malloc(size * sizeof(uint32_t));
+    if (!table) {
+        fprintf(stderr, "Memory allocation failed\n");
+        return false;
+    }
+    free(cache->table);
+    cache->table = table;
+    cache->table_size = size;
+    for (size_t i = 0; i < size; i++) {
+        cache->table[i] = DFA_UNKNOWN;
+    }
+
+    for (uint32_t id = 0; id < cache->nstates; id++) {
+        const DfaState *st = &cache->states[id];
+        size_t h = hash_list(cache->pool + st->offset, st->ninsts, st->is_match, st->look) & (size - 1);
+        while (cache->table[h] != DFA_UNKNOWN) {
+            h = (h + 1) & (size - 1);
+        }
+        cache->table[h] = id;
+    }
+    return true;
+}
+
+// Returns the id of the state with this thread list, adding it if needed,
+// or DFA_UNKNOWN when memory runs out.
+static uint32_t intern(const Dfa *dfa, DfaCache *cache, const uint32_t *list, const size_t n, const bool is_match,
+                       const uint8_t look) {
+    if ((cache->nstates + 1) * 2 > cache->table_size && !rehash(cache)) {
+        return DFA_UNKNOWN;
+    }
+
+    const size_t mask = cache->table_size - 1;
+    size_t h = hash_list(list, n, is_match, look) & mask;
+    while (cache->table[h] != DFA_UNKNOWN) {
+        const uint32_t id = cache->table[h];
+        const DfaState *st = &cache->states[id];
+        if (st->is_match == is_match && st->look == look && st->ninsts == n &&
+            memcmp(cache->pool + st->offset, list, n * sizeof(uint32_t)) == 0) {
+            return id;
+        }
+        h = (h + 1) & mask;
+    }
+
+    if (cache->nstates == cache->state_capacity) {
+        const size_t capacity = cache->state_capacity ? cache->state_capacity * 2 : 16;
+        DfaState *states = realloc(cache->states, capacity * sizeof(DfaState));
+        if (states) {
+            cache->states = states;
+        }
+        uint32_t *trans = states ? realloc(cache->trans, capacity * dfa->stride * sizeof(uint32_t)) : NULL;
+        if (!trans) {
+            fprintf(stderr, "Memory allocation failed\n");
+            return DFA_UNKNOWN;
+        }
+        cache->trans = trans;
+        cache->state_capacity = capacity;
+    }
+    if (cache->pool_length + n > cache->pool_capacity) {
+        size_t capacity = cache->pool_capacity;
+        while (cache->pool_length + n > capacity) {
+            capacity = capacity ? capacity * 2 : 256;
+        }
+        uint32_t *pool = realloc(cache->pool, capacity * sizeof(uint32_t));
+        if (!pool) {
+            fprintf(stderr, "Memory allocation failed\n");
+            return DFA_UNKNOWN;
+        }
+        cache->pool = pool;
+        cache->pool_capacity = capacity;
+    }
+
+    const uint32_t id = (uint32_t) cache->nstates++;
+    DfaState *st = &cache->states[id];
+    st->offset = (uint32_t) cache->pool_length;
+    st->ninsts = (uint32_t) n;
+    st->is_match = is_match;
+    st->look = look;
+    st->is_start = false;
+    // Every byte of a matching loop moves the match end, so match states
+    // are never accelerated.
+    st->accel = dfa->accelerate && id != DFA_DEAD && !is_match ? DFA_ACCEL_UNKNOWN : DFA_ACCEL_NONE;
+    st->jumps = 0;
+    st->skipped = 0;
+    if (n > 0) {
+        memcpy(cache->pool + cache->pool_length, list, n * sizeof(uint32_t));
+        cache->pool_length += n;
+    }
+
+    uint32_t *row = cache->trans + id * dfa->stride;
+    for (size_t c = 0; c < dfa->stride; c++) {
+        row[c] = id == DFA_DEAD ? DFA_DEAD_TAG : DFA_UNKNOWN;
+    }
+    cache->table[h] = id;
+    return id;
+}
+
+// Returns false when even the dead state cannot be stored.
+static bool reset(const Dfa *dfa, DfaCache *cache) {
+    cache->nstates = 0;
+    cache->pool_length = 0;
+    for (size_t i = 0; i < cache->table_size; i++) {
+        cache->table[i] = DFA_UNKNOWN;
+    }
+    memset(cache->start, 0xFF, sizeof(cache->start));
+    return intern(dfa, cache, NULL, 0, false, 0) != DFA_UNKNOWN;
+}
+
+// Appends the epsilon closure of pc to list in priority order. Assertions
+// in `holds` are passed, others fail; unless `resolve` is set, those that
+// depend on the next byte are appended to wait for it. Returns true when a
+// match was appended and the list must be cut there.
+static bool closure(const Dfa *dfa, DfaCache *cache, uint32_t *list, size_t *n, const uint32_t pc,
+                    const uint32_t holds, const bool resolve) {
+    const Prog *prog = dfa->prog;
+    size_t top = 0;
+
+    cache->stack[top++] = pc;
+    while (top > 0) {
+        uint32_t cur = cache->stack[--top];
+        for (;;) {
+            const uint32_t i = cache->sparse[cur];
+            if (i < cache->set_size && cache->dense[i] == cur) {
+                break;
+            }
+            cache->sparse[cur] = (uint32_t) cache->set_size;
+            cache->dense[cache->set_size++] = cur;
+
+            const Inst *inst = &prog->insts[cur];
+            if (inst->op == OP_SPLIT) {
+                cache->stack[top++] = inst->out1;
+                cur = inst->out;
+            } else if (inst->op == OP_SAVE) {
+                cur = inst->out;
+            } else if (inst->op == OP_LOOK) {
+                if (!resolve && inst->arg != LOOK_START) {
+                    list[(*n)++] = cur;
+                    break;
+                }
+                if (!(holds & LOOK_BIT(inst->arg))) {
+                    break;
+                }
+                cur = inst->out;
+            } else if (inst->op == OP_BYTE) {
+                list[(*n)++] = cur;
+                break;
+            } else if (inst->op == OP_MATCH) {
+                list[(*n)++] = cur;
+                if (!dfa->longest) {
+                    return true;
+                }
+                break;
+            } else {
+                break;
+            }
+        }
+    }
+    return false;
+}
+
+// Interns the list just built. Its look-behind context only tells states
+// apart while assertions are waiting in the list.
+static uint32_t finish_state(const Dfa *dfa, DfaCache *cache, const size_t n, const bool is_match, uint8_t look) {
+    bool pending = false;
+    for (size_t i = 0; i < n && !pending; i++) {
+        pending = dfa->prog->insts[cache->list[i]].op == OP_LOOK;
+    }
+    look = pending ? look | DFA_HAS_LOOKS : 0;
+    if (dfa->longest) {
+        qsort(cache->list, n, sizeof(uint32_t), compare_pc);
+    }
+    return intern(dfa, cache, cache->list, n, is_match, look);
+}
+
+static bool is_word_byte(const Dfa *dfa, const size_t cls) {
+    return cls != END_OF_INPUT(dfa) && is_word_rune(dfa->class_rep[cls]);
+}
+
+static uint32_t next_state(const Dfa *dfa, DfaCache *cache, const uint32_t s, const size_t cls) {
+    const Prog *prog = dfa->prog;
+    const DfaState st = cache->states[s];
+    const uint8_t byte = dfa->class_rep[cls];
+    const uint32_t *threads = cache->pool + st.offset;
+    size_t nthreads = st.ninsts;
+    bool is_match = false;
+    size_t n = 0;
+
+    if (st.look & DFA_HAS_LOOKS) {
+        // With the next byte known, every waiting assertion can be decided.
+        uint32_t holds = (st.look & DFA_AFTER_WORD) != 0 ? LOOK_BIT(LOOK_WORD) : LOOK_BIT(LOOK_NOT_WORD);
+        if (is_word_byte(dfa, cls)) {
+            holds ^= LOOK_WORD_BITS;
+        }
+        if (st.look & DFA_AT_START) {
+            holds |= LOOK_BIT(LOOK_START);
+        }
+        if (cls == END_OF_INPUT(dfa)) {
+            holds |= LOOK_BIT(LOOK_END);
+        }
+        cache->set_size = 0;
+        nthreads = 0;
+        for (uint32_t i = 0; i < st.ninsts; i++) {
+            if (closure(dfa, cache, cache->resolved, &nthreads, threads[i], holds, true)) {
+                break;
+            }
+        }
+        threads = cache->resolved;
+    }
+
+    cache->set_size = 0;
+    for (size_t i = 0; i < nthreads; i++) {
+        const Inst *inst = &prog->insts[threads[i]];
+        if (inst->op == OP_MATCH) {
+            is_match = true;
+            if (!dfa->longest) {
+                break;
+            }
+            continue;
+        }
+        if (cls == END_OF_INPUT(dfa) || byte < inst->lo || byte > inst->hi) {
+            continue;
+        }
+        if (closure(dfa, cache, cache->list, &n, inst->out, 0, false)) {
+            // The rest is cut, but a match at the end of the list still
+            // ends before this byte.
+            is_match = prog->insts[threads[nthreads - 1]].op == OP_MATCH;
+            break;
+        }
+    }
+
+    const uint8_t look = dfa->word_quit && is_word_byte(dfa, cls) ? DFA_AFTER_WORD : 0;
+    return finish_state(dfa, cache, n, is_match, look);
+}
+
+// Returns DFA_UNKNOWN when memory runs out.
+static uint32_t start_state(const Dfa *dfa, DfaCache *cache, const bool anchored, const uint8_t look) {
+    if ((cache->table_size == 0 || cache_full(dfa, cache)) && !reset(dfa, cache)) {
+        return DFA_UNKNOWN;
+    }
+    if (cache->start[anchored][look] == DFA_UNKNOWN) {
+        size_t n = 0;
+        cache->set_size = 0;
+        closure(dfa, cache, cache->list, &n, anchored ? dfa->prog->start : dfa->prog->start_unanchored,
+                look & DFA_AT_START ? LOOK_BIT(LOOK_START) : 0, false);
+        const uint32_t id = finish_state(dfa, cache, n, false, look);
+        if (id == DFA_UNKNOWN) {
+            return DFA_UNKNOWN;
+        }
+        if (!anchored && dfa->prefilter) {
+            // The prefilter jumps over this state's self-loops instead.
+            cache->states[id].is_start = true;
+            cache->states[id].accel = DFA_ACCEL_NONE;
+        }
+        cache->start[anchored][look] = id;
+    }
+    return cache->start[anchored][look];
+}
+
+// The look-behind context of a scan that begins at the start of the
+// haystack (in scan order) or just past the byte at `prev`. Returns false
+// when the DFA cannot tell whether that byte belongs to a word.
+static bool start_look(const Dfa *dfa, const Input *input, const bool at_start, const size_t prev,
+                       uint8_t *look) {
+    *look = at_start ? DFA_AT_START : 0;
+    if (!dfa->word_quit || at_start) {
+        return true;
+    }
+    const uint8_t byte = (uint8_t) input->haystack[prev];
+    if (byte >= 0x80) {
+        return false;
+    }
+    if (is_word_rune(byte)) {
+        *look |= DFA_AFTER_WORD;
+    }
+    return true;
+}
+
+// The transition from state s to state next as the table stores it.
+static uint32_t tag(const Dfa *dfa, const DfaCache *cache, const uint32_t s, const uint32_t next) {
+    uint32_t t = next * (uint32_t) dfa->stride;
+    if (next == DFA_DEAD) {
+        t |= DFA_DEAD_TAG;
+    }
+    if (cache->states[next].is_match) {
+        t |= DFA_MATCH_TAG;
+    }
+    if (cache->states[next].is_start) {
+        t |= DFA_START_TAG;
+    }
+    if (next == s && cache->states[s].accel != DFA_ACCEL_NONE) {
+        t |= DFA_ACCEL_TAG;
+    }
+    return t;
+}
+
+// Computes a missing transition out of the state at offset *s, clearing
+// the cache first when it is full. Gives up (DFA_QUIT_TAG) on bytes the
+// DFA cannot handle, when clears keep coming without progress and when
+// memory runs out.
+static uint32_t slow_transition(const Dfa *dfa, DfaCache *cache, uint32_t *s, const size_t cls, const size_t scanned) {
+    const uint32_t stride = (uint32_t) dfa->stride;
+    if (dfa->word_quit && cls != END_OF_INPUT(dfa) && dfa->class_rep[cls] >= 0x80) {
+        cache->trans[*s + cls] = DFA_QUIT_TAG;
+        return DFA_QUIT_TAG;
+    }
+    if (cache_full(dfa, cache)) {
+        if (cache->clears >= 3 && scanned - cache->scanned < 10 * cache->nstates) {
+            return DFA_QUIT_TAG;
+        }
+        const DfaState st = cache->states[*s / stride];
+        memcpy(cache->stack, cache->pool + st.offset, st.ninsts * sizeof(uint32_t));
+        const uint32_t id = reset(dfa, cache) ? intern(dfa, cache, cache->stack, st.ninsts, st.is_match, st.look)
+                                              : DFA_UNKNOWN;
+        if (id == DFA_UNKNOWN) {
+            return DFA_QUIT_TAG;
+        }
+        *s = id * stride;
+        cache->clears++;
+        cache->scanned = scanned;
+        // Marks the start state again, before transitions into it exist.
+        if (dfa->prefilter && !cache_full(dfa, cache) && start_state(dfa, cache, false, 0) == DFA_UNKNOWN) {
+            return DFA_QUIT_TAG;
+        }
+    }
+
+    const uint32_t id = *s / stride;
+    const uint32_t next_id = next_state(dfa, cache, id, cls);
+    if (next_id == DFA_UNKNOWN) {
+        return DFA_QUIT_TAG;
+    }
+    const uint32_t next = tag(dfa, cache, id, next_id);
+    cache->trans[*s + cls] = next;
+    return next;
+}
+
+// Fills in the row of state s and decides whether it can be accelerated.
+// Gives up rather than clear a full cache, since the scan still holds s,
+// and when memory runs out.
+// Only the self-loops of an accelerated state keep DFA_ACCEL_TAG.
+static void accelerate(const Dfa *dfa, DfaCache *cache, const uint32_t s) {
+    const uint32_t self = s * (uint32_t) dfa->stride;
+    uint8_t accel = DFA_ACCEL_ON;
+    size_t n = 0;
+    cache->states[s].accel = DFA_ACCEL_NONE;
+
+    for (size_t cls = 0; cls < END_OF_INPUT(dfa); cls++) {
+        if (cache->trans[self + cls] != DFA_UNKNOWN) {
+            continue;
+        }
+        if (dfa->word_quit && dfa->class_rep[cls] >= 0x80) {
+            cache->trans[self + cls] = DFA_QUIT_TAG;
+            continue;
+        }
+        if (cache_full(dfa, cache)) {
+            accel = DFA_ACCEL_NONE;
+            break;
+        }
+        const uint32_t next = next_state(dfa, cache, s, cls);
+        if (next == DFA_UNKNOWN) {
+            accel = DFA_ACCEL_NONE;
+            break;
+        }
+        cache->trans[self + cls] = tag(dfa, cache, s, next);
+    }
+
+    uint32_t *row = cache->trans + self;
+    for (unsigned b = 0; b < 256 && accel != DFA_ACCEL_NONE; b++) {
+        if ((row[dfa->prog->byte_class[b]] & ~DFA_ACCEL_TAG) == self) {
+            continue;
+        }
+        if (b >= 0x80) {
+            accel |= DFA_ACCEL_HIGH;
+        } else if (n == NEEDLES_MAX) {
+            accel = DFA_ACCEL_NONE;
+        } else {
+            cache->states[s].needles[n++] = (uint8_t) b;
+        }
+    }
+    cache->states[s].accel = accel == DFA_ACCEL_NONE ? DFA_ACCEL_NONE : (uint8_t) (accel | n);
+
+    for (size_t c = 0; c < dfa->stride; c++) {
+        if (row[c] != DFA_UNKNOWN && (row[c] & ~DFA_ACCEL_TAG) == self) {
+            row[c] = accel == DFA_ACCEL_NONE ? self : self | DFA_ACCEL_TAG;
+        }
+    }
+}
+
+// Returns the first position in [at, end) whose byte may leave the
+// accelerated state st, or end.
+static size_t skip_fwd(const Dfa *dfa, const DfaState *st, const uint8_t *hay, const size_t at, const size_t end) {
+    const bool high = (st->accel & DFA_ACCEL_HIGH) != 0;
+    return needles_find(&dfa->scan, st->needles, st->accel & DFA_ACCEL_NEEDLES, high, hay, at, end);
+}
+
+// Returns the position just past the last byte in [start, at) that may
+// leave the accelerated state st, or start.
+static size_t skip_rev(const Dfa *dfa, const DfaState *st, const uint8_t *hay, const size_t start,
+                       const size_t at) {
+    const bool high = (st->accel & DFA_ACCEL_HIGH) != 0;
+    return needles_rfind(&dfa->scan, st->needles, st->accel & DFA_ACCEL_NEEDLES, high, hay, start, at);
+}
+
+// Whether s, whose self-loop the scan just took, is accelerated. The
+// first self-loop taken decides it for good.
+static bool accelerated(const Dfa *dfa, DfaCache *cache, const uint32_t s) {
+    if (cache->states[s].accel == DFA_ACCEL_UNKNOWN) {
+        accelerate(dfa, cache, s);
+    }
+    return cache->states[s].accel != DFA_ACCEL_NONE;
+}
+
+static void count_jump(DfaCache *cache, const uint32_t s, const size_t skipped) {
+    cache->states[s].jumps++;
+    cache->states[s].skipped += skipped;
+    cache->accel_jumps++;
+    cache->accel_skipped += skipped;
+}
+
+DfaResult dfa_search_fwd(const Dfa *dfa, DfaCache *cache, const Input *input, size_t *end) {
+    const uint8_t *hay = (const uint8_t *) input->haystack;
+    const uint8_t *byte_class = dfa->prog->byte_class;
+    const uint32_t stride = (uint32_t) dfa->stride;
+    size_t last = NO_POS;
+    PrefilterState pf;
+    prefilter_state_init(&pf);
+    // Whether the scan is looking into a prefilter candidate.
+    bool candidate = false;
+
+    uint8_t look;
+    if (!start_look(dfa, input, input->start == 0, input->start - 1, &look)) {
+        return DFA_GAVE_UP;
+    }
+    cache->clears = 0;
+    cache->scanned = 0;
+    const uint32_t initial = start_state(dfa, cache, input->anchored, look);
+    if (initial == DFA_UNKNOWN) {
+        return DFA_GAVE_UP;
+    }
+    uint32_t s = initial * stride;
+    const uint32_t *trans = cache->trans;
+    size_t at = input->start;
+    while (at < input->end) {
+        // Four bytes at a time until a transition is special.
+        while (at + 4 <= input->end) {
+            const uint32_t a = trans[s + byte_class[hay[at]]];
+            if (a >= DFA_SPECIAL) {
+                break;
+            }
+            const uint32_t b = trans[a + byte_class[hay[at + 1]]];
+            if (b >= DFA_SPECIAL) {
+                s = a;
+                at += 1;
+                break;
+            }
+            const uint32_t c = trans[b + byte_class[hay[at + 2]]];
+            if (c >= DFA_SPECIAL) {
+                s = b;
+                at += 2;
+                break;
+            }
+            const uint32_t d = trans[c + byte_class[hay[at + 3]]];
+            if (d >= DFA_SPECIAL) {
+                s = c;
+                at += 3;
+                break;
+            }
+            s = d;
+            at += 4;
+        }
+        if (at == input->end) {
+            break;
+        }
+
+        const size_t cls = byte_class[hay[at]];
+        uint32_t next = trans[s + cls];
+        if (next == DFA_UNKNOWN) {
+            next = slow_transition(dfa, cache, &s, cls, at - input->start);
+        }
+        if (next == DFA_QUIT_TAG) {
+            return DFA_GAVE_UP;
+        }
+        if ((next & DFA_START_TAG) && prefilter_active(&pf, at + 1)) {
+            // Back in the start state, nothing is under way: no match can
+            // start before the prefilter's next candidate.
+            size_t to = prefilter_find(dfa->prefilter, hay, at + 1, input->end);
+            if (to == NO_POS) {
+                to = input->end;
+            }
+            cache->prefilter_jumps++;
+            cache->prefilter_skipped += to - at - 1;
+            if (dfa->adapt_prefilter) {
+                prefilter_record(&pf, at + 1, to);
+                cache->prefilter_pauses += pf.paused_until != 0;
+            }
+            candidate = true;
+            trans = cache->trans;
+            s = next & DFA_OFFSET_MASK;
+            at = to;
+            continue;
+        }
+        if (next & DFA_START_TAG) {
+            candidate = false;
+        }
+        if ((next & DFA_ACCEL_TAG) && accelerated(dfa, cache, s / stride)) {
+            const size_t to = skip_fwd(dfa, &cache->states[s / stride], hay, at + 1, input->end);
+            count_jump(cache, s / stride, to - at - 1);
+            trans = cache->trans;
+            at = to;
+            continue;
+        }
+        trans = cache->trans;
+        s = next & DFA_OFFSET_MASK;
+        if (next & DFA_MATCH_TAG) {
+            last = at;
+            if (candidate) {
+                pf.confirmed++;
+                cache->prefilter_confirmed++;
+                candidate = false;
+            }
+            if (input->earliest) {
+                break;
+            }
+        }
+        if (next & DFA_DEAD_TAG) {
+            break;
+        }
+        at++;
+    }
+
+    if (at == input->end) {
+        // Assertions at the end of the span still see the byte after it.
+        const size_t cls = at < input->length ? byte_class[hay[at]] : END_OF_INPUT(dfa);
+        uint32_t next = cache->trans[s + cls];
+        if (next == DFA_UNKNOWN) {
+            next = slow_transition(dfa, cache, &s, cls, at - input->start);
+        }
+        if (next == DFA_QUIT_TAG) {
+            return DFA_GAVE_UP;
+        }
+        if (next & DFA_MATCH_TAG) {
+            last = input->end;
+        }
+    }
+
+    cache->stop = at;
+    if (last == NO_POS) {
+        return DFA_NO_MATCH;
+    }
+    *end = last;
+    return DFA_MATCH;
+}
+
+DfaResult dfa_search_rev(const Dfa *dfa, DfaCache *cache, const Input *input, size_t *start) {
+    const uint8_t *hay = (const uint8_t *) input->haystack;
+    const uint8_t *byte_class = dfa->prog->byte_class;
+    const uint32_t stride = (uint32_t) dfa->stride;
+    size_t last = NO_POS;
+
+    uint8_t look;
+    if (!start_look(dfa, input, input->end == input->length, input->end, &look)) {
+        return DFA_GAVE_UP;
+    }
+    cache->clears = 0;
+    cache->scanned = 0;
+    const uint32_t initial = start_state(dfa, cache, input->anchored, look);
+    if (initial == DFA_UNKNOWN) {
+        return DFA_GAVE_UP;
+    }
+    uint32_t s = initial * stride;
+    const uint32_t *trans = cache->trans;
+    size_t at = input->end;
+    while (at > input->start) {
+        while (at >= input->start + 4) {
+            const uint32_t a = trans[s + byte_class[hay[at - 1]]];
+            if (a >= DFA_SPECIAL) {
+                break;
+            }
+            const uint32_t b = trans[a + byte_class[hay[at - 2]]];
+            if (b >= DFA_SPECIAL) {
+                s = a;
+                at -= 1;
+                break;
+            }
+            const uint32_t c = trans[b + byte_class[hay[at - 3]]];
+            if (c >= DFA_SPECIAL) {
+                s = b;
+                at -= 2;
+                break;
+            }
+            const uint32_t d = trans[c + byte_class[hay[at - 4]]];
+            if (d >= DFA_SPECIAL) {
+                s = c;
+                at -= 3;
+                break;
+            }
+            s = d;
+            at -= 4;
+        }
+        if (at == input->start) {
+            break;
+        }
+
+        const size_t cls = byte_class[hay[at - 1]];
+        uint32_t next = trans[s + cls];
+        if (next == DFA_UNKNOWN) {
+            next = slow_transition(dfa, cache, &s, cls, input->end - at);
+        }
+        if (next == DFA_QUIT_TAG) {
+            return DFA_GAVE_UP;
+        }
+        if ((next & DFA_ACCEL_TAG) && accelerated(dfa, cache, s / stride)) {
+            const size_t to = skip_rev(dfa, &cache->states[s / stride], hay, input->start, at - 1);
+            count_jump(cache, s / stride, at - 1 - to);
+            trans = cache->trans;
+            at = to;
+            continue;
+        }
+        trans = cache->trans;
+        s = next & DFA_OFFSET_MASK;
+        if (next & DFA_MATCH_TAG) {
+            last = at;
+            if (input->earliest) {
+                break;
+            }
+        }
+        if (next & DFA_DEAD_TAG) {
+            break;
+        }
+        at--;
+    }
+
+    if (at == input->start) {
+        const size_t cls = at > 0 ? byte_class[hay[at - 1]] : END_OF_INPUT(dfa);
+        uint32_t next = cache->trans[s + cls];
+        if (next == DFA_UNKNOWN) {
+            next = slow_transition(dfa, cache, &s, cls, input->end - at);
+        }
+        if (next == DFA_QUIT_TAG) {
+            return DFA_GAVE_UP;
+        }
+        if (next & DFA_MATCH_TAG) {
+            last = input->start;
+        }
+    }
+
+    if (last == NO_POS) {
+        return DFA_NO_MATCH;
+    }
+    *start = last;
+    return DFA_MATCH;
+}
+
+void dfa_print_accel(const DfaCache *cache) {
+    size_t naccel = 0;
+    for (size_t id = 0; id < cache->nstates; id++) {
+        const DfaState *st = &cache->states[id];
+        naccel += st->accel != DFA_ACCEL_UNKNOWN && st->accel != DFA_ACCEL_NONE;
+    }
+    printf("accelerated:   %zu of %zu states, %zu jumps, %zu bytes skipped\n", naccel, cache->nstates,
+           cache->accel_jumps, cache->accel_skipped);
+    if (cache->prefilter_jumps > 0) {
+        printf("prefiltered:   %zu jumps, %zu bytes skipped, %zu confirmed, %zu pauses\n", cache->prefilter_jumps,
+               cache->prefilter_skipped, cache->prefilter_confirmed, cache->prefilter_pauses);
+    }
+    for (size_t id = 0; id < cache->nstates; id++) {
+        const DfaState *st = &cache->states[id];
+        if (st->accel == DFA_ACCEL_UNKNOWN || st->accel == DFA_ACCEL_NONE) {
+            continue;
+        }
+        printf("  state %zu: stops at", id);
+        for (size_t i = 0; i < (st->accel & DFA_ACCEL_NEEDLES); i++) {
+            const uint8_t b = st->needles[i];
+            printf(b >= 0x20 && b < 0x7F ? " '%c'" : " \\x%02x", b);
+        }
+        printf("%s, %u jumps, %zu bytes skipped\n", st->accel & DFA_ACCEL_HIGH ? " 0x80-0xff" : "", st->jumps,
+               st->skipped);
+    }
+}
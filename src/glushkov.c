@@ -0,0 +1,203 @@
+#include "glushkov.h"
+
+typedef struct {
+    bool nullable;
+    uint64_t *first;
+    uint64_t *last;
+} Frag;
+
+size_t glushkov_count_positions(const Hir *hir, const size_t limit) {
+    size_t count = 0;
+
+    switch (hir->kind) {
+        case HIR_EMPTY:
+            return 0;
+        case HIR_CLASS:
+            return 1;
+        case HIR_REPEAT: {
+            const size_t copies = hir->max == -1 ? (hir->min > 1 ? (size_t) hir->min : 1) : (size_t) hir->max;
+            const size_t sub = glushkov_count_positions(hir->sub[0], limit);
+            if (sub != 0 && copies > (limit + 1) / sub) {
+                return limit + 1;
+            }
+            return sub * copies;
+        }
+        default:
+            for (size_t i = 0; i < hir->sub_count && count <= limit; i++) {
+                count += glushkov_count_positions(hir->sub[i], limit);
+            }
+            return count;
+    }
+}
+
+bool glushkov_bit(const uint64_t *set, const size_t p) {
+    return (set[p >> 6] >> (p & 63)) & 1;
+}
+
+// Once an allocation fails, the sets may be NULL and the build only
+// unwinds: every operation on them is skipped.
+static Frag frag_new(Glushkov *g, const bool nullable) {
+    Frag f = {
+        .nullable = nullable,
+        .first = calloc(g->nwords, sizeof(uint64_t)),
+        .last = calloc(g->nwords, sizeof(uint64_t)),
+    };
+    if (!f.first || !f.last) {
+        g->failed = true;
+    }
+    return f;
+}
+
+static void frag_free(Frag *f) {
+    free(f->first);
+    free(f->last);
+}
+
+static void set_union(const Glushkov *g, uint64_t *dst, const uint64_t *src) {
+    if (g->failed) {
+        return;
+    }
+    for (size_t i = 0; i < g->nwords; i++) {
+        dst[i] |= src[i];
+    }
+}
+
+// Adds an edge from every position in from to every position in to.
+static void link(Glushkov *g, const uint64_t *from, const uint64_t *to) {
+    if (g->failed) {
+        return;
+    }
+    for (size_t w = 0; w < g->nwords; w++) {
+        for (uint64_t bits = from[w]; bits; bits &= bits - 1) {
+            const size_t p = w * 64 + (size_t) __builtin_ctzll(bits);
+            set_union(g, g->follow + p * g->nwords, to);
+        }
+    }
+}
+
+static Frag concat(Glushkov *g, Frag a, Frag b) {
+    link(g, a.last, b.first);
+    if (a.nullable) {
+        set_union(g, a.first, b.first);
+    }
+    if (b.nullable) {
+        set_union(g, b.last, a.last);
+    }
+    Frag f = {.nullable = a.nullable && b.nullable, .first = a.first, .last = b.last};
+    free(a.last);
+    free(b.first);
+    return f;
+}
+
+static Frag build(Glushkov *g, const Hir *hir);
+
+static Frag optional_chain(Glushkov *g, const Hir *sub, const int count) {
+    if (count == 0) {
+        return frag_new(g, true);
+    }
+    Frag body = build(g, sub);
+    Frag f = concat(g, body, optional_chain(g, sub, count - 1));
+    f.nullable = true;
+    return f;
+}
+
+static Frag build(Glushkov *g, const Hir *hir) {
+    switch (hir->kind) {
+        case HIR_EMPTY:
+            return frag_new(g, true);
+        case HIR_CLASS: {
+            const size_t p = g->npos++;
+            Frag f = frag_new(g, false);
+            if (!g->failed) {
+                g->classes[p] = hir->set;
+                f.first[p >> 6] |= 1ULL << (p & 63);
+                f.last[p >> 6] |= 1ULL << (p & 63);
+            }
+            return f;
+        }
+        case HIR_CAPTURE:
+            return build(g, hir->sub[0]);
+        case HIR_CONCAT: {
+            Frag f = build(g, hir->sub[0]);
+            for (size_t i = 1; i < hir->sub_count; i++) {
+                f = concat(g, f, build(g, hir->sub[i]));
+            }
+            return f;
+        }
+        case HIR_ALT: {
+            Frag f = frag_new(g, false);
+            for (size_t i = 0; i < hir->sub_count; i++) {
+                Frag sub = build(g, hir->sub[i]);
+                f.nullable = f.nullable || sub.nullable;
+                set_union(g, f.first, sub.first);
+                set_union(g, f.last, sub.last);
+                frag_free(&sub);
+            }
+            return f;
+        }
+        case HIR_REPEAT: {
+            const Hir *sub = hir->sub[0];
+            Frag f = frag_new(g, true);
+            if (hir->max == -1) {
+                for (int i = 1; i < hir->min; i++) {
+                    f = concat(g, f, build(g, sub));
+                }
+                Frag loop = build(g, sub);
+                link(g, loop.last, loop.first);
+                loop.nullable = loop.nullable || hir->min == 0;
+                return concat(g, f, loop);
+            }
+            for (int i = 0; i < hir->min; i++) {
+                f = concat(g, f, build(g, sub));
+            }
+            return concat(g, f, optional_chain(g, sub, hir->max - hir->min));
+        }
+        case HIR_LOOK:
+            // Rejected by glushkov_build().
+            break;
+    }
+    return frag_new(g, true);
+}
+
+Glushkov *glushkov_build(const Hir *hir, const size_t max_positions) {
+    if (hir_has_look(hir)) {
+        // Edges carry classes only; there is nowhere to put an assertion.
+        return NULL;
+    }
+    const size_t npos = glushkov_count_positions(hir, max_positions);
+    if (npos > max_positions) {
+        return NULL;
+    }
+
+    Glushkov *g = calloc(1, sizeof(Glushkov));
+    if (!g) {
+        fprintf(stderr, "Memory allocation failed\n");
+        return NULL;
+    }
+    g->nwords = npos / 64 + 1;
+    g->classes = calloc(npos + 1, sizeof(ByteSet));
+    g->follow = calloc((npos + 1) * g->nwords, sizeof(uint64_t));
+    g->failed = !g->classes || !g->follow;
+
+    Frag f = build(g, hir);
+    g->nullable = f.nullable;
+    g->first = f.first;
+    g->last = f.last;
+    if (g->failed) {
+        fprintf(stderr, "Memory allocation failed\n");
+        glushkov_free(g);
+        return NULL;
+    }
+    return g;
+}
+
+void glushkov_free(Glushkov *g) {
+    if (!g) {
+        return;
+    }
+    free(g->classes);
+    free(g->follow);
+    free(g->first);
+    free(g->last);
+    free(g);
+}
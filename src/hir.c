@@ -0,0 +1,950 @@
+#include "hir.h"
+#include "charclass.h"
+
+typedef struct {
+    uint8_t len;
+    uint8_t lo[4];
+    uint8_t hi[4];
+} Utf8Seq;
+
+typedef struct {
+    Utf8Seq *data;
+    size_t length;
+    size_t capacity;
+} SeqList;
+
+void byteset_clear(ByteSet *set) {
+    memset(set->bits, 0, sizeof(set->bits));
+}
+
+void byteset_add(ByteSet *set, const uint8_t b) {
+    set->bits[b >> 6] |= 1ULL << (b & 63);
+}
+
+void byteset_add_range(ByteSet *set, const uint8_t lo, const uint8_t hi) {
+    for (unsigned b = lo; b <= hi; b++) {
+        byteset_add(set, (uint8_t) b);
+    }
+}
+
+void byteset_union(ByteSet *set, const ByteSet *other) {
+    for (size_t i = 0; i < 4; i++) {
+        set->bits[i] |= other->bits[i];
+    }
+}
+
+bool byteset_contains(const ByteSet *set, const uint8_t b) {
+    return (set->bits[b >> 6] >> (b & 63)) & 1;
+}
+
+size_t byteset_count(const ByteSet *set) {
+    size_t count = 0;
+    for (size_t i = 0; i < 4; i++) {
+        count += (size_t) __builtin_popcountll(set->bits[i]);
+    }
+    return count;
+}
+
+bool byteset_equal(const ByteSet *a, const ByteSet *b) {
+    return memcmp(a->bits, b->bits, sizeof(a->bits)) == 0;
+}
+
+Hir *hir_new(const HirKind kind) {
+    Hir *hir = calloc(1, sizeof(Hir));
+    hir->kind = kind;
+    return hir;
+}
+
+Hir *hir_class(const ByteSet *set) {
+    Hir *hir = hir_new(HIR_CLASS);
+    hir->set = *set;
+    return hir;
+}
+
+Hir *hir_byte(const uint8_t b) {
+    Hir *hir = hir_new(HIR_CLASS);
+    byteset_add(&hir->set, b);
+    return hir;
+}
+
+Hir *hir_look(const Look look) {
+    Hir *hir = hir_new(HIR_LOOK);
+    hir->look = look;
+    return hir;
+}
+
+Hir *hir_clone(const Hir *hir) {
+    if (!hir) {
+        return NULL;
+    }
+
+    Hir *copy = hir_new(hir->kind);
+    copy->set = hir->set;
+    copy->min = hir->min;
+    copy->max = hir->max;
+    copy->index = hir->index;
+    copy->look = hir->look;
+    for (size_t i = 0; i < hir->sub_count; i++) {
+        hir_add(copy, hir_clone(hir->sub[i]));
+    }
+    return copy;
+}
+
+void hir_free(Hir *hir) {
+    if (!hir) {
+        return;
+    }
+
+    for (size_t i = 0; i < hir->sub_count; i++) {
+        hir_free(hir->sub[i]);
+    }
+    free(hir->sub);
+    free(hir);
+}
+
+void hir_add(Hir *parent, Hir *child) {
+    if (!parent || !child) {
+        return;
+    }
+
+    Hir **new_sub = realloc(parent->sub, sizeof(Hir *) * (parent->sub_count + 1));
+    if (!new_sub) {
+        return;
+    }
+    parent->sub = new_sub;
+    parent->sub[parent->sub_count] = child;
+    parent->sub_count++;
+}
+
+// Collapses single-child concatenations and alternations.
+static Hir *hir_simplify(Hir *hir) {
+    if ((hir->kind == HIR_CONCAT || hir->kind == HIR_ALT) && hir->sub_count <= 1) {
+        if (hir->sub_count == 0) {
+            free(hir->sub);
+            hir->sub = NULL;
+            hir->kind = HIR_EMPTY;
+            return hir;
+        }
+        Hir *child = hir->sub[0];
+        free(hir->sub);
+        free(hir);
+        return child;
+    }
+    return hir;
+}
+
+static size_t encode_utf8(const rune r, uint8_t *out) {
+    if (r <= 0x7F) {
+        out[0] = (uint8_t) r;
+        return 1;
+    }
+    if (r <= 0x7FF) {
+        out[0] = (uint8_t) (0xC0 | (r >> 6));
+        out[1] = (uint8_t) (0x80 | (r & 0x3F));
+        return 2;
+    }
+    if (r <= 0xFFFF) {
+        out[0] = (uint8_t) (0xE0 | (r >> 12));
+        out[1] = (uint8_t) (0x80 | ((r >> 6) & 0x3F));
+        out[2] = (uint8_t) (0x80 | (r & 0x3F));
+        return 3;
+    }
+    out[0] = (uint8_t) (0xF0 | (r >> 18));
+    out[1] = (uint8_t) (0x80 | ((r >> 12) & 0x3F));
+    out[2] = (uint8_t) (0x80 | ((r >> 6) & 0x3F));
+    out[3] = (uint8_t) (0x80 | (r & 0x3F));
+    return 4;
+}
+
+static void push_seq(SeqList *list, const rune lo, const rune hi) {
+    if (list->length == list->capacity) {
+        list->capacity = list->capacity ? list->capacity * 2 : 16;
+        list->data = realloc(list->data, list->capacity * sizeof(Utf8Seq));
+    }
+    Utf8Seq *seq = &list->data[list->length++];
+    seq->len = (uint8_t) encode_utf8(lo, seq->lo);
+    encode_utf8(hi, seq->hi);
+}
+
+// Splits [lo, hi] until every piece encodes as a product of byte ranges,
+// i.e. every byte position can vary independently of the others.
+static void split_utf8(SeqList *list, const rune lo, const rune hi) {
+    static const rune max_for_len[] = {0x7F, 0x7FF, 0xFFFF};
+
+    if (lo > hi) {
+        return;
+    }
+    if (lo <= 0xDFFF && hi >= 0xD800) {
+        if (lo < 0xD800) {
+            split_utf8(list, lo, 0xD7FF);
+        }
+        if (hi > 0xDFFF) {
+            split_utf8(list, 0xE000, hi);
+        }
+        return;
+    }
+    for (size_t i = 0; i < 3; i++) {
+        if (lo <= max_for_len[i] && hi > max_for_len[i]) {
+            split_utf8(list, lo, max_for_len[i]);
+            split_utf8(list, max_for_len[i] + 1, hi);
+            return;
+        }
+    }
+    if (hi <= 0x7F) {
+        push_seq(list, lo, hi);
+        return;
+    }
+    for (int i = 1; i < 4; i++) {
+        const rune m = (1 << (6 * i)) - 1;
+        if ((lo & ~m) != (hi & ~m)) {
+            if ((lo & m) != 0) {
+                split_utf8(list, lo, lo | m);
+                split_utf8(list, (lo | m) + 1, hi);
+                return;
+            }
+            if ((hi & m) != m) {
+                split_utf8(list, lo, (hi & ~m) - 1);
+                split_utf8(list, hi & ~m, hi);
+                return;
+            }
+        }
+    }
+    push_seq(list, lo, hi);
+}
+
+// Builds a prefix-shared tree from sorted sequences. Sequences with equal
+// leading byte ranges are adjacent, so grouping runs keeps the tree small
+// for large Unicode classes such as \w.
+static Hir *seq_tree(const Utf8Seq *seqs, const size_t n, const size_t depth) {
+    Hir *alt = hir_new(HIR_ALT);
+    ByteSet leaves;
+    bool has_leaves = false;
+    byteset_clear(&leaves);
+
+    size_t i = 0;
+    while (i < n) {
+        size_t j = i + 1;
+        while (j < n && seqs[j].lo[depth] == seqs[i].lo[depth] && seqs[j].hi[depth] == seqs[i].hi[depth]) {
+            j++;
+        }
+
+        ByteSet set;
+        byteset_clear(&set);
+        byteset_add_range(&set, seqs[i].lo[depth], seqs[i].hi[depth]);
+        if (seqs[i].len == depth + 1 || depth == 3) {
+            byteset_union(&leaves, &set);
+            has_leaves = true;
+        } else {
+            Hir *concat = hir_new(HIR_CONCAT);
+            hir_add(concat, hir_class(&set));
+            hir_add(concat, seq_tree(seqs + i, j - i, depth + 1));
+            hir_add(alt, concat);
+        }
+        i = j;
+    }
+
+    if (has_leaves) {
+        hir_add(alt, hir_class(&leaves));
+        // Keep the single-byte leaves first; they are the common case.
+        Hir *last = alt->sub[alt->sub_count - 1];
+        memmove(alt->sub + 1, alt->sub, (alt->sub_count - 1) * sizeof(Hir *));
+        alt->sub[0] = last;
+    }
+
+    return hir_simplify(alt);
+}
+
+Hir *hir_from_runes(const RuneRange *rr) {
+    SeqList list = {0};
+    for (size_t i = 0; i < rr->length; i += 2) {
+        split_utf8(&list, rr->data[i], rr->data[i + 1] > (rune) MAX_RUNE ? (rune) MAX_RUNE : rr->data[i + 1]);
+    }
+
+    if (list.length == 0) {
+        // An empty class can never match; model it as a class with no bytes.
+        ByteSet none;
+        byteset_clear(&none);
+        return hir_class(&none);
+    }
+
+    Hir *hir = seq_tree(list.data, list.length, 0);
+    free(list.data);
+    return hir;
+}
+
+static Hir *hir_from_rune(const rune r) {
+    uint8_t buf[4];
+    const size_t len = encode_utf8(r, buf);
+    if (len == 1) {
+        return hir_byte(buf[0]);
+    }
+
+    Hir *concat = hir_new(HIR_CONCAT);
+    for (size_t i = 0; i < len; i++) {
+        hir_add(concat, hir_byte(buf[i]));
+    }
+    return concat;
+}
+
+static bool control_rune(const char c, rune *out) {
+    switch (c) {
+        case 'f': *out = '\f'; return true;
+        case 'n': *out = '\n'; return true;
+        case 'r': *out = '\r'; return true;
+        case 't': *out = '\t'; return true;
+        case 'v': *out = '\v'; return true;
+        default: return false;
+    }
+}
+
+static const RuneRange *perl_class(const char c) {
+    switch (c) {
+        case 'd': return &PERL_DIGIT;
+        case 'D': return &PERL_NOT_DIGIT;
+        case 's': return &PERL_WHITESPACE;
+        case 'S': return &PERL_NOT_WHITESPACE;
+        case 'w': return &PERL_WORD;
+        case 'W': return &PERL_NOT_WORD;
+        default: return NULL;
+    }
+}
+
+// Resolves a single-rune node (<Literal>, <Control> or <HexSeq>).
+static bool node_rune(const Node *node, rune *out) {
+    if (node->sub_count != 1) {
+        return false;
+    }
+    const char *value = node->sub[0]->label;
+    if (strcmp(node->label, "<Literal>") == 0) {
+        utf8codepoint(value, out);
+        return true;
+    }
+    if (strcmp(node->label, "<Control>") == 0) {
+        return control_rune(value[0], out);
+    }
+    if (strcmp(node->label, "<HexSeq>") == 0) {
+        *out = (rune) strtol(value, NULL, 16);
+        return true;
+    }
+    return false;
+}
+
+static bool class_item(RuneRange *rr, const Node *item) {
+    rune lo, hi;
+
+    if (strcmp(item->label, "<Perl>") == 0) {
+        return append_class(rr, perl_class(item->sub[0]->label[0]));
+    }
+    if (strcmp(item->label, "ClassRange") == 0) {
+        if (item->sub_count != 2 || !node_rune(item->sub[0], &lo) || !node_rune(item->sub[1], &hi)) {
+            return false;
+        }
+        return append_range(rr, lo, hi);
+    }
+    if (node_rune(item, &lo)) {
+        return append_literal(rr, lo);
+    }
+
+    fprintf(stderr, "Unsupported class item: %s\n", item->label);
+    return false;
+}
+
+static Hir *hir_from_class(const Node *node) {
+    RuneRange rr;
+    rrange_init(&rr);
+
+    for (size_t i = 0; i < node->sub_count; i++) {
+        if (!class_item(&rr, node->sub[i])) {
+            rrange_free(&rr);
+            return NULL;
+        }
+    }
+    clean_class(&rr);
+    if (node->label[0] == '^') {
+        negate_class(&rr);
+    }
+
+    Hir *hir = hir_from_runes(&rr);
+    rrange_free(&rr);
+    return hir;
+}
+
+// Literal alternations, such as keyword lists, are factored into a trie so
+// that branches with a common prefix share its states. Priorities survive
+// because branches that part at a byte can never both match, except where
+// one literal ends and a longer one runs on: the node's end marker then
+// sits between the edges of literals listed before and after the shorter
+// one, and a literal may only join edges that come after it.
+#define TRIE_END UINT32_MAX
+// Edges are unique per byte on either side of a node's one end marker.
+#define TRIE_MAX_EDGES (2 * 256 + 1)
+
+typedef struct {
+    uint8_t byte;
+    // Child node, or TRIE_END where a literal ends.
+    uint32_t child;
+} TrieEdge;
+
+typedef struct {
+    TrieEdge *edges;
+    size_t nedges;
+    size_t capacity;
+    // First edge after the end marker, or 0 if the node has none.
+    size_t open;
+    bool ends;
+    // Nodes with the same id accept the same suffixes.
+    uint32_t id;
+} TrieNode;
+
+typedef struct {
+    TrieNode *nodes;
+    size_t nnodes;
+    size_t capacity;
+} Trie;
+
+// Length of the literal hir matches, or SIZE_MAX if it is not a literal.
+static size_t literal_len(const Hir *hir) {
+    switch (hir->kind) {
+        case HIR_EMPTY:
+            return 0;
+        case HIR_CLASS:
+            return byteset_count(&hir->set) == 1 ? 1 : SIZE_MAX;
+        case HIR_CONCAT: {
+            size_t len = 0;
+            for (size_t i = 0; i < hir->sub_count; i++) {
+                const size_t sub = literal_len(hir->sub[i]);
+                if (sub == SIZE_MAX) {
+                    return SIZE_MAX;
+                }
+                len += sub;
+            }
+            return len;
+        }
+        default:
+            return SIZE_MAX;
+    }
+}
+
+static size_t literal_bytes(const Hir *hir, uint8_t *out) {
+    if (hir->kind == HIR_CLASS) {
+        for (size_t i = 0; i < 4; i++) {
+            if (hir->set.bits[i]) {
+                out[0] = (uint8_t) (i * 64 + (size_t) __builtin_ctzll(hir->set.bits[i]));
+            }
+        }
+        return 1;
+    }
+    size_t len = 0;
+    for (size_t i = 0; i < hir->sub_count; i++) {
+        len += literal_bytes(hir->sub[i], out + len);
+    }
+    return len;
+}
+
+static uint32_t trie_node(Trie *trie) {
+    if (trie->nnodes == trie->capacity) {
+        trie->capacity = trie->capacity ? trie->capacity * 2 : 64;
+        trie->nodes = realloc(trie->nodes, trie->capacity * sizeof(TrieNode));
+    }
+    memset(&trie->nodes[trie->nnodes], 0, sizeof(TrieNode));
+    return (uint32_t) trie->nnodes++;
+}
+
+static void trie_edge(TrieNode *node, const uint8_t byte, const uint32_t child) {
+    if (node->nedges == node->capacity) {
+        node->capacity = node->capacity ? node->capacity * 2 : 4;
+        node->edges = realloc(node->edges, node->capacity * sizeof(TrieEdge));
+    }
+    node->edges[node->nedges++] = (TrieEdge) {.byte = byte, .child = child};
+}
+
+static void trie_insert(Trie *trie, const uint8_t *s, const size_t len) {
+    uint32_t n = 0;
+    for (size_t k = 0; k < len; k++) {
+        TrieNode *node = &trie->nodes[n];
+        uint32_t child = TRIE_END;
+        for (size_t e = node->open; e < node->nedges; e++) {
+            if (node->edges[e].byte == s[k] && node->edges[e].child != TRIE_END) {
+                child = node->edges[e].child;
+                break;
+            }
+        }
+        if (child == TRIE_END) {
+            child = trie_node(trie);
+            trie_edge(&trie->nodes[n], s[k], child);
+        }
+        n = child;
+    }
+    // A literal that already ended here outranks this one, which is dropped.
+    TrieNode *node = &trie->nodes[n];
+    if (!node->ends) {
+        trie_edge(node, 0, TRIE_END);
+        node->ends = true;
+        node->open = node->nedges;
+    }
+}
+
+static uint64_t trie_hash(const Trie *trie, const TrieNode *node) {
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t e = 0; e < node->nedges; e++) {
+        const TrieEdge *edge = &node->edges[e];
+        const uint32_t child = edge->child == TRIE_END ? TRIE_END : trie->nodes[edge->child].id;
+        h = (h ^ edge->byte) * 1099511628211ULL;
+        h = (h ^ child) * 1099511628211ULL;
+    }
+    return h;
+}
+
+static bool trie_same(const Trie *trie, const TrieNode *a, const TrieNode *b) {
+    if (a->nedges != b->nedges) {
+        return false;
+    }
+    for (size_t e = 0; e < a->nedges; e++) {
+        const TrieEdge *x = &a->edges[e];
+        const TrieEdge *y = &b->edges[e];
+        if (x->byte != y->byte || (x->child == TRIE_END) != (y->child == TRIE_END) ||
+            (x->child != TRIE_END && trie->nodes[x->child].id != trie->nodes[y->child].id)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Numbers the nodes so that equal ids mean equal suffix sets. Children are
+// created after their parents, so a backwards pass sees them first.
+static void trie_number(Trie *trie) {
+    size_t size = 16;
+    while (size < 2 * trie->nnodes) {
+        size *= 2;
+    }
+    uint32_t *table = malloc(size * sizeof(uint32_t));
+    memset(table, 0xFF, size * sizeof(uint32_t));
+
+    for (size_t n = trie->nnodes; n-- > 0;) {
+        TrieNode *node = &trie->nodes[n];
+        size_t h = (size_t) trie_hash(trie, node) & (size - 1);
+        while (table[h] != UINT32_MAX && !trie_same(trie, &trie->nodes[table[h]], node)) {
+            h = (h + 1) & (size - 1);
+        }
+        if (table[h] == UINT32_MAX) {
+            table[h] = (uint32_t) n;
+        }
+        node->id = table[h];
+    }
+    free(table);
+}
+
+static void concat_append(Hir *concat, Hir *hir) {
+    if (hir->kind == HIR_CONCAT) {
+        for (size_t i = 0; i < hir->sub_count; i++) {
+            hir_add(concat, hir->sub[i]);
+        }
+        free(hir->sub);
+        free(hir);
+    } else if (hir->kind == HIR_EMPTY) {
+        hir_free(hir);
+    } else {
+        hir_add(concat, hir);
+    }
+}
+
+static Hir *trie_hir(const Trie *trie, uint32_t n) {
+    Hir *concat = hir_new(HIR_CONCAT);
+    const TrieNode *node = &trie->nodes[n];
+    while (node->nedges == 1 && node->edges[0].child != TRIE_END) {
+        hir_add(concat, hir_byte(node->edges[0].byte));
+        node = &trie->nodes[node->edges[0].child];
+    }
+    if (node->nedges == 1) {
+        return hir_simplify(concat);
+    }
+
+    // Edges between end markers take distinct bytes, so their order does
+    // not matter, and those leading to the same suffixes share a class.
+    Hir *alt = hir_new(HIR_ALT);
+    bool taken[TRIE_MAX_EDGES] = {false};
+    for (size_t e = 0; e < node->nedges; e++) {
+        const TrieEdge *edge = &node->edges[e];
+        if (edge->child == TRIE_END) {
+            hir_add(alt, hir_new(HIR_EMPTY));
+            continue;
+        }
+        if (taken[e]) {
+            continue;
+        }
+        ByteSet set;
+        byteset_clear(&set);
+        byteset_add(&set, edge->byte);
+        for (size_t f = e + 1; f < node->nedges && node->edges[f].child != TRIE_END; f++) {
+            if (trie->nodes[node->edges[f].child].id == trie->nodes[edge->child].id) {
+                byteset_add(&set, node->edges[f].byte);
+                taken[f] = true;
+            }
+        }
+        Hir *branch = hir_new(HIR_CONCAT);
+        hir_add(branch, hir_class(&set));
+        concat_append(branch, trie_hir(trie, edge->child));
+        hir_add(alt, hir_simplify(branch));
+    }
+    hir_add(concat, hir_simplify(alt));
+    return hir_simplify(concat);
+}
+
+static Hir *literal_trie(Hir **branches, const size_t n) {
+    Trie trie = {0};
+    trie_node(&trie);
+    uint8_t *buf = NULL;
+    size_t buf_len = 0;
+    for (size_t i = 0; i < n; i++) {
+        const size_t len = literal_len(branches[i]);
+        if (len > buf_len) {
+            buf_len = len;
+            buf = realloc(buf, buf_len);
+        }
+        literal_bytes(branches[i], buf);
+        trie_insert(&trie, buf, len);
+        hir_free(branches[i]);
+    }
+    free(buf);
+
+    trie_number(&trie);
+    Hir *hir = trie_hir(&trie, 0);
+    for (size_t i = 0; i < trie.nnodes; i++) {
+        free(trie.nodes[i].edges);
+    }
+    free(trie.nodes);
+    return hir;
+}
+
+// Replaces each run of two or more literal branches with their trie.
+static void factor_literals(Hir *alt) {
+    size_t out = 0;
+    size_t i = 0;
+    while (i < alt->sub_count) {
+        size_t j = i;
+        while (j < alt->sub_count && literal_len(alt->sub[j]) != SIZE_MAX) {
+            j++;
+        }
+        if (j - i >= 2) {
+            alt->sub[out++] = literal_trie(alt->sub + i, j - i);
+            i = j;
+        } else {
+            j = j > i ? j : i + 1;
+            while (i < j) {
+                alt->sub[out++] = alt->sub[i++];
+            }
+        }
+    }
+    alt->sub_count = out;
+}
+
+static Hir *hir_from_node(const Node *node, size_t *capture_count);
+
+static Hir *hir_from_atom(const Node *atom, size_t *capture_count) {
+    const Node *node = atom->sub[0];
+    rune r;
+
+    if (strcmp(node->label, "<Dot>") == 0) {
+        return hir_from_runes(&PERL_DOT);
+    }
+    if (strcmp(node->label, "<Perl>") == 0) {
+        return hir_from_runes(perl_class(node->sub[0]->label[0]));
+    }
+    if (strcmp(node->label, "<Expr>") == 0) {
+        Hir *capture = hir_new(HIR_CAPTURE);
+        capture->index = ++*capture_count;
+        Hir *sub = hir_from_node(node, capture_count);
+        if (!sub) {
+            hir_free(capture);
+            return NULL;
+        }
+        hir_add(capture, sub);
+        return capture;
+    }
+    if (strcmp(node->label, "<UniSeq>") == 0) {
+        fprintf(stderr, "Unsupported unicode property: \\p{%s}\n", node->sub[0]->label);
+        return NULL;
+    }
+    if (node_rune(node, &r)) {
+        return hir_from_rune(r);
+    }
+
+    return hir_from_class(node);
+}
+
+static Hir *hir_from_assertion(const Node *node) {
+    switch (node->sub[0]->label[0]) {
+        case '^': return hir_look(LOOK_START);
+        case '$': return hir_look(LOOK_END);
+        case 'b': return hir_look(LOOK_WORD);
+        case 'B': return hir_look(LOOK_NOT_WORD);
+        default:
+            fprintf(stderr, "Unsupported assertion: %s\n", node->sub[0]->label);
+            return NULL;
+    }
+}
+
+static Hir *hir_from_piece(const Node *piece, size_t *capture_count) {
+    if (strcmp(piece->sub[0]->label, "<Assertion>") == 0) {
+        return hir_from_assertion(piece->sub[0]);
+    }
+    Hir *atom = hir_from_atom(piece->sub[0], capture_count);
+    if (!atom || piece->sub_count < 2) {
+        return atom;
+    }
+
+    const Node *quantifier = piece->sub[1];
+    Hir *repeat = hir_new(HIR_REPEAT);
+    repeat->min = atoi(quantifier->sub[0]->label);
+    repeat->max = atoi(quantifier->sub[1]->label);
+    hir_add(repeat, atom);
+    return repeat;
+}
+
+static Hir *hir_from_node(const Node *node, size_t *capture_count) {
+    if (strcmp(node->label, "<Root>") == 0) {
+        return hir_from_node(node->sub[0], capture_count);
+    }
+
+    HirKind kind;
+    if (strcmp(node->label, "<Expr>") == 0) {
+        kind = HIR_ALT;
+    } else if (strcmp(node->label, "<Branch>") == 0) {
+        kind = HIR_CONCAT;
+    } else {
+        fprintf(stderr, "Unexpected syntax node: %s\n", node->label);
+        return NULL;
+    }
+
+    Hir *hir = hir_new(kind);
+    for (size_t i = 0; i < node->sub_count; i++) {
+        const Node *child = node->sub[i];
+        Hir *sub = kind == HIR_ALT ? hir_from_node(child, capture_count) : hir_from_piece(child, capture_count);
+        if (!sub) {
+            hir_free(hir);
+            return NULL;
+        }
+        hir_add(hir, sub);
+    }
+    if (kind == HIR_ALT) {
+        factor_literals(hir);
+    }
+
+    return hir_simplify(hir);
+}
+
+Hir *hir_from_ast(const Node *root, size_t *capture_count) {
+    *capture_count = 0;
+    return hir_from_node(root, capture_count);
+}
+
+Hir *hir_reverse(const Hir *hir) {
+    if (hir->kind == HIR_CAPTURE) {
+        return hir_reverse(hir->sub[0]);
+    }
+
+    Hir *copy = hir_new(hir->kind);
+    copy->set = hir->set;
+    copy->min = hir->min;
+    copy->max = hir->max;
+    copy->index = hir->index;
+    // Read backwards, the start of the haystack is where the scan ends.
+    copy->look = hir->look == LOOK_START ? LOOK_END : hir->look == LOOK_END ? LOOK_START : hir->look;
+    for (size_t i = 0; i < hir->sub_count; i++) {
+        const size_t k = hir->kind == HIR_CONCAT ? hir->sub_count - 1 - i : i;
+        hir_add(copy, hir_reverse(hir->sub[k]));
+    }
+    return copy;
+}
+
+bool hir_nullable(const Hir *hir) {
+    switch (hir->kind) {
+        case HIR_EMPTY:
+            return true;
+        case HIR_CLASS:
+            return false;
+        case HIR_CONCAT:
+            for (size_t i = 0; i < hir->sub_count; i++) {
+                if (!hir_nullable(hir->sub[i])) {
+                    return false;
+                }
+            }
+            return true;
+        case HIR_ALT:
+            for (size_t i = 0; i < hir->sub_count; i++) {
+                if (hir_nullable(hir->sub[i])) {
+                    return true;
+                }
+            }
+            return false;
+        case HIR_REPEAT:
+            return hir->min == 0 || hir_nullable(hir->sub[0]);
+        case HIR_CAPTURE:
+            return hir_nullable(hir->sub[0]);
+        case HIR_LOOK:
+            return true;
+    }
+    return false;
+}
+
+bool hir_has_look(const Hir *hir) {
+    if (hir->kind == HIR_LOOK) {
+        return true;
+    }
+    for (size_t i = 0; i < hir->sub_count; i++) {
+        if (hir_has_look(hir->sub[i])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool is_word_rune(const rune r) {
+    if (r < 0x80) {
+        return (r >= '0' && r <= '9') || (r >= 'A' && r <= 'Z') || (r >= 'a' && r <= 'z') || r == '_';
+    }
+    size_t lo = 0, hi = PERL_WORD.length / 2;
+    while (lo < hi) {
+        const size_t mid = lo + (hi - lo) / 2;
+        if (r < PERL_WORD.data[2 * mid]) {
+            hi = mid;
+        } else if (r > PERL_WORD.data[2 * mid + 1]) {
+            lo = mid + 1;
+        } else {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Decodes the UTF-8 sequence at s, which has n bytes available. Returns
+// its length, or 0 when it is invalid or cut short.
+static size_t decode_rune(const uint8_t *s, const size_t n, rune *out) {
+    size_t len;
+    rune r;
+    if (s[0] < 0x80) {
+        *out = s[0];
+        return 1;
+    } else if (s[0] >= 0xC2 && s[0] <= 0xDF) {
+        len = 2;
+        r = s[0] & 0x1F;
+    } else if (s[0] >= 0xE0 && s[0] <= 0xEF) {
+        len = 3;
+        r = s[0] & 0x0F;
+    } else if (s[0] >= 0xF0 && s[0] <= 0xF4) {
+        len = 4;
+        r = s[0] & 0x07;
+    } else {
+        return 0;
+    }
+    if (len > n) {
+        return 0;
+    }
+    for (size_t i = 1; i < len; i++) {
+        if ((s[i] & 0xC0) != 0x80) {
+            return 0;
+        }
+        r = (r << 6) | (s[i] & 0x3F);
+    }
+    *out = r;
+    return len;
+}
+
+// Whether the rune ending at `at`, or starting there, is a word character.
+// Invalid UTF-8 never is.
+static bool word_before(const Input *input, const size_t at) {
+    const uint8_t *hay = (const uint8_t *) input->haystack;
+    if (at == 0) {
+        return false;
+    }
+    size_t start = at - 1;
+    while (start > 0 && at - start < 4 && (hay[start] & 0xC0) == 0x80) {
+        start--;
+    }
+    rune r = 0;
+    return decode_rune(hay + start, at - start, &r) == at - start && is_word_rune(r);
+}
+
+static bool word_after(const Input *input, const size_t at) {
+    rune r = 0;
+    return at < input->length &&
+           decode_rune((const uint8_t *) input->haystack + at, input->length - at, &r) > 0 && is_word_rune(r);
+}
+
+// Whether at falls between the bytes of a valid UTF-8 sequence.
+static bool inside_rune(const Input *input, const size_t at) {
+    const uint8_t *hay = (const uint8_t *) input->haystack;
+    if (at == 0 || at >= input->length || (hay[at] & 0xC0) != 0x80) {
+        return false;
+    }
+    size_t start = at - 1;
+    while (start > 0 && at - start < 3 && (hay[start] & 0xC0) == 0x80) {
+        start--;
+    }
+    rune r;
+    return decode_rune(hay + start, input->length - start, &r) > at - start;
+}
+
+bool look_matches(const Look look, const Input *input, const size_t at) {
+    switch (look) {
+        case LOOK_START:
+            return at == 0;
+        case LOOK_END:
+            return at == input->length;
+        case LOOK_WORD:
+            return word_before(input, at) != word_after(input, at);
+        case LOOK_NOT_WORD:
+            // Neither side is a word there, but no character boundary either.
+            return word_before(input, at) == word_after(input, at) && !inside_rune(input, at);
+        default:
+            return false;
+    }
+}
+
+static void print_byteset(const ByteSet *set) {
+    printf("[");
+    for (unsigned b = 0; b < 256; b++) {
+        if (!byteset_contains(set, (uint8_t) b)) {
+            continue;
+        }
+        unsigned hi = b;
+        while (hi < 255 && byteset_contains(set, (uint8_t) (hi + 1))) {
+            hi++;
+        }
+        printf(b == hi ? "%02x" : "%02x-%02x", b, hi);
+        b = hi;
+        if (hi < 255) {
+            printf(" ");
+        }
+    }
+    printf("]");
+}
+
+void hir_print(const Hir *hir, const int depth) {
+    static const char *names[] = {"Empty", "Class", "Concat", "Alt", "Repeat", "Capture", "Look"};
+    static const char *looks[] = {"^", "$", "\\b", "\\B"};
+
+    printf("%*s%s", depth * 2, "", names[hir->kind]);
+    switch (hir->kind) {
+        case HIR_CLASS:
+            printf(" ");
+            print_byteset(&hir->set);
+            break;
+        case HIR_REPEAT:
+            printf(" {%d,%d}", hir->min, hir->max);
+            break;
+        case HIR_CAPTURE:
+            printf(" #%zu", hir->index);
+            break;
+        case HIR_LOOK:
+            printf(" %s", looks[hir->look]);
+            break;
+        default:
+            break;
+    }
+    printf("\n");
+
+    for (size_t i = 0; i < hir->sub_count; i++) {
+        hir_print(hir->sub[i], depth + 1);
+    }
+}
@@ -1,3 +1,4 @@
+#include <ctype.h>
 #include "lexer.h"
 
 bool is_special(const char c) {
@@ -36,8 +37,13 @@ const char *peek(const char *pattern, const size_t *pos, const size_t lookahead)
         PARSE_ERROR("NULL pointer argument");
     }
 
-    if (utf8size(pattern) < lookahead + *pos) {
-        return NULL;
+    // Positions never run more than one byte past the terminator, so only
+    // the bytes from there up to the lookahead need checking; measuring the
+    // whole pattern on every peek made parsing quadratic.
+    for (size_t i = *pos > 0 ? *pos - 1 : 0; i + 1 < lookahead + *pos; i++) {
+        if (pattern[i] == '\0') {
+            return NULL;
+        }
     }
 
     const char *current = pattern + *pos;
@@ -105,7 +111,8 @@ Node *expr(const char *pattern, size_t *pos) {
 
     const char *peek_ptr = peek(pattern, pos, 0);
     while (peek_ptr && *peek_ptr != '\0') {
-        if (match(pattern, pos, ")")) {
+        // The closing parenthesis belongs to the enclosing atom.
+        if (*peek_ptr == ')') {
             break;
         }
 
@@ -136,6 +143,13 @@ Node *branch(const char *pattern, size_t *pos) {
 }
 
 Node *piece(const char *pattern, size_t *pos) {
+    Node *assertion_node = assertion(pattern, pos);
+    if (assertion_node) {
+        Node *node = create_node("<Piece>");
+        add_child(node, assertion_node);
+        return node;
+    }
+
     Node *atom_node = atom(pattern, pos);
     if (!atom_node) {
         return NULL;
@@ -147,7 +161,38 @@ Node *piece(const char *pattern, size_t *pos) {
     return node;
 }
 
-//Node *assertion(const char *pattern, size_t *pos);
+Node *assertion(const char *pattern, size_t *pos) {
+    const char *peek_ptr = peek(pattern, pos, 0);
+    if (!peek_ptr) {
+        return NULL;
+    }
+
+    Node *node = NULL;
+    switch (*peek_ptr) {
+        case '^':
+        case '$': {
+            node = create_node("<Assertion>");
+            add_child(node, create_node(*peek_ptr == '^' ? "^" : "$"));
+            match(pattern, pos, peek_ptr);
+            break;
+        }
+        case '\\': {
+            const char *escaped = peek(pattern, pos, 1);
+            if (!escaped || (*escaped != 'b' && *escaped != 'B')) {
+                return NULL;
+            }
+            node = create_node("<Assertion>");
+            add_child(node, create_node(*escaped == 'b' ? "b" : "B"));
+            next(pattern, pos, 1);
+            break;
+        }
+        default: {
+            return NULL;
+        }
+    }
+
+    return node;
+}
 
 Node *quantifier(const char *pattern, size_t *pos) {
     const char *peek_ptr = peek(pattern, pos, 0);
@@ -342,7 +387,13 @@ Node *atom_escape(const char *pattern, size_t *pos) {
         }
 
         default: {
-            return NULL;
+            // An escaped metacharacter, or any other punctuation, stands
+            // for itself.
+            if (!ispunct((unsigned char) peek_ch)) {
+                return NULL;
+            }
+            node = literal(pattern, pos);
+            break;
         }
     }
 
@@ -361,7 +412,8 @@ Node *hex_sequence(const char *pattern, size_t *pos) {
     size_t len = 0;
     while (len < 4 && *peek_ptr && is_hex(*peek_ptr)) {
         node->label[len++] = *peek_ptr;
-        peek_ptr = next(pattern, pos, 0);
+        next(pattern, pos, 0);
+        peek_ptr = peek(pattern, pos, 0);
     }
 
     if (!match(pattern, pos, "}")) {
@@ -0,0 +1,607 @@
+#include <stdio.h>
+#include "ascii.h"
+#include "literal.h"
+
+// Literals listed per set by literal_seq_print().
+#define LITERAL_PRINT_MAX 8
+
+static void seq_set_infinite(LiteralSeq *seq) {
+    literal_seq_free(seq);
+    seq->infinite = true;
+}
+
+// Out of memory, the set becomes infinite, which no prefilter is built on.
+static void seq_push(LiteralSeq *seq, const Literal *lit) {
+    if (seq->infinite) {
+        return;
+    }
+    if (seq->count == seq->capacity) {
+        const size_t capacity = seq->capacity ? seq->capacity * 2 : 8;
+        Literal *lits = realloc(seq->lits, capacity * sizeof(Literal));
+        if (!lits) {
+            fprintf(stderr, "Memory allocation failed\n");
+            seq_set_infinite(seq);
+            return;
+        }
+        seq->lits = lits;
+        seq->capacity = capacity;
+    }
+    seq->lits[seq->count++] = *lit;
+}
+
+static LiteralSeq seq_infinite(void) {
+    return (LiteralSeq) {.infinite = true};
+}
+
+// The set holding just the exact empty literal, which every match of the
+// empty string is.
+static LiteralSeq seq_empty(void) {
+    LiteralSeq seq = {0};
+    const Literal empty = {.len = 0, .exact = true};
+    seq_push(&seq, &empty);
+    return seq;
+}
+
+static bool seq_has_exact(const LiteralSeq *seq) {
+    for (size_t i = 0; i < seq->count; i++) {
+        if (seq->lits[i].exact) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void seq_make_inexact(LiteralSeq *seq) {
+    for (size_t i = 0; i < seq->count; i++) {
+        seq->lits[i].exact = false;
+    }
+}
+
+static int literal_cmp(const void *a, const void *b) {
+    const Literal *x = a;
+    const Literal *y = b;
+    const size_t len = x->len < y->len ? x->len : y->len;
+    const int c = memcmp(x->bytes, y->bytes, len);
+    if (c != 0) {
+        return c;
+    }
+    return x->len < y->len ? -1 : x->len > y->len;
+}
+
+// Sorts the literals and merges equal ones; a literal is only exact if
+// all of its copies were.
+static void seq_dedup(LiteralSeq *seq) {
+    if (seq->count < 2) {
+        return;
+    }
+    qsort(seq->lits, seq->count, sizeof(Literal), literal_cmp);
+    size_t out = 0;
+    for (size_t i = 0; i < seq->count; i++) {
+        if (out > 0 && literal_cmp(&seq->lits[out - 1], &seq->lits[i]) == 0) {
+            seq->lits[out - 1].exact &= seq->lits[i].exact;
+        } else {
+            seq->lits[out++] = seq->lits[i];
+        }
+    }
+    seq->count = out;
+}
+
+// Shortens the literals until the set fits, giving up on it if even
+// single bytes are too many.
+static void seq_shrink(LiteralSeq *seq) {
+    size_t len = LITERAL_MAX_LEN;
+    while (seq->count > LITERAL_MAX_COUNT) {
+        if (--len == 0) {
+            seq_set_infinite(seq);
+            return;
+        }
+        for (size_t i = 0; i < seq->count; i++) {
+            if (seq->lits[i].len > len) {
+                seq->lits[i].len = len;
+                seq->lits[i].exact = false;
+            }
+        }
+        seq_dedup(seq);
+    }
+}
+
+// Moves the literals of other into seq.
+static void seq_union(LiteralSeq *seq, LiteralSeq *other) {
+    if (seq->infinite || other->infinite) {
+        literal_seq_free(other);
+        seq_set_infinite(seq);
+        return;
+    }
+    for (size_t i = 0; i < other->count; i++) {
+        seq_push(seq, &other->lits[i]);
+    }
+    literal_seq_free(other);
+    seq_dedup(seq);
+    seq_shrink(seq);
+}
+
+// Extends every exact literal of seq with every literal of other. When the
+// product would be too large, the literals stop where they are instead.
+static void seq_cross(LiteralSeq *seq, const LiteralSeq *other) {
+    size_t exact = 0;
+    for (size_t i = 0; i < seq->count; i++) {
+        exact += seq->lits[i].exact;
+    }
+    if (other->infinite || seq->count - exact + exact * other->count > LITERAL_MAX_COUNT) {
+        seq_make_inexact(seq);
+        return;
+    }
+
+    LiteralSeq product = {0};
+    for (size_t i = 0; i < seq->count; i++) {
+        const Literal *lit = &seq->lits[i];
+        if (!lit->exact) {
+            seq_push(&product, lit);
+            continue;
+        }
+        for (size_t j = 0; j < other->count; j++) {
+            const Literal *next = &other->lits[j];
+            Literal joined = *lit;
+            const size_t take = lit->len + next->len > LITERAL_MAX_LEN ? LITERAL_MAX_LEN - lit->len : next->len;
+            memcpy(joined.bytes + lit->len, next->bytes, take);
+            joined.len = lit->len + take;
+            joined.exact = next->exact && take == next->len;
+            seq_push(&product, &joined);
+        }
+    }
+    literal_seq_free(seq);
+    *seq = product;
+    seq_dedup(seq);
+}
+
+static LiteralSeq prefixes_concat(Hir *const *subs, const size_t n) {
+    LiteralSeq seq = seq_empty();
+    for (size_t i = 0; i < n && seq_has_exact(&seq); i++) {
+        LiteralSeq sub = literal_prefixes(subs[i]);
+        seq_cross(&seq, &sub);
+        literal_seq_free(&sub);
+    }
+    return seq;
+}
+
+static LiteralSeq prefixes_repeat(const Hir *hir) {
+    LiteralSeq sub = literal_prefixes(hir->sub[0]);
+    LiteralSeq seq = seq_empty();
+
+    if (hir->min == 0) {
+        if (hir->max != 1) {
+            seq_make_inexact(&sub);
+        }
+        seq_union(&seq, &sub);
+        return seq;
+    }
+    const int copies = hir->min < LITERAL_MAX_REPEAT ? hir->min : LITERAL_MAX_REPEAT;
+    for (int i = 0; i < copies && seq_has_exact(&seq); i++) {
+        seq_cross(&seq, &sub);
+    }
+    if (copies < hir->min || hir->max != hir->min) {
+        seq_make_inexact(&seq);
+    }
+    literal_seq_free(&sub);
+    return seq;
+}
+
+LiteralSeq literal_prefixes(const Hir *hir) {
+    switch (hir->kind) {
+        case HIR_EMPTY:
+        case HIR_LOOK:
+            return seq_empty();
+        case HIR_CLASS: {
+            if (byteset_count(&hir->set) > LITERAL_MAX_CLASS) {
+                return seq_infinite();
+            }
+            LiteralSeq seq = {0};
+            for (unsigned b = 0; b < 256; b++) {
+                if (byteset_contains(&hir->set, (uint8_t) b)) {
+                    const Literal lit = {.bytes = {(uint8_t) b}, .len = 1, .exact = true};
+                    seq_push(&seq, &lit);
+                }
+            }
+            return seq;
+        }
+        case HIR_CONCAT:
+            return prefixes_concat(hir->sub, hir->sub_count);
+        case HIR_ALT: {
+            LiteralSeq seq = {0};
+            for (size_t i = 0; i < hir->sub_count && !seq.infinite; i++) {
+                LiteralSeq sub = literal_prefixes(hir->sub[i]);
+                seq_union(&seq, &sub);
+            }
+            return seq;
+        }
+        case HIR_REPEAT:
+            return prefixes_repeat(hir);
+        case HIR_CAPTURE:
+            return literal_prefixes(hir->sub[0]);
+    }
+    return seq_infinite();
+}
+
+LiteralSeq literal_suffixes(const Hir *hir) {
+    Hir *reversed = hir_reverse(hir);
+    LiteralSeq seq = literal_prefixes(reversed);
+    hir_free(reversed);
+
+    for (size_t i = 0; i < seq.count; i++) {
+        Literal *lit = &seq.lits[i];
+        for (size_t j = 0; j < lit->len / 2; j++) {
+            const uint8_t b = lit->bytes[j];
+            lit->bytes[j] = lit->bytes[lit->len - 1 - j];
+            lit->bytes[lit->len - 1 - j] = b;
+        }
+    }
+    seq_dedup(&seq);
+    return seq;
+}
+
+// Keeps the better scoring of the two sets in best.
+static void seq_keep_better(LiteralSeq *best, LiteralSeq *candidate) {
+    if (literal_seq_score(candidate) > literal_seq_score(best)) {
+        literal_seq_free(best);
+        *best = *candidate;
+    } else {
+        literal_seq_free(candidate);
+    }
+}
+
+LiteralSeq literal_inner(const Hir *hir) {
+    switch (hir->kind) {
+        case HIR_CAPTURE:
+            return literal_inner(hir->sub[0]);
+        case HIR_CONCAT: {
+            // Every match holds a prefix of every tail of the concatenation,
+            // and whatever each part's own matches must hold.
+            LiteralSeq best = seq_infinite();
+            for (size_t i = 0; i < hir->sub_count; i++) {
+                LiteralSeq tail = prefixes_concat(hir->sub + i, hir->sub_count - i);
+                seq_keep_better(&best, &tail);
+                LiteralSeq sub = literal_inner(hir->sub[i]);
+                seq_keep_better(&best, &sub);
+            }
+            return best;
+        }
+        case HIR_ALT: {
+            // Inner literals are never extended, so once the union is poor
+            // it is given up on rather than grown further.
+            LiteralSeq seq = {0};
+            for (size_t i = 0; i < hir->sub_count && !seq.infinite; i++) {
+                LiteralSeq sub = literal_inner(hir->sub[i]);
+                seq_union(&seq, &sub);
+                if (literal_seq_score(&seq) == 0) {
+                    seq_set_infinite(&seq);
+                }
+            }
+            return seq;
+        }
+        case HIR_REPEAT: {
+            LiteralSeq seq = literal_prefixes(hir);
+            if (hir->min > 0) {
+                LiteralSeq sub = literal_inner(hir->sub[0]);
+                seq_keep_better(&seq, &sub);
+            }
+            return seq;
+        }
+        default:
+            return literal_prefixes(hir);
+    }
+}
+
+static bool set_push(LiteralSet *set, const uint8_t *a, const size_t alen, const uint8_t *b, const size_t blen,
+                     const size_t max_count) {
+    if (set->count == max_count || set->length + alen + blen > LITERAL_SET_MAX_BYTES) {
+        return false;
+    }
+    if (set->count + 1 >= set->capacity) {
+        const size_t capacity = set->capacity ? set->capacity * 2 : 8;
+        size_t *starts = realloc(set->starts, capacity * sizeof(size_t));
+        if (!starts) {
+            fprintf(stderr, "Memory allocation failed\n");
+            return false;
+        }
+        set->starts = starts;
+        set->capacity = capacity;
+    }
+    if (set->length + alen + blen > set->bytes_capacity) {
+        size_t capacity = set->bytes_capacity;
+        while (set->length + alen + blen > capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+        }
+        uint8_t *bytes = realloc(set->bytes, capacity);
+        if (!bytes) {
+            fprintf(stderr, "Memory allocation failed\n");
+            return false;
+        }
+        set->bytes = bytes;
+        set->bytes_capacity = capacity;
+    }
+    if (alen > 0) {
+        memcpy(set->bytes + set->length, a, alen);
+    }
+    if (blen > 0) {
+        memcpy(set->bytes + set->length + alen, b, blen);
+    }
+    set->length += alen + blen;
+    set->starts[0] = 0;
+    set->starts[++set->count] = set->length;
+    return true;
+}
+
+#define SET_STRING(set, i) ((set)->bytes + (set)->starts[i])
+#define SET_LENGTH(set, i) ((set)->starts[(i) + 1] - (set)->starts[i])
+
+// Replaces a with every string of a followed by every string of b, in
+// order: all continuations of a's first string come first.
+static bool set_cross(LiteralSet *a, const LiteralSet *b, const size_t max_count) {
+    LiteralSet product = {0};
+    bool ok = true;
+    for (size_t i = 0; i < a->count && ok; i++) {
+        for (size_t j = 0; j < b->count && ok; j++) {
+            ok = set_push(&product, SET_STRING(a, i), SET_LENGTH(a, i), SET_STRING(b, j), SET_LENGTH(b, j),
+                          max_count);
+        }
+    }
+    literal_set_free(a);
+    *a = product;
+    return ok;
+}
+
+static bool set_append(LiteralSet *a, const LiteralSet *b, const size_t max_count) {
+    bool ok = true;
+    for (size_t j = 0; j < b->count && ok; j++) {
+        ok = set_push(a, SET_STRING(b, j), SET_LENGTH(b, j), NULL, 0, max_count);
+    }
+    return ok;
+}
+
+// x{min,max} runs like x^min (x (x ...)?)?: each optional copy prefers
+// to match, and its continuations come before skipping it.
+static bool set_repeat(const Hir *hir, const size_t max_count, LiteralSet *set) {
+    const Hir *sub = hir->sub[0];
+    if (hir->max == -1 || (hir->max > hir->min && hir_nullable(sub))) {
+        return false;
+    }
+    LiteralSet body = {0};
+    if (!literal_set_build(sub, max_count, &body)) {
+        literal_set_free(&body);
+        return false;
+    }
+    bool ok = set_push(set, NULL, 0, NULL, 0, max_count);
+    for (int i = 0; i < hir->min && ok; i++) {
+        ok = set_cross(set, &body, max_count);
+    }
+    LiteralSet tail = {0};
+    ok = ok && set_push(&tail, NULL, 0, NULL, 0, max_count);
+    for (int i = hir->min; i < hir->max && ok; i++) {
+        LiteralSet more = {0};
+        ok = set_append(&more, &body, max_count) && set_cross(&more, &tail, max_count) &&
+             set_push(&more, NULL, 0, NULL, 0, max_count);
+        literal_set_free(&tail);
+        tail = more;
+    }
+    ok = ok && set_cross(set, &tail, max_count);
+    literal_set_free(&tail);
+    literal_set_free(&body);
+    return ok;
+}
+
+bool literal_set_build(const Hir *hir, const size_t max_count, LiteralSet *set) {
+    memset(set, 0, sizeof(LiteralSet));
+    switch (hir->kind) {
+        case HIR_EMPTY:
+            return set_push(set, NULL, 0, NULL, 0, max_count);
+        case HIR_CLASS: {
+            bool ok = true;
+            for (unsigned b = 0; b < 256 && ok; b++) {
+                const uint8_t byte = (uint8_t) b;
+                if (byteset_contains(&hir->set, byte)) {
+                    ok = set_push(set, &byte, 1, NULL, 0, max_count);
+                }
+            }
+            return ok;
+        }
+        case HIR_CONCAT: {
+            bool ok = set_push(set, NULL, 0, NULL, 0, max_count);
+            for (size_t i = 0; i < hir->sub_count && ok; i++) {
+                LiteralSet sub;
+                ok = literal_set_build(hir->sub[i], max_count, &sub) && set_cross(set, &sub, max_count);
+                literal_set_free(&sub);
+            }
+            return ok;
+        }
+        case HIR_ALT: {
+            bool ok = true;
+            for (size_t i = 0; i < hir->sub_count && ok; i++) {
+                LiteralSet sub;
+                ok = literal_set_build(hir->sub[i], max_count, &sub) && set_append(set, &sub, max_count);
+                literal_set_free(&sub);
+            }
+            return ok;
+        }
+        case HIR_REPEAT:
+            return set_repeat(hir, max_count, set);
+        case HIR_CAPTURE:
+            return literal_set_build(hir->sub[0], max_count, set);
+        case HIR_LOOK:
+            return false;
+    }
+    return false;
+}
+
+// Appends the one string hir matches to the last string of set, counting
+// its letters and those of them that came from a class of both cases.
+static bool single_string(const Hir *hir, LiteralSet *set, size_t *letters, size_t *folded) {
+    switch (hir->kind) {
+        case HIR_EMPTY:
+            return true;
+        case HIR_CLASS: {
+            const size_t count = byteset_count(&hir->set);
+            unsigned b = 0;
+            while (b < 256 && !byteset_contains(&hir->set, (uint8_t) b)) {
+                b++;
+            }
+            uint8_t byte = (uint8_t) b;
+            if (count == 2) {
+                // The upper case letter comes first.
+                if ((uint8_t) (byte - 'A') >= 26 || !byteset_contains(&hir->set, (uint8_t) (byte | 0x20))) {
+                    return false;
+                }
+                byte |= 0x20;
+                (*folded)++;
+            } else if (count != 1) {
+                return false;
+            }
+            if (ascii_is_letter(byte)) {
+                (*letters)++;
+            }
+            if (set->length == LITERAL_SET_MAX_BYTES) {
+                return false;
+            }
+            if (set->length == set->bytes_capacity) {
+                const size_t capacity = set->bytes_capacity ? set->bytes_capacity * 2 : 64;
+                uint8_t *bytes = realloc(set->bytes, capacity);
+                if (!bytes) {
+                    fprintf(stderr, "Memory allocation failed\n");
+                    return false;
+                }
+                set->bytes = bytes;
+                set->bytes_capacity = capacity;
+            }
+            set->bytes[set->length++] = byte;
+            set->starts[set->count] = set->length;
+            return true;
+        }
+        case HIR_CONCAT:
+            for (size_t i = 0; i < hir->sub_count; i++) {
+                if (!single_string(hir->sub[i], set, letters, folded)) {
+                    return false;
+                }
+            }
+            return true;
+        case HIR_REPEAT:
+            for (int i = 0; i < hir->max; i++) {
+                if (hir->min != hir->max || !single_string(hir->sub[0], set, letters, folded)) {
+                    return false;
+                }
+            }
+            return hir->min == hir->max;
+        case HIR_CAPTURE:
+            return single_string(hir->sub[0], set, letters, folded);
+        default:
+            return false;
+    }
+}
+
+bool literal_single(const Hir *hir, LiteralSet *set, bool *caseless) {
+    memset(set, 0, sizeof(LiteralSet));
+    size_t letters = 0, folded = 0;
+    // A needle is searched for in one case or in both, so a string with
+    // letters of each kind, like [Hh]ello, is left to the automata.
+    if (!set_push(set, NULL, 0, NULL, 0, 1) || !single_string(hir, set, &letters, &folded) ||
+        (folded > 0 && folded != letters)) {
+        literal_set_free(set);
+        return false;
+    }
+    *caseless = folded > 0;
+    return true;
+}
+
+bool literal_set_add(LiteralSet *set, const uint8_t *bytes, const size_t len) {
+    return set_push(set, bytes, len, NULL, 0, SIZE_MAX);
+}
+
+void literal_set_free(LiteralSet *set) {
+    free(set->bytes);
+    free(set->starts);
+    memset(set, 0, sizeof(LiteralSet));
+}
+
+void literal_seq_free(LiteralSeq *seq) {
+    free(seq->lits);
+    seq->lits = NULL;
+    seq->count = 0;
+    seq->capacity = 0;
+}
+
+size_t literal_seq_score(const LiteralSeq *seq) {
+    if (seq->infinite || seq->count == 0) {
+        return 0;
+    }
+    size_t min_len = LITERAL_MAX_LEN;
+    for (size_t i = 0; i < seq->count; i++) {
+        min_len = seq->lits[i].len < min_len ? seq->lits[i].len : min_len;
+    }
+    // The empty literal occurs everywhere, and more than three single bytes
+    // are too common to be worth looking for.
+    if (min_len == 0 || (min_len == 1 && seq->count > 3)) {
+        return 0;
+    }
+    // Length counts for more than the number of literals: a few longer
+    // ones match far less often than a couple of single bytes.
+    return min_len * min_len * LITERAL_MAX_COUNT / seq->count;
+}
+
+// Poor sets are of no use to a search, so they are not kept.
+static LiteralSeq seq_if_good(LiteralSeq seq) {
+    if (literal_seq_score(&seq) == 0) {
+        seq_set_infinite(&seq);
+    }
+    return seq;
+}
+
+Literals *literals_extract(const Hir *hir) {
+    Literals *literals = malloc(sizeof(Literals));
+    if (!literals) {
+        fprintf(stderr, "Memory allocation failed\n");
+        return NULL;
+    }
+    literals->prefixes = seq_if_good(literal_prefixes(hir));
+    literals->suffixes = seq_if_good(literal_suffixes(hir));
+    literals->inner = seq_if_good(literal_inner(hir));
+    return literals;
+}
+
+void literals_free(Literals *literals) {
+    if (!literals) {
+        return;
+    }
+    literal_seq_free(&literals->prefixes);
+    literal_seq_free(&literals->suffixes);
+    literal_seq_free(&literals->inner);
+    free(literals);
+}
+
+// Prints the set's literals, marking inexact ones with a trailing "...".
+void literal_seq_print(const LiteralSeq *seq) {
+    if (seq->infinite) {
+        printf("none");
+        return;
+    }
+    for (size_t i = 0; i < seq->count && i < LITERAL_PRINT_MAX; i++) {
+        const Literal *lit = &seq->lits[i];
+        printf(i > 0 ? " \"" : "\"");
+        for (size_t j = 0; j < lit->len; j++) {
+            const uint8_t b = lit->bytes[j];
+            printf(b >= 0x20 && b < 0x7F && b != '"' && b != '\\' ? "%c" : "\\x%02x", b);
+        }
+        printf(lit->exact ? "\"" : "\"...");
+    }
+    if (seq->count > LITERAL_PRINT_MAX) {
+        printf(" and %zu more", seq->count - LITERAL_PRINT_MAX);
+    }
+    printf(" (score %zu)", literal_seq_score(seq));
+}
+
+void literals_print(const Literals *literals) {
+    printf("prefix lits:   ");
+    literal_seq_print(&literals->prefixes);
+    printf("\nsuffix lits:   ");
+    literal_seq_print(&literals->suffixes);
+    printf("\ninner lits:    ");
+    literal_seq_print(&literals->inner);
+    printf("\n");
+}
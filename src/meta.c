@@ -0,0 +1,210 @@
+#include <stdio.h>
+#include "meta.h"
+#include "dfa.h"
+#include "glushkov.h"
+
+// Positions are only counted this far; past it the exact number no
+// longer changes any decision.
+#define META_POSITION_LIMIT 65536
+
+const char *engine_name(const Engine engine) {
+    static const char *names[] = {"shiftand", "posnfa", "onepass", "dfa", "backtrack", "pikevm", "countset",
+                                  "ahocorasick", "substr", "revinner"};
+    return engine < ENGINE_COUNT ? names[engine] : "?";
+}
+
+// Every byte a match of hir can hold.
+static void hir_bytes(const Hir *hir, ByteSet *set) {
+    if (hir->kind == HIR_CLASS) {
+        byteset_union(set, &hir->set);
+    }
+    for (size_t i = 0; i < hir->sub_count; i++) {
+        hir_bytes(hir->sub[i], set);
+    }
+}
+
+// Picks the tail of the concatenation whose prefix literals score best,
+// given that they begin with bytes nothing before them can match.
+static void analyze_inner(Strategy *s, const Hir *hir) {
+    if (hir->kind != HIR_CONCAT) {
+        return;
+    }
+    LiteralSeq best = {0};
+    size_t best_score = 0;
+    ByteSet before;
+    byteset_clear(&before);
+    for (size_t k = 1; k < hir->sub_count; k++) {
+        hir_bytes(hir->sub[k - 1], &before);
+        // The tail as a concatenation of its own, borrowing the items.
+        Hir tail = *hir;
+        tail.sub = hir->sub + k;
+        tail.sub_count = hir->sub_count - k;
+        LiteralSeq seq = literal_prefixes(&tail);
+        bool disjoint = !seq.infinite && seq.count > 0;
+        for (size_t i = 0; i < seq.count && disjoint; i++) {
+            disjoint = seq.lits[i].len > 0 && !byteset_contains(&before, seq.lits[i].bytes[0]);
+        }
+        const size_t score = disjoint ? literal_seq_score(&seq) : 0;
+        if (score > best_score) {
+            literal_seq_free(&best);
+            best = seq;
+            best_score = score;
+            s->inner_split = k;
+        } else {
+            literal_seq_free(&seq);
+        }
+    }
+    if (best_score == 0) {
+        return;
+    }
+    s->inner_prefilter = prefilter_build(&best);
+    literal_seq_free(&best);
+    if (!s->inner_prefilter) {
+        return;
+    }
+    Hir head = *hir;
+    head.sub_count = s->inner_split;
+    Hir *reversed = hir_reverse(&head);
+    s->inner_rprog = prog_compile(reversed, 0, true);
+    hir_free(reversed);
+    if (!s->inner_rprog) {
+        prefilter_free(s->inner_prefilter);
+        s->inner_prefilter = NULL;
+    }
+}
+
+void strategy_analyze(Strategy *s, const Hir *hir, const Prog *prog, const size_t capture_count,
+                      const size_t dfa_cache_size) {
+    memset(s, 0, sizeof(Strategy));
+    s->capture_count = capture_count;
+    s->literals = literals_extract(hir);
+    s->prefilter = s->literals ? prefilter_build(&s->literals->prefixes) : NULL;
+    LiteralSet set;
+    if (literal_set_build(hir, META_MAX_AHOCORASICK_LITERALS, &set) && set.count > LITERAL_MAX_COUNT) {
+        s->ahocorasick = ahocorasick_build(
+                &set, prog->longest ? AHOCORASICK_LEFTMOST_LONGEST : AHOCORASICK_LEFTMOST_FIRST, AHOCORASICK_AUTO);
+    }
+    literal_set_free(&set);
+    if (!s->prefilter && !s->ahocorasick && prog->looks == 0) {
+        analyze_inner(s, hir);
+    }
+    s->positions = glushkov_count_positions(hir, META_POSITION_LIMIT);
+    if (s->positions > META_POSITION_LIMIT) {
+        s->positions = SIZE_MAX;
+    }
+
+    for (size_t i = 0; i < prog->length; i++) {
+        if (prog->insts[i].op == OP_BYTE) {
+            s->byte_insts++;
+        }
+    }
+    // A rough size for the DFA: one state per byte instruction, each with
+    // a full transition row and its instruction list. Patterns whose
+    // estimate exceeds the cache would clear it constantly.
+    const size_t stride = prog->nclasses + 1;
+    s->dfa_estimate = s->byte_insts * (stride * sizeof(uint32_t) + sizeof(DfaState) + sizeof(uint32_t));
+    s->counters = prog->ncounters > 0;
+    s->counters_reverse = s->counters && s->literals &&
+                          literal_seq_score(&s->literals->suffixes) > literal_seq_score(&s->literals->prefixes);
+    // A DFA state would have to carry every live count.
+    s->dfa = !s->counters && s->dfa_estimate <= dfa_cache_size;
+}
+
+void strategy_free(Strategy *s) {
+    literals_free(s->literals);
+    prefilter_free(s->prefilter);
+    ahocorasick_free(s->ahocorasick);
+    prefilter_free(s->inner_prefilter);
+    prog_free(s->inner_rprog);
+    s->literals = NULL;
+    s->prefilter = NULL;
+    s->ahocorasick = NULL;
+    s->inner_prefilter = NULL;
+    s->inner_rprog = NULL;
+}
+
+Engine strategy_select_captures(const Strategy *s, const Input *input, const size_t backtrack_max) {
+    if (input->anchored && s->onepass) {
+        return ENGINE_ONEPASS;
+    }
+    if (!s->counters && input->end - input->start <= backtrack_max) {
+        return ENGINE_BACKTRACK;
+    }
+    return ENGINE_PIKEVM;
+}
+
+Engine strategy_select(const Strategy *s, const StrategyStats *stats, const Input *input, const size_t nslots,
+                       const size_t backtrack_max) {
+    const bool dfa = s->dfa && stats->dfa_give_ups < META_MAX_DFA_GIVE_UPS;
+
+    if (s->ahocorasick) {
+        // One pass finds both ends, and the automaton never gives up.
+        return ENGINE_AHOCORASICK;
+    }
+    if (nslots == 0 && (s->shiftand || (s->posnfa && !s->counters)) && !dfa) {
+        // A DFA that stops at the first match end is at least as fast, even
+        // for single-word shift-and, so these only stand in for it. Both
+        // beat the Pike VM on a yes/no search. Counter loops unrolled into
+        // positions make the position NFA's sets as wide as the bounds,
+        // while the counting sets pay for them once per step.
+        return s->shiftand ? ENGINE_SHIFTAND : ENGINE_POSNFA;
+    }
+    if (input->anchored && s->onepass) {
+        return ENGINE_ONEPASS;
+    }
+    if (dfa && s->reverse_inner && !input->anchored && stats->reverse_inner_give_ups < META_MAX_DFA_GIVE_UPS) {
+        return ENGINE_REVERSE_INNER;
+    }
+    if (dfa) {
+        // Even for captures, narrowing the haystack to the match with the
+        // DFA first is cheaper than running a capture engine across it.
+        return ENGINE_DFA;
+    }
+    if (s->counters) {
+        return ENGINE_COUNTSET;
+    }
+    return strategy_select_captures(s, input, backtrack_max);
+}
+
+void strategy_print(const Strategy *s, const StrategyStats *stats) {
+    printf("captures:      %zu\n", s->capture_count);
+    if (s->literals) {
+        literals_print(s->literals);
+    }
+    if (s->prefilter) {
+        prefilter_print(s->prefilter);
+    }
+    if (s->ahocorasick) {
+        ahocorasick_print(s->ahocorasick);
+    }
+    if (s->inner_prefilter) {
+        printf("reverse inner: literals from item %zu%s\n", s->inner_split, s->reverse_inner ? "" : " (no dfa)");
+        prefilter_print(s->inner_prefilter);
+    }
+    if (s->positions == SIZE_MAX) {
+        printf("positions:     >%d\n", META_POSITION_LIMIT);
+    } else {
+        printf("positions:     %zu\n", s->positions);
+    }
+    printf("byte insts:    %zu\n", s->byte_insts);
+    printf("dfa estimate:  %zu bytes%s\n", s->dfa_estimate,
+           s->dfa ? "" : s->counters ? " (counters, disabled)" : " (over cache, disabled)");
+    printf("counters:      %s\n", !s->counters ? "no" : s->counters_reverse ? "yes, read backwards" : "yes");
+    printf("onepass:       %s\n", s->onepass ? "yes" : "no");
+    printf("shiftand:      %s\n", s->shiftand ? "yes" : "no");
+    printf("posnfa:        %s\n", s->posnfa ? "yes" : "no");
+    if (!stats) {
+        return;
+    }
+    printf("searches:     ");
+    for (size_t e = 0; e < ENGINE_COUNT; e++) {
+        printf(" %s=%zu", engine_name((Engine) e), stats->searches[e]);
+    }
+    printf("\n");
+    printf("dfa give-ups:  %zu%s\n", stats->dfa_give_ups,
+           stats->dfa_give_ups >= META_MAX_DFA_GIVE_UPS ? " (dfa disabled)" : "");
+    if (s->reverse_inner) {
+        printf("inner give-ups: %zu%s\n", stats->reverse_inner_give_ups,
+               stats->reverse_inner_give_ups >= META_MAX_DFA_GIVE_UPS ? " (reverse inner disabled)" : "");
+    }
+}
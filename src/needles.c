@@ -0,0 +1,235 @@
+#include <string.h>
+#include "needles.h"
+
+#if defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__))
+#include <immintrin.h>
+#define NEEDLES_X86 1
+#endif
+
+#define ONES 0x0101010101010101ULL
+#define HIGHS 0x8080808080808080ULL
+
+static bool is_needle(const uint8_t *needles, const size_t n, const bool high, const uint8_t b) {
+    if (b >= 0x80 && high) {
+        return true;
+    }
+    return (n > 0 && b == needles[0]) || (n > 1 && b == needles[1]) || (n > 2 && b == needles[2]);
+}
+
+// Whether any of the eight bytes in w is a needle.
+static bool word_has_needle(const uint8_t *needles, const size_t n, const bool high, const uint64_t w) {
+    uint64_t found = high ? w & HIGHS : 0;
+    for (size_t i = 0; i < n; i++) {
+        const uint64_t x = w ^ (ONES * needles[i]);
+        found |= (x - ONES) & ~x & HIGHS;
+    }
+    return found != 0;
+}
+
+static size_t find_scalar(const uint8_t *needles, const size_t n, const bool high, const uint8_t *hay, size_t at,
+                          const size_t end) {
+    if (n == 1 && !high) {
+        const uint8_t *p = memchr(hay + at, needles[0], end - at);
+        return p ? (size_t) (p - hay) : end;
+    }
+    for (; at + 8 <= end; at += 8) {
+        uint64_t w;
+        memcpy(&w, hay + at, sizeof(w));
+        if (word_has_needle(needles, n, high, w)) {
+            break;
+        }
+    }
+    while (at < end && !is_needle(needles, n, high, hay[at])) {
+        at++;
+    }
+    return at;
+}
+
+static size_t rfind_scalar(const uint8_t *needles, const size_t n, const bool high, const uint8_t *hay,
+                           const size_t start, size_t at) {
+    for (; at >= start + 8; at -= 8) {
+        uint64_t w;
+        memcpy(&w, hay + at - 8, sizeof(w));
+        if (word_has_needle(needles, n, high, w)) {
+            break;
+        }
+    }
+    while (at > start && !is_needle(needles, n, high, hay[at - 1])) {
+        at--;
+    }
+    return at;
+}
+
+#ifdef NEEDLES_X86
+// The i-th needle to compare with. Missing needles repeat the first, and
+// with none at all high is set, so 0x80 finds nothing it would not.
+static uint8_t needle(const uint8_t *needles, const size_t n, const size_t i) {
+    return n == 0 ? 0x80 : needles[i < n ? i : 0];
+}
+
+static unsigned mask_sse2(const __m128i v, const __m128i n0, const __m128i n1, const __m128i n2, const __m128i hi) {
+    const __m128i eq = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, n0), _mm_cmpeq_epi8(v, n1)),
+                                    _mm_cmpeq_epi8(v, n2));
+    return (unsigned) _mm_movemask_epi8(_mm_or_si128(eq, _mm_and_si128(v, hi)));
+}
+
+static size_t find_sse2(const uint8_t *needles, const size_t n, const bool high, const uint8_t *hay, size_t at,
+                        const size_t end) {
+    if (n == 0 && !high) {
+        return end;
+    }
+    const __m128i n0 = _mm_set1_epi8((char) needle(needles, n, 0));
+    const __m128i n1 = _mm_set1_epi8((char) needle(needles, n, 1));
+    const __m128i n2 = _mm_set1_epi8((char) needle(needles, n, 2));
+    const __m128i hi = _mm_set1_epi8((char) (high ? 0x80 : 0));
+    for (; at + 16 <= end; at += 16) {
+        const unsigned mask = mask_sse2(_mm_loadu_si128((const __m128i *) (hay + at)), n0, n1, n2, hi);
+        if (mask) {
+            return at + (size_t) __builtin_ctz(mask);
+        }
+    }
+    return find_scalar(needles, n, high, hay, at, end);
+}
+
+static size_t rfind_sse2(const uint8_t *needles, const size_t n, const bool high, const uint8_t *hay,
+                         const size_t start, size_t at) {
+    if (n == 0 && !high) {
+        return start;
+    }
+    const __m128i n0 = _mm_set1_epi8((char) needle(needles, n, 0));
+    const __m128i n1 = _mm_set1_epi8((char) needle(needles, n, 1));
+    const __m128i n2 = _mm_set1_epi8((char) needle(needles, n, 2));
+    const __m128i hi = _mm_set1_epi8((char) (high ? 0x80 : 0));
+    for (; at >= start + 16; at -= 16) {
+        const unsigned mask = mask_sse2(_mm_loadu_si128((const __m128i *) (hay + at - 16)), n0, n1, n2, hi);
+        if (mask) {
+            return at - 16 + (size_t) (32 - __builtin_clz(mask));
+        }
+    }
+    return rfind_scalar(needles, n, high, hay, start, at);
+}
+
+__attribute__((target("avx2")))
+static uint32_t mask_avx2(const __m256i v, const __m256i n0, const __m256i n1, const __m256i n2, const __m256i hi) {
+    const __m256i eq = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, n0), _mm256_cmpeq_epi8(v, n1)),
+                                       _mm256_cmpeq_epi8(v, n2));
+    return (uint32_t) _mm256_movemask_epi8(_mm256_or_si256(eq, _mm256_and_si256(v, hi)));
+}
+
+__attribute__((target("avx2")))
+static size_t find_avx2(const uint8_t *needles, const size_t n, const bool high, const uint8_t *hay, size_t at,
+                        const size_t end) {
+    if (n == 0 && !high) {
+        return end;
+    }
+    const __m256i n0 = _mm256_set1_epi8((char) needle(needles, n, 0));
+    const __m256i n1 = _mm256_set1_epi8((char) needle(needles, n, 1));
+    const __m256i n2 = _mm256_set1_epi8((char) needle(needles, n, 2));
+    const __m256i hi = _mm256_set1_epi8((char) (high ? 0x80 : 0));
+    for (; at + 32 <= end; at += 32) {
+        const uint32_t mask = mask_avx2(_mm256_loadu_si256((const __m256i *) (hay + at)), n0, n1, n2, hi);
+        if (mask) {
+            return at + (size_t) __builtin_ctz(mask);
+        }
+    }
+    return find_sse2(needles, n, high, hay, at, end);
+}
+
+__attribute__((target("avx2")))
+static size_t rfind_avx2(const uint8_t *needles, const size_t n, const bool high, const uint8_t *hay,
+                         const size_t start, size_t at) {
+    if (n == 0 && !high) {
+        return start;
+    }
+    const __m256i n0 = _mm256_set1_epi8((char) needle(needles, n, 0));
+    const __m256i n1 = _mm256_set1_epi8((char) needle(needles, n, 1));
+    const __m256i n2 = _mm256_set1_epi8((char) needle(needles, n, 2));
+    const __m256i hi = _mm256_set1_epi8((char) (high ? 0x80 : 0));
+    for (; at >= start + 32; at -= 32) {
+        const uint32_t mask = mask_avx2(_mm256_loadu_si256((const __m256i *) (hay + at - 32)), n0, n1, n2, hi);
+        if (mask) {
+            return at - 32 + (size_t) (32 - __builtin_clz(mask));
+        }
+    }
+    return rfind_sse2(needles, n, high, hay, start, at);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static uint64_t mask_avx512(const __m512i v, const __m512i n0, const __m512i n1, const __m512i n2, const bool high) {
+    const uint64_t eq = _mm512_cmpeq_epi8_mask(v, n0) | _mm512_cmpeq_epi8_mask(v, n1) | _mm512_cmpeq_epi8_mask(v, n2);
+    return high ? eq | _mm512_movepi8_mask(v) : eq;
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static size_t find_avx512(const uint8_t *needles, const size_t n, const bool high, const uint8_t *hay, size_t at,
+                          const size_t end) {
+    if (n == 0 && !high) {
+        return end;
+    }
+    const __m512i n0 = _mm512_set1_epi8((char) needle(needles, n, 0));
+    const __m512i n1 = _mm512_set1_epi8((char) needle(needles, n, 1));
+    const __m512i n2 = _mm512_set1_epi8((char) needle(needles, n, 2));
+    for (; at + 64 <= end; at += 64) {
+        const uint64_t mask = mask_avx512(_mm512_loadu_si512(hay + at), n0, n1, n2, high);
+        if (mask) {
+            return at + (size_t) __builtin_ctzll(mask);
+        }
+    }
+    return find_avx2(needles, n, high, hay, at, end);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static size_t rfind_avx512(const uint8_t *needles, const size_t n, const bool high, const uint8_t *hay,
+                           const size_t start, size_t at) {
+    if (n == 0 && !high) {
+        return start;
+    }
+    const __m512i n0 = _mm512_set1_epi8((char) needle(needles, n, 0));
+    const __m512i n1 = _mm512_set1_epi8((char) needle(needles, n, 1));
+    const __m512i n2 = _mm512_set1_epi8((char) needle(needles, n, 2));
+    for (; at >= start + 64; at -= 64) {
+        const uint64_t mask = mask_avx512(_mm512_loadu_si512(hay + at - 64), n0, n1, n2, high);
+        if (mask) {
+            return at - 64 + (size_t) (64 - __builtin_clzll(mask));
+        }
+    }
+    return rfind_avx2(needles, n, high, hay, start, at);
+}
+#endif
+
+void needles_select(NeedleScan *scan, CpuLevel level) {
+    level = level < cpu_level() ? level : cpu_level();
+#ifdef NEEDLES_X86
+    if (level >= CPU_AVX512) {
+        scan->find = find_avx512;
+        scan->rfind = rfind_avx512;
+        scan->level = CPU_AVX512;
+        return;
+    }
+    if (level >= CPU_AVX2) {
+        scan->find = find_avx2;
+        scan->rfind = rfind_avx2;
+        scan->level = CPU_AVX2;
+        return;
+    }
+    if (level >= CPU_SSE2) {
+        scan->find = find_sse2;
+        scan->rfind = rfind_sse2;
+        scan->level = CPU_SSE2;
+        return;
+    }
+#endif
+    scan->find = find_scalar;
+    scan->rfind = rfind_scalar;
+    scan->level = CPU_SCALAR;
+}
+
+size_t needles_find(const NeedleScan *scan, const uint8_t *needles, const size_t n, const bool high,
+                    const uint8_t *hay, const size_t at, const size_t end) {
+    return scan->find(needles, n, high, hay, at, end);
+}
+
+size_t needles_rfind(const NeedleScan *scan, const uint8_t *needles, const size_t n, const bool high,
+                     const uint8_t *hay, const size_t start, const size_t at) {
+    return scan->rfind(needles, n, high, hay, start, at);
+}
@@ -0,0 +1,264 @@
+#include "onepass.h"
+
+typedef struct {
+    uint32_t pc;
+    uint32_t looks;
+    uint64_t slots;
+} OnePassFrame;
+
+typedef struct {
+    const Prog *prog;
+    OnePass *op;
+    uint32_t *state_of;
+    uint32_t *roots;
+    size_t capacity;
+    uint32_t *seen;
+    OnePassFrame *stack;
+} Builder;
+
+// Grows every per-state array, keeping those that did grow on failure.
+static bool grow(Builder *b) {
+    OnePass *op = b->op;
+    const size_t capacity = b->capacity ? b->capacity * 2 : 16;
+    OnePassTrans *table = realloc(op->table, capacity * op->stride * sizeof(OnePassTrans));
+    if (table) {
+        op->table = table;
+    }
+    uint64_t *match_slots = realloc(op->match_slots, capacity * sizeof(uint64_t));
+    if (match_slots) {
+        op->match_slots = match_slots;
+    }
+    uint32_t *match_looks = realloc(op->match_looks, capacity * sizeof(uint32_t));
+    if (match_looks) {
+        op->match_looks = match_looks;
+    }
+    bool *is_match = realloc(op->is_match, capacity * sizeof(bool));
+    if (is_match) {
+        op->is_match = is_match;
+    }
+    uint32_t *roots = realloc(b->roots, capacity * sizeof(uint32_t));
+    if (roots) {
+        b->roots = roots;
+    }
+    if (!table || !match_slots || !match_looks || !is_match || !roots) {
+        fprintf(stderr, "Memory allocation failed\n");
+        return false;
+    }
+    b->capacity = capacity;
+    return true;
+}
+
+// Returns ONEPASS_DEAD when the table would grow too large or memory runs
+// out.
+static uint32_t state_for(Builder *b, const uint32_t pc) {
+    OnePass *op = b->op;
+    if (b->state_of[pc] != ONEPASS_DEAD) {
+        return b->state_of[pc];
+    }
+
+    if ((op->nstates + 1) * op->stride * sizeof(OnePassTrans) > ONEPASS_MAX_BYTES) {
+        return ONEPASS_DEAD;
+    }
+    if (op->nstates == b->capacity && !grow(b)) {
+        return ONEPASS_DEAD;
+    }
+
+    const uint32_t s = (uint32_t) op->nstates++;
+    for (size_t c = 0; c < op->stride; c++) {
+        op->table[s * op->stride + c] = (OnePassTrans) {.next = ONEPASS_DEAD, .looks = 0, .slots = 0};
+    }
+    op->match_slots[s] = 0;
+    op->match_looks[s] = 0;
+    op->is_match[s] = false;
+    b->roots[s] = pc;
+    b->state_of[pc] = s;
+    return s;
+}
+
+// Walks the epsilon closure of the state's root in priority order. Any
+// instruction reached twice, any byte with two ways forward or a second
+// match means the program is not one-pass.
+static bool build_state(Builder *b, const uint32_t s) {
+    const Prog *prog = b->prog;
+    OnePass *op = b->op;
+    size_t top = 0;
+
+    b->stack[top++] = (OnePassFrame) {.pc = b->roots[s], .looks = 0, .slots = 0};
+    while (top > 0) {
+        const OnePassFrame frame = b->stack[--top];
+        uint32_t pc = frame.pc;
+        uint32_t looks = frame.looks;
+        uint64_t slots = frame.slots;
+
+        for (;;) {
+            if (b->seen[pc] == s + 1) {
+                return false;
+            }
+            b->seen[pc] = s + 1;
+
+            const Inst *inst = &prog->insts[pc];
+            if (inst->op == OP_SPLIT) {
+                b->stack[top++] = (OnePassFrame) {.pc = inst->out1, .looks = looks, .slots = slots};
+                pc = inst->out;
+            } else if (inst->op == OP_SAVE) {
+                if (inst->arg >= ONEPASS_MAX_SLOTS) {
+                    return false;
+                }
+                slots |= 1ULL << inst->arg;
+                pc = inst->out;
+            } else if (inst->op == OP_LOOK) {
+                looks |= LOOK_BIT(inst->arg);
+                pc = inst->out;
+            } else if (inst->op == OP_MATCH) {
+                if (looks != 0 && top > 0) {
+                    // When the assertions fail at search time, the paths
+                    // cut off below would have to be tried after all.
+                    return false;
+                }
+                op->is_match[s] = true;
+                op->match_slots[s] = slots;
+                op->match_looks[s] = looks;
+                // Everything left on the stack has lower priority than this
+                // match and can never be preferred by leftmost-first.
+                return true;
+            } else if (inst->op == OP_BYTE) {
+                const uint32_t next = state_for(b, inst->out);
+                if (next == ONEPASS_DEAD) {
+                    return false;
+                }
+                for (size_t c = prog->byte_class[inst->lo]; c <= prog->byte_class[inst->hi]; c++) {
+                    OnePassTrans *t = &op->table[s * op->stride + c];
+                    if (t->next != ONEPASS_DEAD) {
+                        return false;
+                    }
+                    t->next = next;
+                    t->looks = looks;
+                    t->slots = slots;
+                }
+                break;
+            } else {
+                break;
+            }
+        }
+    }
+
+    return true;
+}
+
+OnePass *onepass_build(const Prog *prog) {
+    // The table keeps only the first match reachable from each state, which
+    // is right for leftmost-first alone.
+    if (prog->reverse || prog->longest || prog->nslots > ONEPASS_MAX_SLOTS || prog->ncounters > 0) {
+        return NULL;
+    }
+
+    OnePass *op = calloc(1, sizeof(OnePass));
+    if (!op) {
+        fprintf(stderr, "Memory allocation failed\n");
+        return NULL;
+    }
+    op->stride = prog->nclasses;
+    op->nslots = prog->nslots;
+    memcpy(op->byte_class, prog->byte_class, sizeof(op->byte_class));
+
+    Builder b = {
+        .prog = prog,
+        .op = op,
+        .state_of = malloc(prog->length * sizeof(uint32_t)),
+        .seen = calloc(prog->length, sizeof(uint32_t)),
+        .stack = malloc((prog->length + 1) * sizeof(OnePassFrame)),
+    };
+    bool ok = b.state_of && b.seen && b.stack;
+    if (!ok) {
+        fprintf(stderr, "Memory allocation failed\n");
+    }
+    for (size_t i = 0; ok && i < prog->length; i++) {
+        b.state_of[i] = ONEPASS_DEAD;
+    }
+
+    ok = ok && state_for(&b, prog->start) != ONEPASS_DEAD;
+    for (size_t s = 0; ok && s < op->nstates; s++) {
+        ok = build_state(&b, (uint32_t) s);
+    }
+
+    free(b.state_of);
+    free(b.seen);
+    free(b.stack);
+    free(b.roots);
+    if (!ok) {
+        onepass_free(op);
+        return NULL;
+    }
+    return op;
+}
+
+void onepass_free(OnePass *op) {
+    if (!op) {
+        return;
+    }
+    free(op->table);
+    free(op->match_slots);
+    free(op->match_looks);
+    free(op->is_match);
+    free(op);
+}
+
+static void apply_slots(size_t *work, uint64_t mask, const size_t at) {
+    while (mask) {
+        work[__builtin_ctzll(mask)] = at;
+        mask &= mask - 1;
+    }
+}
+
+static bool looks_hold(uint32_t looks, const Input *input, const size_t at) {
+    for (; looks; looks &= looks - 1) {
+        if (!look_matches((Look) __builtin_ctz(looks), input, at)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool onepass_search(const OnePass *op, const Input *input, size_t *slots, const size_t nslots) {
+    const uint8_t *hay = (const uint8_t *) input->haystack;
+    const size_t n = nslots < op->nslots ? nslots : op->nslots;
+    size_t work[ONEPASS_MAX_SLOTS];
+    bool matched = false;
+    uint32_t state = 0;
+
+    for (size_t i = 0; i < op->nslots; i++) {
+        work[i] = NO_POS;
+    }
+
+    for (size_t at = input->start;; at++) {
+        if (op->is_match[state] && looks_hold(op->match_looks[state], input, at)) {
+            matched = true;
+            if (n > 0) {
+                memcpy(slots, work, n * sizeof(size_t));
+            }
+            for (uint64_t mask = op->match_slots[state]; mask; mask &= mask - 1) {
+                const size_t slot = (size_t) __builtin_ctzll(mask);
+                if (slot < n) {
+                    slots[slot] = at;
+                }
+            }
+            if (input->earliest) {
+                break;
+            }
+        }
+        if (at >= input->end) {
+            break;
+        }
+
+        const OnePassTrans *t = &op->table[state * op->stride + op->byte_class[(uint8_t) hay[at]]];
+        if (t->next == ONEPASS_DEAD || (t->looks && !looks_hold(t->looks, input, at))) {
+            break;
+        }
+        if (n > 0) {
+            apply_slots(work, t->slots, at);
+        }
+        state = t->next;
+    }
+
+    return matched;
+}
@@ -0,0 +1,219 @@
+#include <stdio.h>
+#include "packedpair.h"
+#include "ascii.h"
+#include "input.h"
+#include "prefilter.h"
+
+#if defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__))
+#include <immintrin.h>
+#define PACKEDPAIR_X86 1
+#endif
+
+// Both cases of a letter occur wherever it is looked for, so it counts as
+// common as the commoner of them.
+static uint8_t rank(const PackedPair *pp, const uint8_t b) {
+    if (!pp->caseless || !ascii_is_letter(b)) {
+        return prefilter_rank(b);
+    }
+    const uint8_t upper = prefilter_rank((uint8_t) (b & ~0x20));
+    const uint8_t lower = prefilter_rank((uint8_t) (b | 0x20));
+    return upper > lower ? upper : lower;
+}
+
+static PackedPair *build(const uint8_t *needle, const size_t len, const bool caseless) {
+    if (len < 2) {
+        return NULL;
+    }
+    PackedPair *pp = calloc(1, sizeof(PackedPair));
+    if (pp) {
+        pp->needle = malloc(len);
+    }
+    if (!pp || !pp->needle) {
+        fprintf(stderr, "Memory allocation failed\n");
+        packed_pair_free(pp);
+        return NULL;
+    }
+    pp->len = len;
+    pp->caseless = caseless;
+    for (size_t i = 0; i < len; i++) {
+        pp->needle[i] = caseless ? ascii_to_lower(needle[i]) : needle[i];
+    }
+    needle = pp->needle;
+
+    // The rarest byte, then the rarest at another offset, preferring a
+    // different value: a repeated byte says little about its neighbour.
+    for (size_t i = 1; i < len; i++) {
+        if (rank(pp, needle[i]) < rank(pp, needle[pp->index1])) {
+            pp->index1 = i;
+        }
+    }
+    pp->index2 = pp->index1 == 0 ? 1 : 0;
+    for (size_t i = 0; i < len; i++) {
+        if (i == pp->index1) {
+            continue;
+        }
+        const bool distinct = needle[i] != needle[pp->index1];
+        const bool best_distinct = needle[pp->index2] != needle[pp->index1];
+        if ((distinct && !best_distinct) ||
+            (distinct == best_distinct && rank(pp, needle[i]) < rank(pp, needle[pp->index2]))) {
+            pp->index2 = i;
+        }
+    }
+    pp->byte1 = needle[pp->index1];
+    pp->byte2 = needle[pp->index2];
+    pp->fold1 = caseless && ascii_is_letter(pp->byte1) ? 0x20 : 0;
+    pp->fold2 = caseless && ascii_is_letter(pp->byte2) ? 0x20 : 0;
+    packed_pair_select(pp, cpu_level());
+    return pp;
+}
+
+PackedPair *packed_pair_build(const uint8_t *needle, const size_t len) {
+    return build(needle, len, false);
+}
+
+PackedPair *packed_pair_build_caseless(const uint8_t *needle, const size_t len) {
+    return build(needle, len, true);
+}
+
+void packed_pair_free(PackedPair *pp) {
+    if (!pp) {
+        return;
+    }
+    free(pp->needle);
+    free(pp);
+}
+
+static bool matches_at(const PackedPair *pp, const uint8_t *hay, const size_t i, const size_t end) {
+    if (i + pp->len > end) {
+        return false;
+    }
+    if (!pp->caseless) {
+        return memcmp(hay + i, pp->needle, pp->len) == 0;
+    }
+    for (size_t j = 0; j < pp->len; j++) {
+        if (ascii_to_lower(hay[i + j]) != pp->needle[j]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// memchr on the rarer byte of the pair, then the other, then the rest.
+static size_t find_scalar(const PackedPair *pp, const uint8_t *hay, size_t at, const size_t end) {
+    if (pp->caseless) {
+        for (; at + pp->len <= end; at++) {
+            if ((hay[at + pp->index1] | pp->fold1) == pp->byte1 && (hay[at + pp->index2] | pp->fold2) == pp->byte2 &&
+                matches_at(pp, hay, at, end)) {
+                return at;
+            }
+        }
+        return NO_POS;
+    }
+    while (at + pp->len <= end) {
+        const uint8_t *p = memchr(hay + at + pp->index1, pp->byte1, end - pp->len + 1 - at);
+        if (!p) {
+            return NO_POS;
+        }
+        const size_t i = (size_t) (p - hay) - pp->index1;
+        if (hay[i + pp->index2] == pp->byte2 && matches_at(pp, hay, i, end)) {
+            return i;
+        }
+        at = i + 1;
+    }
+    return NO_POS;
+}
+
+#ifdef PACKEDPAIR_X86
+static size_t find_sse2(const PackedPair *pp, const uint8_t *hay, size_t at, const size_t end) {
+    const __m128i b1 = _mm_set1_epi8((char) pp->byte1);
+    const __m128i b2 = _mm_set1_epi8((char) pp->byte2);
+    const __m128i f1 = _mm_set1_epi8((char) pp->fold1);
+    const __m128i f2 = _mm_set1_epi8((char) pp->fold2);
+    const size_t reach = (pp->index1 > pp->index2 ? pp->index1 : pp->index2) + 16;
+    for (; at + reach <= end; at += 16) {
+        const __m128i v1 = _mm_or_si128(_mm_loadu_si128((const __m128i *) (hay + at + pp->index1)), f1);
+        const __m128i v2 = _mm_or_si128(_mm_loadu_si128((const __m128i *) (hay + at + pp->index2)), f2);
+        unsigned mask = (unsigned) _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(v1, b1), _mm_cmpeq_epi8(v2, b2)));
+        while (mask) {
+            const size_t i = at + (size_t) __builtin_ctz(mask);
+            if (matches_at(pp, hay, i, end)) {
+                return i;
+            }
+            mask &= mask - 1;
+        }
+    }
+    return find_scalar(pp, hay, at, end);
+}
+
+__attribute__((target("avx2")))
+static size_t find_avx2(const PackedPair *pp, const uint8_t *hay, size_t at, const size_t end) {
+    const __m256i b1 = _mm256_set1_epi8((char) pp->byte1);
+    const __m256i b2 = _mm256_set1_epi8((char) pp->byte2);
+    const __m256i f1 = _mm256_set1_epi8((char) pp->fold1);
+    const __m256i f2 = _mm256_set1_epi8((char) pp->fold2);
+    const size_t reach = (pp->index1 > pp->index2 ? pp->index1 : pp->index2) + 32;
+    for (; at + reach <= end; at += 32) {
+        const __m256i v1 = _mm256_or_si256(_mm256_loadu_si256((const __m256i *) (hay + at + pp->index1)), f1);
+        const __m256i v2 = _mm256_or_si256(_mm256_loadu_si256((const __m256i *) (hay + at + pp->index2)), f2);
+        uint32_t mask = (uint32_t) _mm256_movemask_epi8(
+                _mm256_and_si256(_mm256_cmpeq_epi8(v1, b1), _mm256_cmpeq_epi8(v2, b2)));
+        while (mask) {
+            const size_t i = at + (size_t) __builtin_ctz(mask);
+            if (matches_at(pp, hay, i, end)) {
+                return i;
+            }
+            mask &= mask - 1;
+        }
+    }
+    return find_sse2(pp, hay, at, end);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static size_t find_avx512(const PackedPair *pp, const uint8_t *hay, size_t at, const size_t end) {
+    const __m512i b1 = _mm512_set1_epi8((char) pp->byte1);
+    const __m512i b2 = _mm512_set1_epi8((char) pp->byte2);
+    const __m512i f1 = _mm512_set1_epi8((char) pp->fold1);
+    const __m512i f2 = _mm512_set1_epi8((char) pp->fold2);
+    const size_t reach = (pp->index1 > pp->index2 ? pp->index1 : pp->index2) + 64;
+    for (; at + reach <= end; at += 64) {
+        const __m512i v1 = _mm512_or_si512(_mm512_loadu_si512(hay + at + pp->index1), f1);
+        const __m512i v2 = _mm512_or_si512(_mm512_loadu_si512(hay + at + pp->index2), f2);
+        uint64_t mask = _mm512_cmpeq_epi8_mask(v1, b1) & _mm512_cmpeq_epi8_mask(v2, b2);
+        while (mask) {
+            const size_t i = at + (size_t) __builtin_ctzll(mask);
+            if (matches_at(pp, hay, i, end)) {
+                return i;
+            }
+            mask &= mask - 1;
+        }
+    }
+    return find_avx2(pp, hay, at, end);
+}
+#endif
+
+void packed_pair_select(PackedPair *pp, CpuLevel level) {
+    level = level < cpu_level() ? level : cpu_level();
+#ifdef PACKEDPAIR_X86
+    if (level >= CPU_AVX512) {
+        pp->find = find_avx512;
+        pp->level = CPU_AVX512;
+        return;
+    }
+    if (level >= CPU_AVX2) {
+        pp->find = find_avx2;
+        pp->level = CPU_AVX2;
+        return;
+    }
+    if (level >= CPU_SSE2) {
+        pp->find = find_sse2;
+        pp->level = CPU_SSE2;
+        return;
+    }
+#endif
+    pp->find = find_scalar;
+    pp->level = CPU_SCALAR;
+}
+
+size_t packed_pair_find(const PackedPair *pp, const uint8_t *hay, const size_t at, const size_t end) {
+    return pp->find(pp, hay, at, end);
+}
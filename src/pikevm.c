@@ -0,0 +1,322 @@
+#include "pikevm.h"
+
+#define RESTORE UINT32_MAX
+
+static bool list_init(ThreadList *list, const size_t ninsts, const size_t nslots) {
+    memset(list, 0, sizeof(ThreadList));
+    list->capacity = ninsts;
+    list->pcs = malloc(ninsts * sizeof(uint32_t));
+    list->counts = malloc(ninsts * sizeof(uint32_t));
+    list->slots = malloc((ninsts * nslots + 1) * sizeof(size_t));
+    list->sparse = malloc(ninsts * sizeof(uint32_t));
+    list->gen = 1;
+    return list->pcs && list->counts && list->slots && list->sparse;
+}
+
+static void list_free(ThreadList *list) {
+    free(list->pcs);
+    free(list->counts);
+    free(list->slots);
+    free(list->sparse);
+    free(list->keys);
+    free(list->gens);
+    memset(list, 0, sizeof(ThreadList));
+}
+
+static void list_clear(ThreadList *list) {
+    list->size = 0;
+    if (list->table_used > 0) {
+        list->table_used = 0;
+        if (++list->gen == 0) {
+            memset(list->gens, 0, list->table_size * sizeof(uint32_t));
+            list->gen = 1;
+        }
+    }
+}
+
+static bool list_grow(ThreadList *list, const size_t nslots) {
+    const size_t capacity = list->capacity * 2;
+    uint32_t *pcs = realloc(list->pcs, capacity * sizeof(uint32_t));
+    if (pcs) {
+        list->pcs = pcs;
+    }
+    uint32_t *counts = realloc(list->counts, capacity * sizeof(uint32_t));
+    if (counts) {
+        list->counts = counts;
+    }
+    size_t *slots = realloc(list->slots, (capacity * nslots + 1) * sizeof(size_t));
+    if (slots) {
+        list->slots = slots;
+    }
+    if (!pcs || !counts || !slots) {
+        fprintf(stderr, "Memory allocation failed\n");
+        return false;
+    }
+    list->capacity = capacity;
+    return true;
+}
+
+static size_t hash_key(const uint64_t key, const size_t mask) {
+    return (size_t) ((key * 0x9E3779B97F4A7C15ULL) >> 32) & mask;
+}
+
+static bool table_grow(ThreadList *list) {
+    const size_t size = list->table_size ? list->table_size * 2 : 64;
+    uint64_t *keys = malloc(size * sizeof(uint64_t));
+    uint32_t *gens = calloc(size, sizeof(uint32_t));
+    if (!keys || !gens) {
+        fprintf(stderr, "Memory allocation failed\n");
+        free(keys);
+        free(gens);
+        return false;
+    }
+    for (size_t i = 0; i < list->table_size; i++) {
+        if (list->gens[i] == list->gen) {
+            size_t j = hash_key(list->keys[i], size - 1);
+            while (gens[j] == list->gen) {
+                j = (j + 1) & (size - 1);
+            }
+            keys[j] = list->keys[i];
+            gens[j] = list->gen;
+        }
+    }
+    free(list->keys);
+    free(list->gens);
+    list->keys = keys;
+    list->gens = gens;
+    list->table_size = size;
+    return true;
+}
+
+// Makes room for one more thread at pc; returns false when memory runs out.
+static bool list_reserve(ThreadList *list, const Prog *prog, const uint32_t pc, const size_t nslots) {
+    if (prog->counter_of && prog->counter_of[pc] != NO_COUNTER && 2 * (list->table_used + 1) > list->table_size &&
+        !table_grow(list)) {
+        return false;
+    }
+    return list->size < list->capacity || list_grow(list, nslots);
+}
+
+// Records a thread at (pc, count) and returns true, or returns false if
+// a higher-priority thread already holds that state. Room for it must
+// have been reserved.
+static bool list_add(ThreadList *list, const Prog *prog, const uint32_t pc, const uint32_t count) {
+    if (prog->counter_of && prog->counter_of[pc] != NO_COUNTER) {
+        const uint64_t key = (uint64_t) pc << 32 | count;
+        size_t i = hash_key(key, list->table_size - 1);
+        while (list->gens[i] == list->gen) {
+            if (list->keys[i] == key) {
+                return false;
+            }
+            i = (i + 1) & (list->table_size - 1);
+        }
+        list->keys[i] = key;
+        list->gens[i] = list->gen;
+        list->table_used++;
+    } else {
+        const uint32_t i = list->sparse[pc];
+        if (i < list->size && list->pcs[i] == pc) {
+            return false;
+        }
+        list->sparse[pc] = (uint32_t) list->size;
+    }
+
+    list->pcs[list->size] = pc;
+    list->counts[list->size] = count;
+    list->size++;
+    return true;
+}
+
+bool pikevm_cache_init(PikeCache *cache, const Prog *prog) {
+    cache->ninsts = prog->length;
+    cache->nslots = prog->nslots;
+    cache->tracked = prog->nslots;
+    cache->stack_capacity = 2 * (prog->length + 1);
+    cache->stack = malloc(cache->stack_capacity * sizeof(PikeFrame));
+    cache->scratch = malloc((prog->nslots + 1) * sizeof(size_t));
+    const bool ok = list_init(&cache->lists[0], prog->length, prog->nslots) &&
+                    list_init(&cache->lists[1], prog->length, prog->nslots);
+    if (!ok || !cache->stack || !cache->scratch) {
+        fprintf(stderr, "Memory allocation failed\n");
+        pikevm_cache_free(cache);
+        return false;
+    }
+    return true;
+}
+
+void pikevm_cache_free(PikeCache *cache) {
+    list_free(&cache->lists[0]);
+    list_free(&cache->lists[1]);
+    free(cache->stack);
+    free(cache->scratch);
+    cache->stack = NULL;
+    cache->scratch = NULL;
+}
+
+static bool push(PikeCache *cache, size_t *top, const PikeFrame frame) {
+    if (*top == cache->stack_capacity) {
+        PikeFrame *stack = realloc(cache->stack, 2 * cache->stack_capacity * sizeof(PikeFrame));
+        if (!stack) {
+            fprintf(stderr, "Memory allocation failed\n");
+            return false;
+        }
+        cache->stack = stack;
+        cache->stack_capacity *= 2;
+    }
+    cache->stack[(*top)++] = frame;
+    return true;
+}
+
+// Follows every epsilon path from pc in priority order, recording the
+// capture slots and count each consuming instruction is reached with.
+// Returns false when memory runs out.
+static bool add_thread(const Prog *prog, PikeCache *cache, ThreadList *list, const uint32_t pc,
+                       const uint32_t count, const Input *input, const size_t at) {
+    const size_t nslots = cache->nslots;
+    const size_t tracked = cache->tracked;
+    size_t *slots = cache->scratch;
+    size_t top = 0;
+
+    if (!push(cache, &top, (PikeFrame) {.pc = pc, .count = count})) {
+        return false;
+    }
+    while (top > 0) {
+        const PikeFrame frame = cache->stack[--top];
+        if (frame.pc == RESTORE) {
+            slots[frame.slot] = frame.value;
+            continue;
+        }
+
+        uint32_t cur = frame.pc;
+        uint32_t n = frame.count;
+        for (;;) {
+            if (!list_reserve(list, prog, cur, nslots)) {
+                return false;
+            }
+            if (!list_add(list, prog, cur, n)) {
+                break;
+            }
+            const Inst *inst = &prog->insts[cur];
+            if (inst->op == OP_SPLIT) {
+                if (!push(cache, &top, (PikeFrame) {.pc = inst->out1, .count = n})) {
+                    return false;
+                }
+                cur = inst->out;
+            } else if (inst->op == OP_SAVE) {
+                if (inst->arg < tracked) {
+                    if (!push(cache, &top,
+                              (PikeFrame) {.pc = RESTORE, .slot = inst->arg, .value = slots[inst->arg]})) {
+                        return false;
+                    }
+                    slots[inst->arg] = at;
+                }
+                cur = inst->out;
+            } else if (inst->op == OP_CINIT) {
+                n = 0;
+                cur = inst->out;
+            } else if (inst->op == OP_CLOOP) {
+                // Another iteration is preferred to leaving the loop.
+                const Counter *k = &prog->counters[inst->arg];
+                if (n >= k->min && n < k->max) {
+                    if (!push(cache, &top, (PikeFrame) {.pc = inst->out1, .count = 0})) {
+                        return false;
+                    }
+                    cur = inst->out;
+                } else if (n < k->min) {
+                    cur = inst->out;
+                } else {
+                    n = 0;
+                    cur = inst->out1;
+                }
+            } else if (inst->op == OP_CINC) {
+                const Counter *k = &prog->counters[inst->arg];
+                if (n < k->min || k->max != UINT32_MAX) {
+                    n++;
+                }
+                cur = inst->out;
+            } else if (inst->op == OP_LOOK) {
+                if (!look_matches((Look) inst->arg, input, at)) {
+                    break;
+                }
+                cur = inst->out;
+            } else {
+                memcpy(list->slots + (list->size - 1) * nslots, slots, tracked * sizeof(size_t));
+                break;
+            }
+        }
+    }
+    return true;
+}
+
+bool pikevm_search(const Prog *prog, PikeCache *cache, const Input *input, size_t *slots, const size_t nslots) {
+    const uint8_t *hay = (const uint8_t *) input->haystack;
+    const size_t nprog = cache->nslots;
+    const size_t tracked = nslots < nprog ? nslots : nprog;
+    // Comparing matches needs their starts; a yes/no answer does not.
+    const bool longest = prog->longest && tracked > 0 && !input->earliest;
+    ThreadList *clist = &cache->lists[0];
+    ThreadList *nlist = &cache->lists[1];
+    bool matched = false;
+    size_t best = NO_POS;
+
+    cache->tracked = tracked;
+    list_clear(clist);
+    list_clear(nlist);
+
+    for (size_t at = input->start; at <= input->end; at++) {
+        if (!matched && (!input->anchored || at == input->start)) {
+            for (size_t i = 0; i < tracked; i++) {
+                cache->scratch[i] = NO_POS;
+            }
+            if (!add_thread(prog, cache, clist, prog->start, 0, input, at)) {
+                return false;
+            }
+        }
+        if (clist->size == 0) {
+            break;
+        }
+
+        for (size_t i = 0; i < clist->size; i++) {
+            const Inst *inst = &prog->insts[clist->pcs[i]];
+            const size_t *thread = clist->slots + i * nprog;
+
+            if (inst->op == OP_BYTE) {
+                if (longest && matched && thread[0] > slots[0]) {
+                    // Started right of the match found; it cannot be leftmost.
+                    continue;
+                }
+                if (at < input->end && inst->lo <= hay[at] && hay[at] <= inst->hi) {
+                    memcpy(cache->scratch, thread, tracked * sizeof(size_t));
+                    if (!add_thread(prog, cache, nlist, inst->out, clist->counts[i], input, at + 1)) {
+                        return false;
+                    }
+                }
+            } else if (inst->op == OP_MATCH && longest) {
+                // Threads are ordered by start, then priority, so the first
+                // match seen at a position is the one to keep there.
+                if (!matched || thread[0] < slots[0] || (thread[0] == slots[0] && at > best)) {
+                    memcpy(slots, thread, tracked * sizeof(size_t));
+                    best = at;
+                }
+                matched = true;
+            } else if (inst->op == OP_MATCH) {
+                if (tracked > 0) {
+                    memcpy(slots, thread, tracked * sizeof(size_t));
+                }
+                matched = true;
+                if (input->earliest) {
+                    return true;
+                }
+                // Lower-priority threads can no longer win under leftmost-first.
+                break;
+            }
+        }
+
+        ThreadList *tmp = clist;
+        clist = nlist;
+        nlist = tmp;
+        list_clear(nlist);
+    }
+
+    return matched;
+}
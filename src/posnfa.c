@@ -0,0 +1,179 @@
+#include "posnfa.h"
+
+// Bytes that belong to the same position classes are interchangeable.
+static void build_classes(PosNfa *nfa, const Glushkov *g) {
+    uint64_t *vec = calloc(256 * g->nwords, sizeof(uint64_t));
+
+    for (size_t p = 0; p < g->npos; p++) {
+        for (unsigned b = 0; b < 256; b++) {
+            if (byteset_contains(&g->classes[p], (uint8_t) b)) {
+                vec[b * g->nwords + (p >> 6)] |= 1ULL << (p & 63);
+            }
+        }
+    }
+
+    uint8_t rep[256];
+    nfa->nclasses = 0;
+    for (unsigned b = 0; b < 256; b++) {
+        size_t c = 0;
+        while (c < nfa->nclasses &&
+               memcmp(vec + rep[c] * g->nwords, vec + b * g->nwords, g->nwords * sizeof(uint64_t)) != 0) {
+            c++;
+        }
+        if (c == nfa->nclasses) {
+            rep[nfa->nclasses++] = (uint8_t) b;
+        }
+        nfa->byte_class[b] = (uint8_t) c;
+    }
+
+    size_t nfirst = 0;
+    nfa->first_start = malloc((nfa->nclasses + 1) * sizeof(uint32_t));
+    for (size_t c = 0; c < nfa->nclasses; c++) {
+        for (size_t w = 0; w < g->nwords; w++) {
+            nfirst += (size_t) __builtin_popcountll(g->first[w] & vec[rep[c] * g->nwords + w]);
+        }
+    }
+    nfa->first = malloc((nfirst + 1) * sizeof(uint32_t));
+    nfirst = 0;
+    for (size_t c = 0; c < nfa->nclasses; c++) {
+        nfa->first_start[c] = (uint32_t) nfirst;
+        for (size_t w = 0; w < g->nwords; w++) {
+            for (uint64_t bits = g->first[w] & vec[rep[c] * g->nwords + w]; bits; bits &= bits - 1) {
+                nfa->first[nfirst++] = (uint32_t) (w * 64 + (size_t) __builtin_ctzll(bits));
+            }
+        }
+    }
+    nfa->first_start[nfa->nclasses] = (uint32_t) nfirst;
+    free(vec);
+}
+
+PosNfa *posnfa_build(const Hir *hir) {
+    Glushkov *g = glushkov_build(hir, POSNFA_MAX_POSITIONS);
+    if (!g) {
+        return NULL;
+    }
+
+    PosNfa *nfa = calloc(1, sizeof(PosNfa));
+    nfa->npos = g->npos;
+    nfa->nullable = g->nullable;
+    nfa->classes = malloc((g->npos + 1) * sizeof(ByteSet));
+    memcpy(nfa->classes, g->classes, g->npos * sizeof(ByteSet));
+    nfa->is_last = malloc(g->npos + 1);
+    for (size_t p = 0; p < g->npos; p++) {
+        nfa->is_last[p] = glushkov_bit(g->last, p);
+    }
+
+    nfa->succ_start = malloc((g->npos + 1) * sizeof(uint32_t));
+    for (size_t p = 0; p < g->npos * g->nwords; p++) {
+        nfa->nedges += (size_t) __builtin_popcountll(g->follow[p]);
+    }
+    nfa->succ = malloc((nfa->nedges + 1) * sizeof(uint32_t));
+    size_t n = 0;
+    for (size_t p = 0; p < g->npos; p++) {
+        const uint64_t *follow = g->follow + p * g->nwords;
+        nfa->succ_start[p] = (uint32_t) n;
+        for (size_t w = 0; w < g->nwords; w++) {
+            for (uint64_t bits = follow[w]; bits; bits &= bits - 1) {
+                nfa->succ[n++] = (uint32_t) (w * 64 + (size_t) __builtin_ctzll(bits));
+            }
+        }
+    }
+    nfa->succ_start[g->npos] = (uint32_t) n;
+    build_classes(nfa, g);
+
+    glushkov_free(g);
+    return nfa;
+}
+
+void posnfa_free(PosNfa *nfa) {
+    if (!nfa) {
+        return;
+    }
+    free(nfa->classes);
+    free(nfa->is_last);
+    free(nfa->succ_start);
+    free(nfa->succ);
+    free(nfa->first_start);
+    free(nfa->first);
+    free(nfa);
+}
+
+bool posnfa_cache_init(PosNfaCache *cache, const PosNfa *nfa) {
+    memset(cache, 0, sizeof(PosNfaCache));
+    cache->npos = nfa->npos;
+    cache->lists[0] = malloc((nfa->npos + 1) * sizeof(uint32_t));
+    cache->lists[1] = malloc((nfa->npos + 1) * sizeof(uint32_t));
+    cache->marks = calloc(nfa->npos + 1, sizeof(uint32_t));
+    if (!cache->lists[0] || !cache->lists[1] || !cache->marks) {
+        fprintf(stderr, "Memory allocation failed\n");
+        posnfa_cache_free(cache);
+        return false;
+    }
+    return true;
+}
+
+void posnfa_cache_free(PosNfaCache *cache) {
+    free(cache->lists[0]);
+    free(cache->lists[1]);
+    free(cache->marks);
+    memset(cache, 0, sizeof(PosNfaCache));
+}
+
+static bool takes(const ByteSet *set, const uint8_t b) {
+    return (set->bits[b >> 6] >> (b & 63)) & 1;
+}
+
+bool posnfa_search(const PosNfa *nfa, PosNfaCache *cache, const Input *input, size_t *end) {
+    const uint8_t *hay = (const uint8_t *) input->haystack;
+    uint32_t *cur = cache->lists[0];
+    uint32_t *next = cache->lists[1];
+    size_t ncur = 0;
+
+    if (nfa->nullable) {
+        *end = input->start;
+        return true;
+    }
+    for (size_t at = input->start; at < input->end; at++) {
+        const uint8_t b = hay[at];
+        if (++cache->step == 0) {
+            memset(cache->marks, 0, cache->npos * sizeof(uint32_t));
+            cache->step = 1;
+        }
+        const uint32_t step = cache->step;
+        size_t nnext = 0;
+
+        if (!input->anchored || at == input->start) {
+            const size_t c = nfa->byte_class[b];
+            for (uint32_t i = nfa->first_start[c]; i < nfa->first_start[c + 1]; i++) {
+                const uint32_t q = nfa->first[i];
+                cache->marks[q] = step;
+                next[nnext++] = q;
+            }
+        }
+        for (size_t i = 0; i < ncur; i++) {
+            const uint32_t p = cur[i];
+            for (uint32_t e = nfa->succ_start[p]; e < nfa->succ_start[p + 1]; e++) {
+                const uint32_t q = nfa->succ[e];
+                if (cache->marks[q] != step && takes(&nfa->classes[q], b)) {
+                    cache->marks[q] = step;
+                    next[nnext++] = q;
+                }
+            }
+        }
+
+        for (size_t i = 0; i < nnext; i++) {
+            if (nfa->is_last[next[i]]) {
+                *end = at + 1;
+                return true;
+            }
+        }
+        if (nnext == 0 && input->anchored) {
+            return false;
+        }
+        uint32_t *tmp = cur;
+        cur = next;
+        next = tmp;
+        ncur = nnext;
+    }
+    return false;
+}
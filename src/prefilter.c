@@ -0,0 +1,323 @@
+#include <stdio.h>
+#include "prefilter.h"
+
+// Rank of every byte, 0 for the rarest and 255 for the most common. The
+// ranks order the average of two byte distributions: one over 57 MB of
+// text (licenses, C headers, Python sources, package notices) and one
+// over 33 MB of executables, so NUL, space and 'e' come out on top and
+// the bytes that are rare in both UTF-8 text and machine code at the
+// bottom.
+static const uint8_t BYTE_RANK[256] = {
+        255, 226, 205, 195, 202, 203, 153, 167, 219, 148, 236, 133, 138, 179, 206, 230,
+        209, 147, 161, 80, 118, 139, 66, 56, 189, 60, 51, 62, 100, 78, 72, 200,
+        253, 89, 152, 107, 229, 162, 53, 129, 204, 193, 172, 97, 183, 194, 232, 251,
+        212, 218, 196, 160, 150, 176, 121, 91, 177, 188, 184, 126, 123, 178, 88, 52,
+        187, 223, 185, 186, 220, 207, 170, 155, 245, 217, 111, 105, 225, 182, 173, 164,
+        190, 57, 171, 197, 199, 165, 115, 132, 124, 71, 67, 142, 145, 149, 98, 238,
+        125, 244, 239, 241, 237, 254, 227, 222, 231, 249, 99, 191, 246, 233, 242, 248,
+        247, 166, 243, 250, 252, 235, 208, 192, 211, 214, 110, 96, 158, 94, 83, 76,
+        180, 102, 43, 216, 213, 215, 68, 55, 128, 234, 35, 228, 93, 221, 58, 49,
+        154, 9, 16, 28, 84, 29, 8, 11, 70, 13, 1, 0, 45, 18, 2, 17,
+        95, 19, 27, 21, 33, 6, 7, 4, 86, 12, 25, 23, 50, 10, 3, 22,
+        92, 15, 5, 14, 63, 20, 116, 39, 120, 82, 146, 42, 112, 54, 122, 90,
+        210, 163, 108, 174, 141, 113, 151, 198, 106, 117, 46, 24, 37, 30, 34, 26,
+        130, 61, 135, 44, 32, 38, 41, 40, 127, 75, 47, 101, 31, 73, 69, 157,
+        134, 59, 65, 36, 77, 48, 79, 104, 224, 201, 85, 169, 114, 119, 137, 175,
+        143, 64, 74, 103, 81, 87, 168, 144, 159, 109, 131, 136, 140, 156, 181, 240,
+};
+
+uint8_t prefilter_rank(const uint8_t byte) {
+    return BYTE_RANK[byte];
+}
+
+// The rarest byte of lit among the first n of needles, or -1 if it holds
+// none of them.
+static int rarest_needle(const Literal *lit, const uint8_t *needles, const size_t n) {
+    int best = -1;
+    for (size_t i = 0; i < n; i++) {
+        if (memchr(lit->bytes, needles[i], lit->len) &&
+            (best < 0 || BYTE_RANK[needles[i]] < BYTE_RANK[needles[best]])) {
+            best = (int) i;
+        }
+    }
+    return best;
+}
+
+static uint8_t rarest_byte(const Literal *lit) {
+    uint8_t best = lit->bytes[0];
+    for (size_t i = 1; i < lit->len; i++) {
+        if (BYTE_RANK[lit->bytes[i]] < BYTE_RANK[best]) {
+            best = lit->bytes[i];
+        }
+    }
+    return best;
+}
+
+// Picks at most three needles that every literal holds one of. Each round
+// takes, among the rarest bytes of the literals not yet covered, the one
+// that covers the most of them. Returns the number picked, or 0.
+static size_t pick_needles(const LiteralSeq *seq, uint8_t *needles) {
+    size_t n = 0;
+    for (;;) {
+        size_t covers[256] = {0};
+        bool uncovered = false;
+        for (size_t i = 0; i < seq->count; i++) {
+            const Literal *lit = &seq->lits[i];
+            if (rarest_needle(lit, needles, n) >= 0) {
+                continue;
+            }
+            uncovered = true;
+            covers[rarest_byte(lit)] = 1;
+        }
+        if (!uncovered) {
+            return n;
+        }
+        if (n == PREFILTER_MAX_NEEDLES) {
+            return 0;
+        }
+
+        for (size_t i = 0; i < seq->count; i++) {
+            const Literal *lit = &seq->lits[i];
+            if (rarest_needle(lit, needles, n) >= 0) {
+                continue;
+            }
+            bool seen[256] = {false};
+            for (size_t j = 0; j < lit->len; j++) {
+                const uint8_t b = lit->bytes[j];
+                if (covers[b] > 0 && !seen[b]) {
+                    seen[b] = true;
+                    covers[b]++;
+                }
+            }
+        }
+        unsigned best = 256;
+        for (unsigned b = 0; b < 256; b++) {
+            if (covers[b] > 0 && (best == 256 || covers[b] > covers[best] ||
+                                  (covers[b] == covers[best] && BYTE_RANK[b] < BYTE_RANK[best]))) {
+                best = b;
+            }
+        }
+        needles[n++] = (uint8_t) best;
+    }
+}
+
+static Prefilter *build_ahocorasick(const LiteralSeq *prefixes) {
+    LiteralSet set = {0};
+    for (size_t i = 0; i < prefixes->count; i++) {
+        literal_set_add(&set, prefixes->lits[i].bytes, prefixes->lits[i].len);
+    }
+    Prefilter *pre = calloc(1, sizeof(Prefilter));
+    if (!pre) {
+        fprintf(stderr, "Memory allocation failed\n");
+        literal_set_free(&set);
+        return NULL;
+    }
+    // Any literal marks a candidate, so the cheaper kind will do.
+    pre->ahocorasick = ahocorasick_build(&set, AHOCORASICK_LEFTMOST_FIRST, AHOCORASICK_AUTO);
+    literal_set_free(&set);
+    if (!pre->ahocorasick) {
+        free(pre);
+        return NULL;
+    }
+    return pre;
+}
+
+Prefilter *prefilter_build(const LiteralSeq *prefixes) {
+    if (prefixes->infinite || prefixes->count == 0) {
+        return NULL;
+    }
+    size_t min_len = LITERAL_MAX_LEN;
+    for (size_t i = 0; i < prefixes->count; i++) {
+        min_len = prefixes->lits[i].len < min_len ? prefixes->lits[i].len : min_len;
+    }
+    if (min_len == 0) {
+        return NULL;
+    }
+    uint8_t needles[PREFILTER_MAX_NEEDLES];
+    const size_t n = pick_needles(prefixes, needles);
+    bool rare = n > 0;
+    for (size_t i = 0; i < n; i++) {
+        rare &= BYTE_RANK[needles[i]] < PREFILTER_MAX_RANK;
+    }
+
+    // Two bytes at a fixed distance, or two or three leading bytes, are
+    // rare enough even when each is common on its own, so no rank is too
+    // high for the vector searchers. Teddy only loses to memchr on a
+    // single rare byte.
+    if (prefixes->count == 1 && min_len >= 2) {
+        Prefilter *pre = calloc(1, sizeof(Prefilter));
+        if (!pre) {
+            fprintf(stderr, "Memory allocation failed\n");
+            return NULL;
+        }
+        pre->pair = packed_pair_build(prefixes->lits[0].bytes, prefixes->lits[0].len);
+        if (!pre->pair) {
+            free(pre);
+            return NULL;
+        }
+        return pre;
+    }
+    if ((n != 1 || !rare) && min_len >= 2) {
+        Teddy *teddy = teddy_build(prefixes);
+        Prefilter *pre = teddy ? calloc(1, sizeof(Prefilter)) : NULL;
+        if (pre) {
+            pre->teddy = teddy;
+            return pre;
+        }
+        teddy_free(teddy);
+        if (!teddy && !rare) {
+            return build_ahocorasick(prefixes);
+        }
+    }
+    if (!rare) {
+        return NULL;
+    }
+
+    Prefilter *pre = calloc(1, sizeof(Prefilter));
+    if (pre) {
+        pre->lits = malloc(prefixes->count * sizeof(Literal));
+        pre->offsets = malloc(prefixes->count * sizeof(size_t));
+    }
+    if (!pre || !pre->lits || !pre->offsets) {
+        fprintf(stderr, "Memory allocation failed\n");
+        prefilter_free(pre);
+        return NULL;
+    }
+    memcpy(pre->needles, needles, n);
+    pre->nneedles = n;
+    needles_select(&pre->scan, cpu_level());
+
+    size_t count = 0;
+    for (size_t i = 0; i < n; i++) {
+        pre->first[i] = count;
+        for (size_t j = 0; j < prefixes->count; j++) {
+            const Literal *lit = &prefixes->lits[j];
+            if (rarest_needle(lit, needles, n) != (int) i) {
+                continue;
+            }
+            const size_t offset = (size_t) ((const uint8_t *) memchr(lit->bytes, needles[i], lit->len) - lit->bytes);
+            pre->lits[count] = *lit;
+            pre->offsets[count++] = offset;
+            pre->max_offset = offset > pre->max_offset ? offset : pre->max_offset;
+        }
+    }
+    pre->first[n] = count;
+    return pre;
+}
+
+void prefilter_free(Prefilter *pre) {
+    if (!pre) {
+        return;
+    }
+    free(pre->lits);
+    free(pre->offsets);
+    packed_pair_free(pre->pair);
+    teddy_free(pre->teddy);
+    ahocorasick_free(pre->ahocorasick);
+    free(pre);
+}
+
+// The next needle in [at, end), or NO_POS.
+static size_t find_needle(const Prefilter *pre, const uint8_t *hay, const size_t at, const size_t end) {
+    const size_t p = needles_find(&pre->scan, pre->needles, pre->nneedles, false, hay, at, end);
+    return p < end ? p : NO_POS;
+}
+
+void prefilter_state_init(PrefilterState *st) {
+    memset(st, 0, sizeof(PrefilterState));
+}
+
+bool prefilter_active(PrefilterState *st, const size_t at) {
+    if (st->paused_until == 0) {
+        return true;
+    }
+    if (at < st->paused_until) {
+        return false;
+    }
+    st->candidates = 0;
+    st->confirmed = 0;
+    st->skipped = 0;
+    st->paused_until = 0;
+    return true;
+}
+
+void prefilter_record(PrefilterState *st, const size_t from, const size_t to) {
+    st->candidates++;
+    st->skipped += to - from;
+    const size_t wasted = st->candidates - st->confirmed;
+    if (st->candidates >= PREFILTER_MIN_CANDIDATES && st->skipped < PREFILTER_MIN_SKIP * wasted) {
+        st->paused_until = to + PREFILTER_PAUSE;
+    }
+}
+
+size_t prefilter_find(const Prefilter *pre, const uint8_t *hay, const size_t at, const size_t end) {
+    if (pre->pair) {
+        return packed_pair_find(pre->pair, hay, at, end);
+    }
+    if (pre->teddy) {
+        return teddy_find(pre->teddy, hay, at, end);
+    }
+    if (pre->ahocorasick) {
+        const Input input = {(const char *) hay, end, at, end, false, false};
+        size_t start, match_end;
+        return ahocorasick_find(pre->ahocorasick, &input, &start, &match_end) ? start : NO_POS;
+    }
+    size_t best = NO_POS;
+    size_t from = at;
+    while (from < end) {
+        const size_t p = find_needle(pre, hay, from, end);
+        // Needles this far on can only belong to literals starting later.
+        if (p == NO_POS || (best != NO_POS && p >= best + pre->max_offset)) {
+            break;
+        }
+        size_t i = 0;
+        while (pre->needles[i] != hay[p]) {
+            i++;
+        }
+        for (size_t j = pre->first[i]; j < pre->first[i + 1]; j++) {
+            const Literal *lit = &pre->lits[j];
+            const size_t offset = pre->offsets[j];
+            if (p < at + offset || p - offset >= best || p - offset + lit->len > end) {
+                continue;
+            }
+            if (memcmp(hay + p - offset, lit->bytes, lit->len) == 0) {
+                best = p - offset;
+            }
+        }
+        from = p + 1;
+    }
+    return best;
+}
+
+static void print_byte(const uint8_t b) {
+    printf(b >= 0x20 && b < 0x7F ? " '%c'" : " \\x%02x", b);
+    printf(" (rank %u)", BYTE_RANK[b]);
+}
+
+void prefilter_print(const Prefilter *pre) {
+    static const char *names[] = {"memchr", "memchr2", "memchr3"};
+    if (pre->pair) {
+        const PackedPair *pp = pre->pair;
+        printf("prefilter:     packed pair (%s)", cpu_level_name(pp->level));
+        print_byte(pp->byte1);
+        printf(" at %zu,", pp->index1);
+        print_byte(pp->byte2);
+        printf(" at %zu\n", pp->index2);
+        return;
+    }
+    if (pre->teddy) {
+        const Teddy *t = pre->teddy;
+        printf("prefilter:     teddy (%s), %zu literals, %zu leading bytes\n", cpu_level_name(t->level),
+               t->first[TEDDY_BUCKETS], t->nmasks);
+        return;
+    }
+    if (pre->ahocorasick) {
+        printf("prefilter:     aho-corasick, %zu literals\n", pre->ahocorasick->npatterns);
+        return;
+    }
+    printf("prefilter:     %s (%s)", names[pre->nneedles - 1], cpu_level_name(pre->scan.level));
+    for (size_t i = 0; i < pre->nneedles; i++) {
+        print_byte(pre->needles[i]);
+    }
+    printf(", %zu literals\n", pre->first[pre->nneedles]);
+}
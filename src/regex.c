@@ -0,0 +1,475 @@
+#include "regex.h"
+#include "backtrack.h"
+#include "countset.h"
+#include "dfa.h"
+#include "lexer.h"
+#include "meta.h"
+#include "onepass.h"
+#include "pikevm.h"
+#include "posnfa.h"
+#include "prog.h"
+#include "shiftand.h"
+#include "substr.h"
+#include "utf8valid.h"
+
+struct Regex {
+    RegexConfig config;
+    Prog *prog;
+    Prog *rprog;
+    size_t capture_count;
+    size_t backtrack_max;
+    OnePass *onepass;
+    ShiftAnd *shiftand;
+    // Only built when the pattern has too many positions for shift-and.
+    PosNfa *posnfa;
+    Dfa *dfa;
+    Dfa *rdfa;
+    // Finds the longest match from a known start, in leftmost-longest mode.
+    Dfa *ldfa;
+    // Runs back from an inner literal over what precedes it.
+    Dfa *inner_rdfa;
+    Strategy strategy;
+    // Set instead of everything above when the pattern is one string.
+    Substr *substr;
+};
+
+struct RegexCache {
+    PikeCache pike;
+    BacktrackCache backtrack;
+    DfaCache dfa;
+    DfaCache rdfa;
+    DfaCache ldfa;
+    DfaCache inner_rdfa;
+    CountCache countset;
+    CountCache rcountset;
+    PosNfaCache posnfa;
+    // Slots for regex_captures(), one pair per group.
+    size_t *slots;
+    size_t invalid_utf8;
+    StrategyStats stats;
+};
+
+void input_init(Input *input, const char *haystack, const size_t length) {
+    input->haystack = haystack;
+    input->length = length;
+    input->start = 0;
+    input->end = length;
+    input->anchored = false;
+    input->earliest = false;
+}
+
+void regex_config_init(RegexConfig *config) {
+    config->backtrack_budget = REGEX_DEFAULT_BACKTRACK_BUDGET;
+    config->dfa_cache_size = DFA_DEFAULT_CACHE_SIZE;
+    config->longest = false;
+    config->utf8 = false;
+}
+
+Regex *regex_compile(const char *pattern, const RegexConfig *config) {
+    Node *ast = build_syntax_tree(pattern);
+    size_t capture_count;
+    Hir *hir = hir_from_ast(ast, &capture_count);
+    free_node(ast);
+    if (!hir) {
+        return NULL;
+    }
+
+    LiteralSet single;
+    bool caseless;
+    if (capture_count == 0 && literal_single(hir, &single, &caseless)) {
+        Regex *re = calloc(1, sizeof(Regex));
+        if (re) {
+            re->substr = substr_build(single.bytes, single.length, caseless);
+        }
+        literal_set_free(&single);
+        hir_free(hir);
+        if (!re || !re->substr) {
+            fprintf(stderr, "Memory allocation failed\n");
+            free(re);
+            return NULL;
+        }
+        if (config) {
+            re->config = *config;
+        } else {
+            regex_config_init(&re->config);
+        }
+        return re;
+    }
+
+    Hir *reversed = hir_reverse(hir);
+    Prog *prog = prog_compile(hir, capture_count, false);
+    Prog *rprog = prog_compile(reversed, 0, true);
+    hir_free(reversed);
+    if (!prog || !rprog) {
+        prog_free(prog);
+        prog_free(rprog);
+        hir_free(hir);
+        return NULL;
+    }
+
+    Regex *re = calloc(1, sizeof(Regex));
+    if (!re) {
+        fprintf(stderr, "Memory allocation failed\n");
+        prog_free(prog);
+        prog_free(rprog);
+        hir_free(hir);
+        return NULL;
+    }
+    if (config) {
+        re->config = *config;
+    } else {
+        regex_config_init(&re->config);
+    }
+    prog->longest = re->config.longest;
+    re->prog = prog;
+    re->rprog = rprog;
+    re->capture_count = capture_count;
+    re->backtrack_max = backtrack_max_haystack(prog, re->config.backtrack_budget);
+    re->onepass = onepass_build(prog);
+    re->shiftand = shiftand_build(hir);
+    re->posnfa = re->shiftand ? NULL : posnfa_build(hir);
+    re->dfa = dfa_build(prog, false);
+    re->rdfa = dfa_build(rprog, true);
+    re->ldfa = re->config.longest ? dfa_build(prog, true) : NULL;
+    strategy_analyze(&re->strategy, hir, prog, capture_count, re->config.dfa_cache_size);
+    re->strategy.onepass = re->onepass != NULL;
+    re->strategy.shiftand = re->shiftand != NULL;
+    re->strategy.posnfa = re->posnfa != NULL;
+    re->strategy.dfa = re->strategy.dfa && re->dfa && re->rdfa && (re->ldfa || !re->config.longest);
+    re->inner_rdfa = re->strategy.inner_rprog ? dfa_build(re->strategy.inner_rprog, true) : NULL;
+    re->strategy.reverse_inner = re->strategy.dfa && re->inner_rdfa;
+    if (re->dfa && prog->looks == 0) {
+        re->dfa->prefilter = re->strategy.prefilter;
+    }
+    hir_free(hir);
+    return re;
+}
+
+void regex_free(Regex *re) {
+    if (!re) {
+        return;
+    }
+    onepass_free(re->onepass);
+    shiftand_free(re->shiftand);
+    posnfa_free(re->posnfa);
+    dfa_free(re->dfa);
+    dfa_free(re->rdfa);
+    dfa_free(re->ldfa);
+    dfa_free(re->inner_rdfa);
+    prog_free(re->prog);
+    prog_free(re->rprog);
+    strategy_free(&re->strategy);
+    substr_free(re->substr);
+    free(re);
+}
+
+size_t regex_capture_count(const Regex *re) {
+    return re->capture_count;
+}
+
+RegexCache *regex_cache_new(const Regex *re) {
+    RegexCache *cache = calloc(1, sizeof(RegexCache));
+    if (!cache) {
+        fprintf(stderr, "Memory allocation failed\n");
+        return NULL;
+    }
+    cache->slots = malloc(2 * (re->capture_count + 1) * sizeof(size_t));
+    cache->invalid_utf8 = NO_POS;
+    // A single string needs no scratch besides the slots.
+    if (!cache->slots || (re->prog && (!pikevm_cache_init(&cache->pike, re->prog) ||
+                                       !backtrack_cache_init(&cache->backtrack, re->prog))) ||
+        (re->dfa && !dfa_cache_init(&cache->dfa, re->dfa, re->config.dfa_cache_size)) ||
+        (re->rdfa && !dfa_cache_init(&cache->rdfa, re->rdfa, re->config.dfa_cache_size)) ||
+        (re->ldfa && !dfa_cache_init(&cache->ldfa, re->ldfa, re->config.dfa_cache_size)) ||
+        (re->inner_rdfa && !dfa_cache_init(&cache->inner_rdfa, re->inner_rdfa, re->config.dfa_cache_size)) ||
+        (re->prog && re->prog->ncounters > 0 && (!countset_cache_init(&cache->countset, re->prog) ||
+                                                 !countset_cache_init(&cache->rcountset, re->rprog))) ||
+        (re->posnfa && !posnfa_cache_init(&cache->posnfa, re->posnfa))) {
+        regex_cache_free(cache);
+        return NULL;
+    }
+    return cache;
+}
+
+void regex_cache_free(RegexCache *cache) {
+    if (!cache) {
+        return;
+    }
+    pikevm_cache_free(&cache->pike);
+    backtrack_cache_free(&cache->backtrack);
+    dfa_cache_free(&cache->dfa);
+    dfa_cache_free(&cache->rdfa);
+    dfa_cache_free(&cache->ldfa);
+    dfa_cache_free(&cache->inner_rdfa);
+    countset_cache_free(&cache->countset);
+    countset_cache_free(&cache->rcountset);
+    posnfa_cache_free(&cache->posnfa);
+    free(cache->slots);
+    free(cache);
+}
+
+static bool run_engine(const Regex *re, RegexCache *cache, const Engine engine, const Input *input, size_t *slots,
+                       const size_t nslots) {
+    size_t end;
+
+    cache->stats.searches[engine]++;
+    switch (engine) {
+        case ENGINE_SHIFTAND:
+            // Only a yes/no answer is wanted, so the earliest match end will do.
+            return shiftand_search(re->shiftand, input, &end);
+        case ENGINE_POSNFA:
+            return posnfa_search(re->posnfa, &cache->posnfa, input, &end);
+        case ENGINE_ONEPASS:
+            return onepass_search(re->onepass, input, slots, nslots);
+        case ENGINE_BACKTRACK:
+            return backtrack_search(re->prog, &cache->backtrack, input, slots, nslots);
+        default:
+            return pikevm_search(re->prog, &cache->pike, input, slots, nslots);
+    }
+}
+
+static bool search_captures(const Regex *re, RegexCache *cache, const Input *input, size_t *slots,
+                            const size_t nslots) {
+    const Engine engine = strategy_select_captures(&re->strategy, input, re->backtrack_max);
+    return run_engine(re, cache, engine, input, slots, nslots);
+}
+
+// Reports a match found by an engine that only knows where it starts and
+// ends; groups come from a capture engine confined to the match.
+static bool report_match(const Regex *re, RegexCache *cache, const Input *input, const size_t start,
+                         const size_t end, size_t *slots, const size_t nslots) {
+    if (nslots <= 2) {
+        if (nslots > 0) {
+            slots[0] = start;
+        }
+        if (nslots == 2) {
+            slots[1] = end;
+        }
+        return true;
+    }
+    Input bounded = *input;
+    bounded.start = start;
+    bounded.end = end;
+    bounded.anchored = true;
+    return search_captures(re, cache, &bounded, slots, nslots);
+}
+
+// Finds the match by its inner literals; see meta.h. No match can start
+// before the previous candidate, as it would have to step over it, and one
+// starting before the next would end at or after it. A forward scan that
+// read past the next candidate without a match gives up, since the scans
+// from that one on would read the same bytes again.
+static DfaResult search_reverse_inner(const Regex *re, RegexCache *cache, const Input *input, size_t *start,
+                                      size_t *end) {
+    const uint8_t *hay = (const uint8_t *) input->haystack;
+    size_t min_start = input->start;
+    size_t fwd_stop = input->start;
+    size_t at = input->start;
+    for (;;) {
+        const size_t lit = prefilter_find(re->strategy.inner_prefilter, hay, at, input->end);
+        if (lit == NO_POS) {
+            return DFA_NO_MATCH;
+        }
+        if (lit < fwd_stop) {
+            return DFA_GAVE_UP;
+        }
+        Input rev = *input;
+        rev.start = min_start;
+        rev.end = lit;
+        rev.anchored = true;
+        rev.earliest = false;
+        DfaResult found = dfa_search_rev(re->inner_rdfa, &cache->inner_rdfa, &rev, start);
+        if (found == DFA_MATCH) {
+            Input fwd = *input;
+            fwd.start = *start;
+            fwd.anchored = true;
+            if (re->ldfa) {
+                found = dfa_search_fwd(re->ldfa, &cache->ldfa, &fwd, end);
+                fwd_stop = cache->ldfa.stop;
+            } else {
+                found = dfa_search_fwd(re->dfa, &cache->dfa, &fwd, end);
+                fwd_stop = cache->dfa.stop;
+            }
+        }
+        if (found != DFA_NO_MATCH) {
+            return found;
+        }
+        min_start = lit + 1;
+        at = lit + 1;
+    }
+}
+
+bool regex_search(const Regex *re, RegexCache *cache, const Input *input, size_t *slots, const size_t nslots) {
+    if (input->start > input->end || input->end > input->length) {
+        return false;
+    }
+    if (re->config.utf8) {
+        const size_t invalid =
+                utf8_validate((const uint8_t *) input->haystack + input->start, input->end - input->start);
+        cache->invalid_utf8 = invalid == NO_POS ? NO_POS : input->start + invalid;
+        if (invalid != NO_POS) {
+            return false;
+        }
+    }
+    if (re->substr) {
+        cache->stats.searches[ENGINE_SUBSTR]++;
+        size_t start;
+        if (!substr_search(re->substr, input, &start)) {
+            return false;
+        }
+        for (size_t i = 0; i < nslots; i++) {
+            slots[i] = i == 0 ? start : i == 1 ? start + re->substr->len : NO_POS;
+        }
+        return true;
+    }
+    Input earliest;
+    if (nslots == 0 && !input->earliest) {
+        // Without slots to fill, any match end answers the question.
+        earliest = *input;
+        earliest.earliest = true;
+        input = &earliest;
+    }
+    const Engine engine = strategy_select(&re->strategy, &cache->stats, input, nslots, re->backtrack_max);
+    if (engine == ENGINE_COUNTSET) {
+        // The counting-set matcher answers yes/no in time independent of
+        // the repetition bounds. Positions come from a capture engine,
+        // which is only cheap anchored: unanchored, every start adds its
+        // own count to each pc of a counter loop. Run backwards over the
+        // span, the matcher finds where the leftmost match starts. A yes/no
+        // search reads backwards too when the pattern ends in rarer bytes
+        // than it starts with.
+        cache->stats.searches[ENGINE_COUNTSET]++;
+        const bool backwards = !input->anchored && (nslots > 0 || re->strategy.counters_reverse);
+        if (backwards) {
+            Input rev = *input;
+            rev.earliest = nslots == 0;
+            size_t start;
+            const CountSetResult found = countset_search(re->rprog, &cache->rcountset, &rev, &start);
+            if (found == COUNTSET_NO_MATCH) {
+                return false;
+            }
+            if (found == COUNTSET_MATCH && nslots == 0) {
+                return true;
+            }
+            if (found == COUNTSET_MATCH) {
+                Input bounded = *input;
+                bounded.start = start;
+                bounded.anchored = true;
+                return search_captures(re, cache, &bounded, slots, nslots);
+            }
+        } else if (nslots == 0) {
+            size_t end;
+            const CountSetResult found = countset_search(re->prog, &cache->countset, input, &end);
+            if (found != COUNTSET_GAVE_UP) {
+                return found == COUNTSET_MATCH;
+            }
+        }
+        return search_captures(re, cache, input, slots, nslots);
+    }
+    if (engine == ENGINE_AHOCORASICK) {
+        cache->stats.searches[ENGINE_AHOCORASICK]++;
+        size_t start, end;
+        return ahocorasick_find(re->strategy.ahocorasick, input, &start, &end) &&
+               report_match(re, cache, input, start, end, slots, nslots);
+    }
+    size_t start, end;
+    if (engine == ENGINE_REVERSE_INNER) {
+        cache->stats.searches[ENGINE_REVERSE_INNER]++;
+        const DfaResult found = search_reverse_inner(re, cache, input, &start, &end);
+        if (found != DFA_GAVE_UP) {
+            return found == DFA_MATCH && report_match(re, cache, input, start, end, slots, nslots);
+        }
+        cache->stats.reverse_inner_give_ups++;
+    } else if (engine != ENGINE_DFA) {
+        return run_engine(re, cache, engine, input, slots, nslots);
+    }
+    cache->stats.searches[ENGINE_DFA]++;
+
+    // The forward DFA finds where the leftmost-first match ends; the
+    // reverse DFA, anchored there, finds the leftmost position it starts.
+    // That is where the leftmost-longest match starts too, and the longest
+    // DFA, anchored there, finds where it ends.
+    const DfaResult fwd = dfa_search_fwd(re->dfa, &cache->dfa, input, &end);
+    if (fwd == DFA_NO_MATCH) {
+        return false;
+    }
+    if (fwd == DFA_MATCH && nslots == 0) {
+        return true;
+    }
+    if (fwd == DFA_MATCH) {
+        Input rev = *input;
+        rev.end = end;
+        rev.anchored = true;
+        rev.earliest = false;
+        DfaResult found = dfa_search_rev(re->rdfa, &cache->rdfa, &rev, &start);
+        if (found == DFA_MATCH && re->ldfa) {
+            Input fwd_longest = *input;
+            fwd_longest.start = start;
+            fwd_longest.anchored = true;
+            fwd_longest.earliest = false;
+            found = dfa_search_fwd(re->ldfa, &cache->ldfa, &fwd_longest, &end);
+        }
+        if (found == DFA_MATCH) {
+            return report_match(re, cache, input, start, end, slots, nslots);
+        }
+    }
+
+    cache->stats.dfa_give_ups++;
+    return search_captures(re, cache, input, slots, nslots);
+}
+
+bool regex_is_match(const Regex *re, RegexCache *cache, const char *haystack, const size_t length) {
+    Input input;
+
+    input_init(&input, haystack, length);
+    input.earliest = true;
+    return regex_search(re, cache, &input, NULL, 0);
+}
+
+bool regex_find(const Regex *re, RegexCache *cache, const char *haystack, const size_t length, Match *match) {
+    Input input;
+    size_t slots[2];
+
+    input_init(&input, haystack, length);
+    if (!regex_search(re, cache, &input, slots, 2)) {
+        return false;
+    }
+    match->start = slots[0];
+    match->end = slots[1];
+    return true;
+}
+
+bool regex_captures(const Regex *re, RegexCache *cache, const char *haystack, const size_t length, Match *groups,
+                    const size_t ngroups) {
+    Input input;
+    size_t *slots = cache->slots;
+
+    input_init(&input, haystack, length);
+    if (!regex_search(re, cache, &input, slots, 2 * (re->capture_count + 1))) {
+        return false;
+    }
+    for (size_t i = 0; i < ngroups; i++) {
+        const bool set = i <= re->capture_count && slots[2 * i] != NO_POS && slots[2 * i + 1] != NO_POS;
+        groups[i].start = set ? slots[2 * i] : NO_POS;
+        groups[i].end = set ? slots[2 * i + 1] : NO_POS;
+    }
+    return true;
+}
+
+size_t regex_invalid_utf8(const RegexCache *cache) {
+    return cache->invalid_utf8;
+}
+
+void regex_print_strategy(const Regex *re, const RegexCache *cache) {
+    if (re->substr) {
+        printf("substr:        %zu bytes%s\n", re->substr->len, re->substr->caseless ? ", caseless" : "");
+        if (cache) {
+            printf("searches:      substr=%zu\n", cache->stats.searches[ENGINE_SUBSTR]);
+        }
+        return;
+    }
+    strategy_print(&re->strategy, cache ? &cache->stats : NULL);
+    if (cache && re->dfa) {
+        dfa_print_accel(&cache->dfa);
+    }
+}
@@ -0,0 +1,241 @@
+#include "shiftand.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SHIFTAND_X86 1
+#endif
+
+static bool build_classes(ShiftAnd *sa, const Glushkov *g) {
+    uint64_t vec[256][4] = {{0}};
+
+    for (size_t p = 0; p < g->npos; p++) {
+        for (unsigned b = 0; b < 256; b++) {
+            if (byteset_contains(&g->classes[p], (uint8_t) b)) {
+                vec[b][p >> 6] |= 1ULL << (p & 63);
+            }
+        }
+    }
+
+    sa->masks = malloc(256 * sizeof(*sa->masks));
+    if (!sa->masks) {
+        return false;
+    }
+    sa->nclasses = 0;
+    for (unsigned b = 0; b < 256; b++) {
+        size_t c = 0;
+        while (c < sa->nclasses && memcmp(sa->masks[c], vec[b], sizeof(vec[b])) != 0) {
+            c++;
+        }
+        if (c == sa->nclasses) {
+            memcpy(sa->masks[c], vec[b], sizeof(vec[b]));
+            sa->nclasses++;
+        }
+        sa->byte_class[b] = (uint8_t) c;
+    }
+    return true;
+}
+
+ShiftAnd *shiftand_build(const Hir *hir) {
+    Glushkov *g = glushkov_build(hir, SHIFTAND_MAX_POSITIONS);
+    if (!g) {
+        return NULL;
+    }
+
+    ShiftAnd *sa = calloc(1, sizeof(ShiftAnd));
+    if (!sa) {
+        fprintf(stderr, "Memory allocation failed\n");
+        glushkov_free(g);
+        return NULL;
+    }
+    sa->npos = g->npos;
+    sa->nwords = g->npos <= SHIFTAND_WORD_POSITIONS ? 1 : 4;
+    sa->nullable = g->nullable;
+    memcpy(sa->first, g->first, (g->nwords < 4 ? g->nwords : 4) * sizeof(uint64_t));
+    memcpy(sa->last, g->last, (g->nwords < 4 ? g->nwords : 4) * sizeof(uint64_t));
+    if (sa->nwords == 1) {
+        sa->tables = calloc(8, sizeof(*sa->tables));
+    } else {
+        sa->exc_follow = calloc(g->npos, sizeof(*sa->exc_follow));
+    }
+    if (!build_classes(sa, g) || (!sa->tables && !sa->exc_follow)) {
+        fprintf(stderr, "Memory allocation failed\n");
+        shiftand_free(sa);
+        glushkov_free(g);
+        return NULL;
+    }
+
+    if (sa->nwords == 1) {
+        for (size_t p = 0; p < g->npos; p++) {
+            const uint64_t follow = g->follow[p * g->nwords];
+            const size_t k = p / 8;
+            const unsigned bit = 1U << (p % 8);
+            for (unsigned v = 0; v < 256; v++) {
+                if (v & bit) {
+                    sa->tables[k][v] |= follow;
+                }
+            }
+        }
+    } else {
+        for (size_t p = 0; p < g->npos; p++) {
+            const uint64_t *follow = g->follow + p * g->nwords;
+            for (size_t w = 0; w < 4 && w < g->nwords; w++) {
+                sa->exc_follow[p][w] = follow[w];
+            }
+            if (p + 1 < g->npos && glushkov_bit(follow, p + 1)) {
+                sa->consec[(p + 1) >> 6] |= 1ULL << ((p + 1) & 63);
+                sa->exc_follow[p][(p + 1) >> 6] &= ~(1ULL << ((p + 1) & 63));
+            }
+            const uint64_t *ex = sa->exc_follow[p];
+            if (ex[0] | ex[1] | ex[2] | ex[3]) {
+                sa->exc_src[p >> 6] |= 1ULL << (p & 63);
+            }
+        }
+    }
+    shiftand_select(sa, cpu_level());
+
+    glushkov_free(g);
+    return sa;
+}
+
+void shiftand_free(ShiftAnd *sa) {
+    if (!sa) {
+        return;
+    }
+    free(sa->masks);
+    free(sa->tables);
+    free(sa->exc_follow);
+    free(sa);
+}
+
+static bool search_word(const ShiftAnd *sa, const Input *input, size_t *end) {
+    const uint8_t *hay = (const uint8_t *) input->haystack;
+    const size_t nchunks = (sa->npos + 7) / 8;
+    const uint64_t first = sa->first[0];
+    const uint64_t last = sa->last[0];
+    uint64_t d = 0;
+
+    for (size_t at = input->start; at < input->end; at++) {
+        uint64_t f = !input->anchored || at == input->start ? first : 0;
+        for (size_t k = 0; k < nchunks; k++) {
+            f |= sa->tables[k][(d >> (8 * k)) & 0xFF];
+        }
+        d = f & sa->masks[sa->byte_class[hay[at]]][0];
+        if (d & last) {
+            *end = at + 1;
+            return true;
+        }
+        if (d == 0 && input->anchored) {
+            return false;
+        }
+    }
+    return false;
+}
+
+static bool search_multi(const ShiftAnd *sa, const Input *input, size_t *end) {
+    const uint8_t *hay = (const uint8_t *) input->haystack;
+    uint64_t d[4] = {0};
+
+    for (size_t at = input->start; at < input->end; at++) {
+        uint64_t nd[4];
+        nd[0] = (d[0] << 1) & sa->consec[0];
+        for (size_t w = 1; w < 4; w++) {
+            nd[w] = ((d[w] << 1) | (d[w - 1] >> 63)) & sa->consec[w];
+        }
+        for (size_t w = 0; w < 4; w++) {
+            for (uint64_t bits = d[w] & sa->exc_src[w]; bits; bits &= bits - 1) {
+                const uint64_t *ex = sa->exc_follow[w * 64 + (size_t) __builtin_ctzll(bits)];
+                nd[0] |= ex[0];
+                nd[1] |= ex[1];
+                nd[2] |= ex[2];
+                nd[3] |= ex[3];
+            }
+        }
+
+        const bool inject = !input->anchored || at == input->start;
+        const uint64_t *mask = sa->masks[sa->byte_class[hay[at]]];
+        uint64_t any = 0, hit = 0;
+        for (size_t w = 0; w < 4; w++) {
+            d[w] = (nd[w] | (inject ? sa->first[w] : 0)) & mask[w];
+            any |= d[w];
+            hit |= d[w] & sa->last[w];
+        }
+        if (hit) {
+            *end = at + 1;
+            return true;
+        }
+        if (!any && input->anchored) {
+            return false;
+        }
+    }
+    return false;
+}
+
+#ifdef SHIFTAND_X86
+__attribute__((target("avx2")))
+static bool search_avx2(const ShiftAnd *sa, const Input *input, size_t *end) {
+    const uint8_t *hay = (const uint8_t *) input->haystack;
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i consec = _mm256_loadu_si256((const __m256i *) sa->consec);
+    const __m256i exc_src = _mm256_loadu_si256((const __m256i *) sa->exc_src);
+    const __m256i first = _mm256_loadu_si256((const __m256i *) sa->first);
+    const __m256i last = _mm256_loadu_si256((const __m256i *) sa->last);
+    __m256i d = zero;
+
+    for (size_t at = input->start; at < input->end; at++) {
+        // Shift the 256-bit vector left by one, carrying across lanes.
+        __m256i carry = _mm256_srli_epi64(d, 63);
+        carry = _mm256_permute4x64_epi64(carry, _MM_SHUFFLE(2, 1, 0, 3));
+        carry = _mm256_blend_epi32(carry, zero, 0x03);
+        __m256i nd = _mm256_and_si256(_mm256_or_si256(_mm256_slli_epi64(d, 1), carry), consec);
+
+        const __m256i ex = _mm256_and_si256(d, exc_src);
+        if (!_mm256_testz_si256(ex, ex)) {
+            uint64_t words[4];
+            _mm256_storeu_si256((__m256i *) words, ex);
+            for (size_t w = 0; w < 4; w++) {
+                for (uint64_t bits = words[w]; bits; bits &= bits - 1) {
+                    const uint64_t *follow = sa->exc_follow[w * 64 + (size_t) __builtin_ctzll(bits)];
+                    nd = _mm256_or_si256(nd, _mm256_loadu_si256((const __m256i *) follow));
+                }
+            }
+        }
+
+        if (!input->anchored || at == input->start) {
+            nd = _mm256_or_si256(nd, first);
+        }
+        d = _mm256_and_si256(nd, _mm256_loadu_si256((const __m256i *) sa->masks[sa->byte_class[hay[at]]]));
+        if (!_mm256_testz_si256(d, last)) {
+            *end = at + 1;
+            return true;
+        }
+        if (input->anchored && _mm256_testz_si256(d, d)) {
+            return false;
+        }
+    }
+    return false;
+}
+#endif
+
+void shiftand_select(ShiftAnd *sa, CpuLevel level) {
+    level = level < cpu_level() ? level : cpu_level();
+    sa->level = CPU_SCALAR;
+    if (sa->nwords == 1) {
+        sa->search = search_word;
+        return;
+    }
+    sa->search = search_multi;
+#ifdef SHIFTAND_X86
+    if (level >= CPU_AVX2) {
+        sa->search = search_avx2;
+        sa->level = CPU_AVX2;
+    }
+#endif
+}
+
+bool shiftand_search(const ShiftAnd *sa, const Input *input, size_t *end) {
+    if (sa->nullable) {
+        *end = input->start;
+        return true;
+    }
+    return sa->search(sa, input, end);
+}
@@ -0,0 +1,81 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "substr.h"
+#include "ascii.h"
+
+Substr *substr_build(const uint8_t *needle, const size_t len, const bool caseless) {
+    Substr *s = calloc(1, sizeof(Substr));
+    if (s) {
+        s->needle = malloc(len + 1);
+    }
+    if (!s || !s->needle) {
+        fprintf(stderr, "Memory allocation failed\n");
+        substr_free(s);
+        return NULL;
+    }
+    for (size_t i = 0; i < len; i++) {
+        s->needle[i] = caseless ? ascii_to_lower(needle[i]) : needle[i];
+    }
+    s->len = len;
+    s->caseless = caseless;
+    if (len >= 2) {
+        s->pair = caseless ? packed_pair_build_caseless(s->needle, len) : packed_pair_build(s->needle, len);
+        if (!s->pair) {
+            substr_free(s);
+            return NULL;
+        }
+    }
+    return s;
+}
+
+void substr_free(Substr *s) {
+    if (!s) {
+        return;
+    }
+    packed_pair_free(s->pair);
+    free(s->needle);
+    free(s);
+}
+
+static bool matches_at(const Substr *s, const uint8_t *hay, const size_t i, const size_t end) {
+    if (i + s->len > end) {
+        return false;
+    }
+    for (size_t j = 0; j < s->len; j++) {
+        if ((s->caseless ? ascii_to_lower(hay[i + j]) : hay[i + j]) != s->needle[j]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// A single byte, in either case when it is a letter of a caseless needle.
+static size_t find_byte(const Substr *s, const uint8_t *hay, const size_t at, const size_t end) {
+    const uint8_t b = s->needle[0];
+    const uint8_t *p = memchr(hay + at, b, end - at);
+    if (s->caseless && (uint8_t) (b - 'a') < 26) {
+        const uint8_t *q = memchr(hay + at, b & ~0x20, (size_t) ((p ? p : hay + end) - (hay + at)));
+        p = q ? q : p;
+    }
+    return p ? (size_t) (p - hay) : NO_POS;
+}
+
+bool substr_search(const Substr *s, const Input *input, size_t *start) {
+    const uint8_t *hay = (const uint8_t *) input->haystack;
+    size_t at;
+    if (input->anchored) {
+        at = matches_at(s, hay, input->start, input->end) ? input->start : NO_POS;
+    } else if (s->len == 0) {
+        at = input->start;
+    } else if (s->len == 1) {
+        at = input->start < input->end ? find_byte(s, hay, input->start, input->end) : NO_POS;
+    } else {
+        at = packed_pair_find(s->pair, hay, input->start, input->end);
+    }
+    if (at == NO_POS) {
+        return false;
+    }
+    *start = at;
+    return true;
+}
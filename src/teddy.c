@@ -0,0 +1,227 @@
+#include <stdio.h>
+#include "teddy.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TEDDY_X86 1
+#endif
+
+Teddy *teddy_build(const LiteralSeq *seq) {
+#ifndef TEDDY_X86
+    (void) seq;
+    return NULL;
+#else
+    if (seq->infinite || seq->count == 0 || cpu_level() < CPU_SSSE3) {
+        return NULL;
+    }
+    size_t min_len = LITERAL_MAX_LEN;
+    for (size_t i = 0; i < seq->count; i++) {
+        min_len = seq->lits[i].len < min_len ? seq->lits[i].len : min_len;
+    }
+    if (min_len == 0) {
+        return NULL;
+    }
+
+    Teddy *t = calloc(1, sizeof(Teddy));
+    if (t) {
+        t->lits = malloc(seq->count * sizeof(Literal));
+    }
+    if (!t || !t->lits) {
+        fprintf(stderr, "Memory allocation failed\n");
+        teddy_free(t);
+        return NULL;
+    }
+    t->nmasks = min_len < TEDDY_MAX_MASKS ? min_len : TEDDY_MAX_MASKS;
+    teddy_select(t, cpu_level());
+
+    // The set is sorted, so neighbours share leading bytes; giving runs of
+    // them the same bucket keeps a bucket's nibbles, and its false hits, few.
+    for (size_t b = 0; b < TEDDY_BUCKETS; b++) {
+        t->first[b] = b * seq->count / TEDDY_BUCKETS;
+    }
+    t->first[TEDDY_BUCKETS] = seq->count;
+    for (size_t b = 0; b < TEDDY_BUCKETS; b++) {
+        for (size_t i = t->first[b]; i < t->first[b + 1]; i++) {
+            const Literal *lit = &seq->lits[i];
+            t->lits[i] = *lit;
+            for (size_t j = 0; j < t->nmasks; j++) {
+                t->lo[j][lit->bytes[j] & 0x0F] |= (uint8_t) (1U << b);
+                t->hi[j][lit->bytes[j] >> 4] |= (uint8_t) (1U << b);
+            }
+        }
+    }
+    return t;
+#endif
+}
+
+void teddy_free(Teddy *t) {
+    if (!t) {
+        return;
+    }
+    free(t->lits);
+    free(t);
+}
+
+// Whether a literal from one of the buckets in bits starts at i.
+static bool verify(const Teddy *t, const uint8_t *hay, const size_t i, const size_t end, unsigned bits) {
+    while (bits) {
+        const size_t b = (size_t) __builtin_ctz(bits);
+        for (size_t j = t->first[b]; j < t->first[b + 1]; j++) {
+            const Literal *lit = &t->lits[j];
+            if (i + lit->len <= end && memcmp(hay + i, lit->bytes, lit->len) == 0) {
+                return true;
+            }
+        }
+        bits &= bits - 1;
+    }
+    return false;
+}
+
+// The same lookups one position at a time, for the tail of the haystack.
+static size_t find_scalar(const Teddy *t, const uint8_t *hay, size_t at, const size_t end) {
+    for (; at + t->nmasks <= end; at++) {
+        unsigned bits = 0xFF;
+        for (size_t j = 0; j < t->nmasks; j++) {
+            const uint8_t b = hay[at + j];
+            bits &= t->lo[j][b & 0x0F] & t->hi[j][b >> 4];
+        }
+        if (bits && verify(t, hay, at, end, bits)) {
+            return at;
+        }
+    }
+    return NO_POS;
+}
+
+#ifdef TEDDY_X86
+__attribute__((target("ssse3")))
+static size_t find_ssse3(const Teddy *t, const uint8_t *hay, size_t at, const size_t end) {
+    const __m128i nibble = _mm_set1_epi8(0x0F);
+    const __m128i zero = _mm_setzero_si128();
+    __m128i lo[TEDDY_MAX_MASKS], hi[TEDDY_MAX_MASKS];
+    for (size_t j = 0; j < t->nmasks; j++) {
+        lo[j] = _mm_loadu_si128((const __m128i *) t->lo[j]);
+        hi[j] = _mm_loadu_si128((const __m128i *) t->hi[j]);
+    }
+
+    for (; at + t->nmasks - 1 + 16 <= end; at += 16) {
+        __m128i res = _mm_set1_epi8((char) 0xFF);
+        for (size_t j = 0; j < t->nmasks; j++) {
+            const __m128i v = _mm_loadu_si128((const __m128i *) (hay + at + j));
+            const __m128i l = _mm_shuffle_epi8(lo[j], _mm_and_si128(v, nibble));
+            const __m128i h = _mm_shuffle_epi8(hi[j], _mm_and_si128(_mm_srli_epi16(v, 4), nibble));
+            res = _mm_and_si128(res, _mm_and_si128(l, h));
+        }
+        unsigned mask = (unsigned) _mm_movemask_epi8(_mm_cmpeq_epi8(res, zero)) ^ 0xFFFFU;
+        if (!mask) {
+            continue;
+        }
+        uint8_t bits[16];
+        _mm_storeu_si128((__m128i *) bits, res);
+        while (mask) {
+            const size_t k = (size_t) __builtin_ctz(mask);
+            if (verify(t, hay, at + k, end, bits[k])) {
+                return at + k;
+            }
+            mask &= mask - 1;
+        }
+    }
+    return find_scalar(t, hay, at, end);
+}
+
+__attribute__((target("avx2")))
+static size_t find_avx2(const Teddy *t, const uint8_t *hay, size_t at, const size_t end) {
+    const __m256i nibble = _mm256_set1_epi8(0x0F);
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i lo[TEDDY_MAX_MASKS], hi[TEDDY_MAX_MASKS];
+    for (size_t j = 0; j < t->nmasks; j++) {
+        // pshufb looks up within each 128-bit lane, so both get the table.
+        lo[j] = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) t->lo[j]));
+        hi[j] = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) t->hi[j]));
+    }
+
+    for (; at + t->nmasks - 1 + 32 <= end; at += 32) {
+        __m256i res = _mm256_set1_epi8((char) 0xFF);
+        for (size_t j = 0; j < t->nmasks; j++) {
+            const __m256i v = _mm256_loadu_si256((const __m256i *) (hay + at + j));
+            const __m256i l = _mm256_shuffle_epi8(lo[j], _mm256_and_si256(v, nibble));
+            const __m256i h = _mm256_shuffle_epi8(hi[j], _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble));
+            res = _mm256_and_si256(res, _mm256_and_si256(l, h));
+        }
+        uint32_t mask = ~(uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(res, zero));
+        if (!mask) {
+            continue;
+        }
+        uint8_t bits[32];
+        _mm256_storeu_si256((__m256i *) bits, res);
+        while (mask) {
+            const size_t k = (size_t) __builtin_ctz(mask);
+            if (verify(t, hay, at + k, end, bits[k])) {
+                return at + k;
+            }
+            mask &= mask - 1;
+        }
+    }
+    return find_ssse3(t, hay, at, end);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static size_t find_avx512(const Teddy *t, const uint8_t *hay, size_t at, const size_t end) {
+    const __m512i nibble = _mm512_set1_epi8(0x0F);
+    __m512i lo[TEDDY_MAX_MASKS], hi[TEDDY_MAX_MASKS];
+    for (size_t j = 0; j < t->nmasks; j++) {
+        lo[j] = _mm512_broadcast_i32x4(_mm_loadu_si128((const __m128i *) t->lo[j]));
+        hi[j] = _mm512_broadcast_i32x4(_mm_loadu_si128((const __m128i *) t->hi[j]));
+    }
+
+    for (; at + t->nmasks - 1 + 64 <= end; at += 64) {
+        __m512i res = _mm512_set1_epi8((char) 0xFF);
+        for (size_t j = 0; j < t->nmasks; j++) {
+            const __m512i v = _mm512_loadu_si512(hay + at + j);
+            const __m512i l = _mm512_shuffle_epi8(lo[j], _mm512_and_si512(v, nibble));
+            const __m512i h = _mm512_shuffle_epi8(hi[j], _mm512_and_si512(_mm512_srli_epi16(v, 4), nibble));
+            res = _mm512_and_si512(res, _mm512_and_si512(l, h));
+        }
+        uint64_t mask = _mm512_test_epi8_mask(res, res);
+        if (!mask) {
+            continue;
+        }
+        uint8_t bits[64];
+        _mm512_storeu_si512(bits, res);
+        while (mask) {
+            const size_t k = (size_t) __builtin_ctzll(mask);
+            if (verify(t, hay, at + k, end, bits[k])) {
+                return at + k;
+            }
+            mask &= mask - 1;
+        }
+    }
+    return find_avx2(t, hay, at, end);
+}
+#endif
+
+void teddy_select(Teddy *t, CpuLevel level) {
+    level = level < cpu_level() ? level : cpu_level();
+#ifdef TEDDY_X86
+    if (level >= CPU_AVX512) {
+        t->find = find_avx512;
+        t->level = CPU_AVX512;
+        return;
+    }
+    if (level >= CPU_AVX2) {
+        t->find = find_avx2;
+        t->level = CPU_AVX2;
+        return;
+    }
+    if (level >= CPU_SSSE3) {
+        t->find = find_ssse3;
+        t->level = CPU_SSSE3;
+        return;
+    }
+#endif
+    t->find = find_scalar;
+    t->level = CPU_SCALAR;
+}
+
+size_t teddy_find(const Teddy *t, const uint8_t *hay, const size_t at, const size_t end) {
+    return t->find(t, hay, at, end);
+}
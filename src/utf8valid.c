@@ -0,0 +1,242 @@
+#include <string.h>
+#include "utf8valid.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define UTF8VALID_X86 1
+#endif
+
+typedef size_t (*ValidateFn)(const uint8_t *s, size_t len);
+
+static size_t validate_scalar_from(const uint8_t *s, size_t at, const size_t len) {
+    while (at < len) {
+        if (at + 8 <= len) {
+            uint64_t word;
+            memcpy(&word, s + at, sizeof(word));
+            if (!(word & 0x8080808080808080ULL)) {
+                at += 8;
+                continue;
+            }
+        }
+        const uint8_t b = s[at];
+        if (b < 0x80) {
+            at++;
+            continue;
+        }
+        // The sequence length and the range its second byte must lie in.
+        size_t n;
+        uint8_t lo = 0x80, hi = 0xBF;
+        if (b >= 0xC2 && b <= 0xDF) {
+            n = 2;
+        } else if (b >= 0xE0 && b <= 0xEF) {
+            n = 3;
+            lo = b == 0xE0 ? 0xA0 : lo;
+            hi = b == 0xED ? 0x9F : hi;
+        } else if (b >= 0xF0 && b <= 0xF4) {
+            n = 4;
+            lo = b == 0xF0 ? 0x90 : lo;
+            hi = b == 0xF4 ? 0x8F : hi;
+        } else {
+            return at;
+        }
+        if (at + n > len || s[at + 1] < lo || s[at + 1] > hi) {
+            return at;
+        }
+        for (size_t i = 2; i < n; i++) {
+            if ((s[at + i] & 0xC0) != 0x80) {
+                return at;
+            }
+        }
+        at += n;
+    }
+    return NO_POS;
+}
+
+static size_t validate_scalar(const uint8_t *s, const size_t len) {
+    return validate_scalar_from(s, 0, len);
+}
+
+// Checks s[at, len) a byte at a time, given that s[0, at) holds valid
+// UTF-8 but for a sequence it may cut short. Its lead is at most three
+// bytes back, and in valid UTF-8 every byte but a continuation starts a
+// sequence.
+static size_t validate_rest(const uint8_t *s, const size_t at, const size_t len) {
+    size_t from = at >= 3 ? at - 3 : 0;
+    while (from < at && (s[from] & 0xC0) == 0x80) {
+        from++;
+    }
+    return validate_scalar_from(s, from, len);
+}
+
+#ifdef UTF8VALID_X86
+// Error bits: the pairs of bytes each one stands for, a first byte then a
+// second, where x is any bit.
+#define TOO_SHORT (1 << 0)  // 11xxxxxx 0xxxxxxx, 11xxxxxx 11xxxxxx
+#define TOO_LONG (1 << 1)   // 0xxxxxxx 10xxxxxx
+#define OVERLONG_3 (1 << 2) // 11100000 100xxxxx
+#define TOO_LARGE (1 << 3)  // 11110100 1001xxxx, 11110100 101xxxxx, 11110101-11111111 1001xxxx or 101xxxxx
+#define SURROGATE (1 << 4)  // 11101101 101xxxxx
+#define OVERLONG_2 (1 << 5) // 1100000x 10xxxxxx
+// 11110000 1000xxxx, and 11110101-11111111 1000xxxx
+#define TOO_LARGE_1000 (1 << 6)
+#define OVERLONG_4 (1 << 6)
+#define TWO_CONTS (1 << 7) // 10xxxxxx 10xxxxxx
+// Errors decided by the first byte's high nibble alone.
+#define CARRY (TOO_SHORT | TOO_LONG | TWO_CONTS)
+
+static const uint8_t BYTE_1_HIGH[16] = {
+        TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+        TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS,
+        TOO_SHORT | OVERLONG_2,
+        TOO_SHORT,
+        TOO_SHORT | OVERLONG_3 | SURROGATE,
+        TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4,
+};
+
+static const uint8_t BYTE_1_LOW[16] = {
+        CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4,
+        CARRY | OVERLONG_2,
+        CARRY,
+        CARRY,
+        CARRY | TOO_LARGE,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+};
+
+static const uint8_t BYTE_2_HIGH[16] = {
+        TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+        TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4,
+        TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE,
+        TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+        TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+        TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+};
+
+// Subtracted with saturation from the last bytes of a block, leaves a
+// nonzero byte where a lead needs more bytes than the block has left.
+static const uint8_t INCOMPLETE[32] = {
+        0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+        0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xEF, 0xDF, 0xBF,
+};
+
+__attribute__((target("ssse3")))
+static size_t validate_ssse3(const uint8_t *s, const size_t len) {
+    const __m128i nibble = _mm_set1_epi8(0x0F);
+    const __m128i byte_1_high = _mm_loadu_si128((const __m128i *) BYTE_1_HIGH);
+    const __m128i byte_1_low = _mm_loadu_si128((const __m128i *) BYTE_1_LOW);
+    const __m128i byte_2_high = _mm_loadu_si128((const __m128i *) BYTE_2_HIGH);
+    const __m128i incomplete_max = _mm_loadu_si128((const __m128i *) (INCOMPLETE + 16));
+    __m128i prev = _mm_setzero_si128();
+    __m128i incomplete = _mm_setzero_si128();
+
+    size_t at = 0;
+    for (; at + 16 <= len; at += 16) {
+        const __m128i in = _mm_loadu_si128((const __m128i *) (s + at));
+        const bool ascii = !_mm_movemask_epi8(in);
+        __m128i error;
+        if (ascii) {
+            // All ASCII: wrong only if the last block cut a sequence short.
+            error = incomplete;
+        } else {
+            const __m128i prev1 = _mm_alignr_epi8(in, prev, 15);
+            const __m128i prev2 = _mm_alignr_epi8(in, prev, 14);
+            const __m128i prev3 = _mm_alignr_epi8(in, prev, 13);
+            const __m128i b1h = _mm_shuffle_epi8(byte_1_high, _mm_and_si128(_mm_srli_epi16(prev1, 4), nibble));
+            const __m128i b1l = _mm_shuffle_epi8(byte_1_low, _mm_and_si128(prev1, nibble));
+            const __m128i b2h = _mm_shuffle_epi8(byte_2_high, _mm_and_si128(_mm_srli_epi16(in, 4), nibble));
+            const __m128i special = _mm_and_si128(_mm_and_si128(b1h, b1l), b2h);
+            // Only the bytes two after a lead 111xxxxx, or three after a
+            // lead 1111xxxx, end up with the top bit set.
+            const __m128i third = _mm_subs_epu8(prev2, _mm_set1_epi8((char) (0xE0 - 0x80)));
+            const __m128i fourth = _mm_subs_epu8(prev3, _mm_set1_epi8((char) (0xF0 - 0x80)));
+            const __m128i must23 = _mm_and_si128(_mm_or_si128(third, fourth), _mm_set1_epi8((char) 0x80));
+            error = _mm_xor_si128(must23, special);
+        }
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(error, _mm_setzero_si128())) != 0xFFFF) {
+            return validate_rest(s, at, len);
+        }
+        prev = in;
+        incomplete = ascii ? _mm_setzero_si128() : _mm_subs_epu8(in, incomplete_max);
+    }
+    return validate_rest(s, at, len);
+}
+
+__attribute__((target("avx2")))
+static size_t validate_avx2(const uint8_t *s, const size_t len) {
+    const __m256i nibble = _mm256_set1_epi8(0x0F);
+    const __m256i byte_1_high = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) BYTE_1_HIGH));
+    const __m256i byte_1_low = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) BYTE_1_LOW));
+    const __m256i byte_2_high = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) BYTE_2_HIGH));
+    const __m256i incomplete_max = _mm256_loadu_si256((const __m256i *) INCOMPLETE);
+    __m256i prev = _mm256_setzero_si256();
+    __m256i incomplete = _mm256_setzero_si256();
+
+    size_t at = 0;
+    for (; at + 32 <= len; at += 32) {
+        const __m256i in = _mm256_loadu_si256((const __m256i *) (s + at));
+        const bool ascii = !_mm256_movemask_epi8(in);
+        __m256i error;
+        if (ascii) {
+            error = incomplete;
+        } else {
+            // alignr shifts within 128-bit lanes, so the bytes before each
+            // lane come from the block's low lane and the last one's high.
+            const __m256i before = _mm256_permute2x128_si256(prev, in, 0x21);
+            const __m256i prev1 = _mm256_alignr_epi8(in, before, 15);
+            const __m256i prev2 = _mm256_alignr_epi8(in, before, 14);
+            const __m256i prev3 = _mm256_alignr_epi8(in, before, 13);
+            const __m256i b1h = _mm256_shuffle_epi8(byte_1_high, _mm256_and_si256(_mm256_srli_epi16(prev1, 4), nibble));
+            const __m256i b1l = _mm256_shuffle_epi8(byte_1_low, _mm256_and_si256(prev1, nibble));
+            const __m256i b2h = _mm256_shuffle_epi8(byte_2_high, _mm256_and_si256(_mm256_srli_epi16(in, 4), nibble));
+            const __m256i special = _mm256_and_si256(_mm256_and_si256(b1h, b1l), b2h);
+            const __m256i third = _mm256_subs_epu8(prev2, _mm256_set1_epi8((char) (0xE0 - 0x80)));
+            const __m256i fourth = _mm256_subs_epu8(prev3, _mm256_set1_epi8((char) (0xF0 - 0x80)));
+            const __m256i must23 = _mm256_and_si256(_mm256_or_si256(third, fourth), _mm256_set1_epi8((char) 0x80));
+            error = _mm256_xor_si256(must23, special);
+        }
+        if (!_mm256_testz_si256(error, error)) {
+            return validate_rest(s, at, len);
+        }
+        prev = in;
+        incomplete = ascii ? _mm256_setzero_si256() : _mm256_subs_epu8(in, incomplete_max);
+    }
+    return validate_rest(s, at, len);
+}
+#endif
+
+static ValidateFn select_kernel(CpuLevel level) {
+    level = level < cpu_level() ? level : cpu_level();
+#ifdef UTF8VALID_X86
+    if (level >= CPU_AVX2) {
+        return validate_avx2;
+    }
+    if (level >= CPU_SSSE3) {
+        return validate_ssse3;
+    }
+#endif
+    return validate_scalar;
+}
+
+static ValidateFn kernel;
+
+// Picks the kernel before main, so threads only ever read it.
+__attribute__((constructor)) static void utf8valid_init(void) {
+    kernel = select_kernel(cpu_level());
+}
+
+size_t utf8_validate(const uint8_t *s, const size_t len) {
+    return kernel(s, len);
+}
+
+size_t utf8_validate_level(const uint8_t *s, const size_t len, const CpuLevel level) {
+    return select_kernel(level)(s, len);
+}